@@ -0,0 +1,115 @@
+"""Where the content of each file is already stored in S3.
+
+Files written by an S3 populate are recorded with the object they came from,
+and files uploaded by a files snapshot with the object they were uploaded to,
+along with the file's identity at the time: device, inode, size, mtime and
+ctime. A later files snapshot looks each file up; if it is unchanged since,
+its content is copied inside S3 from that object rather than uploaded again.
+
+A file is unchanged if its identity is the one recorded. Any write changes
+ctime, and ctime can't be set back from user space, so a rewrite is caught
+even when the size stays the same and the mtime is put back (os.utime,
+touch -d) or doesn't move (coarse timestamps). Otherwise (e.g., the file was
+rewritten with the same content) it is unchanged only if its MD5 matches the
+object's ETag (for objects uploaded in one part, whose ETag is their MD5).
+
+The record lives for the lifetime of the process, like the environment's
+subsystems themselves.
+"""
+
+import hashlib
+import os
+import re
+import threading
+from dataclasses import dataclass
+
+# Bytes hashed at a time when checking a file against an ETag
+_HASH_READ_SIZE = 1024 * 1024
+_MD5_ETAG = re.compile(r"[0-9a-f]{32}")
+
+
+@dataclass(frozen=True)
+class StoredObject:
+    """An S3 object holding a file's content, and the file's stat when it did."""
+
+    bucket: str
+    key: str
+    etag: str
+    size: int
+    mtime_ns: int
+    ctime_ns: int
+    ino: int
+    dev: int
+
+    def same_file(self, st: os.stat_result) -> bool:
+        """Whether st is the stat of the recorded file, untouched since."""
+        return (
+            self.size == st.st_size
+            and self.mtime_ns == st.st_mtime_ns
+            and self.ctime_ns == st.st_ctime_ns
+            and self.ino == st.st_ino
+            and self.dev == st.st_dev
+        )
+
+
+_objects: dict[str, StoredObject] = {}
+_lock = threading.Lock()
+
+
+def record(path: str, bucket: str, key: str, etag: str, st: os.stat_result) -> None:
+    """Record that s3://bucket/key (with etag) holds the content of path as of st.
+
+    st must be the stat of path itself, not of a copy of it.
+    """
+    stored = StoredObject(
+        bucket,
+        key,
+        etag.strip('"'),
+        st.st_size,
+        st.st_mtime_ns,
+        st.st_ctime_ns,
+        st.st_ino,
+        st.st_dev,
+    )
+    with _lock:
+        _objects[path] = stored
+
+
+def forget(path: str) -> None:
+    """Forget what was recorded for path."""
+    with _lock:
+        _ = _objects.pop(path, None)
+
+
+def find_unchanged(
+    path: str, st: os.stat_result | None, read_path: str | None = None
+) -> StoredObject | None:
+    """The object holding the content to store for path, if it is unchanged.
+
+    Args:
+        path: The file as it was recorded
+        st: Its current stat (of path itself, never of a copy), or None if it
+            is gone
+        read_path: Where the content to store is read from (e.g., a snapshot's
+            staged copy of path), hashed unless path is unchanged since it was
+            recorded; path if None
+
+    Returns:
+        The StoredObject, or None if nothing was recorded for path or the
+        content differs
+    """
+    with _lock:
+        stored = _objects.get(path)
+    if stored is None:
+        return None
+    if st is not None and stored.same_file(st):
+        return stored
+    if not _MD5_ETAG.fullmatch(stored.etag):
+        return None
+    digest = hashlib.md5(usedforsecurity=False)
+    with open(read_path or path, "rb") as f:
+        if os.fstat(f.fileno()).st_size != stored.size:
+            return None
+        while data := f.read(_HASH_READ_SIZE):
+            digest.update(data)
+    return stored if digest.hexdigest() == stored.etag else None
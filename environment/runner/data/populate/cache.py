@@ -0,0 +1,231 @@
+"""Host-local cache of S3 objects downloaded by populate.
+
+Episodes of the same task populate the same objects again and again. With
+POPULATE_CACHE_DIR set (typically a volume shared by the episodes on a host),
+each object is downloaded once and kept as
+
+    objects/<digest[:2]>/<digest>
+
+where the digest is of its ETag and size, so identical objects under any key
+or bucket share an entry and a changed object gets a new one. Entries are
+materialized into subsystems as their own inodes, never shared with the
+cache, in order of preference:
+
+- as a reflink (FICLONE): the copy shares the cached extents copy-on-write,
+  a metadata operation that needs the cache on the same filesystem,
+- with copy_file_range(), which copies inside the kernel (and which some
+  filesystems turn into a reflink or server-side copy themselves).
+
+Entries are not hardlinked into subsystems: the sandbox may run as root, which
+ignores a read-only mode, and a write through the link would change the entry
+for every later episode. Entries are evicted least recently used first (a hit
+touches the entry's mtime) to keep the cache under POPULATE_CACHE_SIZE.
+"""
+
+import contextlib
+import errno
+import fcntl
+import hashlib
+import os
+import tempfile
+import time
+
+from loguru import logger
+
+from runner.utils.settings import get_settings
+
+settings = get_settings()
+
+FICLONE = 0x40049409
+# Bytes copied per copy_file_range() call
+COPY_SIZE = 64 * 1024 * 1024
+# Errors meaning "this way of materializing doesn't work here"
+_UNSUPPORTED = (errno.EOPNOTSUPP, errno.EXDEV, errno.EINVAL, errno.ENOSYS, errno.EPERM)
+
+
+class PopulateCache:
+    """Content-addressed cache of S3 objects in a local directory."""
+
+    def __init__(self, root: str, max_size: int):
+        self.root: str = root
+        self.max_size: int = max_size
+        self._objects: str = os.path.join(root, "objects")
+        self._tmp: str = os.path.join(root, "tmp")
+        # Cleared the first time reflinks fail as unsupported
+        self._can_clone: bool = True
+
+    def entry_path(self, etag: str, size: int) -> str:
+        """Where the object with etag and size is (or would be) cached."""
+        etag = etag.strip('"')
+        digest = hashlib.sha256(f"{etag}:{size}".encode()).hexdigest()
+        return os.path.join(self._objects, digest[:2], digest)
+
+    def temp_path(self) -> str:
+        """A new path to download an object to before add()ing it."""
+        os.makedirs(self._tmp, exist_ok=True)
+        fd, path = tempfile.mkstemp(dir=self._tmp, prefix="download-")
+        os.close(fd)
+        return path
+
+    def add(self, download_path: str, entry_path: str) -> None:
+        """Move a downloaded object into the cache as entry_path (read-only)."""
+        os.chmod(download_path, 0o444)
+        os.makedirs(os.path.dirname(entry_path), exist_ok=True)
+        # Atomic: concurrent populates of the same object both succeed
+        os.replace(download_path, entry_path)
+
+    def discard(self, download_path: str) -> None:
+        """Remove a download that won't be added."""
+        with contextlib.suppress(FileNotFoundError):
+            os.unlink(download_path)
+
+    def materialize(self, entry_path: str, target_path: str, read_only: bool) -> bool:
+        """Put a copy of the cached entry at target_path, replacing any file there.
+
+        The copy is built next to target_path and renamed over it, so the
+        target is never seen partially written.
+
+        Args:
+            entry_path: The cache entry (see entry_path())
+            target_path: Where the file goes
+            read_only: Make the file read-only
+
+        Returns:
+            False if the entry isn't cached (a miss), True otherwise
+        """
+        try:
+            src = os.open(entry_path, os.O_RDONLY | os.O_CLOEXEC)
+        except FileNotFoundError:
+            return False
+        try:
+            st = os.fstat(src)
+            if st.st_nlink > 1 or st.st_mode & 0o222:
+                # Linked or made writable outside the cache (e.g., by a
+                # populate that hardlinked entries), so it may have been
+                # written: drop it
+                logger.warning(f"Discarding modified populate cache entry {entry_path}")
+                self.discard(entry_path)
+                return False
+            tmp = os.path.join(
+                os.path.dirname(target_path),
+                f".populate-{os.getpid()}-{time.time_ns()}",
+            )
+            if not self._clone(src, tmp, read_only):
+                self._copy(src, tmp, read_only)
+            os.replace(tmp, target_path)
+            # Mark the entry recently used
+            os.utime(src)
+        finally:
+            os.close(src)
+        return True
+
+    def _create(self, tmp: str) -> int:
+        return os.open(tmp, os.O_WRONLY | os.O_CREAT | os.O_EXCL | os.O_CLOEXEC, 0o666)
+
+    def _clone(self, src: int, tmp: str, read_only: bool) -> bool:
+        if not self._can_clone:
+            return False
+        dst = self._create(tmp)
+        try:
+            fcntl.ioctl(dst, FICLONE, src)
+            if read_only:
+                os.fchmod(dst, 0o444)
+        except OSError as e:
+            os.close(dst)
+            os.unlink(tmp)
+            if e.errno not in _UNSUPPORTED + (errno.ENOTTY,):
+                raise
+            logger.info(
+                f"Populate cache {self.root}: reflinks unavailable ({e.strerror}); "
+                "materializing with copies"
+            )
+            self._can_clone = False
+            return False
+        os.close(dst)
+        return True
+
+    def _copy(self, src: int, tmp: str, read_only: bool) -> None:
+        dst = self._create(tmp)
+        try:
+            size = os.fstat(src).st_size
+            offset = 0
+            while offset < size:
+                n = _copy_range(src, dst, offset, min(COPY_SIZE, size - offset))
+                if n == 0:
+                    break
+                offset += n
+            if read_only:
+                os.fchmod(dst, 0o444)
+        except BaseException:
+            os.close(dst)
+            os.unlink(tmp)
+            raise
+        os.close(dst)
+
+    def evict(self) -> None:
+        """Remove least recently used entries until the cache fits max_size."""
+        # Downloads abandoned by crashed populates
+        cutoff = time.time() - 24 * 3600
+        with contextlib.suppress(FileNotFoundError):
+            for entry in os.scandir(self._tmp):
+                with contextlib.suppress(FileNotFoundError):
+                    if entry.stat(follow_symlinks=False).st_mtime < cutoff:
+                        os.unlink(entry.path)
+
+        entries: list[tuple[float, int, str]] = []
+        total = 0
+        with contextlib.suppress(FileNotFoundError):
+            for shard in os.scandir(self._objects):
+                for entry in os.scandir(shard.path):
+                    with contextlib.suppress(FileNotFoundError):
+                        st = entry.stat(follow_symlinks=False)
+                        entries.append((st.st_mtime, st.st_size, entry.path))
+                        total += st.st_size
+        if total <= self.max_size:
+            return
+
+        entries.sort()
+        evicted = 0
+        for _, size, path in entries:
+            if total <= self.max_size:
+                break
+            with contextlib.suppress(FileNotFoundError):
+                os.unlink(path)
+                evicted += 1
+            total -= size
+        logger.info(
+            f"Evicted {evicted} object(s) from populate cache {self.root}; "
+            f"{total / 1e9:.2f} GB kept"
+        )
+
+
+def _copy_range(src: int, dst: int, offset: int, count: int) -> int:
+    """Copy count bytes at offset from src to dst, in the kernel where possible."""
+    try:
+        return os.copy_file_range(src, dst, count, offset, offset)
+    except OSError as e:
+        # Across filesystems on older kernels, or where it isn't implemented
+        if e.errno not in (errno.EXDEV, errno.ENOSYS, errno.EINVAL, errno.EOPNOTSUPP):
+            raise
+    data = os.pread(src, count, offset)
+    view = memoryview(data)
+    while view:
+        n = os.pwrite(dst, view, offset)
+        view = view[n:]
+        offset += n
+    return len(data)
+
+
+_cache: PopulateCache | None = None
+
+
+def get_populate_cache() -> PopulateCache | None:
+    """The configured populate cache, or None if POPULATE_CACHE_DIR is empty."""
+    global _cache
+    if not settings.POPULATE_CACHE_DIR:
+        return None
+    if _cache is None:
+        _cache = PopulateCache(
+            settings.POPULATE_CACHE_DIR, settings.POPULATE_CACHE_SIZE
+        )
+    return _cache
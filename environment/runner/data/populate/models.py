@@ -33,6 +33,10 @@ class PopulateSource(BaseModel):
             "Subsystem name where files will be placed. Must be 'filesystem', '.apps_data', or a nested path under one of these (e.g., 'filesystem/data', '.apps_data/custom'). Defaults to 'filesystem'."
         ),
     )
+    read_only: bool = Field(
+        default=False,
+        description="Make the files read-only.",
+    )
 
     @field_validator("url")
     @classmethod
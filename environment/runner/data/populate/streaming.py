@@ -1,14 +1,25 @@
 """Streaming upload handler for direct file population.
 
 This module handles extracting tar.gz archives uploaded directly via HTTP
-into subsystem directories. Memory-safe implementation that streams to disk
-and extracts incrementally.
+into subsystem directories. The archive is never stored: the upload is fed
+through a pipe to an extractor thread that decompresses and untars it as it
+arrives, and file bodies are written by a pool of writer threads, so
+receiving, decompressing and writing overlap. Memory use is bounded by the
+pipe and the writers' queue, whatever the archive's size.
 """
 
+import asyncio
+import contextlib
+import errno
+import fcntl
+import gzip
+import os
 import tarfile
-import tempfile
+import threading
 from collections.abc import AsyncIterator
+from concurrent.futures import ThreadPoolExecutor
 from pathlib import Path
+from typing import BinaryIO
 
 from loguru import logger
 
@@ -18,6 +29,17 @@ from .models import PopulateStreamResult
 
 settings = get_settings()
 
+# Capacity of the pipe between the upload and the extractor; the kernel caps
+# it at /proc/sys/fs/pipe-max-size (1 MiB by default)
+PIPE_SIZE = 1024 * 1024
+# Bytes tarfile reads from the decompressor at a time; what it doesn't use is
+# copied on every read, so this stays small
+READ_SIZE = 64 * 1024
+# Bytes of a file body handed to a writer thread at a time
+WRITE_SIZE = 1024 * 1024
+# Files up to this size are written by the extractor itself
+SMALL_FILE_SIZE = 64 * 1024
+
 
 def get_subsystem_paths() -> dict[str, Path]:
     """Get mapping of subsystem names to their root paths.
@@ -61,6 +83,208 @@ def validate_subsystem(subsystem: str) -> None:
         )
 
 
+def _wake(future: asyncio.Future[None]) -> None:
+    if not future.done():
+        future.set_result(None)
+
+
+async def _feed(chunks: AsyncIterator[bytes], fd: int) -> None:
+    """Write chunks into the non-blocking pipe fd as they arrive, then close it.
+
+    Waits on the event loop while the pipe is full, so the upload is read no
+    faster than it is extracted.
+
+    Raises:
+        BrokenPipeError: If the extractor stopped reading
+    """
+    loop = asyncio.get_running_loop()
+    try:
+        async for chunk in chunks:
+            view = memoryview(chunk)
+            while view:
+                try:
+                    view = view[os.write(fd, view) :]
+                except BlockingIOError:
+                    writable = loop.create_future()
+                    loop.add_writer(fd, _wake, writable)
+                    try:
+                        await writable
+                    finally:
+                        loop.remove_writer(fd)
+    finally:
+        os.close(fd)
+
+
+def _create(path: str, size: int) -> int:
+    """Create a new file at path, with size bytes allocated.
+
+    An existing file at path is replaced (as GNU tar does), not written
+    into: a symlink is not followed, and a file hardlinked elsewhere is not
+    changed.
+    """
+    with contextlib.suppress(FileNotFoundError):
+        os.unlink(path)
+    flags = os.O_WRONLY | os.O_CREAT | os.O_TRUNC | os.O_NOFOLLOW | os.O_CLOEXEC
+    fd = os.open(path, flags, 0o600)
+    if size:
+        try:
+            os.posix_fallocate(fd, 0, size)
+        except OSError as e:
+            # Allocation is only an optimization, except when space runs out
+            if e.errno not in (errno.EOPNOTSUPP, errno.EINVAL):
+                os.close(fd)
+                raise
+    return fd
+
+
+def _pwrite_all(fd: int, data: bytes, offset: int) -> None:
+    view = memoryview(data)
+    while view:
+        n = os.pwrite(fd, view, offset)
+        view = view[n:]
+        offset += n
+
+
+class _OpenFile:
+    """A file being extracted, closed (after setting its mode and mtime) once
+    the extractor and every writer holding it have released it."""
+
+    def __init__(self, fd: int, member: tarfile.TarInfo):
+        self.fd: int = fd
+        self.member: tarfile.TarInfo = member
+        self._holds: int = 1
+        self._lock: threading.Lock = threading.Lock()
+
+    def hold(self) -> None:
+        with self._lock:
+            self._holds += 1
+
+    def release(self) -> None:
+        with self._lock:
+            self._holds -= 1
+            if self._holds:
+                return
+        try:
+            if self.member.mode is not None:
+                os.fchmod(self.fd, self.member.mode)
+            if self.member.mtime is not None:
+                os.utime(self.fd, (self.member.mtime, self.member.mtime))
+        finally:
+            os.close(self.fd)
+
+
+class _FileWriter:
+    """Writes the bodies of extracted files on a pool of threads.
+
+    Bodies are handed over in WRITE_SIZE pieces, each written with pwrite()
+    at its offset, so pieces of one file and of different files are written
+    in parallel with each other and with decompression. At most two pieces
+    per thread are held at once; the extractor waits for a free slot.
+    """
+
+    def __init__(self, threads: int):
+        self._pool: ThreadPoolExecutor = ThreadPoolExecutor(
+            max_workers=threads, thread_name_prefix="populate-write"
+        )
+        self._slots: threading.Semaphore = threading.Semaphore(2 * threads)
+        self._error: BaseException | None = None
+
+    def _check(self) -> None:
+        if self._error is not None:
+            raise self._error
+
+    def extract(
+        self, tar: tarfile.TarFile, member: tarfile.TarInfo, target_path: str
+    ) -> None:
+        """Extract the regular file member into target_path.
+
+        The member is checked and sanitized by tarfile's "data" filter, as
+        tar.extract(member, path=target_path, filter="data") would.
+
+        Raises:
+            tarfile.FilterError: If the filter rejects the member
+            tarfile.ReadError: If the archive ends inside the file's body
+            OSError: If an earlier write failed
+        """
+        self._check()
+        info = tarfile.data_filter(member, target_path)
+        path = os.path.join(target_path, info.name)
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+
+        file = _OpenFile(_create(path, info.size), info)
+        try:
+            source = tar.extractfile(member)
+            assert source is not None
+            offset = 0
+            while offset < info.size:
+                data = source.read(min(WRITE_SIZE, info.size - offset))
+                if not data:
+                    raise tarfile.ReadError("unexpected end of data")
+                if info.size <= SMALL_FILE_SIZE:
+                    _pwrite_all(file.fd, data, offset)
+                else:
+                    self._slots.acquire()
+                    file.hold()
+                    self._pool.submit(self._write, file, data, offset)
+                offset += len(data)
+        finally:
+            file.release()
+
+    def _write(self, file: _OpenFile, data: bytes, offset: int) -> None:
+        try:
+            _pwrite_all(file.fd, data, offset)
+        except BaseException as e:
+            self._error = self._error or e
+        finally:
+            self._slots.release()
+            try:
+                file.release()
+            except BaseException as e:
+                self._error = self._error or e
+
+    def close(self) -> None:
+        """Wait for all writes.
+
+        Raises:
+            OSError: If a write failed
+        """
+        self._pool.shutdown(wait=True)
+        self._check()
+
+
+def _extract(source: BinaryIO, target_path: Path) -> tuple[int, int]:
+    """Extract the tar.gz stream source into target_path.
+
+    Regular files go through a _FileWriter; other members (directories,
+    links) are extracted by tarfile. Every member passes tarfile's "data"
+    filter.
+
+    Returns:
+        Number of members extracted and total size of the regular files
+    """
+    objects_added = 0
+    extracted_bytes = 0
+    writer = _FileWriter(settings.POPULATE_WRITE_THREADS)
+    try:
+        with (
+            gzip.GzipFile(fileobj=source, mode="rb") as decompressed,
+            tarfile.open(fileobj=decompressed, mode="r|", bufsize=READ_SIZE) as tar,
+        ):
+            for member in tar:
+                objects_added += 1
+
+                if member.isfile():
+                    extracted_bytes += member.size
+
+                if member.isreg() and member.sparse is None:
+                    writer.extract(tar, member, str(target_path))
+                else:
+                    tar.extract(member, path=target_path, filter="data")
+    finally:
+        writer.close()
+    return objects_added, extracted_bytes
+
+
 async def handle_populate_stream(
     file_stream: AsyncIterator[bytes],
     subsystem: str,
@@ -68,9 +292,8 @@ async def handle_populate_stream(
     """
     Extract a tar.gz stream directly into a subsystem.
 
-    Memory-safe implementation:
-    - Streams upload to temporary file (no memory buffering)
-    - Extracts incrementally using tar.next() (constant memory)
+    Extraction starts with the first bytes received and runs on background
+    threads (see _extract); the archive is never buffered or stored.
 
     Args:
         file_stream: Async iterator of bytes from uploaded file
@@ -101,28 +324,29 @@ async def handle_populate_stream(
 
     target_path.mkdir(parents=True, exist_ok=True)
 
-    with tempfile.NamedTemporaryFile(suffix=".tar.gz", delete=True) as tmp:
-        async for chunk in file_stream:
-            _ = tmp.write(chunk)
-
-        tmp.flush()
-        _ = tmp.seek(0)
-
-        objects_added = 0
-        extracted_bytes = 0
-
-        with tarfile.open(fileobj=tmp, mode="r:gz") as tar:
-            while True:
-                member = tar.next()
-                if member is None:
-                    break
-
-                objects_added += 1
-
-                if member.isfile():
-                    extracted_bytes += member.size
-
-                tar.extract(member, path=target_path, filter="data")
+    read_fd, write_fd = os.pipe2(os.O_CLOEXEC)
+    with contextlib.suppress(OSError):
+        fcntl.fcntl(write_fd, fcntl.F_SETPIPE_SZ, PIPE_SIZE)
+    os.set_blocking(write_fd, False)
+    source = open(read_fd, "rb", buffering=0)
+
+    def extract() -> tuple[int, int]:
+        with source:
+            return _extract(source, target_path)
+
+    extraction = asyncio.ensure_future(asyncio.to_thread(extract))
+    try:
+        await _feed(file_stream, write_fd)
+    except BrokenPipeError:
+        # The extractor stopped reading: at the archive's end, or on an
+        # error that awaiting it raises
+        pass
+    except BaseException:
+        # The extractor sees the archive end early and stops
+        _ = await asyncio.gather(extraction, return_exceptions=True)
+        raise
+
+    objects_added, extracted_bytes = await extraction
 
     logger.info(
         f"Extracted {objects_added} objects ({extracted_bytes / 1e6:.1f} MB) to {target_path}"
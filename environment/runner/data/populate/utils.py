@@ -1,6 +1,8 @@
 """Utility functions for populating subsystems from S3."""
 
 import asyncio
+import contextlib
+import errno
 import os
 import time
 import traceback
@@ -8,15 +10,113 @@ from typing import Any
 
 from aiohttp import ClientError as AiohttpClientError
 from aiohttp import ClientPayloadError, ServerDisconnectedError
-from botocore.exceptions import ClientError
+from botocore.exceptions import ClientError, HTTPClientError
+from botocore.exceptions import ConnectionError as BotoConnectionError
 from fastapi import HTTPException
 from loguru import logger
 
 from runner.utils.decorators import with_concurrency_limit, with_retry
 from runner.utils.s3 import get_s3_client
+from runner.utils.settings import get_settings
 
+from . import baseline
+from .cache import get_populate_cache
 from .models import PopulateResult, PopulateSource
 
+settings = get_settings()
+
+# Connection errors worth retrying a GET (or one range of it) for; of the
+# errors S3 answers with, only 5xx and throttling are (see _is_transient)
+_CONNECTION_ERRORS = (
+    AiohttpClientError,
+    ClientPayloadError,
+    ServerDisconnectedError,
+    BotoConnectionError,
+    HTTPClientError,
+    ConnectionResetError,
+    TimeoutError,
+)
+_THROTTLING_CODES = frozenset(
+    {
+        "SlowDown",
+        "Throttling",
+        "ThrottlingException",
+        "RequestTimeout",
+        "TooManyRequests",
+    }
+)
+
+
+class ObjectChangedError(Exception):
+    """An object was overwritten while it was being populated (412 on IfMatch)."""
+
+    def __init__(self, bucket: str, key: str, etag: str):
+        super().__init__(
+            f"s3://{bucket}/{key} was overwritten while it was being populated "
+            f"(its ETag is no longer {etag}); populate it again"
+        )
+
+
+def _s3_status(e: ClientError) -> tuple[int, str]:
+    """HTTP status and error code of a failed S3 call."""
+    status = e.response.get("ResponseMetadata", {}).get("HTTPStatusCode") or 0
+    return status, e.response.get("Error", {}).get("Code", "")
+
+
+def _is_transient(e: Exception) -> bool:
+    """Whether a failed GET may succeed if repeated: never a 403, 404 or 412."""
+    if isinstance(e, ClientError):
+        status, code = _s3_status(e)
+        return status >= 500 or status == 429 or code in _THROTTLING_CODES
+    return isinstance(e, _CONNECTION_ERRORS)
+
+
+def _check_unchanged(e: ClientError, bucket: str, key: str, etag: str | None) -> None:
+    """Raise ObjectChangedError if a conditional GET failed because of its etag."""
+    status, code = _s3_status(e)
+    if etag and (status == 412 or code == "PreconditionFailed"):
+        raise ObjectChangedError(bucket, key, etag) from e
+
+
+class _TransferBudget:
+    """Connections and bandwidth shared by all S3 downloads on an event loop.
+
+    Every GET (whole object or one range) holds a connection while it runs,
+    and every chunk it reads waits its turn on the bandwidth, so concurrent
+    populates, and the ranges of large objects within them, share one
+    budget rather than each getting their own.
+    """
+
+    def __init__(self, max_connections: int, max_bandwidth: int):
+        self.connections: asyncio.Semaphore = asyncio.Semaphore(max_connections)
+        self._max_bandwidth: int = max_bandwidth
+        # When the bandwidth is next free (time.monotonic())
+        self._free_at: float = 0.0
+
+    async def throttle(self, nbytes: int) -> None:
+        """Wait until nbytes more fit within the bandwidth."""
+        if self._max_bandwidth <= 0:
+            return
+        now = time.monotonic()
+        self._free_at = max(self._free_at, now) + nbytes / self._max_bandwidth
+        if self._free_at > now:
+            await asyncio.sleep(self._free_at - now)
+
+
+_budgets: dict[int, _TransferBudget] = {}
+
+
+def _transfer_budget() -> _TransferBudget:
+    """The transfer budget of the running event loop."""
+    loop_id = id(asyncio.get_running_loop())
+    budget = _budgets.get(loop_id)
+    if budget is None:
+        budget = _TransferBudget(
+            settings.POPULATE_MAX_CONNECTIONS, settings.POPULATE_MAX_BANDWIDTH
+        )
+        _budgets[loop_id] = budget
+    return budget
+
 
 def parse_s3_url(url: str) -> tuple[str, str]:
     """Parse S3 URL into bucket and key components.
@@ -66,7 +166,8 @@ async def _download_file_chunked(body: Any, target_path: str, chunk_size: int) -
 
     Helper function to download file data from an S3 object body stream
     and write it to a local file path in chunks. Handles cleanup of the
-    body stream automatically.
+    body stream automatically. Reads are paced by the transfer budget's
+    bandwidth.
 
     Args:
         body: S3 object body stream (from response["Body"])
@@ -76,14 +177,140 @@ async def _download_file_chunked(body: Any, target_path: str, chunk_size: int) -
     Raises:
         OSError: If file cannot be written to disk
     """
+    budget = _transfer_budget()
     with open(target_path, "wb") as dst:
         while True:
             buf = await body.read(chunk_size)
             if not buf:
                 break
+            await budget.throttle(len(buf))
             _ = dst.write(buf)
 
 
+def _preallocate(target_path: str, size: int) -> int:
+    """Open target_path for writing, truncated and with size bytes allocated."""
+    fd = os.open(
+        target_path, os.O_WRONLY | os.O_CREAT | os.O_TRUNC | os.O_CLOEXEC, 0o666
+    )
+    try:
+        try:
+            os.posix_fallocate(fd, 0, size)
+        except OSError as e:
+            # Allocation is only an optimization, except when space runs out
+            if e.errno not in (errno.EOPNOTSUPP, errno.EINVAL):
+                raise
+            os.ftruncate(fd, size)
+    except BaseException:
+        os.close(fd)
+        raise
+    return fd
+
+
+def _pwrite_all(fd: int, data: bytes, offset: int) -> None:
+    view = memoryview(data)
+    while view:
+        n = os.pwrite(fd, view, offset)
+        view = view[n:]
+        offset += n
+
+
+@with_retry(max_retries=5, base_backoff=0.5, retry_if=_is_transient)
+async def _download_range(
+    client: Any,
+    bucket: str,
+    key: str,
+    etag: str,
+    fd: int,
+    start: int,
+    end: int,
+    chunk_size: int,
+) -> None:
+    """Download bytes [start, end) of an object and pwrite them at start in fd.
+
+    Retried on its own when it fails transiently; a retry downloads the whole
+    range again. The GET is conditional on etag, so the ranges all come from
+    one version of the object.
+
+    Raises:
+        ObjectChangedError: If the object no longer has etag
+        ClientError: If the GET fails, after retries if it is transient
+        ClientPayloadError: If the range ends early, after retries
+        OSError: If the bytes cannot be written
+    """
+    budget = _transfer_budget()
+    async with budget.connections:
+        try:
+            response = await client.get_object(
+                Bucket=bucket, Key=key, Range=f"bytes={start}-{end - 1}", IfMatch=etag
+            )
+        except ClientError as e:
+            _check_unchanged(e, bucket, key, etag)
+            raise
+        body = response["Body"]
+        try:
+            offset = start
+            while offset < end:
+                buf = await body.read(min(chunk_size, end - offset))
+                if not buf:
+                    raise ClientPayloadError(
+                        f"Range {start}-{end - 1} of s3://{bucket}/{key} ended at {offset}"
+                    )
+                await budget.throttle(len(buf))
+                await asyncio.to_thread(_pwrite_all, fd, buf, offset)
+                offset += len(buf)
+        finally:
+            body.close()
+
+
+async def _download_file_ranged(
+    client: Any,
+    bucket: str,
+    key: str,
+    etag: str,
+    size: int,
+    target_path: str,
+    chunk_size: int,
+) -> None:
+    """Download an object with concurrent ranged GETs into a preallocated file.
+
+    The object is split into POPULATE_RANGE_SIZE ranges, up to
+    POPULATE_RANGE_CONCURRENCY of which are downloaded at once (within the
+    transfer budget), each written where it belongs with pwrite(). If a range
+    fails after its retries, the others are cancelled.
+
+    Raises:
+        ObjectChangedError: If the object no longer has etag
+        ClientError: If a range cannot be downloaded
+        OSError: If the file cannot be written
+    """
+    range_size = settings.POPULATE_RANGE_SIZE
+    limit = asyncio.Semaphore(settings.POPULATE_RANGE_CONCURRENCY)
+
+    async def fetch(start: int) -> None:
+        async with limit:
+            await _download_range(
+                client,
+                bucket,
+                key,
+                etag,
+                fd,
+                start,
+                min(start + range_size, size),
+                chunk_size,
+            )
+
+    fd = await asyncio.to_thread(_preallocate, target_path, size)
+    try:
+        async with asyncio.TaskGroup() as tasks:
+            for start in range(0, size, range_size):
+                _ = tasks.create_task(fetch(start))
+    except BaseExceptionGroup as group:
+        # Surface the first failure, as gather() would
+        raise group.exceptions[0] from None
+    finally:
+        os.close(fd)
+
+
 def validate_path_safety(rel_path: str, subsystem_root: str) -> str:
     """Validate that a relative path is safe and prevent directory traversal.
 
@@ -119,37 +346,107 @@ def validate_path_safety(rel_path: str, subsystem_root: str) -> str:
     return target_path
 
 
+def _record_baseline(obj_summary: Any, etag: str | None, target_path: str) -> None:
+    """Record the object as holding target_path's content, for files snapshots."""
+    if etag:
+        baseline.record(
+            target_path,
+            obj_summary.bucket_name,
+            obj_summary.key,
+            etag,
+            os.stat(target_path),
+        )
+
+
+async def _download_object(
+    obj_summary: Any,
+    size: int | None,
+    etag: str | None,
+    target_path: str,
+    chunk_size: int,
+) -> None:
+    """Download an object to target_path, in ranges if it is large.
+
+    Objects of at least POPULATE_RANGED_THRESHOLD bytes are downloaded with
+    concurrent ranged GETs (see _download_file_ranged), others with a single
+    GET; either way each GET holds a connection from the transfer budget and
+    is conditional on etag (when known), so what is written is the listed
+    version of the object.
+
+    Each GET is retried where it fails, and only on connection errors,
+    throttling and 5xx: retrying at more than one level would multiply the
+    attempts, and a 403 or 404 won't go away. A 412 means the object was
+    overwritten since it was listed, and fails the populate at once.
+
+    Raises:
+        ObjectChangedError: If the object no longer has etag
+        ClientError: If a GET fails, after retries if it is transient
+    """
+    if size is not None and etag and size >= settings.POPULATE_RANGED_THRESHOLD:
+        logger.debug(
+            f"Downloading {obj_summary.key} ({size} bytes) in ranges -> {target_path}"
+        )
+        await _download_file_ranged(
+            obj_summary.meta.client,
+            obj_summary.bucket_name,
+            obj_summary.key,
+            etag,
+            size,
+            target_path,
+            chunk_size,
+        )
+        return
+
+    await _download_whole(obj_summary, etag, target_path, chunk_size)
+
+
+@with_retry(max_retries=3, retry_if=_is_transient)
+async def _download_whole(
+    obj_summary: Any, etag: str | None, target_path: str, chunk_size: int
+) -> None:
+    """Download an object to target_path with a single GET (see _download_object)."""
+    async with _transfer_budget().connections:
+        try:
+            response = await (
+                obj_summary.get(IfMatch=etag) if etag else obj_summary.get()
+            )
+        except ClientError as e:
+            _check_unchanged(e, obj_summary.bucket_name, obj_summary.key, etag)
+            raise
+        body = response["Body"]
+        logger.debug(f"Downloading {obj_summary.key} -> {target_path}")
+        await _download_file_chunked(body, target_path, chunk_size)
+
+
 @with_concurrency_limit(max_concurrency=100)
-@with_retry(
-    max_retries=3,
-    retry_on=(
-        ClientError,
-        AiohttpClientError,
-        ClientPayloadError,
-        ServerDisconnectedError,
-        ConnectionResetError,
-        TimeoutError,
-    ),
-)
 async def _download_single_object(
     obj_summary: Any,
     key: str,
     subsystem_root: str,
     chunk_size: int,
-) -> None:
+    read_only: bool = False,
+) -> bool:
     """Download a single S3 object to disk.
 
-    This function is decorated with concurrency limiting (max 100 concurrent downloads)
-    and retry logic for transient S3 errors.
+    This function is decorated with concurrency limiting (max 100 concurrent
+    downloads); its GETs are retried on transient errors (see _download_object).
+    With the populate cache enabled
+    (POPULATE_CACHE_DIR), an object is materialized from the cache when it is
+    there, and downloaded into the cache first when it isn't.
 
     Args:
         obj_summary: S3 object summary from bucket.objects.filter()
         key: S3 prefix/key used to calculate relative path
         subsystem_root: Root directory for the subsystem
         chunk_size: Size of chunks to read (bytes)
+        read_only: Make the file read-only
+
+    Returns:
+        Whether the object came from the cache
 
     Raises:
         ValueError: If path is unsafe or invalid
+        ObjectChangedError: If the object was overwritten while it was populated
         ClientError: If S3 operation fails after retries
         OSError: If file cannot be written to disk
     """
@@ -162,24 +459,58 @@ async def _download_single_object(
         rel = os.path.basename(key) or key
         if not rel:
             logger.warning(f"Skipping object with empty basename: {obj_summary.key}")
-            return
+            return False
 
     # Validate and build safe path
     target_path = validate_path_safety(rel, subsystem_root)
 
     os.makedirs(os.path.dirname(target_path), exist_ok=True)
 
-    response = await obj_summary.get()
-    body = response["Body"]
-    logger.debug(f"Downloading {obj_summary.key} -> {target_path}")
-    await _download_file_chunked(body, target_path, chunk_size)
-    logger.debug(f"Successfully downloaded {obj_summary.key}")
+    # Size and ETag come with the listing
+    listed = obj_summary.meta.data or {}
+    size = listed.get("Size")
+    etag = listed.get("ETag")
+
+    cache = get_populate_cache()
+    if cache is None or size is None or not etag or size > cache.max_size:
+        # Replace rather than write into an existing file, as materialize()
+        # does: it may be linked elsewhere
+        with contextlib.suppress(FileNotFoundError):
+            os.unlink(target_path)
+        await _download_object(obj_summary, size, etag, target_path, chunk_size)
+        if read_only:
+            os.chmod(target_path, 0o444)
+        _record_baseline(obj_summary, etag, target_path)
+        logger.debug(f"Successfully downloaded {obj_summary.key}")
+        return False
+
+    entry_path = cache.entry_path(etag, size)
+    if await asyncio.to_thread(cache.materialize, entry_path, target_path, read_only):
+        _record_baseline(obj_summary, etag, target_path)
+        logger.debug(f"Populated {obj_summary.key} from cache -> {target_path}")
+        return True
+
+    download_path = await asyncio.to_thread(cache.temp_path)
+    try:
+        await _download_object(obj_summary, size, etag, download_path, chunk_size)
+        await asyncio.to_thread(cache.add, download_path, entry_path)
+    except BaseException:
+        cache.discard(download_path)
+        raise
+    if not await asyncio.to_thread(
+        cache.materialize, entry_path, target_path, read_only
+    ):
+        raise FileNotFoundError(f"{entry_path} was evicted before it was used")
+    _record_baseline(obj_summary, etag, target_path)
+    logger.debug(f"Successfully downloaded {obj_summary.key} (cached)")
+    return False
 
 
 async def download_objects(
     bucket: str,
     key: str,
     subsystem: str,
+    read_only: bool = False,
 ) -> int:
     """Download objects from S3 and place them in the subsystem directory.
 
@@ -190,16 +521,21 @@ async def download_objects(
        that prefix, preserving the relative directory structure.
 
     Objects are downloaded in parallel (up to 100 concurrent downloads) with
-    automatic retry on transient S3 errors. If any object fails after retries,
-    the entire operation fails.
+    automatic retry on transient S3 errors, and large objects in concurrent
+    ranges, all within a connection and bandwidth budget shared with other
+    populates (POPULATE_MAX_CONNECTIONS, POPULATE_MAX_BANDWIDTH). If any
+    object fails after retries, the entire operation fails.
 
-    Files are written directly to disk without intermediate storage. Existing
-    files with the same path are overwritten.
+    Files are written directly to disk without intermediate storage, or, with
+    the populate cache enabled, materialized from the host-local cache (see
+    cache.py), downloading only the objects it doesn't have. Existing files
+    with the same path are overwritten.
 
     Args:
         bucket: S3 bucket name
         key: S3 object key (can be a single object or a prefix)
         subsystem: Subsystem name where files should be placed (e.g., 'filesystem')
+        read_only: Make the files read-only
 
     Returns:
         Number of objects successfully downloaded
@@ -218,7 +554,9 @@ async def download_objects(
 
     start_time = time.perf_counter()
 
-    async with get_s3_client() as s3res:
+    async with get_s3_client(
+        max_pool_connections=settings.POPULATE_MAX_CONNECTIONS
+    ) as s3res:
         bucket_res = await s3res.Bucket(bucket)
         logger.debug(f"Connected to S3 bucket: {bucket}")
 
@@ -245,21 +583,28 @@ async def download_objects(
                     key=key,
                     subsystem_root=subsystem_root,
                     chunk_size=chunk_size,
+                    read_only=read_only,
                 )
                 for obj_summary in objects_to_download
             ]
 
-            await asyncio.gather(*download_tasks)
+            from_cache = sum(await asyncio.gather(*download_tasks))
 
             objects_downloaded = len(objects_to_download)
             logger.info(
-                f"Downloaded {objects_downloaded} object(s) from s3://{bucket}/{key} to {subsystem_root} in {time.perf_counter() - start_time:.2f} seconds"
+                f"Downloaded {objects_downloaded} object(s) ({from_cache} from cache) from s3://{bucket}/{key} to {subsystem_root} in {time.perf_counter() - start_time:.2f} seconds"
             )
 
+            cache = get_populate_cache()
+            if cache is not None and from_cache < objects_downloaded:
+                await asyncio.to_thread(cache.evict)
+
             return objects_downloaded
 
         except HTTPException:
             raise
+        except ObjectChangedError as e:
+            raise HTTPException(status_code=409, detail=str(e)) from e
         except ClientError as e:
             raise HTTPException(
                 status_code=500,
@@ -313,6 +658,7 @@ async def populate_data(
             bucket=bucket,
             key=key,
             subsystem=source.subsystem,
+            read_only=source.read_only,
         )
 
         total_objects += objects_count
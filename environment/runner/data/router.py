@@ -3,8 +3,9 @@
 This module defines the FastAPI router that handles all /data/* endpoints:
 - /data/populate - Direct tar.gz upload to populate subsystems
 - /data/populate/s3 - Populate from S3 sources
-- /data/snapshot - Stream tar.gz snapshot to client
+- /data/snapshot - Stream tar.gz (or tar) snapshot to client
 - /data/snapshot/s3 - Upload snapshot to S3
+- /data/snapshot/chunks/{snapshot_id} - Stream a chunked snapshot as tar.gz, tar or zip
 
 The router is mounted at the /data prefix in the main FastAPI application.
 """
@@ -24,8 +25,15 @@ from .populate.models import (
     PopulateResult,
     PopulateStreamResult,
 )
-from .snapshot import handle_snapshot, handle_snapshot_s3, handle_snapshot_s3_files
+from .snapshot import (
+    handle_chunked_snapshot_download,
+    handle_snapshot,
+    handle_snapshot_s3,
+    handle_snapshot_s3_chunks,
+    handle_snapshot_s3_files,
+)
 from .snapshot.models import (
+    SnapshotChunksResult,
     SnapshotFilesResult,
     SnapshotRequest,
     SnapshotResult,
@@ -147,11 +155,17 @@ async def populate_s3(request: PopulateRequest) -> PopulateResult:
 
 # ============ SNAPSHOT ENDPOINTS ============
 
+_ARCHIVE_MEDIA_TYPES = {
+    "tar.gz": "application/gzip",
+    "tar": "application/x-tar",
+    "zip": "application/zip",
+}
+
 
 @router.post("/snapshot")
 async def snapshot(request: SnapshotStreamRequest | None = None):
     """
-    Create a snapshot of all subsystems and stream it back as a tar.gz file.
+    Create a snapshot of all subsystems and stream it back as a tar.gz (or tar) file.
 
     This endpoint can be called multiple times during the environment's lifetime.
     Each call creates a new snapshot with a unique ID in the filename.
@@ -160,20 +174,21 @@ async def snapshot(request: SnapshotStreamRequest | None = None):
     creating the archive (e.g., database dumps).
 
     Args:
-        request: Optional request body with pre_snapshot_hooks
+        request: Optional request body with format and pre_snapshot_hooks
 
     Returns:
-        StreamingResponse with the tar.gz archive file
+        StreamingResponse with the tar.gz (or tar) archive file
     """
     hooks_count = len(request.pre_snapshot_hooks) if request else 0
-    logger.debug(f"Snapshot request received (hooks={hooks_count})")
+    fmt = request.format if request else "tar.gz"
+    logger.debug(f"Snapshot request received (format={fmt}, hooks={hooks_count})")
     try:
         hooks = request.pre_snapshot_hooks if request else None
-        stream, filename = await handle_snapshot(pre_snapshot_hooks=hooks)
+        stream, filename = await handle_snapshot(pre_snapshot_hooks=hooks, fmt=fmt)
         logger.debug(f"Snapshot stream created: {filename}")
         return StreamingResponse(
             stream,
-            media_type="application/gzip",
+            media_type=_ARCHIVE_MEDIA_TYPES[fmt],
             headers={"Content-Disposition": f'attachment; filename="{filename}"'},
         )
     except HTTPException:
@@ -186,7 +201,7 @@ async def snapshot(request: SnapshotStreamRequest | None = None):
 @router.post("/snapshot/s3")
 async def snapshot_s3(
     request: SnapshotRequest,
-) -> SnapshotResult | SnapshotFilesResult:
+) -> SnapshotResult | SnapshotFilesResult | SnapshotChunksResult:
     """
     Create a snapshot of all subsystems and upload to S3.
 
@@ -199,7 +214,8 @@ async def snapshot_s3(
         request: SnapshotRequest with format and optional pre_snapshot_hooks
 
     Returns:
-        SnapshotResult (for tar.gz) or SnapshotFilesResult (for files)
+        SnapshotResult (for tar.gz), SnapshotFilesResult (for files) or
+        SnapshotChunksResult (for chunks)
     """
     logger.debug(
         f"Snapshot S3 request received (format={request.format}, hooks={len(request.pre_snapshot_hooks)})"
@@ -212,6 +228,12 @@ async def snapshot_s3(
                 f"Snapshot S3 files completed: {result.snapshot_id} ({result.files_uploaded} files, {result.total_bytes} bytes)"
             )
             return result
+        elif request.format == "chunks":
+            result = await handle_snapshot_s3_chunks(pre_snapshot_hooks=hooks)
+            logger.debug(
+                f"Snapshot S3 chunks completed: {result.snapshot_id} ({result.new_chunks}/{result.chunks} new chunks, dedup ratio {result.dedup_ratio:.3f})"
+            )
+            return result
         else:
             result = await handle_snapshot_s3(pre_snapshot_hooks=hooks)
             logger.debug(
@@ -223,3 +245,38 @@ async def snapshot_s3(
     except Exception as e:
         logger.error(f"Error creating snapshot S3: {e}")
         raise HTTPException(status_code=500, detail=str(e)) from e
+
+
+@router.get("/snapshot/chunks/{snapshot_id}")
+async def snapshot_chunks(
+    snapshot_id: str,
+    format: str = Query(
+        default="tar.gz", description="Archive format: 'tar.gz', 'tar' or 'zip'"
+    ),
+):
+    """
+    Stream a chunked snapshot (format=chunks) back as an archive.
+
+    The archive is rebuilt from the snapshot's manifest and chunks as it is
+    streamed.
+
+    Args:
+        snapshot_id: ID of a snapshot taken with format=chunks
+        format: Archive format: 'tar.gz', 'tar' or 'zip'
+
+    Returns:
+        StreamingResponse with the archive file
+    """
+    logger.debug(f"Chunked snapshot download: {snapshot_id} (format={format})")
+    try:
+        stream, filename = await handle_chunked_snapshot_download(snapshot_id, format)
+        return StreamingResponse(
+            stream,
+            media_type=_ARCHIVE_MEDIA_TYPES[format],
+            headers={"Content-Disposition": f'attachment; filename="{filename}"'},
+        )
+    except HTTPException:
+        raise
+    except Exception as e:
+        logger.error(f"Error streaming chunked snapshot: {e}")
+        raise HTTPException(status_code=500, detail=str(e)) from e
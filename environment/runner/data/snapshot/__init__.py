@@ -1,5 +1,17 @@
 """Snapshot subsystems to S3 or stream as tar.gz."""
 
-from .main import handle_snapshot, handle_snapshot_s3, handle_snapshot_s3_files
+from .main import (
+    handle_chunked_snapshot_download,
+    handle_snapshot,
+    handle_snapshot_s3,
+    handle_snapshot_s3_chunks,
+    handle_snapshot_s3_files,
+)
 
-__all__ = ["handle_snapshot", "handle_snapshot_s3", "handle_snapshot_s3_files"]
+__all__ = [
+    "handle_chunked_snapshot_download",
+    "handle_snapshot",
+    "handle_snapshot_s3",
+    "handle_snapshot_s3_chunks",
+    "handle_snapshot_s3_files",
+]
@@ -0,0 +1,334 @@
+"""Parallel tar.gz writer for snapshots.
+
+tarfile's "w:gz" mode compresses on the thread that builds the archive, which
+caps a snapshot at what one core can deflate (roughly 30-60 MB/s). Here the
+uncompressed tar stream is cut into blocks that a pool of threads compresses
+as independent gzip members, pigz-style, written out in order. zlib releases
+the GIL while it deflates, so the pool scales with cores.
+
+A sequence of gzip members is itself a valid gzip stream (RFC 1952), so the
+output is read unchanged by tarfile's "r:gz", gzip.decompress, gunzip and the
+populate endpoint; consumers need no new format.
+
+File contents are read ahead of the archiver by a second pool: small files are
+read whole, larger ones get a readahead hint for their first blocks, so the
+archive isn't waiting on one read() at a time.
+
+Uncompressed tar archives (write_tar) written to a Spliceable destination
+(PipeStream) never bring file contents into Python: tarfile writes the
+headers and each file's body is spliced from the file into the destination
+by the kernel.
+"""
+
+import gzip
+import io
+import os
+import stat
+import tarfile
+from collections import deque
+from collections.abc import Callable, Iterable, Iterator
+from concurrent.futures import Future, ThreadPoolExecutor
+from pathlib import Path
+from typing import Protocol, cast
+
+from loguru import logger
+
+from runner.utils.settings import get_settings
+
+settings = get_settings()
+
+# Uncompressed bytes per gzip member. Larger blocks compress marginally better
+# (each member starts with an empty dictionary); smaller ones use less memory
+BLOCK_SIZE = 1024 * 1024
+# Files up to this size are read whole by the readahead pool
+SMALL_FILE_SIZE = 1024 * 1024
+# Bytes of a larger file to ask the kernel to read ahead
+READAHEAD_BYTES = 8 * 1024 * 1024
+# Files read ahead of the archiver (bounds readahead memory at
+# READAHEAD_FILES * SMALL_FILE_SIZE)
+READAHEAD_FILES = 32
+
+PathIterator = Callable[[str, str], Iterator[tuple[Path, str]]]
+
+
+class Writable(Protocol):
+    """Anything archive bytes can be written to (S3StreamUploader, PipeStream)."""
+
+    def write(self, data: bytes) -> int:
+        """Write data."""
+        ...
+
+
+class Spliceable(Writable, Protocol):
+    """A destination that can take bytes straight from a file descriptor."""
+
+    def splice_from(self, fd: int, count: int) -> int:
+        """Write up to count bytes read from fd's current offset; return how many."""
+        ...
+
+
+def _compress_member(block: bytes, level: int) -> bytes:
+    """One complete gzip member holding block."""
+    return gzip.compress(block, compresslevel=level, mtime=0)
+
+
+class ParallelGzipWriter:
+    """Write-only file object that gzips what is written to it in parallel.
+
+    Written data is buffered into BLOCK_SIZE blocks; each is compressed as its
+    own gzip member on a thread pool and the members are written to fileobj
+    in order. At most two members per thread are in flight, so memory stays
+    bounded however slowly fileobj drains.
+
+    fileobj only needs write(); it is not closed.
+    """
+
+    def __init__(
+        self,
+        fileobj: Writable,
+        level: int = 6,
+        threads: int | None = None,
+        block_size: int = BLOCK_SIZE,
+    ) -> None:
+        """Initialize the writer.
+
+        Args:
+            fileobj: Destination with a write(bytes) method (e.g. S3StreamUploader)
+            level: zlib compression level (1-9)
+            threads: Compression threads. Default: one per CPU
+            block_size: Uncompressed bytes per gzip member
+        """
+        self.fileobj: Writable = fileobj
+        self.level: int = level
+        self.block_size: int = block_size
+        self.threads: int = threads or os.cpu_count() or 1
+        self.closed: bool = False
+        self._buffer: bytearray = bytearray()
+        self._offset: int = 0
+        self._pending: deque[Future[bytes]] = deque()
+        self._pool: ThreadPoolExecutor = ThreadPoolExecutor(
+            max_workers=self.threads, thread_name_prefix="snapshot-gzip"
+        )
+
+    def _submit(self, block: bytes) -> None:
+        self._pending.append(self._pool.submit(_compress_member, block, self.level))
+        while len(self._pending) > 2 * self.threads:
+            self.fileobj.write(self._pending.popleft().result())
+
+    def write(self, data: bytes) -> int:
+        """Buffer data, handing each full block to the compression pool."""
+        if self.closed:
+            raise ValueError("I/O operation on closed file")
+        self._buffer += data
+        self._offset += len(data)
+        if len(self._buffer) >= self.block_size:
+            self._submit(bytes(self._buffer))
+            self._buffer.clear()
+        return len(data)
+
+    def tell(self) -> int:
+        """Return uncompressed bytes written (tarfile tracks its offset by this)."""
+        return self._offset
+
+    def close(self) -> None:
+        """Compress what is buffered and write every member still in flight."""
+        if self.closed:
+            return
+        try:
+            if self._buffer or not self._offset:
+                self._submit(bytes(self._buffer))
+                self._buffer.clear()
+            while self._pending:
+                self.fileobj.write(self._pending.popleft().result())
+        finally:
+            self.closed = True
+            self._pool.shutdown(wait=True, cancel_futures=True)
+
+    def abort(self) -> None:
+        """Drop buffered and in-flight data without writing it."""
+        self.closed = True
+        self._pending.clear()
+        self._pool.shutdown(wait=True, cancel_futures=True)
+
+    def __enter__(self) -> "ParallelGzipWriter":
+        return self
+
+    def __exit__(
+        self,
+        exc_type: type[BaseException] | None,
+        exc_val: BaseException | None,
+        exc_tb: object | None,
+    ) -> None:
+        if exc_type is not None:
+            self.abort()
+        else:
+            self.close()
+
+
+def _read_ahead(
+    path: Path, small_file_size: int = SMALL_FILE_SIZE
+) -> tuple[os.stat_result, bytes] | None:
+    """Read a small regular file whole, or hint the kernel to read a large one.
+
+    Returns (stat, contents) for a small file and None otherwise; anything
+    unusual (symlinks, vanished files, errors) is left to tarfile to handle.
+    """
+    try:
+        fd = os.open(path, os.O_RDONLY | os.O_CLOEXEC | os.O_NOFOLLOW)
+    except OSError:
+        return None
+    try:
+        st = os.fstat(fd)
+        if not stat.S_ISREG(st.st_mode):
+            return None
+        if st.st_size > small_file_size:
+            os.posix_fadvise(fd, 0, READAHEAD_BYTES, os.POSIX_FADV_WILLNEED)
+            return None
+        data = os.read(fd, st.st_size + 1)
+        return (st, data) if len(data) == st.st_size else None
+    except OSError:
+        return None
+    finally:
+        os.close(fd)
+
+
+def _prefetched(
+    pool: ThreadPoolExecutor,
+    pairs: Iterable[tuple[Path, str]],
+    small_file_size: int = SMALL_FILE_SIZE,
+) -> Iterator[tuple[Path, str, Future[tuple[os.stat_result, bytes] | None]]]:
+    """Yield pairs with their readahead futures, keeping READAHEAD_FILES in flight."""
+    window: deque[tuple[Path, str, Future[tuple[os.stat_result, bytes] | None]]] = (
+        deque()
+    )
+    for path, arcname in pairs:
+        window.append((path, arcname, pool.submit(_read_ahead, path, small_file_size)))
+        if len(window) > READAHEAD_FILES:
+            yield window.popleft()
+    while window:
+        yield window.popleft()
+
+
+def _splice_body(
+    tf: tarfile.TarFile, out: Spliceable, tarinfo: tarfile.TarInfo, path: Path
+) -> None:
+    """Add a regular file as TarFile.addfile does, its body spliced from the file."""
+    fd = os.open(path, os.O_RDONLY | os.O_CLOEXEC | os.O_NOFOLLOW)
+    try:
+        header = tarinfo.tobuf(tf.format, tf.encoding, tf.errors)
+        out.write(header)
+        tf.offset += len(header)
+        if out.splice_from(fd, tarinfo.size) != tarinfo.size:
+            raise OSError(f"unexpected end of data: {path}")
+    finally:
+        os.close(fd)
+    blocks, remainder = divmod(tarinfo.size, tarfile.BLOCKSIZE)
+    if remainder:
+        out.write(tarfile.NUL * (tarfile.BLOCKSIZE - remainder))
+        blocks += 1
+    tf.offset += blocks * tarfile.BLOCKSIZE
+    tf.members.append(tarinfo)
+
+
+def _add(
+    tf: tarfile.TarFile,
+    path: Path,
+    arcname: str,
+    prefetched: tuple[os.stat_result, bytes] | None,
+    splice_to: Spliceable | None = None,
+) -> None:
+    """tf.add(path, arcname, recursive=False), from prefetched contents if still valid.
+
+    With splice_to (tf's own uncompressed destination), file bodies are
+    spliced into it instead of being read.
+    """
+    tarinfo = tf.gettarinfo(str(path), arcname)
+    if tarinfo is None:
+        logger.debug(f"Skipping unsupported file type: {path}")
+        return
+    if not tarinfo.isreg():
+        tf.addfile(tarinfo)
+        return
+    if prefetched is not None:
+        st, data = prefetched
+        if len(data) == tarinfo.size and st.st_mtime == tarinfo.mtime:
+            tf.addfile(tarinfo, io.BytesIO(data))
+            return
+    if splice_to is not None:
+        _splice_body(tf, splice_to, tarinfo, path)
+        return
+    with open(path, "rb") as f:
+        tf.addfile(tarinfo, f)
+
+
+def _add_subsystems(
+    tf: tarfile.TarFile,
+    subsystems: list[str],
+    iter_paths_func: PathIterator,
+    splice_to: Spliceable | None = None,
+) -> None:
+    """Add every (path, arcname) of subsystems to tf, reading files ahead."""
+    # Spliced files are never read into memory, so only hint the kernel
+    small_file_size = 0 if splice_to is not None else SMALL_FILE_SIZE
+    with ThreadPoolExecutor(
+        max_workers=settings.SNAPSHOT_READ_THREADS,
+        thread_name_prefix="snapshot-read",
+    ) as readers:
+        for subsystem in subsystems:
+            subsystem_path = f"/{subsystem}"
+            logger.debug(
+                f"Adding subsystem '{subsystem}' from {subsystem_path} to archive"
+            )
+            # Use subsystem name as arc prefix (handles nested paths correctly)
+            file_count = 0
+            pairs = iter_paths_func(subsystem_path, subsystem)
+            for path, arcname, future in _prefetched(readers, pairs, small_file_size):
+                _add(tf, path, arcname, future.result(), splice_to)
+                file_count += 1
+            logger.debug(f"Added {file_count} file(s) from subsystem '{subsystem}'")
+
+
+def write_tar_gz(
+    fileobj: Writable,
+    subsystems: list[str],
+    iter_paths_func: PathIterator,
+) -> None:
+    """Write a tar.gz of subsystems' files to fileobj.
+
+    Equivalent to adding each (path, arcname) from iter_paths_func to a
+    tarfile.open(mode="w:gz"), with compression and file reads done in
+    parallel.
+
+    Args:
+        fileobj: Destination with a write(bytes) method
+        subsystems: Subsystem names (e.g., ['filesystem', '.apps_data'])
+        iter_paths_func: Function to iterate over file paths for a subsystem
+    """
+    threads = settings.SNAPSHOT_COMPRESSION_THREADS or None
+    with (
+        ParallelGzipWriter(
+            fileobj, level=settings.SNAPSHOT_COMPRESSION_LEVEL, threads=threads
+        ) as gz,
+        tarfile.open(mode="w", fileobj=gz) as tf,  # pyright: ignore[reportArgumentType]
+    ):
+        _add_subsystems(tf, subsystems, iter_paths_func)
+
+
+def write_tar(
+    fileobj: Writable | Spliceable,
+    subsystems: list[str],
+    iter_paths_func: PathIterator,
+) -> None:
+    """Write an uncompressed tar of subsystems' files to fileobj.
+
+    If fileobj has splice_from() (see Spliceable), file bodies go from each
+    file to fileobj without being read into memory.
+
+    Args:
+        fileobj: Destination with a write(bytes) method
+        subsystems: Subsystem names (e.g., ['filesystem', '.apps_data'])
+        iter_paths_func: Function to iterate over file paths for a subsystem
+    """
+    splice_to = cast(Spliceable, fileobj) if hasattr(fileobj, "splice_from") else None
+    with tarfile.open(mode="w", fileobj=fileobj) as tf:  # pyright: ignore[reportArgumentType]
+        _add_subsystems(tf, subsystems, iter_paths_func, splice_to)
@@ -0,0 +1,172 @@
+"""Content-defined chunking of files for chunked snapshots.
+
+Files are cut into chunks with FastCDC (see fastcdc.c), so a chunk's
+boundaries depend only on the bytes around them: a file that is unchanged, or
+changed in one place, between two snapshots yields the same chunks except
+around the change. Chunks are identified by their BLAKE2b-256 digest.
+
+The cutting runs in fastcdc.so through ctypes when it is installed, and in a
+(much slower) pure-Python version of the same algorithm otherwise; both cut
+identical chunks.
+
+Build: gcc -shared -fPIC -O2 -o /app/lib/fastcdc.so fastcdc.c -lpthread
+"""
+
+import ctypes
+import hashlib
+import os
+import threading
+from dataclasses import dataclass
+
+from loguru import logger
+
+DEFAULT_LIBRARY_PATH = "/app/lib/fastcdc.so"
+LIBRARY_PATH = os.getenv("FASTCDC_LIBRARY_PATH", DEFAULT_LIBRARY_PATH)
+
+MIN_SIZE = 128 * 1024
+AVG_SIZE = 512 * 1024
+MAX_SIZE = 2 * 1024 * 1024
+HASH = "blake2b-256"
+# Bytes read from a file at a time (a multiple of MAX_SIZE)
+_READ_SIZE = 8 * MAX_SIZE
+_MAX_CHUNKS = _READ_SIZE // MIN_SIZE + 1
+
+_lib: ctypes.CDLL | None = None
+_lib_loaded = False
+_lib_lock = threading.Lock()
+
+
+def _load() -> ctypes.CDLL | None:
+    global _lib, _lib_loaded
+    with _lib_lock:
+        if not _lib_loaded:
+            _lib_loaded = True
+            try:
+                lib = ctypes.CDLL(LIBRARY_PATH)
+            except OSError as e:
+                logger.info(f"Native FastCDC unavailable ({e}); chunking in Python")
+            else:
+                lib.fastcdc_chunks.restype = ctypes.c_size_t
+                lib.fastcdc_chunks.argtypes = [
+                    ctypes.c_void_p,
+                    ctypes.c_size_t,
+                    ctypes.c_int,
+                    ctypes.c_size_t,
+                    ctypes.c_size_t,
+                    ctypes.c_size_t,
+                    ctypes.POINTER(ctypes.c_size_t),
+                    ctypes.c_size_t,
+                ]
+                _lib = lib
+        return _lib
+
+
+def _gear_table() -> list[int]:
+    # splitmix64 seeded with 0, as in fastcdc.c
+    mask = (1 << 64) - 1
+    table = []
+    state = 0
+    for _ in range(256):
+        state = (state + 0x9E3779B97F4A7C15) & mask
+        z = state
+        z = ((z ^ (z >> 30)) * 0xBF58476D1CE4E5B9) & mask
+        z = ((z ^ (z >> 27)) * 0x94D049BB133111EB) & mask
+        table.append(z ^ (z >> 31))
+    return table
+
+
+_GEAR = _gear_table()
+
+
+def _top_bits(n: int) -> int:
+    return ((1 << n) - 1) << (64 - n)
+
+
+def _py_chunks(data: memoryview, eof: bool) -> list[int]:
+    """fastcdc_chunks() in Python."""
+    bits = AVG_SIZE.bit_length() - 1
+    mask_s = _top_bits(bits + 2)
+    mask_l = _top_bits(max(bits - 2, 1))
+    gear = _GEAR
+    wrap = (1 << 64) - 1
+    lengths = []
+    pos = 0
+    while pos < len(data):
+        left = len(data) - pos
+        if not eof and left < MAX_SIZE:
+            break
+        end = min(left, MAX_SIZE)
+        chunk = end
+        if left > MIN_SIZE:
+            h = 0
+            normal = min(AVG_SIZE, end)
+            for i in range(MIN_SIZE, end):
+                h = ((h << 1) + gear[data[pos + i]]) & wrap
+                if not h & (mask_s if i < normal else mask_l):
+                    chunk = i + 1
+                    break
+        lengths.append(chunk)
+        pos += chunk
+    return lengths
+
+
+def _chunk_lengths(buf: bytearray, length: int, eof: bool) -> list[int]:
+    lib = _load()
+    if lib is None:
+        return _py_chunks(memoryview(buf)[:length], eof)
+    lengths = (ctypes.c_size_t * _MAX_CHUNKS)()
+    address = ctypes.addressof(ctypes.c_char.from_buffer(buf))
+    n = lib.fastcdc_chunks(
+        address, length, int(eof), MIN_SIZE, AVG_SIZE, MAX_SIZE, lengths, _MAX_CHUNKS
+    )
+    return lengths[:n]
+
+
+@dataclass
+class Chunk:
+    digest: str
+    offset: int
+    length: int
+
+
+def chunk_file(path: str) -> tuple[list[Chunk], int]:
+    """The chunks of the file at path (symlinks not followed), and its size.
+
+    The size is what was read, so a file that grows or shrinks while it is
+    chunked is described consistently as it was read.
+    """
+    chunks: list[Chunk] = []
+    buf = bytearray(_READ_SIZE)
+    view = memoryview(buf)
+    fd = os.open(path, os.O_RDONLY | os.O_CLOEXEC | os.O_NOFOLLOW)
+    try:
+        os.posix_fadvise(fd, 0, 0, os.POSIX_FADV_SEQUENTIAL)
+        offset = 0  # File offset of buf[0]
+        filled = 0
+        eof = False
+        while not eof or filled:
+            while not eof and filled < _READ_SIZE:
+                n = os.readv(fd, [view[filled:]])
+                eof = n == 0
+                filled += n
+            start = 0
+            for length in _chunk_lengths(buf, filled, eof):
+                digest = hashlib.blake2b(view[start : start + length], digest_size=32)
+                chunks.append(Chunk(digest.hexdigest(), offset + start, length))
+                start += length
+            # Keep the undecided tail for the next round
+            view[: filled - start] = view[start:filled]
+            offset += start
+            filled -= start
+        return chunks, offset
+    finally:
+        os.close(fd)
+
+
+def read_chunk(path: str, chunk: Chunk) -> bytes:
+    """The bytes of chunk, read back from the file at path."""
+    fd = os.open(path, os.O_RDONLY | os.O_CLOEXEC | os.O_NOFOLLOW)
+    try:
+        return os.pread(fd, chunk.length, chunk.offset)
+    finally:
+        os.close(fd)
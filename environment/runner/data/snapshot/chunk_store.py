@@ -0,0 +1,192 @@
+"""Content-addressed store for chunked snapshots.
+
+A chunked snapshot is a manifest plus the chunks it references:
+
+    chunks/<digest[:2]>/<digest>          a zlib-compressed chunk
+    manifests/<snapshot_id>.json.gz       the snapshot's manifest
+
+kept either in a local directory (SNAPSHOT_CHUNK_STORE) or in
+S3_SNAPSHOTS_BUCKET under S3_SNAPSHOTS_PREFIX. Chunks are named by the digest
+of their uncompressed content, so a chunk that is already stored (by an
+earlier snapshot of this or any other environment) is never uploaded again.
+
+Whether a chunk is stored is remembered for KNOWN_CHUNK_TTL seconds only, then
+asked of the store again: a chunk removed from the store by a cleanup is
+uploaded by the next snapshot that needs it after that.
+
+A stored chunk is never written again, however many later snapshots reference
+it, so its age says nothing about whether it is still needed. The chunks/
+prefix must not be expired by age-based lifecycle rules (S3 expiration, tmp
+reapers): that deletes chunks live manifests reference and breaks those
+snapshots. Expire manifests/ by age if needed, and remove chunks only by
+sweeping those no remaining manifest references.
+"""
+
+import asyncio
+import os
+import tempfile
+import time
+from collections.abc import AsyncGenerator
+from contextlib import asynccontextmanager
+from typing import Any, Protocol
+
+from botocore.exceptions import ClientError
+
+from runner.utils.s3 import get_s3_client
+from runner.utils.settings import get_settings
+
+settings = get_settings()
+
+# Seconds a chunk found in (or put into) the store is trusted to still be there
+KNOWN_CHUNK_TTL = 3600
+
+
+class KnownChunks:
+    """Digests of chunks recently seen in one store, checked before asking it."""
+
+    def __init__(self, ttl: float = KNOWN_CHUNK_TTL):
+        self.ttl: float = ttl
+        self._seen: dict[str, float] = {}
+
+    def __contains__(self, digest: str) -> bool:
+        seen = self._seen.get(digest)
+        if seen is None:
+            return False
+        if time.monotonic() - seen > self.ttl:
+            del self._seen[digest]
+            return False
+        return True
+
+    def add(self, digest: str) -> None:
+        self._seen[digest] = time.monotonic()
+
+
+# Chunks known to be stored, per store location, so repeat snapshots from this
+# process don't re-check every chunk
+_known_chunks: dict[str, KnownChunks] = {}
+
+
+def chunk_key(digest: str) -> str:
+    """Store key of the chunk with digest."""
+    return f"chunks/{digest[:2]}/{digest}"
+
+
+def manifest_key(snapshot_id: str) -> str:
+    """Store key of a snapshot's manifest."""
+    return f"manifests/{snapshot_id}.json.gz"
+
+
+class ChunkStore(Protocol):
+    """Where chunks and manifests are kept."""
+
+    location: str
+    known: KnownChunks
+
+    async def has(self, key: str) -> bool:
+        """Whether an object is stored under key."""
+        ...
+
+    async def put(self, key: str, data: bytes) -> None:
+        """Store data under key, replacing any object there."""
+        ...
+
+    async def get(self, key: str) -> bytes:
+        """The object under key. Raises FileNotFoundError if there is none."""
+        ...
+
+
+class LocalChunkStore:
+    """Chunk store in a local directory."""
+
+    def __init__(self, root: str):
+        self.root: str = root
+        self.location: str = os.path.abspath(root)
+        self.known: KnownChunks = _known_chunks.setdefault(self.location, KnownChunks())
+
+    def _path(self, key: str) -> str:
+        return os.path.join(self.root, key)
+
+    async def has(self, key: str) -> bool:
+        return await asyncio.to_thread(os.path.exists, self._path(key))
+
+    def _put(self, key: str, data: bytes) -> None:
+        path = self._path(key)
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        # Write then rename, so readers never see a partial object
+        fd, tmp = tempfile.mkstemp(dir=os.path.dirname(path), prefix=".tmp-")
+        try:
+            with os.fdopen(fd, "wb") as f:
+                f.write(data)
+            os.replace(tmp, path)
+        except BaseException:
+            os.unlink(tmp)
+            raise
+
+    async def put(self, key: str, data: bytes) -> None:
+        await asyncio.to_thread(self._put, key, data)
+
+    def _get(self, key: str) -> bytes:
+        with open(self._path(key), "rb") as f:
+            return f.read()
+
+    async def get(self, key: str) -> bytes:
+        return await asyncio.to_thread(self._get, key)
+
+
+class S3ChunkStore:
+    """Chunk store in an S3 (or S3-compatible) bucket."""
+
+    def __init__(self, s3_resource: Any, bucket: str, prefix: str):
+        self.client: Any = s3_resource.meta.client
+        self.bucket: str = bucket
+        self.prefix: str = prefix
+        self.location: str = f"s3://{bucket}/{prefix}"
+        self.known: KnownChunks = _known_chunks.setdefault(self.location, KnownChunks())
+
+    async def has(self, key: str) -> bool:
+        try:
+            await self.client.head_object(Bucket=self.bucket, Key=self.prefix + key)
+        except ClientError as e:
+            if e.response.get("Error", {}).get("Code") in ("404", "NoSuchKey"):
+                return False
+            raise
+        return True
+
+    async def put(self, key: str, data: bytes) -> None:
+        await self.client.put_object(
+            Bucket=self.bucket, Key=self.prefix + key, Body=data
+        )
+
+    async def get(self, key: str) -> bytes:
+        try:
+            response = await self.client.get_object(
+                Bucket=self.bucket, Key=self.prefix + key
+            )
+        except ClientError as e:
+            if e.response.get("Error", {}).get("Code") in ("404", "NoSuchKey"):
+                raise FileNotFoundError(f"{self.location}{key}") from e
+            raise
+        return await response["Body"].read()
+
+
+@asynccontextmanager
+async def open_chunk_store() -> AsyncGenerator[ChunkStore, Any]:
+    """Open the configured chunk store.
+
+    SNAPSHOT_CHUNK_STORE names a local directory; when it is empty, the store
+    is S3_SNAPSHOTS_BUCKET under S3_SNAPSHOTS_PREFIX.
+
+    Yields:
+        A LocalChunkStore or S3ChunkStore
+    """
+    if settings.SNAPSHOT_CHUNK_STORE:
+        yield LocalChunkStore(settings.SNAPSHOT_CHUNK_STORE)
+        return
+
+    prefix = (
+        settings.S3_SNAPSHOTS_PREFIX.rstrip("/") + "/"
+        if settings.S3_SNAPSHOTS_PREFIX
+        else ""
+    )
+    async with get_s3_client() as s3:
+        yield S3ChunkStore(s3, settings.S3_SNAPSHOTS_BUCKET, prefix)
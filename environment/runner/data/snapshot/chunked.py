@@ -0,0 +1,389 @@
+"""Chunked snapshots: deduplicated, content-addressed snapshots.
+
+A chunked snapshot stores each file as a list of content-defined chunks (see
+cdc.py) in a chunk store (see chunk_store.py), plus a small manifest listing
+the files. Consecutive snapshots of a task share almost all their chunks, so
+only chunks the store doesn't have yet are uploaded: the cost of a snapshot
+follows what changed, not the size of the tree.
+
+The manifest is gzipped JSON:
+
+    {
+      "version": 1,
+      "snapshot_id": "snap_<hex>",
+      "created_at": "<ISO 8601>",
+      "chunking": {"algorithm": "fastcdc", "min": ..., "avg": ..., "max": ...},
+      "hash": "blake2b-256",
+      "compression": "zlib",
+      "entries": [
+        {"name": "filesystem/a.txt", "type": "file", "mode": 420,
+         "mtime": 1700000000.0, "size": 12, "chunks": [["<digest>", 12]]},
+        {"name": "filesystem/b", "type": "symlink", "mode": 511,
+         "mtime": 1700000000.0, "target": "a.txt"}
+      ]
+    }
+
+Existing consumers read tar.gz or zip, so stream_archive() rebuilds either
+from a manifest on demand. Symlinks go into zips as Info-ZIP does: a member
+with S_IFLNK in its Unix mode and the target as its content.
+"""
+
+import asyncio
+import gzip
+import hashlib
+import json
+import os
+import stat
+import tarfile
+import time
+import zipfile
+import zlib
+from collections import deque
+from collections.abc import AsyncGenerator, Callable, Iterator
+from concurrent.futures import Future
+from contextlib import aclosing
+from dataclasses import dataclass
+from datetime import UTC, datetime
+from pathlib import Path
+from typing import Any
+
+from loguru import logger
+
+from runner.utils.settings import get_settings
+
+from . import cdc
+from .archive import ParallelGzipWriter, Writable
+from .chunk_store import ChunkStore, chunk_key, manifest_key
+from .streaming import stream_from_thread
+
+settings = get_settings()
+
+MANIFEST_VERSION = 1
+ARCHIVE_FORMATS = ("tar.gz", "tar", "zip")
+# Chunks read, compressed and uploaded at once (bounds memory at about
+# CHUNK_UPLOADS * cdc.MAX_SIZE)
+CHUNK_UPLOADS = 16
+# Chunks fetched ahead of the archive being rebuilt
+CHUNK_PREFETCH = 16
+
+PathIterator = Callable[[str, str], Iterator[tuple[Path, str]]]
+
+
+@dataclass
+class ChunkedSnapshotStats:
+    files: int = 0
+    total_bytes: int = 0
+    chunks: int = 0
+    new_chunks: int = 0
+    new_bytes: int = 0
+    uploaded_bytes: int = 0
+    seconds: float = 0.0
+
+    @property
+    def dedup_ratio(self) -> float:
+        """Fraction of the snapshot's bytes that were already stored."""
+        if not self.total_bytes:
+            return 1.0
+        return 1.0 - self.new_bytes / self.total_bytes
+
+
+class _Uploader:
+    """Stores the chunks of one snapshot, each at most once."""
+
+    def __init__(self, store: ChunkStore, stats: ChunkedSnapshotStats):
+        self.store = store
+        self.stats = stats
+        self._slots = asyncio.Semaphore(CHUNK_UPLOADS)
+        self._inflight: dict[str, asyncio.Task[None]] = {}
+
+    def _read(self, path: str, chunk: cdc.Chunk) -> tuple[str, bytes, bytes]:
+        data = cdc.read_chunk(path, chunk)
+        digest = hashlib.blake2b(data, digest_size=32).hexdigest()
+        return digest, data, zlib.compress(data, settings.SNAPSHOT_COMPRESSION_LEVEL)
+
+    async def _upload(self, digest: str, data: bytes, compressed: bytes) -> None:
+        if digest in self.store.known:
+            return
+        if not await self.store.has(chunk_key(digest)):
+            await self.store.put(chunk_key(digest), compressed)
+            self.stats.new_chunks += 1
+            self.stats.new_bytes += len(data)
+            self.stats.uploaded_bytes += len(compressed)
+        self.store.known.add(digest)
+
+    async def _store(self, path: str, chunk: cdc.Chunk) -> None:
+        async with self._slots:
+            if chunk.digest in self.store.known:
+                return
+            if await self.store.has(chunk_key(chunk.digest)):
+                self.store.known.add(chunk.digest)
+                return
+            digest, data, compressed = await asyncio.to_thread(self._read, path, chunk)
+            if digest != chunk.digest or len(data) != chunk.length:
+                # Changed since it was chunked: keep what was read, consistently
+                logger.debug(f"{path} changed while it was snapshotted")
+                chunk.digest, chunk.length = digest, len(data)
+            await self._upload(digest, data, compressed)
+
+    async def add(self, path: str, chunk: cdc.Chunk) -> None:
+        """Store chunk of the file at path unless the store already has it."""
+        task = self._inflight.get(chunk.digest)
+        if task is not None:
+            # Another file's copy of the chunk is being stored; it may turn
+            # out to have changed, in which case this one is stored after all
+            await task
+        if chunk.digest in self.store.known:
+            return
+        task = asyncio.create_task(self._store(path, chunk))
+        self._inflight[chunk.digest] = task
+        await task
+
+
+async def _add_file(
+    uploader: _Uploader, path: Path, entry: dict[str, Any], files: asyncio.Semaphore
+) -> None:
+    async with files:
+        chunks, _ = await asyncio.to_thread(cdc.chunk_file, str(path))
+        await asyncio.gather(*(uploader.add(str(path), c) for c in chunks))
+    entry["chunks"] = [[c.digest, c.length] for c in chunks]
+    entry["size"] = sum(c.length for c in chunks)
+    uploader.stats.chunks += len(chunks)
+    uploader.stats.total_bytes += entry["size"]
+
+
+def _list_entries(
+    subsystems: list[str], iter_paths_func: PathIterator
+) -> list[tuple[Path, dict[str, Any]]]:
+    """Manifest entries of subsystems' regular files and symlinks, with their paths."""
+    entries: list[tuple[Path, dict[str, Any]]] = []
+    for subsystem in subsystems:
+        for path, arcname in iter_paths_func(f"/{subsystem}", subsystem):
+            try:
+                st = os.lstat(path)
+                entry: dict[str, Any] = {
+                    "name": arcname,
+                    "mode": stat.S_IMODE(st.st_mode),
+                    "mtime": st.st_mtime,
+                }
+                if stat.S_ISLNK(st.st_mode):
+                    entry["type"] = "symlink"
+                    entry["target"] = os.readlink(path)
+                elif stat.S_ISREG(st.st_mode):
+                    entry["type"] = "file"
+                else:
+                    continue
+            except FileNotFoundError:
+                logger.debug(f"Skipping file removed before it was snapshotted: {path}")
+                continue
+            entries.append((path, entry))
+    return entries
+
+
+async def write_chunked_snapshot(
+    store: ChunkStore,
+    snapshot_id: str,
+    subsystems: list[str],
+    iter_paths_func: PathIterator,
+) -> ChunkedSnapshotStats:
+    """Store the chunks of subsystems' files that store lacks, then the manifest.
+
+    Args:
+        store: Chunk store to write to
+        snapshot_id: Snapshot ID the manifest is stored under
+        subsystems: Subsystem names (e.g., ['filesystem', '.apps_data'])
+        iter_paths_func: Function to iterate over file paths for a subsystem
+
+    Returns:
+        Counts of files, bytes and chunks, and how many were new
+    """
+    started = time.perf_counter()
+    stats = ChunkedSnapshotStats()
+    uploader = _Uploader(store, stats)
+    files = asyncio.Semaphore(settings.SNAPSHOT_READ_THREADS)
+    tasks: list[asyncio.Task[None]] = []
+
+    entries = await asyncio.to_thread(_list_entries, subsystems, iter_paths_func)
+    for path, entry in entries:
+        if entry["type"] == "file":
+            tasks.append(asyncio.create_task(_add_file(uploader, path, entry, files)))
+    stats.files = len(entries)
+
+    try:
+        await asyncio.gather(*tasks)
+    except BaseException:
+        for task in tasks:
+            task.cancel()
+        raise
+
+    manifest = {
+        "version": MANIFEST_VERSION,
+        "snapshot_id": snapshot_id,
+        "created_at": datetime.now(UTC).isoformat(),
+        "chunking": {
+            "algorithm": "fastcdc",
+            "min": cdc.MIN_SIZE,
+            "avg": cdc.AVG_SIZE,
+            "max": cdc.MAX_SIZE,
+        },
+        "hash": cdc.HASH,
+        "compression": "zlib",
+        "entries": [entry for _, entry in entries],
+    }
+    data = await asyncio.to_thread(
+        lambda: gzip.compress(json.dumps(manifest).encode(), mtime=0)
+    )
+    await store.put(manifest_key(snapshot_id), data)
+    stats.uploaded_bytes += len(data)
+    stats.seconds = time.perf_counter() - started
+    return stats
+
+
+async def load_manifest(store: ChunkStore, snapshot_id: str) -> dict[str, Any]:
+    """The manifest of a chunked snapshot. Raises FileNotFoundError if absent."""
+    data = await store.get(manifest_key(snapshot_id))
+    manifest = json.loads(gzip.decompress(data))
+    if manifest.get("version") != MANIFEST_VERSION:
+        raise ValueError(
+            f"Unsupported chunked snapshot manifest version: {manifest.get('version')}"
+        )
+    return manifest
+
+
+class _ChunkReader:
+    """File object over a file's chunks, fetched through next_chunk()."""
+
+    def __init__(self, next_chunk: Callable[[], bytes], count: int):
+        self._next_chunk = next_chunk
+        self._left = count
+        self._chunk = memoryview(b"")
+        self._pos = 0
+
+    def read(self, size: int) -> bytes:
+        """size bytes, fewer only at the end (as tarfile.copyfileobj expects)."""
+        parts = []
+        while size > 0:
+            if self._pos == len(self._chunk):
+                if not self._left:
+                    break
+                self._chunk = memoryview(self._next_chunk())
+                self._pos = 0
+                self._left -= 1
+            part = self._chunk[self._pos : self._pos + size]
+            parts.append(part)
+            self._pos += len(part)
+            size -= len(part)
+        return b"".join(parts)
+
+
+class _Unseekable:
+    """Write-only view of a stream, so zipfile writes data descriptors."""
+
+    def __init__(self, fileobj: Writable):
+        self._fileobj = fileobj
+
+    def write(self, data: bytes) -> int:
+        return self._fileobj.write(bytes(data))
+
+    def flush(self) -> None:
+        pass
+
+
+def _write_archive(
+    manifest: dict[str, Any],
+    fetch: Callable[[str], Future[bytes]],
+    fileobj: Writable,
+    fmt: str,
+) -> None:
+    """Write the files of manifest to fileobj as a tar.gz, tar or zip archive."""
+    entries = manifest["entries"]
+    chunks = (c for e in entries if e["type"] == "file" for c in e["chunks"])
+    window: deque[tuple[str, int, Future[bytes]]] = deque()
+
+    def next_chunk() -> bytes:
+        # Keep CHUNK_PREFETCH fetches in flight ahead of the writer
+        while len(window) < CHUNK_PREFETCH and (c := next(chunks, None)) is not None:
+            window.append((c[0], c[1], fetch(c[0])))
+        digest, length, future = window.popleft()
+        data = zlib.decompress(future.result())
+        # A damaged or overwritten store object must not pass for the file
+        if (
+            len(data) != length
+            or hashlib.blake2b(data, digest_size=32).hexdigest() != digest
+        ):
+            raise ValueError(f"Stored chunk {digest} does not match its digest")
+        return data
+
+    if fmt == "zip":
+        with zipfile.ZipFile(_Unseekable(fileobj), "w", zipfile.ZIP_DEFLATED) as zf:  # pyright: ignore[reportArgumentType]
+            for entry in entries:
+                mtime = max(entry["mtime"], 315532800)  # Zip dates start in 1980
+                info = zipfile.ZipInfo(entry["name"], time.gmtime(mtime)[:6])
+                info.create_system = 3  # Unix, so external_attr holds st_mode
+                if entry["type"] == "symlink":
+                    info.external_attr = (stat.S_IFLNK | entry["mode"]) << 16
+                    zf.writestr(info, entry["target"])
+                    continue
+                info.external_attr = (stat.S_IFREG | entry["mode"]) << 16
+                info.compress_type = zipfile.ZIP_DEFLATED
+                info.file_size = entry["size"]
+                with zf.open(info, "w") as dst:
+                    for _ in entry["chunks"]:
+                        dst.write(next_chunk())
+        return
+
+    def write_tar(out: Any) -> None:
+        with tarfile.open(mode="w", fileobj=out) as tf:
+            for entry in entries:
+                info = tarfile.TarInfo(entry["name"])
+                info.mode = entry["mode"]
+                info.mtime = entry["mtime"]
+                if entry["type"] == "symlink":
+                    info.type = tarfile.SYMTYPE
+                    info.linkname = entry["target"]
+                    tf.addfile(info)
+                else:
+                    info.size = entry["size"]
+                    tf.addfile(info, _ChunkReader(next_chunk, len(entry["chunks"])))
+
+    if fmt == "tar":
+        write_tar(fileobj)
+    else:
+        with ParallelGzipWriter(
+            fileobj,
+            level=settings.SNAPSHOT_COMPRESSION_LEVEL,
+            threads=settings.SNAPSHOT_COMPRESSION_THREADS or None,
+        ) as gz:
+            write_tar(gz)
+
+
+async def stream_archive(
+    store: ChunkStore, manifest: dict[str, Any], fmt: str
+) -> AsyncGenerator[bytes]:
+    """Rebuild a chunked snapshot as a tar.gz, tar or zip archive, in chunks.
+
+    The archive is written on a background thread that fetches chunks from
+    store through this event loop, CHUNK_PREFETCH at a time.
+
+    Args:
+        store: Chunk store holding the snapshot's chunks
+        manifest: The snapshot's manifest (see load_manifest)
+        fmt: One of ARCHIVE_FORMATS
+
+    Yields:
+        Bytes chunks of the archive
+    """
+    if fmt not in ARCHIVE_FORMATS:
+        raise ValueError(f"Unsupported archive format: {fmt}")
+    loop = asyncio.get_running_loop()
+
+    def fetch(digest: str) -> Future[bytes]:
+        return asyncio.run_coroutine_threadsafe(store.get(chunk_key(digest)), loop)
+
+    async with aclosing(
+        stream_from_thread(
+            lambda pipe: _write_archive(manifest, fetch, pipe, fmt),
+            f"chunked snapshot {manifest['snapshot_id']} as {fmt}",
+        )
+    ) as chunks:
+        async for chunk in chunks:
+            yield chunk
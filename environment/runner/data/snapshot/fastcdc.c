@@ -0,0 +1,96 @@
+/*
+ * fastcdc.c - Content-defined chunking for chunked snapshots
+ *
+ * Compile: gcc -shared -fPIC -O2 -o fastcdc.so fastcdc.c -lpthread
+ * Usage:   loaded with ctypes by runner/data/snapshot/cdc.py (FASTCDC_LIBRARY_PATH)
+ *
+ * FastCDC (Xia et al., USENIX ATC '16): a gear rolling hash,
+ *
+ *     hash = (hash << 1) + GEAR[byte]
+ *
+ * is updated for every byte after the first min_size bytes of a chunk, and the
+ * chunk ends where the hash has all its mask bits clear. Until the chunk
+ * reaches avg_size a mask with two more bits than log2(avg_size) is used, and
+ * after it one with two fewer ("normalized chunking"), which keeps chunk sizes
+ * close to the average; max_size bounds them.
+ *
+ * The mask bits are the top bits of the hash, so a cut depends on the last 64
+ * bytes only: an edit moves the chunk boundaries around it and no others, and
+ * unchanged content elsewhere in a file keeps producing the same chunks.
+ *
+ * The GEAR table comes from splitmix64 seeded with 0 and must match the
+ * Python fallback in cdc.py, or the two would cut different chunks.
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+static uint64_t GEAR[256];
+static pthread_once_t gear_once = PTHREAD_ONCE_INIT;
+
+static void gear_init(void) {
+    uint64_t state = 0;
+    for (int i = 0; i < 256; i++) {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        GEAR[i] = z ^ (z >> 31);
+    }
+}
+
+static inline uint64_t top_bits(unsigned n) {
+    return n == 0 ? 0 : ~0ULL << (64 - n);
+}
+
+static unsigned log2_floor(size_t v) {
+    unsigned n = 0;
+    while (v >>= 1) n++;
+    return n;
+}
+
+/* Length of the chunk at the start of data[0..len). */
+static size_t cut(const uint8_t *data, size_t len, size_t min_size, size_t avg_size,
+                  size_t max_size, uint64_t mask_s, uint64_t mask_l) {
+    if (len <= min_size) return len;
+    if (len > max_size) len = max_size;
+    size_t normal = avg_size < len ? avg_size : len;
+    uint64_t hash = 0;
+    size_t i = min_size;
+    for (; i < normal; i++) {
+        hash = (hash << 1) + GEAR[data[i]];
+        if (!(hash & mask_s)) return i + 1;
+    }
+    for (; i < len; i++) {
+        hash = (hash << 1) + GEAR[data[i]];
+        if (!(hash & mask_l)) return i + 1;
+    }
+    return len;
+}
+
+/*
+ * Split data[0..len) into chunks, writing their lengths to lengths[] (at most
+ * max_chunks of them). Returns the number written. Unless eof is set, the
+ * trailing bytes that could still grow into a longer chunk (fewer than
+ * max_size) are left over: call again with them at the front of more data.
+ */
+size_t fastcdc_chunks(const uint8_t *data, size_t len, int eof, size_t min_size,
+                      size_t avg_size, size_t max_size, size_t *lengths,
+                      size_t max_chunks) {
+    pthread_once(&gear_once, gear_init);
+    unsigned bits = log2_floor(avg_size);
+    uint64_t mask_s = top_bits(bits + 2);
+    uint64_t mask_l = top_bits(bits > 2 ? bits - 2 : 1);
+
+    size_t n = 0;
+    size_t pos = 0;
+    while (pos < len && n < max_chunks) {
+        size_t left = len - pos;
+        if (!eof && left < max_size) break;
+        size_t chunk = cut(data + pos, left, min_size, avg_size, max_size, mask_s,
+                           mask_l);
+        lengths[n++] = chunk;
+        pos += chunk;
+    }
+    return n;
+}
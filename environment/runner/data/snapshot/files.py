@@ -0,0 +1,306 @@
+"""Store a snapshot's files in S3 as one object per file.
+
+Each file is stored the cheapest way that works:
+
+- A file unchanged since it was populated from S3, or uploaded by an earlier
+  files snapshot (see populate/baseline.py), is copied inside S3 from that
+  object without being read. Whether it is unchanged is decided from the live
+  file's stat, including its inode and ctime, never from a staged copy's. If
+  the copy fails (e.g., the object changed or isn't readable with the
+  snapshot's credentials) the file is uploaded.
+- A file smaller than SNAPSHOT_UPLOAD_PART_SIZE is read and put whole.
+- A larger file is streamed through a multipart upload (S3StreamUploader), so
+  it is never held in memory whole.
+
+SNAPSHOT_FILES_CONCURRENCY files are stored at once, and the memory they hold
+is bounded by SNAPSHOT_FILES_MAX_INFLIGHT across all snapshots on the event
+loop: a small file holds its size while it uploads, a streamed one its
+uploader's buffers ((SNAPSHOT_UPLOAD_CONCURRENCY + 1) parts).
+"""
+
+import asyncio
+import contextlib
+import os
+from collections.abc import AsyncIterator, Iterable
+from dataclasses import dataclass
+from typing import Any
+
+from botocore.exceptions import ClientError
+from loguru import logger
+
+from runner.utils.settings import get_settings
+
+from ..populate import baseline
+from .streaming import S3StreamUploader
+
+settings = get_settings()
+
+# S3's limit on the size of a single copy_object(); larger objects are copied
+# in parts with upload_part_copy()
+MAX_COPY_SIZE = 5 * 1024 * 1024 * 1024
+COPY_PART_SIZE = 1024 * 1024 * 1024
+COPY_PART_CONCURRENCY = 8
+
+
+class _ByteBudget:
+    """Bytes held in memory by the file uploads on an event loop."""
+
+    def __init__(self, limit: int):
+        self.limit: int = limit
+        self.used: int = 0
+        self._freed: asyncio.Condition = asyncio.Condition()
+
+    @contextlib.asynccontextmanager
+    async def hold(self, nbytes: int) -> AsyncIterator[None]:
+        """Hold nbytes (at most the whole budget) while the block runs."""
+        nbytes = min(nbytes, self.limit)
+        async with self._freed:
+            _ = await self._freed.wait_for(lambda: self.used + nbytes <= self.limit)
+            self.used += nbytes
+        try:
+            yield
+        finally:
+            async with self._freed:
+                self.used -= nbytes
+                self._freed.notify_all()
+
+
+_budgets: dict[int, _ByteBudget] = {}
+
+
+def _byte_budget() -> _ByteBudget:
+    """The byte budget of the running event loop."""
+    loop_id = id(asyncio.get_running_loop())
+    budget = _budgets.get(loop_id)
+    if budget is None:
+        budget = _ByteBudget(settings.SNAPSHOT_FILES_MAX_INFLIGHT)
+        _budgets[loop_id] = budget
+    return budget
+
+
+@dataclass
+class StoredFiles:
+    """What storing a snapshot's files took."""
+
+    files: int = 0
+    total_bytes: int = 0
+    files_copied: int = 0
+    uploaded_bytes: int = 0
+
+
+def _same_file(a: os.stat_result, b: os.stat_result) -> bool:
+    return a.st_size == b.st_size and a.st_mtime_ns == b.st_mtime_ns
+
+
+def _stat_live(path: str) -> os.stat_result | None:
+    try:
+        return os.stat(path)
+    except FileNotFoundError:
+        return None
+
+
+def _live_to_record(
+    live_st: os.stat_result | None, read_st: os.stat_result, staged: bool
+) -> os.stat_result | None:
+    """The live file's stat to record as holding the content read (as of read_st).
+
+    A staged copy keeps the live file's size and mtime (see quiesce.py) and gets
+    its ctime when it is made; a live file with the same size and mtime and no
+    later ctime hasn't changed since the copy.
+    """
+    if not staged:
+        return read_st
+    if (
+        live_st is not None
+        and _same_file(live_st, read_st)
+        and live_st.st_ctime_ns <= read_st.st_ctime_ns
+    ):
+        return live_st
+    return None
+
+
+def _read_file(path: str) -> tuple[bytes, os.stat_result]:
+    """Read a whole file, with its stat from before the read."""
+    with open(path, "rb") as f:
+        st = os.fstat(f.fileno())
+        return f.read(), st
+
+
+def _stream_file(path: str, uploader: S3StreamUploader, chunk_size: int) -> None:
+    """Write a file's content to uploader (on a thread; blocks on its uploads)."""
+    with open(path, "rb") as f:
+        while data := f.read(chunk_size):
+            _ = uploader.write(data)
+
+
+async def _copy_object(
+    client: Any, source: baseline.StoredObject, bucket: str, key: str
+) -> str:
+    """Copy source to bucket/key inside S3, if it still has the recorded ETag.
+
+    Returns:
+        The copy's ETag
+    """
+    copy_source = {"Bucket": source.bucket, "Key": source.key}
+    if_match = f'"{source.etag}"'
+    if source.size <= MAX_COPY_SIZE:
+        response = await client.copy_object(
+            Bucket=bucket,
+            Key=key,
+            CopySource=copy_source,
+            CopySourceIfMatch=if_match,
+        )
+        return response["CopyObjectResult"]["ETag"]
+
+    upload = await client.create_multipart_upload(Bucket=bucket, Key=key)
+    upload_id = upload["UploadId"]
+    limit = asyncio.Semaphore(COPY_PART_CONCURRENCY)
+
+    async def copy_part(part_number: int, start: int) -> dict[str, Any]:
+        end = min(start + COPY_PART_SIZE, source.size) - 1
+        async with limit:
+            response = await client.upload_part_copy(
+                Bucket=bucket,
+                Key=key,
+                UploadId=upload_id,
+                PartNumber=part_number,
+                CopySource=copy_source,
+                CopySourceIfMatch=if_match,
+                CopySourceRange=f"bytes={start}-{end}",
+            )
+        return {"ETag": response["CopyPartResult"]["ETag"], "PartNumber": part_number}
+
+    try:
+        parts = await asyncio.gather(
+            *(
+                copy_part(i + 1, start)
+                for i, start in enumerate(range(0, source.size, COPY_PART_SIZE))
+            )
+        )
+        response = await client.complete_multipart_upload(
+            Bucket=bucket,
+            Key=key,
+            UploadId=upload_id,
+            MultipartUpload={"Parts": parts},
+        )
+    except BaseException:
+        with contextlib.suppress(Exception):
+            await client.abort_multipart_upload(
+                Bucket=bucket, Key=key, UploadId=upload_id
+            )
+        raise
+    return response["ETag"]
+
+
+async def _upload_file(
+    s3: Any, path: str, bucket: str, key: str, size: int
+) -> tuple[str | None, os.stat_result | None]:
+    """Upload a file, put whole or streamed by size.
+
+    Returns:
+        The object's ETag and the file's stat from before it was read, or
+        (None, None) if the file changed while it was read
+    """
+    part_size = settings.SNAPSHOT_UPLOAD_PART_SIZE
+    budget = _byte_budget()
+    if size < part_size:
+        async with budget.hold(size):
+            data, st = await asyncio.to_thread(_read_file, path)
+            response = await s3.meta.client.put_object(
+                Bucket=bucket, Key=key, Body=data
+            )
+            etag = response["ETag"]
+    else:
+        concurrency = settings.SNAPSHOT_UPLOAD_CONCURRENCY
+        async with budget.hold((concurrency + 1) * part_size):
+            st = await asyncio.to_thread(os.stat, path)
+            uploader = S3StreamUploader(s3, bucket, key, part_size, concurrency)
+            async with uploader:
+                await asyncio.to_thread(_stream_file, path, uploader, part_size)
+            etag = uploader.etag
+    after = await asyncio.to_thread(os.stat, path)
+    if not _same_file(st, after):
+        return None, None
+    return etag, st
+
+
+async def _store_file(
+    s3: Any, bucket: str, path: str, arcname: str, key: str, stored: StoredFiles
+) -> None:
+    """Store one file as bucket/key, copying it inside S3 if it is unchanged."""
+    # Recorded under the file's own path; path may be a staged copy of it, whose
+    # inode and ctime are its own: the record is checked against the live file
+    file_path = "/" + arcname
+    staged = path != file_path
+    st = await asyncio.to_thread(os.stat, path)
+    live_st = await asyncio.to_thread(_stat_live, file_path) if staged else st
+    source = await asyncio.to_thread(baseline.find_unchanged, file_path, live_st, path)
+    if source is not None:
+        try:
+            etag = await _copy_object(s3.meta.client, source, bucket, key)
+        except ClientError as e:
+            logger.debug(
+                f"Copying s3://{source.bucket}/{source.key} for {file_path} "
+                f"failed ({e}); uploading it"
+            )
+            baseline.forget(file_path)
+        else:
+            record_st = _live_to_record(live_st, st, staged)
+            if record_st is not None:
+                baseline.record(file_path, bucket, key, etag, record_st)
+            else:
+                baseline.forget(file_path)
+            stored.files += 1
+            stored.files_copied += 1
+            stored.total_bytes += st.st_size
+            return
+
+    etag, read_st = await _upload_file(s3, path, bucket, key, st.st_size)
+    record_st = None
+    if etag is not None and read_st is not None:
+        if staged:
+            live_st = await asyncio.to_thread(_stat_live, file_path)
+        record_st = _live_to_record(live_st, read_st, staged)
+    if etag is not None and record_st is not None:
+        baseline.record(file_path, bucket, key, etag, record_st)
+    else:
+        baseline.forget(file_path)
+    stored.files += 1
+    stored.total_bytes += st.st_size
+    stored.uploaded_bytes += st.st_size
+
+
+async def store_files(
+    s3: Any, bucket: str, prefix: str, files: Iterable[tuple[str, str]]
+) -> StoredFiles:
+    """Store each (path, arcname) file as s3://bucket/{prefix}/{arcname}.
+
+    Args:
+        s3: The S3 resource from get_s3_client()
+        bucket: Destination bucket
+        prefix: Key prefix of the snapshot
+        files: Local path of each file (possibly a staged copy) and its name
+            in the snapshot ('<subsystem>/<relative path>')
+
+    Returns:
+        Counts of the files and bytes stored, copied and uploaded
+
+    Raises:
+        ClientError: If a file cannot be uploaded
+        OSError: If a file cannot be read
+    """
+    stored = StoredFiles()
+    pending = iter(files)
+
+    async def worker() -> None:
+        for path, arcname in pending:
+            await _store_file(s3, bucket, path, arcname, f"{prefix}/{arcname}", stored)
+
+    try:
+        async with asyncio.TaskGroup() as tasks:
+            for _ in range(settings.SNAPSHOT_FILES_CONCURRENCY):
+                _ = tasks.create_task(worker())
+    except BaseExceptionGroup as group:
+        # Surface the first failure, as gather() would
+        raise group.exceptions[0] from None
+    return stored
@@ -18,6 +18,13 @@ class SnapshotStreamRequest(BaseModel):
     Used by the /data/snapshot endpoint (direct tar.gz streaming).
     """
 
+    format: str = Field(
+        default="tar.gz",
+        description=(
+            "Archive format: 'tar.gz' (compressed) or 'tar' (uncompressed; file "
+            "contents are sent without passing through Python)"
+        ),
+    )
     pre_snapshot_hooks: list[LifecycleHook] = Field(
         default_factory=list,
         description="Commands to run before creating the snapshot (e.g., database dumps).",
@@ -36,7 +43,10 @@ class SnapshotRequest(BaseModel):
 
     format: str = Field(
         default="files",
-        description="Output format: 'tar.gz' (single archive) or 'files' (individual files)",
+        description=(
+            "Output format: 'tar.gz' (single archive), 'files' (individual files) "
+            "or 'chunks' (deduplicated chunks and a manifest)"
+        ),
     )
     pre_snapshot_hooks: list[LifecycleHook] = Field(
         default_factory=list,
@@ -83,3 +93,46 @@ class SnapshotFilesResult(BaseModel):
     total_bytes: int = Field(
         ..., description="Total size of all files uploaded in bytes"
     )
+    files_copied: int = Field(
+        default=0,
+        description=(
+            "Of files_uploaded, files unchanged since they were populated or last "
+            "snapshotted, copied inside S3 rather than uploaded"
+        ),
+    )
+    uploaded_bytes: int = Field(
+        default=0,
+        description="Of total_bytes, bytes actually uploaded (not copied inside S3)",
+    )
+
+
+class SnapshotChunksResult(BaseModel):
+    """Result of snapshot operation (chunks format).
+
+    Returned by the /data/snapshot/s3?format=chunks endpoint after storing the
+    chunks the chunk store lacked and the snapshot's manifest. The snapshot can
+    be downloaded as tar.gz, tar or zip from /data/snapshot/chunks/{snapshot_id}.
+    """
+
+    snapshot_id: str = Field(
+        ..., description="Unique identifier for this snapshot (format: 'snap_<hex>')"
+    )
+    manifest_uri: str = Field(
+        ..., description="Location of the snapshot's manifest in the chunk store"
+    )
+    files: int = Field(..., description="Number of files and symlinks in the snapshot")
+    total_bytes: int = Field(..., description="Total size of all files in bytes")
+    chunks: int = Field(..., description="Number of chunks the files were cut into")
+    new_chunks: int = Field(
+        ..., description="Number of chunks the store did not have yet"
+    )
+    new_bytes: int = Field(..., description="Uncompressed size of the new chunks")
+    uploaded_bytes: int = Field(
+        ..., description="Bytes written to the store (compressed chunks and manifest)"
+    )
+    dedup_ratio: float = Field(
+        ..., description="Fraction of total_bytes that was already stored"
+    )
+    upload_seconds: float = Field(
+        ..., description="Time taken to chunk and store the snapshot"
+    )
@@ -0,0 +1,274 @@
+"""Quiesce sandboxed writers while a snapshot captures a consistent view.
+
+Background processes started by the agent can keep writing while a snapshot
+is archived, producing torn archives. The code execution server's sandbox
+library (sandbox_fs.so) shares a small segment with this process; while its
+quiesce count is nonzero every mutating call under the tracked roots
+(open-for-write, writes, rename, unlink, mkdir, ...) pauses on a futex. Each snapshot increments
+the count while it captures and decrements it when done, so concurrent
+snapshots don't release each other. Reads are never paused, so the agent's
+processes keep running.
+
+While quiesced, the snapshot waits for in-flight mutations to drain, captures
+the file list and, where the filesystem supports it, makes reflink (FICLONE)
+copies into a staging directory; the archive is built from the copies. Writers
+are released as soon as that is done, and never held while the archive is
+written.
+
+Without reflink support (checked once per staging directory) there is nothing
+to hold the captured content, so writers are released right after the file
+list is captured and the live files are archived. Such a snapshot has a
+consistent file list but not point-in-time content: a file written while the
+archive is read can be archived torn, or in a state newer than its neighbours'.
+Each such snapshot logs a warning. Where that matters, put
+SNAPSHOT_STAGING_DIR on the same reflink-capable filesystem (XFS, Btrfs) as
+the snapshotted roots.
+
+The segment layout must match sandbox_fs.c and the code server's
+utils/shared_segment.py.
+"""
+
+import ctypes
+import errno
+import fcntl
+import mmap
+import os
+import platform
+import shutil
+import struct
+import time
+from collections.abc import Callable, Iterator
+from pathlib import Path
+
+from loguru import logger
+
+from runner.utils.settings import get_settings
+
+settings = get_settings()
+
+SEGMENT_MAGIC = 0x46584253  # "SBXF" in memory
+SEGMENT_VERSION = 1
+# magic, version, nslots, quiesce, mutators, reserved, quiesce_expires_ns
+HEADER_FORMAT = "<IIIIIIQ"
+QUIESCE_OFFSET = 12
+MUTATORS_OFFSET = 16
+EXPIRES_OFFSET = 24
+
+FICLONE = 0x40049409
+# What FICLONE fails with where the filesystems can't share extents
+_NO_REFLINK_ERRORS = (
+    errno.EOPNOTSUPP,
+    errno.EXDEV,
+    errno.EINVAL,
+    errno.ENOTTY,
+    errno.ENOSYS,
+)
+FUTEX_WAKE = 1
+_SYS_FUTEX = {"x86_64": 202, "aarch64": 98}.get(platform.machine())
+
+PathIterator = Callable[[str, str], Iterator[tuple[Path, str]]]
+
+
+class WriterQuiesce:
+    """Holds one count of the sandbox quiesce until released."""
+
+    def __init__(self, fd: int, segment: mmap.mmap):
+        self._fd = fd
+        self._segment = segment
+        self._quiesce = ctypes.c_uint32.from_buffer(segment, QUIESCE_OFFSET)
+        self._mutators = ctypes.c_uint32.from_buffer(segment, MUTATORS_OFFSET)
+        self._expires = ctypes.c_uint64.from_buffer(segment, EXPIRES_OFFSET)
+        self._held = False
+
+    @classmethod
+    def acquire(cls, segment_path: str, drain_timeout: float) -> "WriterQuiesce | None":
+        """Pause sandboxed writers and wait for in-flight mutations to finish.
+
+        Returns None if no code execution segment exists (nothing to quiesce).
+        """
+        try:
+            fd = os.open(segment_path, os.O_RDWR | os.O_CLOEXEC)
+        except FileNotFoundError:
+            return None
+        try:
+            segment = mmap.mmap(fd, 0)
+        except BaseException:
+            os.close(fd)
+            raise
+
+        magic, version, *_ = struct.unpack_from(HEADER_FORMAT, segment, 0)
+        if magic != SEGMENT_MAGIC or version != SEGMENT_VERSION:
+            logger.warning(f"Ignoring unrecognised sandbox segment at {segment_path}")
+            segment.close()
+            os.close(fd)
+            return None
+
+        quiesce = cls(fd, segment)
+        # Writers only read the count; snapshots (possibly in other processes)
+        # update it under the segment's flock
+        fcntl.flock(fd, fcntl.LOCK_EX)
+        try:
+            if quiesce._quiesce.value == 0:
+                # A new quiesce: writers start a new shared deadline
+                quiesce._expires.value = 0
+            quiesce._quiesce.value += 1
+        finally:
+            fcntl.flock(fd, fcntl.LOCK_UN)
+        quiesce._held = True
+
+        # Writers register before checking the flag, so once the count reads
+        # zero after the flag is visible no mutation can be in flight. The
+        # first check comes after a sleep, by which time the store is visible.
+        deadline = time.monotonic() + drain_timeout
+        while True:
+            time.sleep(0.001)
+            if quiesce._mutators.value == 0:
+                break
+            if time.monotonic() >= deadline:
+                # A writer killed mid-call never decrements; don't wait forever
+                logger.warning(
+                    f"{quiesce._mutators.value} sandboxed mutation(s) still in "
+                    f"flight after {drain_timeout}s, snapshotting anyway"
+                )
+                break
+        return quiesce
+
+    def release(self) -> None:
+        """Drop this count, waking paused writers if it was the last. Safe to call twice."""
+        if not self._held:
+            return
+        self._held = False
+        fcntl.flock(self._fd, fcntl.LOCK_EX)
+        try:
+            self._quiesce.value = max(self._quiesce.value - 1, 0)
+            last = self._quiesce.value == 0
+        finally:
+            fcntl.flock(self._fd, fcntl.LOCK_UN)
+        if last and _SYS_FUTEX is not None:
+            libc = ctypes.CDLL(None, use_errno=True)
+            libc.syscall(
+                _SYS_FUTEX,
+                ctypes.c_void_p(ctypes.addressof(self._quiesce)),
+                FUTEX_WAKE,
+                0x7FFFFFFF,
+                None,
+                None,
+                0,
+            )
+        # Writers also poll in short slices, so a failed wake only adds latency
+        del self._quiesce, self._mutators, self._expires
+        self._segment.close()
+        os.close(self._fd)
+
+
+class SnapshotView:
+    """A consistent set of (path, arcname) pairs to archive.
+
+    Use view.iter_paths in place of utils.iter_paths and close() the view once
+    the archive has been written.
+    """
+
+    def __init__(
+        self,
+        entries: dict[str, list[tuple[Path, str]]],
+        staging_dir: str | None,
+    ):
+        self._entries = entries
+        self._staging_dir = staging_dir
+
+    def iter_paths(
+        self,
+        root_dir: str,
+        arc_prefix: str,  # noqa: ARG002
+    ) -> Iterator[tuple[Path, str]]:
+        yield from self._entries.get(root_dir, [])
+
+    def close(self) -> None:
+        if self._staging_dir is not None:
+            shutil.rmtree(self._staging_dir, ignore_errors=True)
+
+
+def _clone_file(src: Path, dst: Path) -> None:
+    """Reflink src to dst and copy its metadata. Raises OSError if unsupported."""
+    dst.parent.mkdir(parents=True, exist_ok=True)
+    with open(src, "rb") as fsrc, open(dst, "wb") as fdst:
+        fcntl.ioctl(fdst.fileno(), FICLONE, fsrc.fileno())
+    shutil.copystat(src, dst)
+    st = src.stat()
+    try:
+        os.chown(dst, st.st_uid, st.st_gid)
+    except PermissionError:
+        pass
+
+
+# Staging directories found unable to hold reflinks of the subsystems' files
+_no_reflinks: set[str] = set()
+
+
+def _warn_live_view(reason: str) -> None:
+    logger.warning(
+        f"Snapshot archives live files ({reason}); the file list is consistent "
+        "but files written during the upload may be captured torn"
+    )
+
+
+def capture_consistent_view(
+    subsystems: list[str], iter_paths: PathIterator
+) -> SnapshotView:
+    """Capture the file list (and reflink copies) with sandboxed writers paused.
+
+    Writers are released before this returns. Falls back to an unquiesced live
+    view if the code execution server's segment is not present or quiescing is
+    disabled, and to a live view of the quiesced file list where reflinks are
+    unsupported (see the module docstring; logged as a warning every time).
+    """
+    quiesce = None
+    if settings.SNAPSHOT_QUIESCE:
+        quiesce = WriterQuiesce.acquire(
+            settings.SANDBOX_SHARED_SEGMENT, settings.SNAPSHOT_QUIESCE_DRAIN_TIMEOUT
+        )
+
+    try:
+        entries: dict[str, list[tuple[Path, str]]] = {}
+        for subsystem in subsystems:
+            root = f"/{subsystem}"
+            entries[root] = list(iter_paths(root, subsystem))
+
+        if quiesce is None:
+            return SnapshotView(entries, None)
+        if settings.SNAPSHOT_STAGING_DIR in _no_reflinks:
+            _warn_live_view("reflinks unsupported")
+            return SnapshotView(entries, None)
+
+        started = time.monotonic()
+        staging_dir = os.path.join(
+            settings.SNAPSHOT_STAGING_DIR, f"{os.getpid()}-{time.time_ns()}"
+        )
+        try:
+            staged: dict[str, list[tuple[Path, str]]] = {}
+            for root, pairs in entries.items():
+                staged[root] = []
+                for path, arcname in pairs:
+                    if path.is_symlink():
+                        staged[root].append((path, arcname))
+                        continue
+                    copy = Path(staging_dir, arcname)
+                    _clone_file(path, copy)
+                    staged[root].append((copy, arcname))
+        except OSError as e:
+            shutil.rmtree(staging_dir, ignore_errors=True)
+            if e.errno in _NO_REFLINK_ERRORS:
+                _no_reflinks.add(settings.SNAPSHOT_STAGING_DIR)
+                _warn_live_view(f"reflinks unsupported: {e.strerror or e}")
+            else:
+                _warn_live_view(f"reflink staging failed: {e}")
+            return SnapshotView(entries, None)
+
+        logger.debug(
+            f"Captured consistent view of {sum(len(v) for v in staged.values())} "
+            f"file(s) in {time.monotonic() - started:.3f}s"
+        )
+        return SnapshotView(staged, staging_dir)
+    finally:
+        if quiesce is not None:
+            quiesce.release()
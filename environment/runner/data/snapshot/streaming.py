@@ -6,16 +6,21 @@ without loading everything into memory.
 """
 
 import asyncio
-import io
-import queue
-import tarfile
+import contextlib
+import errno
+import fcntl
+import os
 import threading
-from collections.abc import Callable, Iterator
+from collections.abc import AsyncGenerator, Callable, Iterator
 from pathlib import Path
 from typing import Any, Protocol, cast
 
 from loguru import logger
 
+from runner.utils.decorators import with_retry
+
+from .archive import write_tar, write_tar_gz
+
 
 class S3ClientProtocol(Protocol):
     """Protocol for S3 client from aioboto3."""
@@ -71,27 +76,43 @@ class S3StreamUploader:
     """File-like object that streams data to S3 using multipart upload.
 
     This class implements a file-like interface that buffers data and uploads
-    it to S3 in chunks using multipart upload. It can be used with tarfile
+    it to S3 in parts using multipart upload. It can be used with tarfile
     or other libraries that expect a file-like object.
 
-    The multipart upload threshold is 5 MiB - chunks smaller than this are
-    buffered, and when the buffer exceeds the threshold, it's uploaded as a part.
+    Written buffers are kept by reference until a part is full, then joined
+    once and handed to an upload task on the event loop; up to
+    max_concurrency parts upload at once, each retried on its own, and the
+    upload is completed with the parts in order. Parts start at
+    multipart_threshold bytes and double every PARTS_PER_SIZE parts, so the
+    10,000-part limit is never reached (8 MiB parts reach 8 GB at part 1,000
+    and TBs by part 10,000). Objects smaller than one part are uploaded with a
+    single put.
+
+    write() is meant to be called from a thread other than the event loop's
+    (e.g. tarfile under asyncio.to_thread): it blocks while max_concurrency
+    parts are in flight, which bounds memory at about
+    (max_concurrency + 1) * part size however slow S3 is.
 
     Example:
         async with get_s3_client() as s3:
             uploader = S3StreamUploader(s3, "my-bucket", "my-key.tar.gz")
             async with uploader:
-                with tarfile.open(mode="w:gz", fileobj=uploader) as tf:
-                    tf.add("file.txt")
+                await asyncio.to_thread(write_tar_gz, uploader, subsystems, iter_paths)
                 # Upload completes automatically on exit
     """
 
+    # Parts uploaded at each part size before the size doubles
+    PARTS_PER_SIZE: int = 1000
+    # S3's limit on the size of a part
+    MAX_PART_SIZE: int = 5 * 1024 * 1024 * 1024
+
     def __init__(
         self,
         s3_resource: S3ServiceResourceProtocol,
         bucket: str,
         key: str,
         multipart_threshold: int = 5 * 1024 * 1024,  # 5 MiB
+        max_concurrency: int = 8,
     ):
         """Initialize the streaming uploader.
 
@@ -99,40 +120,58 @@ class S3StreamUploader:
             s3_resource: The S3 resource from aioboto3
             bucket: S3 bucket name
             key: S3 object key
-            multipart_threshold: Minimum size (bytes) before using multipart upload
+            multipart_threshold: Size of the first parts, and the size below
+                which the object is uploaded with a single put (at least 5 MiB,
+                S3's minimum part size)
+            max_concurrency: Parts uploaded (and held in memory) at once
         """
         self.s3_resource: S3ServiceResourceProtocol = s3_resource
         self.bucket: str = bucket
         self.key: str = key
         self.multipart_threshold: int = multipart_threshold
+        self.max_concurrency: int = max_concurrency
 
-        self.buffer: io.BytesIO = io.BytesIO()
         self.total_size: int = 0
+        # The object's ETag, once the upload completes
+        self.etag: str | None = None
         self.multipart_upload_id: str | None = None
         self.parts: list[dict[str, Any]] = []
         self.part_number: int = 1
+        self._buffer: list[bytes] = []
+        self._buffered: int = 0
         self._aborted: bool = False
-        self._should_stop: bool = False
-        self._flush_task: asyncio.Task[None] | None = None
+        self._error: BaseException | None = None
+        self._loop: asyncio.AbstractEventLoop | None = None
+        self._loop_thread: int | None = None
+        self._tasks: set[asyncio.Task[None]] = set()
+        self._slots: threading.Semaphore = threading.Semaphore(max_concurrency)
         self._thread_lock: threading.Lock = threading.Lock()  # For sync write()
         self._async_lock: asyncio.Lock = asyncio.Lock()  # For async operations
 
+    def _part_size(self, part_number: int) -> int:
+        """Size of part part_number (1-based)."""
+        doublings = (part_number - 1) // self.PARTS_PER_SIZE
+        return min(self.multipart_threshold << doublings, self.MAX_PART_SIZE)
+
     async def _init_multipart_upload(self) -> None:
         """Initialize multipart upload if not already started."""
-        if self.multipart_upload_id is None:
-            client = self.s3_resource.meta.client
-            response = await client.create_multipart_upload(
-                Bucket=self.bucket, Key=self.key
-            )
-            self.multipart_upload_id = response["UploadId"]
-            logger.debug(
-                f"Started multipart upload {self.multipart_upload_id} for s3://{self.bucket}/{self.key}"
-            )
+        async with self._async_lock:
+            if self.multipart_upload_id is None:
+                client = self.s3_resource.meta.client
+                response = await client.create_multipart_upload(
+                    Bucket=self.bucket, Key=self.key
+                )
+                self.multipart_upload_id = response["UploadId"]
+                logger.debug(
+                    f"Started multipart upload {self.multipart_upload_id} for s3://{self.bucket}/{self.key}"
+                )
 
-    async def _upload_part(self, data: bytes) -> dict[str, Any]:
+    @with_retry(max_retries=5, base_backoff=0.5, jitter=0.5)
+    async def _upload_part(self, part_number: int, data: bytes) -> dict[str, Any]:
         """Upload a single part and return part info.
 
         Args:
+            part_number: The part's number (1-based)
             data: The data to upload as a part
 
         Returns:
@@ -145,167 +184,172 @@ class S3StreamUploader:
         response = await client.upload_part(
             Bucket=self.bucket,
             Key=self.key,
-            PartNumber=self.part_number,
+            PartNumber=part_number,
             UploadId=self.multipart_upload_id,
             Body=data,
         )
+        return {"ETag": response["ETag"], "PartNumber": part_number}
 
-        part_info: dict[str, Any] = {
-            "ETag": response["ETag"],
-            "PartNumber": self.part_number,
-        }
-        self.part_number += 1
-        return part_info
-
-    async def _flush_buffer(self) -> None:
-        """Upload buffered data as a part if buffer is large enough.
-
-        Uses thread lock (via executor) to safely read buffer while write()
-        operations may be happening synchronously. This prevents race conditions
-        where write() modifies the buffer while flush is reading/truncating it.
-        """
-        loop = asyncio.get_event_loop()
-
-        # Acquire thread lock and read buffer in executor to avoid blocking event loop
-        def read_buffer_safely():
-            """Read buffer data with thread lock protection."""
-            with self._thread_lock:
-                buffer_size = self.buffer.tell()
-                if buffer_size >= self.multipart_threshold:
-                    _ = self.buffer.seek(0)
-                    data = self.buffer.read()
-                    _ = self.buffer.seek(0)
-                    _ = self.buffer.truncate(0)
-                    return data
-                return None
-
-        # Run buffer read in executor (doesn't block event loop)
-        data = await loop.run_in_executor(None, read_buffer_safely)
-
-        if data:
-            # Protect upload operations with async lock
-            async with self._async_lock:
-                part_info = await self._upload_part(data)
-                self.parts.append(part_info)
+    async def _run_part(self, part_number: int, data: bytes, slot: bool) -> None:
+        """Upload a part, recording it (or the error) and freeing its slot."""
+        try:
+            part_info = await self._upload_part(part_number, data)
+            self.parts.append(part_info)
             logger.debug(
-                f"Uploaded part {part_info['PartNumber']} ({len(data)} bytes) for s3://{self.bucket}/{self.key}"
+                f"Uploaded part {part_number} ({len(data)} bytes) for s3://{self.bucket}/{self.key}"
             )
+        except BaseException as e:
+            if self._error is None:
+                self._error = e
+            if not isinstance(e, asyncio.CancelledError):
+                logger.error(
+                    f"Failed to upload part {part_number} for s3://{self.bucket}/{self.key}: {repr(e)}"
+                )
+        finally:
+            if slot:
+                self._slots.release()
 
-    async def _background_flush_loop(self) -> None:
-        """Background task that periodically checks buffer size and flushes.
+    def _start_part(self, part_number: int, data: bytes, slot: bool) -> None:
+        """Start uploading a part (on the event loop)."""
+        task = asyncio.create_task(self._run_part(part_number, data, slot))
+        self._tasks.add(task)
+        task.add_done_callback(self._tasks.discard)
 
-        This task runs concurrently with tarfile writes, checking every 100ms
-        if the buffer has exceeded the multipart threshold and needs to be flushed.
-        This enables true streaming uploads without accumulating all data in memory.
+    def _check(self) -> None:
+        if self._aborted:
+            raise ValueError("I/O operation on aborted upload")
+        if self._error is not None:
+            raise RuntimeError(
+                f"Upload to s3://{self.bucket}/{self.key} failed"
+            ) from self._error
+
+    def _hand_off(self, part_number: int, data: bytes) -> None:
+        """Start uploading data as part part_number.
+
+        From another thread, waits for one of the max_concurrency slots first;
+        on the event loop itself it can't wait (that would stop the uploads
+        that free slots), so the part starts right away.
         """
-        while not self._should_stop:
-            try:
-                await self._flush_buffer()
-                # Check every 100ms
-                await asyncio.sleep(0.1)
-            except Exception as e:
-                # Log errors but don't stop the loop unless we're shutting down
-                # The error will be caught when we try to complete the upload
-                logger.error(
-                    f"Error in background flush loop for s3://{self.bucket}/{self.key}: {e}"
-                )
-                if self._should_stop:
-                    break
-                # Continue running even if flush fails (will retry on next iteration)
-                await asyncio.sleep(0.1)
+        if self._loop is None or self._loop_thread is None:
+            raise RuntimeError(
+                "S3StreamUploader must be used as an async context manager"
+            )
+        if self._loop_thread == threading.get_ident():
+            self._start_part(part_number, data, False)
+            return
+        while not self._slots.acquire(timeout=1.0):
+            self._check()
+        try:
+            self._check()
+        except BaseException:
+            self._slots.release()
+            raise
+        self._loop.call_soon_threadsafe(self._start_part, part_number, data, True)
 
     def write(self, data: bytes) -> int:
-        """Write data to the buffer (synchronous, called by tarfile).
+        """Write data (synchronous, called by tarfile).
 
-        This method is called synchronously by tarfile during compression.
-        Uses threading.Lock to protect buffer operations from concurrent
-        access by the background flush task.
+        Buffers data until a part is full, then hands the part to an upload
+        task; blocks while max_concurrency parts are in flight.
 
         Args:
             data: Bytes to write
 
         Returns:
             Number of bytes written
+
+        Raises:
+            RuntimeError: If uploading a part failed
         """
+        self._check()
+        if not isinstance(data, bytes):
+            data = bytes(data)  # The caller may reuse its buffer
         with self._thread_lock:
-            written = self.buffer.write(data)
-            self.total_size += written
-        return written
+            if data:
+                self._buffer.append(data)
+                self._buffered += len(data)
+                self.total_size += len(data)
+            if self._buffered < self._part_size(self.part_number):
+                return len(data)
+            part = b"".join(self._buffer)
+            self._buffer.clear()
+            self._buffered = 0
+            part_number = self.part_number
+            self.part_number += 1
+        self._hand_off(part_number, part)
+        return len(data)
 
     async def flush(self) -> None:
-        """Flush buffered data to S3."""
-        await self._flush_buffer()
+        """Wait for the parts in flight to finish uploading.
+
+        Data short of a full part stays buffered: parts other than the last
+        must be at least 5 MiB.
+
+        Raises:
+            RuntimeError: If uploading a part failed
+        """
+        while self._tasks:
+            await asyncio.gather(*self._tasks, return_exceptions=True)
+        self._check()
 
     async def close(self) -> None:
         """Close the uploader and complete the multipart upload."""
         if self._aborted:
             return
 
-        # Stop the background flush task
-        self._should_stop = True
-        if self._flush_task is not None:
-            try:
-                await asyncio.wait_for(self._flush_task, timeout=5.0)
-            except TimeoutError:
-                logger.warning(
-                    f"Background flush task did not stop cleanly for s3://{self.bucket}/{self.key}"
-                )
-                self._flush_task.cancel()
-            except Exception as e:
-                logger.warning(
-                    f"Error stopping background flush task for s3://{self.bucket}/{self.key}: {e}"
-                )
-
-        # Upload any remaining buffered data
-        await self._flush_buffer()
-
-        # Get remaining data with thread lock protection
-        loop = asyncio.get_event_loop()
+        await self.flush()
 
-        def read_remaining():
-            """Read remaining buffer data with thread lock."""
-            with self._thread_lock:
-                buffer_size = self.buffer.tell()
-                if buffer_size > 0:
-                    _ = self.buffer.seek(0)
-                    return self.buffer.read()
-                return None
-
-        remaining_data = await loop.run_in_executor(None, read_remaining)
+        with self._thread_lock:
+            remaining_data = b"".join(self._buffer)
+            self._buffer.clear()
+            self._buffered = 0
 
-        if remaining_data:
-            if self.multipart_upload_id:
-                # Upload as final part
-                part_info = await self._upload_part(remaining_data)
-                self.parts.append(part_info)
-            else:
-                # Small file, use simple upload
+        if self.part_number == 1:
+            # Nothing handed off yet: a single put is enough
+            if remaining_data:
                 try:
                     bucket_res = await self.s3_resource.Bucket(self.bucket)
                     obj = await bucket_res.Object(self.key)
-                    _ = await obj.put(Body=remaining_data)
+                    response = await obj.put(Body=remaining_data)
+                    self.etag = response.get("ETag")
                 except Exception as e:
                     logger.error(
                         f"Failed to upload small file to s3://{self.bucket}/{self.key}: {e}"
                     )
                     raise
+            return
 
-        # Complete multipart upload if we started one
-        if self.multipart_upload_id and self.parts:
-            client = self.s3_resource.meta.client
-            _ = await client.complete_multipart_upload(
-                Bucket=self.bucket,
-                Key=self.key,
-                UploadId=self.multipart_upload_id,
-                MultipartUpload=cast(Any, {"Parts": self.parts}),
-            )
-            logger.debug(
-                f"Completed multipart upload {self.multipart_upload_id} for s3://{self.bucket}/{self.key} ({len(self.parts)} parts)"
-            )
+        if remaining_data:
+            # Upload as final part
+            await self._run_part(self.part_number, remaining_data, False)
+            self.part_number += 1
+            self._check()
+
+        # Complete multipart upload, parts in order
+        assert self.multipart_upload_id is not None
+        self.parts.sort(key=lambda part: part["PartNumber"])
+        client = self.s3_resource.meta.client
+        response = await client.complete_multipart_upload(
+            Bucket=self.bucket,
+            Key=self.key,
+            UploadId=self.multipart_upload_id,
+            MultipartUpload=cast(Any, {"Parts": self.parts}),
+        )
+        self.etag = response.get("ETag")
+        logger.debug(
+            f"Completed multipart upload {self.multipart_upload_id} for s3://{self.bucket}/{self.key} ({len(self.parts)} parts)"
+        )
 
     async def abort(self) -> None:
         """Abort the multipart upload if one was started."""
-        if self.multipart_upload_id and not self._aborted:
+        if self._aborted:
+            return
+        self._aborted = True
+        for task in list(self._tasks):
+            task.cancel()
+        if self._tasks:
+            await asyncio.gather(*self._tasks, return_exceptions=True)
+        if self.multipart_upload_id:
             try:
                 client = self.s3_resource.meta.client
                 await client.abort_multipart_upload(
@@ -320,8 +364,6 @@ class S3StreamUploader:
                 logger.warning(
                     f"Failed to abort multipart upload {self.multipart_upload_id} for s3://{self.bucket}/{self.key}: {e}"
                 )
-            finally:
-                self._aborted = True
 
     def tell(self) -> int:
         """Return current position (total bytes written)."""
@@ -341,11 +383,11 @@ class S3StreamUploader:
     async def __aenter__(self) -> "S3StreamUploader":
         """Async context manager entry.
 
-        Starts the background flush task that periodically checks buffer size
-        and uploads parts to S3, enabling true streaming uploads.
+        Binds the uploader to the running event loop, which part uploads
+        handed off by write() run on.
         """
-        self._should_stop = False
-        self._flush_task = asyncio.create_task(self._background_flush_loop())
+        self._loop = asyncio.get_running_loop()
+        self._loop_thread = threading.get_ident()
         return self
 
     async def __aexit__(
@@ -356,101 +398,113 @@ class S3StreamUploader:
     ) -> None:
         """Async context manager exit - handles cleanup and error cases.
 
-        Stops the background flush task and either aborts (on error) or
-        completes (on success) the multipart upload.
+        Either aborts (on error) or completes (on success) the multipart
+        upload; a failed completion aborts it too.
         """
         if exc_type is not None:
             # Error occurred, abort multipart upload
-            self._should_stop = True
-            if self._flush_task is not None:
-                self._flush_task.cancel()
-                try:
-                    await self._flush_task
-                except asyncio.CancelledError:
-                    pass
-                except Exception as e:
-                    logger.warning(f"Error cancelling background flush task: {e}")
             await self.abort()
-        else:
+            return
+        try:
             # Success, complete the upload
             await self.close()
+        except BaseException:
+            await self.abort()
+            raise
 
 
-class StreamingTarFile:
-    """File-like object that streams chunks via a queue for memory-efficient streaming.
+def _wake(future: asyncio.Future[None]) -> None:
+    if not future.done():
+        future.set_result(None)
 
-    This allows streaming tar.gz data as it's being created without buffering
-    everything in memory. Uses a queue to enable producer-consumer pattern where
-    tarfile writes chunks to the queue and a generator yields them immediately.
 
-    This is memory-safe for TB-scale files as chunks are yielded as soon as
-    they're written, rather than accumulating in memory.
-    """
+class PipeStream:
+    """Write-only file object whose output is read from a pipe on the event loop.
 
-    # Timeout for periodic closed flag checks (in seconds)
-    TIMEOUT_SECONDS: float = 0.1
+    An archive is written into the pipe on a background thread (write() and
+    splice_from() block while the pipe is full, which slows the writer to the
+    reader's pace) and chunks() reads it on the event loop, so no bytes pass
+    through a Python queue or a thread hop per chunk. splice_from() moves a
+    file's contents into the pipe inside the kernel.
 
-    def __init__(self, queue_size: int = 100) -> None:
-        """Initialize the streaming tar file.
+    Once the reader stops (e.g., the client disconnected), the next write
+    raises BrokenPipeError, which stops the writer.
+    """
 
-        Args:
-            queue_size: Maximum number of chunks to buffer in the queue.
-                Larger values use more memory but provide better throughput.
-                Default is 100 chunks.
-        """
-        self.queue: queue.Queue[bytes | None] = queue.Queue(maxsize=queue_size)
+    # Pipe capacity; the kernel caps it at /proc/sys/fs/pipe-max-size (1 MiB
+    # by default) and leaves the 64 KiB default if it can't be raised
+    PIPE_SIZE: int = 1024 * 1024
+    # Bytes spliced from a file per call
+    SPLICE_SIZE: int = 1024 * 1024
+
+    def __init__(self) -> None:
+        """Create the pipe."""
+        self._read_fd, self._write_fd = os.pipe2(os.O_CLOEXEC)
+        with contextlib.suppress(OSError):
+            fcntl.fcntl(self._write_fd, fcntl.F_SETPIPE_SZ, self.PIPE_SIZE)
+        os.set_blocking(self._read_fd, False)
         self.closed: bool = False
         self.total_size: int = 0
         self._write_error: Exception | None = None
+        self._can_splice: bool = True
 
     def write(self, data: bytes) -> int:
-        """Write data - puts it in the queue for immediate consumption.
-
-        This method is called synchronously by tarfile during compression.
-        Chunks are immediately available for yielding via the generator.
-
-        Args:
-            data: Bytes to write
-
-        Returns:
-            Number of bytes written
+        """Write all of data to the pipe, blocking while it is full.
 
         Raises:
-            ValueError: If the file is closed
-            RuntimeError: If a previous write error occurred
+            ValueError: If the writer side is closed
+            BrokenPipeError: If the reader has gone away
         """
         if self.closed:
             raise ValueError("I/O operation on closed file")
-        if self._write_error:
-            raise RuntimeError("Previous write error occurred") from self._write_error
+        self._write_all(data)
+        self.total_size += len(data)
+        return len(data)
 
-        try:
-            # Put chunk in queue - this will block if queue is full,
-            # allowing backpressure to slow down tarfile if consumer is slow
-            self.queue.put(data, block=True)
-            self.total_size += len(data)
-            return len(data)
-        except Exception as e:
-            # Store error so generator can detect it
-            self._write_error = e
-            raise
+    def _write_all(self, data: bytes) -> None:
+        view = memoryview(data)
+        while view:
+            view = view[os.write(self._write_fd, view) :]
 
-    def read(self, size: int = -1) -> bytes:  # noqa: ARG002
-        """Read is not supported (write-only)."""
-        raise NotImplementedError("Read not supported")
+    def splice_from(self, fd: int, count: int) -> int:
+        """Move up to count bytes from fd's current offset into the pipe.
 
-    def seek(self, pos: int, whence: int = 0) -> int:  # noqa: ARG002
-        """Seek is not supported."""
-        if pos == 0 and whence == 0:
-            return 0
-        raise OSError("Seek not supported")
+        Uses splice(2), so the bytes never enter this process; falls back to
+        reading and writing them where fd's filesystem can't splice.
+
+        Returns:
+            Bytes moved; fewer than count only if fd hit end of file
+        """
+        if self.closed:
+            raise ValueError("I/O operation on closed file")
+        moved = 0
+        while moved < count:
+            size = min(count - moved, self.SPLICE_SIZE)
+            if self._can_splice:
+                try:
+                    n = os.splice(fd, self._write_fd, size)
+                except OSError as e:
+                    if e.errno not in (errno.EINVAL, errno.ENOSYS):
+                        raise
+                    logger.debug(f"splice unavailable ({e}); copying file bodies")
+                    self._can_splice = False
+                    continue
+            else:
+                data = os.read(fd, size)
+                self._write_all(data)
+                n = len(data)
+            if n == 0:
+                break
+            moved += n
+        self.total_size += moved
+        return moved
 
     def tell(self) -> int:
         """Return total bytes written."""
         return self.total_size
 
     def set_error(self, error: Exception) -> None:
-        """Set an error that occurred during writing.
+        """Record an error that stopped the writer, for the reader to raise.
 
         Args:
             error: The exception that occurred
@@ -458,131 +512,117 @@ class StreamingTarFile:
         self._write_error = error
 
     def close(self) -> None:
-        """Mark as closed and signal end of data with None sentinel.
-
-        If the queue is full and the sentinel cannot be added immediately,
-        the iterator will detect closure via periodic timeout checks.
-        """
+        """Close the writer side; the reader sees end of data once it drains."""
         if not self.closed:
             self.closed = True
-            # Put None sentinel to signal end of stream
-            try:
-                self.queue.put(None, block=False)
-            except queue.Full:
-                # Queue is full - iterator will detect closed flag via timeout check
-                logger.debug(
-                    "Queue full when closing, iterator will detect closure via timeout check"
-                )
-                pass
+            os.close(self._write_fd)
 
-    def __iter__(self) -> Iterator[bytes]:
-        """Iterate over chunks as they're written to the queue.
+    def close_reader(self) -> None:
+        """Close the reader side; the writer's next write raises BrokenPipeError."""
+        if self._read_fd >= 0:
+            os.close(self._read_fd)
+            self._read_fd = -1
 
-        This generator yields chunks immediately as they're written by tarfile,
-        enabling true streaming without accumulating all data in memory.
+    async def chunks(self) -> AsyncGenerator[bytes]:
+        """Yield what is written, as it is written, until the writer closes.
 
-        Uses timeout-based checks to detect closure even when the queue is full
-        and the sentinel cannot be added, preventing deadlocks.
-
-        Yields:
-            Bytes chunks of the tar.gz archive
+        Closes the reader side when done or abandoned.
 
         Raises:
-            RuntimeError: If a write error occurred during tarfile creation
+            RuntimeError: If the writer recorded an error (see set_error)
         """
-        while True:
-            try:
-                # Use timeout to periodically check closed flag
-                # This prevents deadlock when queue is full and sentinel can't be added
-                chunk = self.queue.get(block=True, timeout=self.TIMEOUT_SECONDS)
-                if chunk is None:
-                    # None sentinel indicates end of stream
+        loop = asyncio.get_running_loop()
+        try:
+            while True:
+                try:
+                    chunk = os.read(self._read_fd, self.PIPE_SIZE)
+                except BlockingIOError:
+                    readable = loop.create_future()
+                    loop.add_reader(self._read_fd, _wake, readable)
+                    try:
+                        await readable
+                    finally:
+                        loop.remove_reader(self._read_fd)
+                    continue
+                if not chunk:
                     break
                 yield chunk
-            except queue.Empty:
-                # Timeout occurred - check if stream is closed
-                if self.closed:
-                    # Stream closed - check if queue has remaining data
-                    # Use non-blocking get to avoid another timeout
-                    try:
-                        chunk = self.queue.get_nowait()
-                        if chunk is None:
-                            break
-                        yield chunk
-                        # Continue loop to get more chunks
-                        continue
-                    except queue.Empty:
-                        # Queue is empty and closed - we're done
-                        break
-                # Not closed, continue waiting
-                continue
-            except Exception:
-                # Check if write error occurred
-                if self._write_error:
-                    raise RuntimeError(
-                        "Error during tarfile creation"
-                    ) from self._write_error
-                raise
-
-        # Verify no write errors occurred
+        finally:
+            self.close_reader()
+
         if self._write_error:
-            raise RuntimeError("Error during tarfile creation") from self._write_error
+            raise RuntimeError("Error during archive creation") from self._write_error
 
 
-def create_tar_gz_stream(
-    subsystems: list[str],
-    snapshot_id: str,
-    iter_paths_func: Callable[[str, str], Iterator[tuple[Path, str]]],
-) -> Iterator[bytes]:
-    """Create a tar.gz archive and yield chunks as bytes.
+async def stream_from_thread(
+    write: Callable[[PipeStream], None], description: str
+) -> AsyncGenerator[bytes]:
+    """Run write(pipe) on a background thread and yield what it writes.
 
-    This generator runs tarfile compression in a background thread and yields
-    chunks directly as they're produced, enabling true streaming without
-    buffering everything in memory.
+    If the consumer stops early, the writer is stopped (its next write fails)
+    and waited for, so nothing it reads is released from under it.
 
     Args:
-        subsystems: List of subsystem names to include in archive
-        snapshot_id: Snapshot ID for logging
-        iter_paths_func: Function to iterate over file paths for a subsystem
+        write: Writes the whole output to the PipeStream it is given
+        description: What is written, for log messages
 
     Yields:
-        Bytes chunks of the tar.gz archive
-
-    Raises:
-        RuntimeError: If tarfile creation fails
+        Bytes chunks of the output
     """
-    stream_file = StreamingTarFile()
+    pipe = PipeStream()
 
-    # Run tarfile compression in a background thread
-    # This allows chunks to be yielded immediately as they're produced
-    def create_archive():
-        """Create tar.gz archive, writing chunks to stream_file."""
+    def run() -> None:
         try:
-            with tarfile.open(mode="w:gz", fileobj=stream_file) as tf:
-                for subsystem in subsystems:
-                    subsystem_path = f"/{subsystem}"
-                    logger.debug(
-                        f"Adding subsystem '{subsystem}' from {subsystem_path} to archive"
-                    )
-                    file_count = 0
-                    for path, arcname in iter_paths_func(subsystem_path, subsystem):
-                        tf.add(path, arcname=arcname, recursive=False)
-                        file_count += 1
-                    logger.debug(
-                        f"Added {file_count} file(s) from subsystem '{subsystem}'"
-                    )
+            write(pipe)
+        except BrokenPipeError:
+            logger.debug(f"Stopped writing {description}: reader went away")
         except Exception as e:
-            stream_file.set_error(e)
-            logger.error(
-                f"Error creating tar archive for snapshot {snapshot_id}: {repr(e)}"
-            )
+            pipe.set_error(e)
+            logger.error(f"Error writing {description}: {repr(e)}")
         finally:
-            stream_file.close()
+            pipe.close()
+
+    thread = threading.Thread(target=run, daemon=True)
+    thread.start()
+    try:
+        async for chunk in pipe.chunks():
+            yield chunk
+    finally:
+        # A writer blocked on the full pipe fails as soon as the reader closes
+        pipe.close_reader()
+        await asyncio.to_thread(thread.join)
+
+
+STREAM_FORMATS = ("tar.gz", "tar")
+
+
+def create_archive_stream(
+    subsystems: list[str],
+    snapshot_id: str,
+    iter_paths_func: Callable[[str, str], Iterator[tuple[Path, str]]],
+    fmt: str = "tar.gz",
+) -> AsyncGenerator[bytes]:
+    """Create a tar.gz or tar archive and yield chunks as bytes.
 
-    # Start tarfile compression in background thread
-    archive_thread = threading.Thread(target=create_archive, daemon=True)
-    archive_thread.start()
+    The archive is written on a background thread into a pipe that is read
+    on the event loop (see PipeStream); chunks are yielded as soon as they
+    are written, without buffering the archive. In tar format file bodies
+    are spliced into the pipe rather than read.
+
+    Args:
+        subsystems: List of subsystem names to include in archive
+        snapshot_id: Snapshot ID for logging
+        iter_paths_func: Function to iterate over file paths for a subsystem
+        fmt: 'tar.gz' or 'tar'
 
-    # Yield chunks as they're written to the queue
-    # The generator blocks waiting for chunks, enabling true streaming
-    yield from stream_file
+    Returns:
+        Async generator of bytes chunks of the archive, which raises
+        RuntimeError if the archive can't be created
+    """
+    if fmt not in STREAM_FORMATS:
+        raise ValueError(f"Unsupported archive format: {fmt}")
+    write = write_tar_gz if fmt == "tar.gz" else write_tar
+    return stream_from_thread(
+        lambda pipe: write(pipe, subsystems, iter_paths_func),
+        f"{fmt} archive for snapshot {snapshot_id}",
+    )
@@ -1,5 +1,7 @@
 """Utility functions for snapshotting subsystems to S3."""
 
+import ctypes
+import os
 from contextlib import asynccontextmanager
 from pathlib import Path
 
@@ -40,6 +42,35 @@ def iter_paths(root_dir: str, arc_prefix: str):
             yield path, arcname
 
 
+def sync_subsystems(subsystems: list[str]) -> None:
+    """Flush dirty pages of each subsystem's filesystem before archiving.
+
+    Sandboxed code may run with relaxed durability (fsync and friends are
+    no-ops under ephemeral roots), so the snapshot is the single durability
+    barrier: one syncfs() per subsystem root instead of one fsync per write.
+    Falls back to a global sync() where syncfs is unavailable.
+
+    Args:
+        subsystems: Subsystem names (e.g., ['filesystem', '.apps_data'])
+    """
+    libc = ctypes.CDLL(None, use_errno=True)
+    syncfs = getattr(libc, "syncfs", None)
+    for subsystem in subsystems:
+        root = f"/{subsystem}"
+        if not os.path.isdir(root):
+            continue
+        if syncfs is None:
+            os.sync()
+            return
+        fd = os.open(root, os.O_RDONLY | os.O_DIRECTORY)
+        try:
+            if syncfs(fd) != 0:
+                err = ctypes.get_errno()
+                logger.warning(f"syncfs({root}) failed: {os.strerror(err)}")
+        finally:
+            os.close(fd)
+
+
 @asynccontextmanager
 async def s3_stream_uploader(object_key: str):
     """Create a streaming uploader context manager for S3 multipart upload.
@@ -63,7 +94,13 @@ async def s3_stream_uploader(object_key: str):
     key += object_key
 
     async with get_s3_client() as s3:
-        uploader = S3StreamUploader(s3, bucket, key)
+        uploader = S3StreamUploader(
+            s3,
+            bucket,
+            key,
+            multipart_threshold=settings.SNAPSHOT_UPLOAD_PART_SIZE,
+            max_concurrency=settings.SNAPSHOT_UPLOAD_CONCURRENCY,
+        )
         async with uploader:
             yield uploader
 
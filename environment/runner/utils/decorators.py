@@ -1,6 +1,7 @@
 import asyncio
 import functools
 import random
+from collections.abc import Callable
 
 from loguru import logger
 
@@ -11,6 +12,7 @@ def with_retry(
     jitter: float = 1.0,
     retry_on: tuple[type[Exception], ...] | None = None,
     skip_on: tuple[type[Exception], ...] | None = None,
+    retry_if: Callable[[Exception], bool] | None = None,
 ):
     """
     This decorator is used to retry a function if it fails.
@@ -22,6 +24,7 @@ def with_retry(
         jitter: Random jitter to add to backoff time
         retry_on: Tuple of exception types to retry on. If None, retries on all exceptions.
         skip_on: Tuple of exception types to never retry on, even if they match retry_on.
+        retry_if: Predicate an exception must also satisfy to be retried.
     """
 
     def decorator(func):
@@ -38,6 +41,9 @@ def with_retry(
                     if retry_on is not None and not isinstance(e, retry_on):
                         raise
 
+                    if retry_if is not None and not retry_if(e):
+                        raise
+
                     is_last_attempt = attempt >= max_retries
                     if is_last_attempt:
                         logger.error(
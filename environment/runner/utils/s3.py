@@ -19,7 +19,9 @@ settings = get_settings()
 
 
 @asynccontextmanager
-async def get_s3_client() -> AsyncGenerator[S3ServiceResource, Any]:
+async def get_s3_client(
+    max_pool_connections: int | None = None,
+) -> AsyncGenerator[S3ServiceResource, Any]:
     """Get an async S3 resource client for interacting with S3.
 
     Creates an async S3 resource client using credentials from settings.
@@ -27,7 +29,12 @@ async def get_s3_client() -> AsyncGenerator[S3ServiceResource, Any]:
     otherwise falls back to default AWS credential chain (IAM roles, etc.).
 
     The client is configured with S3v4 signature version and uses the
-    region specified in S3_DEFAULT_REGION setting.
+    region specified in S3_DEFAULT_REGION setting, and S3_ENDPOINT_URL when
+    it is set.
+
+    Args:
+        max_pool_connections: HTTP connections the client may hold open at
+            once (aiobotocore's default of 10 if not given)
 
     Example usage:
         async with get_s3_client() as s3:
@@ -47,8 +54,14 @@ async def get_s3_client() -> AsyncGenerator[S3ServiceResource, Any]:
     else:
         session = aioboto3.Session()
 
-    config = AioConfig(signature_version="s3v4")
+    config_options: dict[str, Any] = {"signature_version": "s3v4"}
+    if max_pool_connections is not None:
+        config_options["max_pool_connections"] = max_pool_connections
+    config = AioConfig(**config_options)
     async with session.resource(
-        "s3", config=config, region_name=settings.S3_DEFAULT_REGION
+        "s3",
+        config=config,
+        region_name=settings.S3_DEFAULT_REGION,
+        endpoint_url=settings.S3_ENDPOINT_URL,
     ) as s3:
         yield s3
@@ -43,6 +43,9 @@ class Settings(BaseSettings):
     S3_DEFAULT_REGION: str = "us-west-2"
     """Default AWS region for S3 operations (e.g., 'us-west-2')."""
 
+    S3_ENDPOINT_URL: str | None = None
+    """Endpoint of an S3-compatible API (e.g., MinIO). If not set, uses AWS S3."""
+
     # S3 Credentials (for S3-compatible API access)
     S3_ACCESS_KEY_ID: str | None = None
     """AWS access key ID for S3 authentication. If not set, uses default credential chain."""
@@ -60,6 +63,69 @@ class Settings(BaseSettings):
     APPS_DATA_SUBSYSTEM_NAME: str = ".apps_data"
     """Name of the apps data subsystem root directory."""
 
+    # Populate
+    POPULATE_WRITE_THREADS: int = 8
+    """Threads writing file bodies extracted from uploaded archives."""
+
+    POPULATE_MAX_CONNECTIONS: int = 64
+    """S3 GET requests in flight at once, across all S3 populates."""
+
+    POPULATE_MAX_BANDWIDTH: int = 0
+    """Bytes per second downloaded across all S3 populates. 0 means unlimited."""
+
+    POPULATE_RANGED_THRESHOLD: int = 64 * 1024 * 1024
+    """Objects at least this large are downloaded with concurrent ranged GETs."""
+
+    POPULATE_RANGE_SIZE: int = 16 * 1024 * 1024
+    """Bytes per ranged GET."""
+
+    POPULATE_RANGE_CONCURRENCY: int = 8
+    """Ranged GETs in flight at once per object."""
+
+    POPULATE_CACHE_DIR: str = ""
+    """Host directory (e.g., a volume shared by episodes) caching S3 objects for populate. If empty, nothing is cached."""
+
+    POPULATE_CACHE_SIZE: int = 50 * 1024**3
+    """Bytes the populate cache keeps; least recently used objects are evicted beyond it."""
+
+    # Snapshot consistency
+    SNAPSHOT_QUIESCE: bool = True
+    """Pause sandboxed writers while a snapshot captures its file list."""
+
+    SANDBOX_SHARED_SEGMENT: str = "/dev/shm/sandbox_fs.seg"
+    """Shared segment created by the code execution server's sandbox."""
+
+    SNAPSHOT_QUIESCE_DRAIN_TIMEOUT: float = 2.0
+    """Seconds to wait for in-flight sandboxed mutations before capturing anyway."""
+
+    SNAPSHOT_STAGING_DIR: str = "/.snapshot_staging"
+    """Where reflink copies are staged. Must share a filesystem with the subsystems."""
+
+    # Snapshot archive writing
+    SNAPSHOT_COMPRESSION_LEVEL: int = 6
+    """gzip level (1-9) for tar.gz snapshots."""
+
+    SNAPSHOT_COMPRESSION_THREADS: int = 0
+    """Threads compressing tar.gz snapshots. 0 means one per CPU."""
+
+    SNAPSHOT_READ_THREADS: int = 8
+    """Threads reading files ahead of the snapshot archiver."""
+
+    SNAPSHOT_UPLOAD_PART_SIZE: int = 8 * 1024 * 1024
+    """Bytes per part of a tar.gz snapshot upload (min 5 MiB); doubles every 1,000 parts."""
+
+    SNAPSHOT_UPLOAD_CONCURRENCY: int = 8
+    """Parts of a tar.gz snapshot uploaded at once (each held in memory)."""
+
+    SNAPSHOT_FILES_CONCURRENCY: int = 20
+    """Files of a files snapshot uploaded (or copied inside S3) at once."""
+
+    SNAPSHOT_FILES_MAX_INFLIGHT: int = 256 * 1024 * 1024
+    """Bytes all files snapshot uploads hold in memory at once."""
+
+    SNAPSHOT_CHUNK_STORE: str = ""
+    """Local directory for chunked snapshots. If empty, S3_SNAPSHOTS_BUCKET is used."""
+
 
 @cache
 def get_settings() -> Settings:
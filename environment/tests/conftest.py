@@ -70,6 +70,7 @@ def environment_container(environment_image: DockerImage) -> Generator[DockerCon
         .with_env("S3_SECRET_ACCESS_KEY", "test")
         .with_env("S3_REGION", "us-west-2")
         .with_env("S3_SNAPSHOTS_BUCKET", "test")
+        .with_env("SNAPSHOT_CHUNK_STORE", "/tmp/snapshot-chunks")
         .with_env("RLS_GITHUB_READ_TOKEN", os.environ.get("RLS_GITHUB_READ_TOKEN", ""))
     ) as container:
         # Get base URL from container
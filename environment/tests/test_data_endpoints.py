@@ -5,7 +5,9 @@ Verifies the /data/* endpoints for populating and snapshotting subsystems.
 
 import gzip
 import io
+import os
 import tarfile
+import zipfile
 
 import httpx
 import pytest
@@ -58,6 +60,23 @@ class TestPopulateEndpoints:
         assert "objects_added" in data, f"Expected objects_added in response: {data}"
         assert data["objects_added"] >= 1, f"Expected at least 1 object added: {data}"
 
+    @pytest.mark.asyncio
+    async def test_populate_rejects_path_traversal(self, base_url: str) -> None:
+        """Test that archive members outside the subsystem are not extracted."""
+        archive = _create_test_tar_gz({"../populate_escape.txt": b"escaped"})
+
+        async with httpx.AsyncClient() as client:
+            response = await client.post(
+                f"{base_url}/data/populate",
+                params={"subsystem": "filesystem"},
+                files={"archive": ("test.tar.gz", archive, "application/gzip")},
+                timeout=60,
+            )
+
+        assert response.status_code >= 400, (
+            f"Expected traversal to be rejected, got {response.status_code}"
+        )
+
     @pytest.mark.asyncio
     async def test_populate_endpoint_validation_error(self, base_url: str) -> None:
         """Test that /data/populate returns validation error without file."""
@@ -133,6 +152,42 @@ class TestSnapshotEndpoints:
             members = tar.getnames()
             assert isinstance(members, list), "Should return list of members"
 
+    @pytest.mark.asyncio
+    async def test_snapshot_endpoint_returns_tar(self, base_url: str) -> None:
+        """Test that /data/snapshot with format 'tar' returns an uncompressed tar."""
+        test_files = {"tar_format_test.txt": b"Uncompressed snapshot test file"}
+        async with httpx.AsyncClient() as client:
+            populate_response = await client.post(
+                f"{base_url}/data/populate",
+                params={"subsystem": "filesystem"},
+                files={
+                    "archive": (
+                        "test.tar.gz",
+                        _create_test_tar_gz(test_files),
+                        "application/gzip",
+                    )
+                },
+                timeout=60,
+            )
+            assert populate_response.status_code == 200, populate_response.text
+
+            response = await client.post(
+                f"{base_url}/data/snapshot",
+                json={"format": "tar"},
+                timeout=60,
+            )
+
+        assert response.status_code == 200, (
+            f"Expected 200, got {response.status_code}: {response.text}"
+        )
+        assert "x-tar" in response.headers.get("content-type", "")
+        assert '.tar"' in response.headers.get("content-disposition", "")
+
+        with tarfile.open(fileobj=io.BytesIO(response.content), mode="r:") as tar:
+            member = tar.extractfile("filesystem/tar_format_test.txt")
+            assert member is not None
+            assert member.read() == test_files["tar_format_test.txt"]
+
     @pytest.mark.asyncio
     async def test_snapshot_s3_endpoint_exists(self, base_url: str) -> None:
         """Test that /data/snapshot/s3 endpoint exists.
@@ -206,3 +261,76 @@ class TestPopulateSnapshotRoundtrip:
             assert found_nested, (
                 f"nested_file.txt not found in snapshot. Members: {member_names}"
             )
+
+
+class TestChunkedSnapshotRoundtrip:
+    """Chunked snapshots: dedup across snapshots and rebuilt archives."""
+
+    @pytest.mark.asyncio
+    async def test_chunked_snapshot_dedups_and_rebuilds(self, base_url: str) -> None:
+        """Test that a repeated chunked snapshot uploads nothing new and downloads."""
+        big = os.urandom(3 * 1024 * 1024)
+        test_files = {
+            "chunked_test/big.bin": big,
+            "chunked_test/small.txt": b"Chunked snapshot test file",
+        }
+        archive = _create_test_tar_gz(test_files)
+
+        async with httpx.AsyncClient() as client:
+            populate_response = await client.post(
+                f"{base_url}/data/populate",
+                params={"subsystem": "filesystem"},
+                files={"archive": ("test.tar.gz", archive, "application/gzip")},
+                timeout=60,
+            )
+            assert populate_response.status_code == 200, (
+                f"Populate failed: {populate_response.text}"
+            )
+
+            results = []
+            for _ in range(2):
+                response = await client.post(
+                    f"{base_url}/data/snapshot/s3",
+                    json={"format": "chunks"},
+                    timeout=120,
+                )
+                assert response.status_code == 200, (
+                    f"Chunked snapshot failed: {response.text}"
+                )
+                results.append(response.json())
+
+            first, second = results
+            assert first["total_bytes"] >= len(big)
+            # Nothing changed in between, so every chunk was already stored
+            assert second["new_chunks"] == 0, f"Expected no new chunks: {second}"
+            assert second["dedup_ratio"] == 1.0
+
+            tar_response = await client.get(
+                f"{base_url}/data/snapshot/chunks/{second['snapshot_id']}",
+                params={"format": "tar.gz"},
+                timeout=120,
+            )
+            zip_response = await client.get(
+                f"{base_url}/data/snapshot/chunks/{second['snapshot_id']}",
+                params={"format": "zip"},
+                timeout=120,
+            )
+            missing_response = await client.get(
+                f"{base_url}/data/snapshot/chunks/snap_0", timeout=30
+            )
+
+        assert tar_response.status_code == 200, tar_response.text
+        with tarfile.open(fileobj=io.BytesIO(tar_response.content), mode="r:gz") as tar:
+            member = tar.extractfile("filesystem/chunked_test/big.bin")
+            assert member is not None
+            assert member.read() == big
+
+        assert zip_response.status_code == 200, zip_response.text
+        with zipfile.ZipFile(io.BytesIO(zip_response.content)) as zf:
+            assert zf.read("filesystem/chunked_test/big.bin") == big
+            assert (
+                zf.read("filesystem/chunked_test/small.txt")
+                == test_files["chunked_test/small.txt"]
+            )
+
+        assert missing_response.status_code == 404, missing_response.text
@@ -45,6 +45,7 @@ from .constants import (
     FileExtractionStrategy,
 )
 from .match_utils import match_sub_artifacts_by_content
+from .tree_diff import MemberReader, classify_change
 from .types import Artifact, ArtifactChange, ChangeType, SnapshotDiff
 
 
@@ -54,7 +55,8 @@ class SnapshotDiffGenerator:
 
     This class handles the complete process of comparing two snapshots:
     1. Lists all files in both snapshots
-    2. Categorizes changes as created, deleted, modified, or unchanged
+    2. Categorizes changes as created, deleted, modified, or unchanged from the
+       zips' central directories (size and CRC-32, see tree_diff.py)
     3. Generates text diffs for supported file types
     4. Provides comprehensive metadata about all changes
 
@@ -86,6 +88,9 @@ class SnapshotDiffGenerator:
         # Initialize file extraction service
         self._extraction_service = FileExtractionService()
 
+        # Members of changed files, decompressed ahead of extraction
+        self._members = MemberReader()
+
         # Initialize rate limiting semaphore if not already done
         if SnapshotDiffGenerator._reducto_semaphore is None:
             max_concurrent = int(os.getenv("REDUCTO_MAX_CONCURRENT", "10"))
@@ -187,7 +192,7 @@ class SnapshotDiffGenerator:
                 return None
 
             # Read image bytes from zip
-            image_bytes = zip_file.read(zip_path)
+            image_bytes = self._members.read(zip_file, zip_path)
 
             # Validate that the bytes are actually an image
             if not self._is_valid_image_bytes(image_bytes, path):
@@ -303,111 +308,46 @@ class SnapshotDiffGenerator:
             # Get all unique file paths
             all_paths = set(original_file_map.keys()) | set(final_file_map.keys())
 
+            # Classify every path from the zips' central directories (size and
+            # CRC-32), without decompressing anything
+            change_types = {
+                path: classify_change(
+                    original_file_map.get(path), final_file_map.get(path)
+                )
+                for path in all_paths
+            }
+
             # Process file changes with parallelization
+            semaphore = asyncio.Semaphore(MAX_CONCURRENT_FILE_OPERATIONS)
+
             async def process_file_change(path: str) -> ArtifactChange:
                 """Process a single file change"""
                 original_file = original_file_map.get(path)
                 final_file = final_file_map.get(path)
+                change_type = change_types[path]
 
-                if original_file is None and final_file is not None:
-                    return await self._create_artifact_change(
-                        path,
-                        ChangeType.CREATED,
-                        None,
-                        final_file,
-                    )
-                elif final_file is None and original_file is not None:
+                if change_type == ChangeType.UNCHANGED:
+                    # Nothing to read or extract
                     return await self._create_artifact_change(
-                        path,
-                        ChangeType.DELETED,
-                        original_file,
-                        None,
+                        path, change_type, original_file, final_file
                     )
-                elif original_file is not None and final_file is not None:
-                    # Check if files are different based on size
-                    # Note: There may be edge cases where file size is the same but content
-                    # differs (xls,xlsx,csv). For these cases, we do a byte comparison.
-                    original_md = original_file.get("metadata") or {}
-                    final_md = final_file.get("metadata") or {}
-                    orig_size = original_md.get("size")
-                    final_size = final_md.get("size")
-
-                    if orig_size == final_size:
-                        file_ext = Path(path).suffix.lower()
-                        needs_byte_comparison = file_ext in {
-                            ".xls",
-                            ".csv",
-                            ".xlsx",
-                        }
-
-                        if needs_byte_comparison:
-                            try:
-                                orig_bytes = self.original_zip.read(
-                                    original_file["full_path"]
-                                )
-                                final_bytes = self.final_zip.read(
-                                    final_file["full_path"]
-                                )
 
-                                if orig_bytes == final_bytes:
-                                    return await self._create_artifact_change(
-                                        path,
-                                        ChangeType.UNCHANGED,
-                                        original_file,
-                                        final_file,
-                                    )
-                                else:
-                                    return await self._create_artifact_change(
-                                        path,
-                                        ChangeType.MODIFIED,
-                                        original_file,
-                                        final_file,
-                                    )
-                            except KeyError as e:
-                                # Defensive: This should not happen since metadata is built from zip.filelist
-                                # But guard against corrupted zips or unexpected edge cases
-                                logger.error(
-                                    f"[JUDGE][DIFF] Unexpected KeyError reading {path} from zip: {e}. "
-                                    f"This may indicate a corrupted snapshot. Treating as unchanged."
-                                )
-                                return await self._create_artifact_change(
-                                    path,
-                                    ChangeType.UNCHANGED,
-                                    original_file,
-                                    final_file,
-                                )
-                        else:
-                            return await self._create_artifact_change(
-                                path,
-                                ChangeType.UNCHANGED,
-                                original_file,
-                                final_file,
-                            )
-                    else:
-                        return await self._create_artifact_change(
-                            path,
-                            ChangeType.MODIFIED,
-                            original_file,
-                            final_file,
-                        )
-                else:
-                    # This case is impossible since path comes from union of both file maps
-                    raise ValueError(
-                        f"File '{path}' not found in either snapshot - this should never happen"
+                async with (
+                    semaphore,
+                    self._members.prefetched(
+                        self._members_to_read(path, original_file, final_file)
+                    ),
+                ):
+                    return await self._create_artifact_change(
+                        path, change_type, original_file, final_file
                     )
 
-            # Process files in parallel with concurrency limit
-            semaphore = asyncio.Semaphore(MAX_CONCURRENT_FILE_OPERATIONS)
-
-            async def bounded_process(path: str) -> ArtifactChange:
-                async with semaphore:
-                    return await process_file_change(path)
-
             if debug_logging:
                 print(f"\nDEBUG: Processing {len(all_paths)} file changes in parallel")
 
             tasks = [
-                asyncio.create_task(bounded_process(path)) for path in sorted(all_paths)
+                asyncio.create_task(process_file_change(path))
+                for path in sorted(all_paths)
             ]
             # file_level_artifacts: One ArtifactChange per file path (artifact_type="file")
             # Contains ALL change types: CREATED, DELETED, MODIFIED, UNCHANGED
@@ -562,6 +502,7 @@ class SnapshotDiffGenerator:
                 {
                     "name": relative_path,
                     "full_path": info.filename,  # Keep full path for reading from zip
+                    "crc": info.CRC,  # With the size, identifies the content
                     "metadata": {
                         "size": info.file_size,
                         "last_modified": None,  # ZipInfo doesn't have reliable datetime
@@ -571,6 +512,25 @@ class SnapshotDiffGenerator:
 
         return files
 
+    def _members_to_read(
+        self,
+        path: str,
+        original_file: dict[str, Any] | None,
+        final_file: dict[str, Any] | None,
+    ) -> list[tuple[zipfile.ZipFile, str]]:
+        """
+        The zip members _create_artifact_change reads for a changed file.
+
+        Pure images only need their final version (or original, if deleted);
+        other files are extracted on both sides.
+        """
+        members: list[tuple[zipfile.ZipFile, str]] = []
+        if original_file and not (self._is_pure_image_file(path) and final_file):
+            members.append((self.original_zip, original_file["full_path"]))
+        if final_file:
+            members.append((self.final_zip, final_file["full_path"]))
+        return members
+
     async def _create_artifact_change(
         self,
         path: str,
@@ -690,7 +650,7 @@ class SnapshotDiffGenerator:
             where image_metadata_list contains dicts with 'url', 'placeholder', 'type', 'caption'
         """
         try:
-            file_bytes = zip_file.read(file_path)
+            file_bytes = self._members.read(zip_file, file_path)
             suffix = Path(file_path).suffix.lower()
 
             # Check if we can extract text content
@@ -934,7 +894,7 @@ class SnapshotDiffGenerator:
                     if original_file and original_changed_indices:
                         original_path = original_file.get("full_path", path)
                         original_suffix = Path(original_path).suffix.lower()
-                        raw_bytes = self.original_zip.read(original_path)
+                        raw_bytes = self._members.read(self.original_zip, original_path)
                         if original_suffix in SPREADSHEET_EXTENSIONS:
                             evaluated = await evaluate_excel_formulas_with_libreoffice(
                                 raw_bytes, original_suffix
@@ -950,7 +910,7 @@ class SnapshotDiffGenerator:
                     if final_file and final_changed_indices:
                         final_path = final_file.get("full_path", path)
                         final_suffix = Path(final_path).suffix.lower()
-                        raw_bytes = self.final_zip.read(final_path)
+                        raw_bytes = self._members.read(self.final_zip, final_path)
                         if final_suffix in SPREADSHEET_EXTENSIONS:
                             evaluated = await evaluate_excel_formulas_with_libreoffice(
                                 raw_bytes, final_suffix
@@ -1292,7 +1252,7 @@ class SnapshotDiffGenerator:
         Returns a dict with 'content', 'images', and 'sub_artifacts' keys.
         """
         try:
-            file_bytes = zip_file.read(file_path)
+            file_bytes = self._members.read(zip_file, file_path)
             suffix = Path(file_path).suffix.lower()
 
             # Check if we can extract text content
@@ -1375,7 +1335,7 @@ class SnapshotDiffGenerator:
         Extract content using local extractor only (fast, for change detection).
         """
         try:
-            file_bytes = zip_file.read(file_path)
+            file_bytes = self._members.read(zip_file, file_path)
             suffix = Path(file_path).suffix.lower()
 
             # Get local extractor
@@ -1443,7 +1403,7 @@ class SnapshotDiffGenerator:
         Extract content using Reducto extractor (high-quality, slower).
         """
         try:
-            file_bytes = zip_file.read(file_path)
+            file_bytes = self._members.read(zip_file, file_path)
             suffix = Path(file_path).suffix.lower()
 
             # Get Reducto extractor
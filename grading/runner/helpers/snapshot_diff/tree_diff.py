@@ -0,0 +1,84 @@
+"""
+Tree diff of two snapshot zips from their central directories.
+
+A zip's central directory records each member's CRC-32 and uncompressed size,
+so whether a file changed between two snapshots is known without decompressing
+either version: only created, deleted and modified files are ever read. Their
+members are decompressed ahead on threads (zlib releases the GIL), once each
+however many extractors look at them, and dropped as soon as their
+ArtifactChange is built, so diff time and memory scale with the number of
+changes rather than with the size of the snapshots.
+"""
+
+import asyncio
+import contextlib
+import zipfile
+from collections.abc import AsyncIterator
+from typing import Any
+
+from .types import ChangeType
+
+
+def classify_change(
+    original_file: dict[str, Any] | None, final_file: dict[str, Any] | None
+) -> ChangeType:
+    """
+    Classify a path from its entries in both snapshots (see _list_zip_files).
+
+    Files present in both are unchanged when their uncompressed size and
+    CRC-32 match; nothing is decompressed.
+    """
+    if original_file is None and final_file is None:
+        raise ValueError("File not found in either snapshot")
+    if original_file is None:
+        return ChangeType.CREATED
+    if final_file is None:
+        return ChangeType.DELETED
+
+    original_size = (original_file.get("metadata") or {}).get("size")
+    final_size = (final_file.get("metadata") or {}).get("size")
+    if original_size == final_size and original_file.get("crc") == final_file.get(
+        "crc"
+    ):
+        return ChangeType.UNCHANGED
+    return ChangeType.MODIFIED
+
+
+class MemberReader:
+    """
+    Decompressed zip members of the files being diffed, read ahead on threads.
+    """
+
+    def __init__(self) -> None:
+        self._members: dict[tuple[int, str], bytes] = {}
+
+    @contextlib.asynccontextmanager
+    async def prefetched(
+        self, members: list[tuple[zipfile.ZipFile, str]]
+    ) -> AsyncIterator[None]:
+        """
+        Decompress members in parallel and serve them from memory within the block.
+
+        A member that fails to read is left to read(), which raises the error
+        where the caller already handles it.
+        """
+        keys = [(id(zip_file), name) for zip_file, name in members]
+        results = await asyncio.gather(
+            *(asyncio.to_thread(zip_file.read, name) for zip_file, name in members),
+            return_exceptions=True,
+        )
+        for key, data in zip(keys, results, strict=True):
+            if isinstance(data, bytes):
+                self._members[key] = data
+        try:
+            yield
+        finally:
+            for key in keys:
+                self._members.pop(key, None)
+
+    def read(self, zip_file: zipfile.ZipFile, name: str) -> bytes:
+        """Read a member, from memory if it was prefetched."""
+        data = self._members.get((id(zip_file), name))
+        if data is None:
+            data = zip_file.read(name)
+        return data
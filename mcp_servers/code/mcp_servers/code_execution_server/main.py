@@ -10,15 +10,16 @@ from mcp_schema import flatten_schema
 from middleware.logging import LoggingMiddleware
 from middleware.validation_error_sanitizer import ValidationErrorSanitizerMiddleware
 from tools.code_exec import code_exec, verify_sandbox_available
+from tools.python_session import python_session
 
 mcp = FastMCP(
     "code-execution-server",
     instructions=(
         "Sandboxed execution of shell commands and Python in a persistent directory "
         "(APP_FS_ROOT). Run scripts, create/modify/delete files, install packages "
-        "(e.g. pip/uv); configurable command timeout. No persistent Python session "
-        "across calls. Use for data analysis, scripting, and training agents on code "
-        "execution."
+        "(e.g. pip/uv); configurable command timeout. python_session keeps Python "
+        "state across calls and can checkpoint it to branch from later. Use for data "
+        "analysis, scripting, and training agents on code execution."
     ),
 )
 mcp.add_middleware(ErrorHandlingMiddleware(include_traceback=True))
@@ -27,6 +28,7 @@ mcp.add_middleware(LoggingMiddleware())
 mcp.add_middleware(ValidationErrorSanitizerMiddleware())
 
 mcp.tool(code_exec)
+mcp.tool(python_session)
 
 
 async def _flatten_tool_schemas():
@@ -4,8 +4,14 @@ from .code_exec import (
     CodeExecRequest,
     CodeExecResponse,
 )
+from .python_session import (
+    PythonSessionRequest,
+    PythonSessionResponse,
+)
 
 __all__ = [
     "CodeExecRequest",
     "CodeExecResponse",
+    "PythonSessionRequest",
+    "PythonSessionResponse",
 ]
@@ -0,0 +1,63 @@
+"""Pydantic models for persistent Python sessions."""
+
+from typing import Literal
+
+from mcp_schema import FlatBaseModel as BaseModel
+from pydantic import ConfigDict, Field
+
+
+class PythonSessionRequest(BaseModel):
+    """Request model for a persistent Python session."""
+
+    model_config = ConfigDict(extra="forbid")
+
+    action: Literal["exec", "checkpoint", "resume", "drop", "list"] = Field(
+        "exec",
+        description=(
+            "What to do: "
+            "'exec' runs `code` in `session` (started on first use); "
+            "'checkpoint' saves the session's current state and returns a checkpoint id; "
+            "'resume' starts `session` (replacing it if it exists) from `checkpoint`, "
+            "so several sessions can continue from one saved state; "
+            "'drop' ends `session`, or deletes `checkpoint` if given; "
+            "'list' shows live sessions and checkpoints."
+        ),
+    )
+    session: str = Field(
+        "main",
+        description="Session name. Variables, imports and loaded data persist per session.",
+    )
+    code: str | None = Field(
+        None,
+        description=(
+            "Python source for 'exec' (NOT a shell command). Runs in the sandbox root "
+            "directory (/filesystem); the value of a trailing expression is printed, "
+            "as in a notebook."
+        ),
+    )
+    checkpoint: str | None = Field(
+        None,
+        description="Checkpoint id (e.g. 'cp3') for 'resume' and 'drop'.",
+    )
+
+
+class PythonSessionResponse(BaseModel):
+    """Response model for a persistent Python session."""
+
+    model_config = ConfigDict(extra="forbid")
+
+    success: bool = Field(
+        ...,
+        description=(
+            "Boolean indicating the action succeeded. For 'exec', `false` if the code "
+            "raised, timed out (the session is then ended), or the session died."
+        ),
+    )
+    output: str = Field(
+        ...,
+        description=(
+            "Printed output and any traceback for 'exec', the checkpoint id for "
+            "'checkpoint', or a status message. Large outputs (over 100KB, or 2KB "
+            "for HTML content) are automatically truncated."
+        ),
+    )
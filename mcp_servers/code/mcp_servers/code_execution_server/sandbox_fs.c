@@ -5,8 +5,33 @@
  * Usage:   LD_PRELOAD=/path/to/sandbox_fs.so python script.py
  * 
  * Environment variables:
- *   SANDBOX_BLOCKED_PATHS  - Colon-separated list of paths to block (default: /app:/.apps_data)
- *   SANDBOX_DEBUG          - Set to "1" to enable debug logging to stderr
+ *   SANDBOX_BLOCKED_PATHS       - Colon-separated list of paths to block (default: /app:/.apps_data)
+ *   SANDBOX_READONLY_PATHS      - Colon-separated list of paths that stay readable but whose
+ *                                 contents cannot be modified (mutations fail with EROFS)
+ *                                 An entry of either list prefixed with '~' (e.g. "~/etc/ssh") is an
+ *                                 audit-only rule: it is evaluated and would-deny decisions are
+ *                                 counted, but the call is allowed
+ *   SANDBOX_AUDIT_LOG           - File to append one line per audit-only decision to
+ *   SANDBOX_TRACE_FILE          - Existing file to append the execution trace to: every path the
+ *                                 command reads, stats or executes with the identity it had, plus
+ *                                 its mutations and clock/randomness/socket use (utils/memo.py)
+ *   SANDBOX_DEBUG               - Set to "1" to enable debug logging to stderr
+ *   SANDBOX_RELAXED_DURABILITY  - Set to "1" to turn fsync/fdatasync/sync_file_range/syncfs
+ *                                 into no-ops for files under SANDBOX_EPHEMERAL_ROOTS
+ *   SANDBOX_EPHEMERAL_ROOTS     - Colon-separated list of roots whose contents are thrown away
+ *                                 after the episode (default: /filesystem)
+ *   SANDBOX_SHARED_SEGMENT      - Path of the shared segment created by the server; mutations
+ *                                 under SANDBOX_TRACKED_ROOTS pause while a snapshot quiesces it
+ *   SANDBOX_EXEC_SLOT           - Index of this execution's slot in the shared segment; when set,
+ *                                 bytes written under SANDBOX_TRACKED_ROOTS are charged to the slot
+ *                                 and writes fail with ENOSPC once its quota is exceeded
+ *   SANDBOX_TRACKED_ROOTS       - Colon-separated list of roots subject to the write quota and to
+ *                                 snapshot quiescing (default: /filesystem)
+ *   SANDBOX_QUIESCE_MAX_MS      - Longest a mutation waits for a snapshot before proceeding anyway
+ *                                 (default: 30000)
+ *
+ * USDT probes (provider "sandbox_fs") are built in when <sys/sdt.h> is available
+ * (systemtap-sdt-dev); pass -DSANDBOX_NO_USDT to leave them out. See "USDT probes" below.
  */
 
 #define _GNU_SOURCE
@@ -25,7 +50,18 @@
 #include <pthread.h>
 #include <ftw.h>
 #include <utime.h>
+#include <stdint.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <time.h>
+#include <glob.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <link.h>
 
 /* ============================================================================
  * Configuration
@@ -33,9 +69,33 @@
 
 #define MAX_BLOCKED_PATHS 64
 #define DEFAULT_BLOCKED_PATHS "/app:/.apps_data"
+#define MAX_READONLY_PATHS 16
+#define MAX_EPHEMERAL_ROOTS 16
+#define DEFAULT_EPHEMERAL_ROOTS "/filesystem"
+#define MAX_TRACKED_ROOTS 16
+#define DEFAULT_TRACKED_ROOTS "/filesystem"
+#define MAX_TRACKED_FDS 65536
+#define DEFAULT_QUIESCE_MAX_MS 30000
+#define AUDIT_RULE_PREFIX '~'
+#define TRACE_MAX_EVENTS 200000
 
 static char *blocked_paths[MAX_BLOCKED_PATHS];
+static unsigned char blocked_audit[MAX_BLOCKED_PATHS];  // 1 = audit-only rule
 static int blocked_paths_count = 0;
+static char *readonly_paths[MAX_READONLY_PATHS];
+static unsigned char readonly_audit[MAX_READONLY_PATHS];
+static int readonly_paths_count = 0;
+static int audit_active = 0;  // Any audit-only rule configured: time checks, record would-denies
+static int audit_log_fd = -1;
+static int trace_fd = -1;  // SANDBOX_TRACE_FILE, see "Execution tracing"
+static char *ephemeral_roots[MAX_EPHEMERAL_ROOTS];
+static int ephemeral_roots_count = 0;
+static int relaxed_durability = 0;
+static char *tracked_roots[MAX_TRACKED_ROOTS];
+static int tracked_roots_count = 0;
+static int tracking_active = 0;
+static int quota_failed = 0;  // Fail-closed: slot requested but unusable, deny quota writes
+static long quiesce_max_ms = DEFAULT_QUIESCE_MAX_MS;
 static int debug_enabled = 0;
 static int initialized = 0;
 static int init_failed = 0;  // Fail-closed: if initialization fails, block everything
@@ -51,37 +111,223 @@ static pthread_once_t init_once = PTHREAD_ONCE_INIT;
     } \
 } while(0)
 
+/*
+ * The library's own clock reads go straight to libc so that they never count
+ * as the traced command reading the clock (see "Execution tracing").
+ */
+typedef int (*orig_clock_gettime_fn)(clockid_t, struct timespec *);
+static orig_clock_gettime_fn real_clock_gettime;
+
+static int clock_now(clockid_t clk, struct timespec *ts) {
+    if (!real_clock_gettime) {
+        real_clock_gettime = (orig_clock_gettime_fn)dlsym(RTLD_NEXT, "clock_gettime");
+        if (!real_clock_gettime) return (int)syscall(SYS_clock_gettime, clk, ts);
+    }
+    return real_clock_gettime(clk, ts);
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_now(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
 /* ============================================================================
- * Initialization
+ * USDT probes
+ *
+ * Static tracepoints for production debugging, e.g.
+ *   bpftrace -p PID -e 'usdt:/app/lib/sandbox_fs.so:sandbox_fs:check
+ *       { printf("%s %s -> %d (%d ns)\n", str(arg0), str(arg1), arg2, arg3); }'
+ *
+ *   policy_init(blocked_count, readonly_count, init_failed, latency_ns)
+ *   enter(op, path)                          path-taking interposer entry
+ *   match_normalized(op, path, latency_ns)   is_path_blocked() decisions
+ *   match_resolved(op, path, latency_ns)
+ *   match_parent(op, path, latency_ns)
+ *   dirfd_failed(op, path, latency_ns)
+ *   check(op, path, blocked, latency_ns)     every is_path_blocked() verdict
+ *   audit(op, path, rule, latency_ns)        an audit-only rule would have denied
+ *
+ * A probe site is a single NOP until a tracer attaches. The extra work done
+ * only to feed probes (remembering the op, reading the clock) is skipped
+ * unless a tracer has bumped the probe's semaphore.
  * ============================================================================ */
 
-static void init_blocked_paths(void) {
-    if (initialized) return;
+#if !defined(SANDBOX_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define SANDBOX_USDT 1
+#endif
+#endif
+
+/* Interposer currently running, for decision probes and the audit log */
+static __thread const char *probe_op;
+
+#ifdef SANDBOX_USDT
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define PROBE_SEMAPHORE(name) \
+    __extension__ unsigned short sandbox_fs_##name##_semaphore \
+    __attribute__((unused, section(".probes"), visibility("hidden")))
+
+PROBE_SEMAPHORE(policy_init);
+PROBE_SEMAPHORE(enter);
+PROBE_SEMAPHORE(match_normalized);
+PROBE_SEMAPHORE(match_resolved);
+PROBE_SEMAPHORE(match_parent);
+PROBE_SEMAPHORE(dirfd_failed);
+PROBE_SEMAPHORE(check);
+PROBE_SEMAPHORE(audit);
+
+#define POLICY_PROBES_ACTIVE() __builtin_expect( \
+    (sandbox_fs_match_normalized_semaphore | sandbox_fs_match_resolved_semaphore | \
+     sandbox_fs_match_parent_semaphore | sandbox_fs_dirfd_failed_semaphore | \
+     sandbox_fs_check_semaphore) != 0, 0)
+
+
+#define PROBE_CLOCK() monotonic_ns()
+#define PROBE_START() (POLICY_PROBES_ACTIVE() ? monotonic_ns() : 0)
+#define PROBE_ENTER(path) do { \
+    if (POLICY_PROBES_ACTIVE() || audit_active) probe_op = __func__; \
+    STAP_PROBE2(sandbox_fs, enter, __func__, (path)); \
+} while (0)
+#define PROBE_DECISION(name, path, t0) \
+    STAP_PROBE3(sandbox_fs, name, probe_op, (path), monotonic_ns() - (t0))
+#define PROBE_CHECK(path, blocked, t0) \
+    STAP_PROBE4(sandbox_fs, check, probe_op, (path), (blocked), monotonic_ns() - (t0))
+#define PROBE_AUDIT(path, rule, latency) \
+    STAP_PROBE4(sandbox_fs, audit, probe_op, (path), (rule), (latency))
+#define PROBE_POLICY_INIT(t0) \
+    STAP_PROBE4(sandbox_fs, policy_init, blocked_paths_count, readonly_paths_count, \
+                init_failed, monotonic_ns() - (t0))
+#else
+#define PROBE_CLOCK() 0
+#define PROBE_START() 0
+#define PROBE_ENTER(path) do { if (audit_active) probe_op = __func__; } while (0)
+#define PROBE_DECISION(name, path, t0) do { (void)(t0); } while (0)
+#define PROBE_CHECK(path, blocked, t0) do { (void)(t0); } while (0)
+#define PROBE_AUDIT(path, rule, latency) do { } while (0)
+#define PROBE_POLICY_INIT(t0) do { (void)(t0); } while (0)
+#endif
+
+/* ============================================================================
+ * Shared segment
+ *
+ * A small file (normally under /dev/shm) created by the code execution server
+ * and mapped MAP_SHARED by every sandboxed process. The header carries the
+ * snapshot quiesce count; it is followed by one cache-line sized accounting
+ * slot per concurrent execution. All processes of one execution tree share a
+ * slot through SANDBOX_EXEC_SLOT. Layout must match utils/shared_segment.py
+ * and the environment's snapshot/quiesce.py.
+ * ============================================================================ */
+
+#define SEGMENT_MAGIC   0x46584253u  /* "SBXF" in memory */
+#define SEGMENT_VERSION 1
+
+struct segment_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nslots;
+    uint32_t quiesce;        /* futex word: snapshots currently capturing */
+    uint32_t mutators;       /* mutating calls currently in flight */
+    uint32_t reserved;
+    uint64_t quiesce_expires_ns; /* CLOCK_MONOTONIC end of the current quiesce, 0 = unset */
+    uint8_t  pad[32];
+};
+
+struct exec_slot {
+    uint64_t quota_bytes;    /* 0 = unlimited (count only) */
+    uint64_t bytes_written;  /* charged by the interposer */
+    uint64_t denials;        /* writes refused with ENOSPC */
+    uint64_t audit_denials;  /* calls an audit-only rule would have refused */
+    uint64_t policy_checks;  /* path policy checks, counted while audit rules exist */
+    uint64_t policy_check_ns;/* time spent in those checks */
+    uint64_t trace_errors;   /* execution trace events that could not be recorded */
+    uint8_t  pad[8];
+};
+
+_Static_assert(sizeof(struct segment_header) == 64, "segment header layout");
+_Static_assert(sizeof(struct exec_slot) == 64, "segment slot layout");
+
+static struct segment_header *segment = NULL;
+static size_t segment_size = 0;
+static struct exec_slot *quota_slot = NULL;
+
+/*
+ * Map the shared segment. Returns 0 on success, -1 if it is missing or
+ * malformed.
+ *
+ * Uses the original open() via dlsym: the segment path is itself listed in
+ * SANDBOX_BLOCKED_PATHS so that sandboxed code cannot tamper with it.
+ */
+static int map_shared_segment(const char *path) {
+    typedef int (*orig_open_fn)(const char *, int, ...);
+    orig_open_fn orig_open = dlsym(RTLD_NEXT, "open");
+    if (!orig_open) return -1;
     
-    // Check debug flag
-    const char *debug_env = getenv("SANDBOX_DEBUG");
-    debug_enabled = (debug_env && strcmp(debug_env, "1") == 0);
+    int fd = orig_open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) return -1;
     
-    // Get blocked paths from environment or use default
-    const char *paths_env = getenv("SANDBOX_BLOCKED_PATHS");
-    const char *paths = paths_env ? paths_env : DEFAULT_BLOCKED_PATHS;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct segment_header)) {
+        close(fd);
+        return -1;
+    }
     
-    DEBUG_LOG("Initializing with blocked paths: %s", paths);
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return -1;
     
-    // Parse colon-separated paths
-    char *paths_copy = strdup(paths);
-    if (!paths_copy) {
-        fprintf(stderr, "[sandbox_fs] ERROR: Failed to allocate memory for paths\n");
-        fprintf(stderr, "[sandbox_fs] SECURITY: Failing closed - all paths will be blocked\n");
-        init_failed = 1;  // Fail-closed: block all paths when initialization fails
-        return;
+    struct segment_header *hdr = base;
+    size_t needed = sizeof(*hdr) + (size_t)hdr->nslots * sizeof(struct exec_slot);
+    if (hdr->magic != SEGMENT_MAGIC || hdr->version != SEGMENT_VERSION ||
+        (size_t)st.st_size < needed) {
+        munmap(base, (size_t)st.st_size);
+        return -1;
     }
     
+    segment = hdr;
+    segment_size = (size_t)st.st_size;
+    return 0;
+}
+
+/* Locate this execution's accounting slot. Returns 0 on success, -1 if out of range. */
+static int attach_exec_slot(const char *slot_env) {
+    char *end;
+    errno = 0;
+    unsigned long slot = strtoul(slot_env, &end, 10);
+    if (errno || end == slot_env || *end != '\0' || slot >= segment->nslots) return -1;
+    
+    quota_slot = (struct exec_slot *)(segment + 1) + slot;
+    return 0;
+}
+
+/* ============================================================================
+ * Initialization
+ * ============================================================================ */
+
+/*
+ * Parse a colon-separated path list into out[], trimming whitespace and
+ * trailing slashes. Returns the number of entries stored, or -1 if the
+ * working copy could not be allocated.
+ */
+static int parse_path_list(const char *paths, char **out, unsigned char *audit, int max,
+                           const char *label) {
+    char *paths_copy = strdup(paths);
+    if (!paths_copy) return -1;
+    
+    int count = 0;
     char *saveptr;
     char *token = strtok_r(paths_copy, ":", &saveptr);
-    while (token && blocked_paths_count < MAX_BLOCKED_PATHS) {
+    while (token && count < max) {
         // Trim leading/trailing whitespace
         while (*token == ' ') token++;
+        // '~' marks an audit-only rule where the caller supports them
+        unsigned char audit_only = 0;
+        if (audit && *token == AUDIT_RULE_PREFIX) {
+            audit_only = 1;
+            token++;
+        }
         char *end = token + strlen(token) - 1;
         while (end > token && *end == ' ') *end-- = '\0';
         
@@ -91,27 +337,218 @@ static void init_blocked_paths(void) {
         while (end > token && *end == '/') *end-- = '\0';
         
         if (strlen(token) > 0) {
-            blocked_paths[blocked_paths_count] = strdup(token);
-            if (blocked_paths[blocked_paths_count]) {
-                DEBUG_LOG("  Blocking path: %s", blocked_paths[blocked_paths_count]);
-                blocked_paths_count++;
+            out[count] = strdup(token);
+            if (out[count]) {
+                DEBUG_LOG("  %s: %s%s", label, out[count], audit_only ? " (audit only)" : "");
+                if (audit) {
+                    audit[count] = audit_only;
+                    audit_active |= audit_only;
+                }
+                count++;
             }
         }
         token = strtok_r(NULL, ":", &saveptr);
     }
     
     free(paths_copy);
+    return count;
+}
+
+/*
+ * Map the shared segment and, if the server assigned us a slot, enable write
+ * accounting. Quiescing is best-effort: without a segment, mutations simply
+ * never pause. The quota is a resource limit, so a requested-but-unusable
+ * slot fails closed: writes under the tracked roots are refused rather than
+ * left uncounted.
+ */
+static void init_shared_segment(void) {
+    const char *segment_env = getenv("SANDBOX_SHARED_SEGMENT");
+    const char *slot_env = getenv("SANDBOX_EXEC_SLOT");
+    if (!segment_env && !slot_env) return;
+    
+    const char *roots_env = getenv("SANDBOX_TRACKED_ROOTS");
+    const char *roots = roots_env ? roots_env : DEFAULT_TRACKED_ROOTS;
+    int count = parse_path_list(roots, tracked_roots, NULL, MAX_TRACKED_ROOTS, "Tracked root");
+    if (count <= 0) {
+        // Nothing to charge against; an empty root list means no quota
+        if (count < 0 && slot_env) quota_failed = 1;
+        return;
+    }
+    tracked_roots_count = count;
+    tracking_active = 1;
+    
+    const char *max_env = getenv("SANDBOX_QUIESCE_MAX_MS");
+    if (max_env) quiesce_max_ms = strtol(max_env, NULL, 10);
+    
+    if (!segment_env || map_shared_segment(segment_env) != 0) {
+        if (slot_env) {
+            fprintf(stderr, "[sandbox_fs] ERROR: Cannot map shared segment %s\n",
+                    segment_env ? segment_env : "(unset)");
+            fprintf(stderr, "[sandbox_fs] Failing closed - writes under tracked roots will be refused\n");
+            quota_failed = 1;
+        }
+        DEBUG_LOG("Shared segment unavailable - snapshots will not quiesce writers");
+        return;
+    }
+    
+    if (slot_env) {
+        if (attach_exec_slot(slot_env) != 0) {
+            fprintf(stderr, "[sandbox_fs] ERROR: Invalid slot %s in shared segment %s\n",
+                    slot_env, segment_env);
+            fprintf(stderr, "[sandbox_fs] Failing closed - writes under tracked roots will be refused\n");
+            quota_failed = 1;
+            return;
+        }
+        DEBUG_LOG("Write quota slot %s: %llu bytes", slot_env,
+                  (unsigned long long)quota_slot->quota_bytes);
+    }
+}
+
+static void init_blocked_paths(void) {
+    if (initialized) return;
+    
+    // Check debug flag
+    const char *debug_env = getenv("SANDBOX_DEBUG");
+    debug_enabled = (debug_env && strcmp(debug_env, "1") == 0);
+    
+    // Get blocked paths from environment or use default
+    const char *paths_env = getenv("SANDBOX_BLOCKED_PATHS");
+    const char *paths = paths_env ? paths_env : DEFAULT_BLOCKED_PATHS;
+    
+    DEBUG_LOG("Initializing with blocked paths: %s", paths);
+    
+    int count = parse_path_list(paths, blocked_paths, blocked_audit, MAX_BLOCKED_PATHS, "Blocking path");
+    if (count < 0) {
+        fprintf(stderr, "[sandbox_fs] ERROR: Failed to allocate memory for paths\n");
+        fprintf(stderr, "[sandbox_fs] SECURITY: Failing closed - all paths will be blocked\n");
+        init_failed = 1;  // Fail-closed: block all paths when initialization fails
+        return;
+    }
+    blocked_paths_count = count;
+    
+    // Read-only paths are a security policy too: fail closed
+    const char *readonly_env = getenv("SANDBOX_READONLY_PATHS");
+    if (readonly_env) {
+        count = parse_path_list(readonly_env, readonly_paths, readonly_audit, MAX_READONLY_PATHS, "Read-only path");
+        if (count < 0) {
+            fprintf(stderr, "[sandbox_fs] ERROR: Failed to allocate memory for read-only paths\n");
+            fprintf(stderr, "[sandbox_fs] SECURITY: Failing closed - all paths will be blocked\n");
+            init_failed = 1;
+            return;
+        }
+        readonly_paths_count = count;
+    }
+    
+    // Durability relaxation is a performance policy, not a security one:
+    // if the roots can't be parsed we simply keep syncing as normal.
+    const char *relaxed_env = getenv("SANDBOX_RELAXED_DURABILITY");
+    if (relaxed_env && strcmp(relaxed_env, "1") == 0) {
+        const char *roots_env = getenv("SANDBOX_EPHEMERAL_ROOTS");
+        const char *roots = roots_env ? roots_env : DEFAULT_EPHEMERAL_ROOTS;
+        count = parse_path_list(roots, ephemeral_roots, NULL, MAX_EPHEMERAL_ROOTS, "Ephemeral root");
+        if (count > 0) {
+            ephemeral_roots_count = count;
+            relaxed_durability = 1;
+        }
+    }
+    
+    // The audit log is diagnostics only: without it decisions are just counted
+    const char *audit_log_env = getenv("SANDBOX_AUDIT_LOG");
+    if (audit_active && audit_log_env && *audit_log_env) {
+        audit_log_fd = (int)syscall(SYS_openat, AT_FDCWD, audit_log_env,
+                                    O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+        if (audit_log_fd < 0) DEBUG_LOG("Cannot open audit log %s", audit_log_env);
+    }
+    
+    init_shared_segment();
+    
+    // After the segment: a trace that can't be opened is reported through the
+    // slot, and the server then won't reuse the run
+    const char *trace_env = getenv("SANDBOX_TRACE_FILE");
+    if (trace_env && *trace_env) {
+        trace_fd = (int)syscall(SYS_openat, AT_FDCWD, trace_env, O_WRONLY | O_APPEND | O_CLOEXEC);
+        if (trace_fd < 0) {
+            DEBUG_LOG("Cannot open trace file %s", trace_env);
+            if (quota_slot) __atomic_fetch_add(&quota_slot->trace_errors, 1, __ATOMIC_RELAXED);
+        }
+    }
+    
     initialized = 1;
 }
 
+static void init_policy(void) {
+    uint64_t t0 = PROBE_CLOCK();
+    init_blocked_paths();
+    PROBE_POLICY_INIT(t0);
+}
+
 static void ensure_initialized(void) {
-    pthread_once(&init_once, init_blocked_paths);
+    pthread_once(&init_once, init_policy);
 }
 
 /* ============================================================================
  * Path checking logic
  * ============================================================================ */
 
+/*
+ * First audit-only rule matched by the check in progress on this thread, so a
+ * check whose stages (normalized, resolved, ...) all match is recorded once.
+ */
+static __thread const char *audit_rule;
+
+/*
+ * Return the enforced rule that covers path (exact match or a parent of it),
+ * or NULL. Matching audit-only rules are remembered in audit_rule instead.
+ */
+static const char *match_rules(const char *path, char **rules, const unsigned char *audit, int count) {
+    for (int i = 0; i < count; i++) {
+        const char *rule = rules[i];
+        size_t rule_len = strlen(rule);
+        
+        if (strncmp(path, rule, rule_len) == 0 &&
+            (path[rule_len] == '\0' || path[rule_len] == '/')) {
+            if (!audit[i]) return rule;
+            if (!audit_rule) audit_rule = rule;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Account one policy check while audit rules are configured: its latency
+ * goes to the execution's slot, and if only an audit-only rule stood in the
+ * way of the call, the would-deny is counted, logged and probed.
+ */
+static void audit_record(const char *kind, const char *path, int denied, uint64_t t0) {
+    uint64_t latency = monotonic_ns() - t0;
+    const char *rule = audit_rule;
+    audit_rule = NULL;
+    
+    if (quota_slot) {
+        __atomic_fetch_add(&quota_slot->policy_checks, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&quota_slot->policy_check_ns, latency, __ATOMIC_RELAXED);
+    }
+    if (!rule || denied) return;
+    
+    if (quota_slot) __atomic_fetch_add(&quota_slot->audit_denials, 1, __ATOMIC_RELAXED);
+    DEBUG_LOG("AUDIT: would deny %s %s (%s rule %s)", probe_op ? probe_op : "?", path, kind, rule);
+    PROBE_AUDIT(path, rule, latency);
+    
+    if (audit_log_fd >= 0) {
+        char line[PATH_MAX * 2 + 128];
+        int len = snprintf(line, sizeof(line), "%d\t%s\t%s\t%s\t%s\t%llu\n",
+                           (int)getpid(), probe_op ? probe_op : "?", kind, rule, path,
+                           (unsigned long long)latency);
+        if (len > 0) {
+            if ((size_t)len >= sizeof(line)) len = sizeof(line) - 1;
+            // Raw syscall: the log sits under a blocked path and must not recurse
+            // into the write interposer
+            ssize_t ignored = syscall(SYS_write, audit_log_fd, line, (size_t)len);
+            (void)ignored;
+        }
+    }
+}
+
 /*
  * Normalize a path by resolving . and .. components without following symlinks.
  * This is important to prevent bypasses like /workspace/../app
@@ -188,7 +625,8 @@ static char *normalize_path(const char *path, char *resolved, size_t resolved_si
  *   /filesystem/link2 -> link1/app
  * Would allow access to /app via /filesystem/link2.
  *
- * Returns: 1 if the resolved path (or any resolvable prefix) is blocked, 0 otherwise.
+ * Returns: RESOLVED_MATCH if the resolved path is blocked, PARENT_MATCH if the
+ * resolved parent directory (or cwd) is, 0 otherwise.
  *
  * Strategy:
  * 1. Try realpath on the full path (handles existing files/symlinks)
@@ -196,6 +634,9 @@ static char *normalize_path(const char *path, char *resolved, size_t resolved_si
  *    and append the filename - this catches symlink chains in parent paths
  * 3. Fall back to basic normalization for truly new paths
  */
+#define RESOLVED_MATCH 1
+#define PARENT_MATCH   2
+
 static int is_resolved_path_blocked(const char *path) {
     if (!path) return 0;
     
@@ -215,17 +656,10 @@ static int is_resolved_path_blocked(const char *path) {
         // Path exists and is resolved - check the canonical path
         DEBUG_LOG("Resolved path %s -> %s", path, resolved);
         
-        // Check against blocked paths
-        for (int i = 0; i < blocked_paths_count; i++) {
-            const char *blocked = blocked_paths[i];
-            size_t blocked_len = strlen(blocked);
-            
-            if (strncmp(resolved, blocked, blocked_len) == 0) {
-                if (resolved[blocked_len] == '\0' || resolved[blocked_len] == '/') {
-                    DEBUG_LOG("BLOCKED (resolved): %s -> %s (matched %s)", path, resolved, blocked);
-                    return 1;
-                }
-            }
+        const char *blocked = match_rules(resolved, blocked_paths, blocked_audit, blocked_paths_count);
+        if (blocked) {
+            DEBUG_LOG("BLOCKED (resolved): %s -> %s (matched %s)", path, resolved, blocked);
+            return RESOLVED_MATCH;
         }
         return 0;
     }
@@ -248,16 +682,10 @@ static int is_resolved_path_blocked(const char *path) {
         char cwd[PATH_MAX];
         if (getcwd(cwd, sizeof(cwd)) && orig_realpath(cwd, resolved) != NULL) {
             // Check if cwd resolves to a blocked path
-            for (int i = 0; i < blocked_paths_count; i++) {
-                const char *blocked = blocked_paths[i];
-                size_t blocked_len = strlen(blocked);
-                
-                if (strncmp(resolved, blocked, blocked_len) == 0) {
-                    if (resolved[blocked_len] == '\0' || resolved[blocked_len] == '/') {
-                        DEBUG_LOG("BLOCKED (cwd resolved): cwd=%s -> %s (matched %s)", cwd, resolved, blocked);
-                        return 1;
-                    }
-                }
+            const char *blocked = match_rules(resolved, blocked_paths, blocked_audit, blocked_paths_count);
+            if (blocked) {
+                DEBUG_LOG("BLOCKED (cwd resolved): cwd=%s -> %s (matched %s)", cwd, resolved, blocked);
+                return PARENT_MATCH;
             }
         }
         return 0;
@@ -282,17 +710,10 @@ static int is_resolved_path_blocked(const char *path) {
         if (snprintf(full_resolved, sizeof(full_resolved), "%s/%s", resolved, filename) < (int)sizeof(full_resolved)) {
             DEBUG_LOG("Resolved parent path %s -> %s/%s", path, resolved, filename);
             
-            // Check against blocked paths
-            for (int i = 0; i < blocked_paths_count; i++) {
-                const char *blocked = blocked_paths[i];
-                size_t blocked_len = strlen(blocked);
-                
-                if (strncmp(full_resolved, blocked, blocked_len) == 0) {
-                    if (full_resolved[blocked_len] == '\0' || full_resolved[blocked_len] == '/') {
-                        DEBUG_LOG("BLOCKED (parent resolved): %s -> %s (matched %s)", path, full_resolved, blocked);
-                        return 1;
-                    }
-                }
+            const char *blocked = match_rules(full_resolved, blocked_paths, blocked_audit, blocked_paths_count);
+            if (blocked) {
+                DEBUG_LOG("BLOCKED (parent resolved): %s -> %s (matched %s)", path, full_resolved, blocked);
+                return PARENT_MATCH;
             }
         }
     }
@@ -315,7 +736,7 @@ static int is_resolved_path_blocked(const char *path) {
  *   ln -s link1/app /filesystem/link2
  *   cat /filesystem/link2/secret.txt  # Would access /app/secret.txt!
  */
-static int is_path_blocked(const char *path) {
+static int check_path_blocked(const char *path, uint64_t probe_t0) {
     ensure_initialized();
     
     // Fail-closed: if initialization failed, block ALL paths for security
@@ -334,29 +755,37 @@ static int is_path_blocked(const char *path) {
         normalized[sizeof(normalized) - 1] = '\0';
     }
     
-    for (int i = 0; i < blocked_paths_count; i++) {
-        const char *blocked = blocked_paths[i];
-        size_t blocked_len = strlen(blocked);
-        
-        // Check if normalized path starts with blocked path
-        if (strncmp(normalized, blocked, blocked_len) == 0) {
-            // Must be exact match or followed by /
-            if (normalized[blocked_len] == '\0' || normalized[blocked_len] == '/') {
-                DEBUG_LOG("BLOCKED: %s (matched %s)", path, blocked);
-                return 1;
-            }
-        }
+    const char *blocked = match_rules(normalized, blocked_paths, blocked_audit, blocked_paths_count);
+    if (blocked) {
+        DEBUG_LOG("BLOCKED: %s (matched %s)", path, blocked);
+        PROBE_DECISION(match_normalized, path, probe_t0);
+        return 1;
     }
     
     // Second, check with symlink resolution to catch symlink chain attacks
     // This resolves the path following all symlinks and checks the canonical path
-    if (is_resolved_path_blocked(normalized)) {
+    switch (is_resolved_path_blocked(normalized)) {
+    case RESOLVED_MATCH:
+        PROBE_DECISION(match_resolved, path, probe_t0);
+        return 1;
+    case PARENT_MATCH:
+        PROBE_DECISION(match_parent, path, probe_t0);
         return 1;
     }
     
     return 0;
 }
 
+static int is_path_blocked(const char *path) {
+    ensure_initialized();
+    uint64_t probe_t0 = PROBE_START();
+    uint64_t audit_t0 = audit_active ? monotonic_ns() : 0;
+    int blocked = check_path_blocked(path, probe_t0);
+    PROBE_CHECK(path, blocked, probe_t0);
+    if (audit_active) audit_record("blocked", path, blocked, audit_t0);
+    return blocked;
+}
+
 /*
  * Check path relative to a directory file descriptor.
  * This handles openat() style calls.
@@ -369,6 +798,7 @@ static int is_path_blocked(const char *path) {
  */
 static int is_path_blocked_at(int dirfd, const char *path) {
     if (!path) return 0;
+    uint64_t probe_t0 = PROBE_START();
     
     // If absolute path, check directly
     if (path[0] == '/') {
@@ -401,6 +831,7 @@ static int is_path_blocked_at(int dirfd, const char *path) {
         // Can't resolve dirfd, conservatively BLOCK (not allow!)
         // An attacker could exploit allowing here by providing an invalid fd
         DEBUG_LOG("WARNING: Cannot resolve dirfd %d, blocking access to %s", dirfd, path);
+        PROBE_DECISION(dirfd_failed, path, probe_t0);
         return 1;
     }
     fd_path[len] = '\0';
@@ -415,6 +846,513 @@ static int is_path_blocked_at(int dirfd, const char *path) {
     return is_path_blocked(full_path);
 }
 
+/* ============================================================================
+ * Execution tracing
+ *
+ * With SANDBOX_TRACE_FILE set, the library appends one line per event to that
+ * file so the server can decide whether a later run of the same command would
+ * see the same inputs (utils/memo.py) and which files to prewarm at startup
+ * (utils/prewarm.py):
+ *
+ *     <kind>\t<absolute path or call>\t<dev>:<ino>:<mode>:<size>:<mtime_ns>:<ctime_ns>
+ *
+ *   R  path opened for reading (files and directories)
+ *   S  path stat'ed, access()ed, etc. (symlinks followed)
+ *   L  same, on the link itself (lstat, readlink, O_NOFOLLOW)
+ *   X  path executed
+ *   M  shared object loaded by ld.so or dlopen (listed at exec and exit)
+ *   W  path about to be modified
+ *   T  the wall clock, randomness or a glibc-internal directory walk was used
+ *   N  a socket was created
+ *
+ * The identity is taken with a raw newfstatat just before the call proceeds;
+ * "-" means the path did not exist. Nothing that goes to the kernel without
+ * passing through these interposers (static binaries, raw syscalls) is seen;
+ * libraries ld.so opens itself are only listed if the process execs or exits
+ * normally. Events that cannot be recorded are counted in the slot's
+ * trace_errors, which makes the server discard the trace.
+ * ============================================================================ */
+
+static uint64_t trace_events = 0;
+static int trace_tainted = 0;  // A T or N event was written by this process
+
+static void trace_error(const char *what, const char *path) {
+    DEBUG_LOG("TRACE: cannot record %s %s", what, path ? path : "");
+    if (quota_slot) __atomic_fetch_add(&quota_slot->trace_errors, 1, __ATOMIC_RELAXED);
+}
+
+static void trace_write(const char *line, int len) {
+    if (__atomic_add_fetch(&trace_events, 1, __ATOMIC_RELAXED) > TRACE_MAX_EVENTS) {
+        if (trace_events == TRACE_MAX_EVENTS + 1) trace_error("events beyond", "TRACE_MAX_EVENTS");
+        return;
+    }
+    // Raw syscall: the trace file is blocked and must not recurse into the
+    // write interposer. O_APPEND keeps lines from concurrent processes whole.
+    if (syscall(SYS_write, trace_fd, line, (size_t)len) != len) trace_error("event", line);
+}
+
+/*
+ * Absolute form of dirfd/path as the server will look it up. No lexical
+ * normalization: "a/../b" must keep following the symlink "a" like the
+ * kernel does.
+ */
+static int trace_abs_path(int dirfd, const char *path, char *out, size_t size) {
+    if (path[0] == '/') {
+        return snprintf(out, size, "%s", path) < (int)size ? 0 : -1;
+    }
+    char base[PATH_MAX];
+    if (dirfd == AT_FDCWD) {
+        if (syscall(SYS_getcwd, base, sizeof(base)) < 0) return -1;
+    } else {
+        char proc_path[64];
+        snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", dirfd);
+        long len = syscall(SYS_readlinkat, AT_FDCWD, proc_path, base, sizeof(base) - 1);
+        if (len < 0) return -1;
+        base[len] = '\0';
+    }
+    int n = path[0] ? snprintf(out, size, "%s/%s", strcmp(base, "/") ? base : "", path)
+                    : snprintf(out, size, "%s", base);
+    return n >= 0 && n < (int)size ? 0 : -1;
+}
+
+static void trace_path(char kind, int dirfd, const char *path) {
+    if (trace_fd < 0 || !path) return;
+    int saved_errno = errno;
+    
+    char abs_path[PATH_MAX];
+    if (trace_abs_path(dirfd, path, abs_path, sizeof(abs_path)) != 0 ||
+        strpbrk(abs_path, "\t\n")) {
+        trace_error("path", path);
+        errno = saved_errno;
+        return;
+    }
+    
+    char line[PATH_MAX + 160];
+    int len;
+    struct stat st;
+    int flags = kind == 'L' ? AT_SYMLINK_NOFOLLOW : 0;
+    if (syscall(SYS_newfstatat, AT_FDCWD, abs_path, &st, flags) == 0) {
+        len = snprintf(line, sizeof(line), "%c\t%s\t%llu:%llu:%o:%lld:%lld:%lld\n", kind, abs_path,
+                       (unsigned long long)st.st_dev, (unsigned long long)st.st_ino,
+                       (unsigned)st.st_mode, (long long)st.st_size,
+                       (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec,
+                       (long long)st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec);
+    } else if (errno == ENOENT || errno == ENOTDIR) {
+        len = snprintf(line, sizeof(line), "%c\t%s\t-\n", kind, abs_path);
+    } else {
+        trace_error("identity of", abs_path);
+        errno = saved_errno;
+        return;
+    }
+    trace_write(line, len);
+    errno = saved_errno;
+}
+
+/* Record that the run depends on something besides its inputs (once per process). */
+static void trace_taint(char kind, const char *call) {
+    if (trace_fd < 0 || __atomic_exchange_n(&trace_tainted, 1, __ATOMIC_RELAXED)) return;
+    char line[128];
+    int len = snprintf(line, sizeof(line), "%c\t%s\t-\n", kind, call);
+    trace_write(line, len);
+}
+
+/* Every component of an absolute path, for calls whose result spells out the symlinks crossed. */
+static void trace_components(const char *path) {
+    if (trace_fd < 0 || !path) return;
+    char abs_path[PATH_MAX];
+    if (trace_abs_path(AT_FDCWD, path, abs_path, sizeof(abs_path)) != 0) {
+        trace_error("path", path);
+        return;
+    }
+    for (char *p = abs_path + 1; ; p++) {
+        if (*p == '/' || *p == '\0') {
+            char c = *p;
+            *p = '\0';
+            trace_path('L', AT_FDCWD, abs_path);
+            *p = c;
+            if (c == '\0') break;
+        }
+    }
+}
+
+static int trace_object(struct dl_phdr_info *info, size_t size, void *data) {
+    (void)size;
+    (void)data;
+    // The main program has no name here (it was an X event); skip the vDSO
+    if (info->dlpi_name && info->dlpi_name[0] == '/') trace_path('M', AT_FDCWD, info->dlpi_name);
+    return 0;
+}
+
+static void trace_loaded_objects(void) {
+    if (trace_fd >= 0) dl_iterate_phdr(trace_object, NULL);
+}
+
+/*
+ * Check whether a path is under one of the read-only roots.
+ * Returns 1 if the path may be read but not modified, 0 otherwise.
+ *
+ * Like is_path_blocked(), both the normalized path and its symlink-resolved
+ * form are checked, so a link planted under /filesystem cannot be used to
+ * write through into the read-only store.
+ */
+static int path_under_readonly(const char *path) {
+    const char *root = match_rules(path, readonly_paths, readonly_audit, readonly_paths_count);
+    if (root) {
+        DEBUG_LOG("READ-ONLY: %s (matched %s)", path, root);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * follow=0 is for calls that act on a symlink itself (unlink, rename, lchown):
+ * removing a link that points into the store must stay possible.
+ */
+static int check_path_readonly(const char *path, int follow) {
+    if (!path || readonly_paths_count == 0) return 0;
+    
+    char normalized[PATH_MAX];
+    if (!normalize_path(path, normalized, sizeof(normalized))) {
+        strncpy(normalized, path, sizeof(normalized) - 1);
+        normalized[sizeof(normalized) - 1] = '\0';
+    }
+    if (path_under_readonly(normalized)) return 1;
+    
+    typedef char *(*orig_realpath_fn)(const char *, char *);
+    orig_realpath_fn orig_realpath = dlsym(RTLD_NEXT, "realpath");
+    if (!orig_realpath) return 1;  // Can't resolve symlinks - conservatively read-only
+    
+    char resolved[PATH_MAX];
+    if (follow && orig_realpath(normalized, resolved) != NULL) {
+        return path_under_readonly(resolved);
+    }
+    
+    // Resolve the parent directory and re-append the last component
+    char *last_slash = strrchr(normalized, '/');
+    if (!last_slash || last_slash == normalized) return 0;
+    *last_slash = '\0';
+    if (orig_realpath(normalized, resolved) == NULL) return 0;
+    
+    char full_resolved[PATH_MAX];
+    if (snprintf(full_resolved, sizeof(full_resolved), "%s/%s", resolved, last_slash + 1) >= (int)sizeof(full_resolved)) {
+        return 1;
+    }
+    return path_under_readonly(full_resolved);
+}
+
+static int readonly_check(const char *path, int follow) {
+    ensure_initialized();
+    if (!audit_active) return check_path_readonly(path, follow);
+    
+    uint64_t t0 = monotonic_ns();
+    int readonly = check_path_readonly(path, follow);
+    audit_record("readonly", path, readonly, t0);
+    return readonly;
+}
+
+/*
+ * Read-only check for *at() style calls. Resolves dirfd with the original
+ * readlink (see is_path_blocked_at) and fails closed if it can't.
+ */
+static int readonly_check_at(int dirfd, const char *path, int follow) {
+    ensure_initialized();
+    if (!path || readonly_paths_count == 0) return 0;
+    if (path[0] == '/' || dirfd == AT_FDCWD) return readonly_check(path, follow);
+    
+    typedef ssize_t (*orig_readlink_fn)(const char *, char *, size_t);
+    orig_readlink_fn orig_readlink = dlsym(RTLD_NEXT, "readlink");
+    if (!orig_readlink) return 1;
+    
+    char fd_path[PATH_MAX];
+    char proc_path[64];
+    snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", dirfd);
+    
+    ssize_t len = orig_readlink(proc_path, fd_path, sizeof(fd_path) - 1);
+    if (len == -1) return 1;
+    fd_path[len] = '\0';
+    
+    char full_path[PATH_MAX];
+    if (snprintf(full_path, sizeof(full_path), "%s/%s", fd_path, path) >= (int)sizeof(full_path)) {
+        return 1;
+    }
+    return readonly_check(full_path, follow);
+}
+
+/* Every mutation passes one of these, so they also record it in the trace. */
+#define is_path_readonly(path) \
+    (trace_path('W', AT_FDCWD, (path)), readonly_check((path), 1))
+#define is_path_readonly_nofollow(path) \
+    (trace_path('W', AT_FDCWD, (path)), readonly_check((path), 0))
+#define is_path_readonly_at(dirfd, path) \
+    (trace_path('W', (dirfd), (path)), readonly_check_at((dirfd), (path), 1))
+#define is_path_readonly_at_nofollow(dirfd, path) \
+    (trace_path('W', (dirfd), (path)), readonly_check_at((dirfd), (path), 0))
+
+/*
+ * Check whether an open fd refers to a file under one of the ephemeral roots.
+ * Used by the durability interceptors to decide whether a sync can be skipped.
+ *
+ * Any failure to resolve the fd answers "not ephemeral", so the caller falls
+ * through to the real sync - relaxing durability must never be the default.
+ */
+static int is_fd_ephemeral(int fd) {
+    ensure_initialized();
+    if (!relaxed_durability || fd < 0) return 0;
+    
+    typedef ssize_t (*orig_readlink_fn)(const char *, char *, size_t);
+    orig_readlink_fn orig_readlink = dlsym(RTLD_NEXT, "readlink");
+    if (!orig_readlink) return 0;
+    
+    char fd_path[PATH_MAX];
+    char proc_path[64];
+    snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", fd);
+    
+    ssize_t len = orig_readlink(proc_path, fd_path, sizeof(fd_path) - 1);
+    if (len <= 0) return 0;
+    fd_path[len] = '\0';
+    
+    for (int i = 0; i < ephemeral_roots_count; i++) {
+        const char *root = ephemeral_roots[i];
+        size_t root_len = strlen(root);
+        
+        if (strncmp(fd_path, root, root_len) == 0) {
+            if (fd_path[root_len] == '\0' || fd_path[root_len] == '/') {
+                DEBUG_LOG("Skipping sync on fd %d: %s (ephemeral root %s)", fd, fd_path, root);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Per-process cache of whether an fd is charged against the write quota.
+ * Classified lazily on the first write through the fd, so that the
+ * steady-state cost on every other fd is a single table lookup. Forgotten on
+ * close and again by every call that hands out an fd (open, creat, fopen,
+ * dup, fcntl F_DUPFD, ...), so a number freed behind the interposer's back (a
+ * raw close syscall, a library's internal close) never keeps a stale class.
+ */
+#define FD_UNKNOWN   0
+#define FD_UNTRACKED 1
+#define FD_TRACKED     2
+
+static unsigned char fd_state[MAX_TRACKED_FDS];
+
+static const char *match_tracked_root(const char *path) {
+    for (int i = 0; i < tracked_roots_count; i++) {
+        const char *root = tracked_roots[i];
+        size_t root_len = strlen(root);
+        
+        if (strncmp(path, root, root_len) == 0) {
+            if (path[root_len] == '\0' || path[root_len] == '/') return root;
+        }
+    }
+    return NULL;
+}
+
+static unsigned char classify_fd(int fd) {
+    ensure_initialized();
+    if (!tracking_active) return FD_UNTRACKED;
+    
+    typedef ssize_t (*orig_readlink_fn)(const char *, char *, size_t);
+    orig_readlink_fn orig_readlink = dlsym(RTLD_NEXT, "readlink");
+    if (!orig_readlink) return FD_TRACKED;  // Can't tell - charge it
+    
+    char fd_path[PATH_MAX];
+    char proc_path[64];
+    snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", fd);
+    
+    ssize_t len = orig_readlink(proc_path, fd_path, sizeof(fd_path) - 1);
+    if (len <= 0) return FD_UNTRACKED;  // Not an open fd; the write will fail with EBADF
+    fd_path[len] = '\0';
+    
+    const char *root = match_tracked_root(fd_path);
+    if (root) {
+        DEBUG_LOG("Charging writes on fd %d: %s (quota root %s)", fd, fd_path, root);
+        return FD_TRACKED;
+    }
+    return FD_UNTRACKED;
+}
+
+static inline int is_fd_tracked(int fd) {
+    if (fd < 0) return 0;
+    if (fd >= MAX_TRACKED_FDS) return classify_fd(fd) == FD_TRACKED;
+    
+    unsigned char state = fd_state[fd];
+    if (state == FD_UNKNOWN) {
+        state = classify_fd(fd);
+        fd_state[fd] = state;
+    }
+    return state == FD_TRACKED;
+}
+
+static inline void forget_fd(int fd) {
+    if (fd >= 0 && fd < MAX_TRACKED_FDS) fd_state[fd] = FD_UNKNOWN;
+}
+
+/*
+ * Snapshot quiesce gate. Every mutating call under the tracked roots (see
+ * is_path_tracked_at; writes through tracked fds) registers itself in
+ * segment->mutators for its duration; while segment->quiesce is nonzero (one
+ * count per snapshot capturing), new mutations back out and sleep on the futex
+ * until the snapshot handlers have captured their file lists (and reflink
+ * copies) and the count drops to zero. Each snapshot waits for mutators to
+ * drain to zero before capturing, so it never sees a half-done rename or
+ * write. Reads are never gated.
+ *
+ * Waiting is bounded by SANDBOX_QUIESCE_MAX_MS from the first mutation paused
+ * by the current quiesce, a deadline shared by all processes through
+ * segment->quiesce_expires_ns (the snapshot handler clears it when the count
+ * rises from zero). Once it passes, mutations proceed ungated until the next
+ * quiesce, so a snapshot handler that dies or stalls while holding the count
+ * delays each call at most once rather than every call by the full wait.
+ *
+ * Returns a token for mutation_exit(): 1 if registered, 0 otherwise.
+ */
+static int mutation_enter(void) {
+    if (!segment) return 0;
+    
+    for (;;) {
+        __atomic_fetch_add(&segment->mutators, 1, __ATOMIC_SEQ_CST);
+        uint32_t quiesce = __atomic_load_n(&segment->quiesce, __ATOMIC_SEQ_CST);
+        if (!quiesce) return 1;
+        __atomic_fetch_sub(&segment->mutators, 1, __ATOMIC_SEQ_CST);
+        
+        uint64_t now = monotonic_ns();
+        uint64_t expires = __atomic_load_n(&segment->quiesce_expires_ns, __ATOMIC_SEQ_CST);
+        if (expires == 0) {
+            uint64_t want = now + (uint64_t)quiesce_max_ms * 1000000ull;
+            // The first paused mutation sets the deadline; the rest adopt it
+            if (__atomic_compare_exchange_n(&segment->quiesce_expires_ns, &expires, want, 0,
+                                            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+                expires = want;
+            }
+            DEBUG_LOG("Mutation paused: snapshot in progress");
+        }
+        if (now >= expires) {
+            DEBUG_LOG("Snapshot quiesce exceeded %ld ms, proceeding", quiesce_max_ms);
+            return 0;
+        }
+        
+        // Sleep in short slices so a missed wakeup costs at most one slice
+        int saved_errno = errno;
+        struct timespec slice = {0, 50 * 1000000L};
+        syscall(SYS_futex, &segment->quiesce, FUTEX_WAIT, quiesce, &slice, NULL, 0);
+        errno = saved_errno;
+    }
+}
+
+static inline void mutation_exit(int token) {
+    if (token) __atomic_fetch_sub(&segment->mutators, 1, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Whether a call mutating dirfd/path must pass the quiesce gate: snapshots
+ * only capture the tracked roots, so mutations elsewhere never pause. The path
+ * is matched as written (normalized), fully resolved and with only its parent
+ * resolved, so a symlink into a tracked root is gated whether or not the call
+ * follows it. Anything that can't be resolved is gated.
+ */
+static int is_path_tracked_at(int dirfd, const char *path) {
+    if (!segment || !path) return 0;
+    
+    char full_path[PATH_MAX];
+    char normalized[PATH_MAX];
+    if (trace_abs_path(dirfd, path, full_path, sizeof(full_path)) < 0) return 1;
+    if (!normalize_path(full_path, normalized, sizeof(normalized))) return 1;
+    if (match_tracked_root(normalized)) return 1;
+    
+    typedef char *(*orig_realpath_fn)(const char *, char *);
+    orig_realpath_fn orig_realpath = dlsym(RTLD_NEXT, "realpath");
+    if (!orig_realpath) return 1;
+    
+    int saved_errno = errno;
+    char resolved[PATH_MAX];
+    int tracked = orig_realpath(full_path, resolved) && match_tracked_root(resolved);
+    
+    // Resolve the parent directory and re-append the last component
+    char *last_slash = strrchr(normalized, '/');
+    if (!tracked && last_slash && last_slash != normalized) {
+        *last_slash = '\0';
+        if (orig_realpath(normalized, resolved)) {
+            char parent_resolved[PATH_MAX];
+            if (snprintf(parent_resolved, sizeof(parent_resolved), "%s/%s", resolved, last_slash + 1)
+                    >= (int)sizeof(parent_resolved)) {
+                tracked = 1;
+            } else {
+                tracked = match_tracked_root(parent_resolved) != NULL;
+            }
+        }
+    }
+    errno = saved_errno;
+    return tracked;
+}
+
+#define is_path_tracked(path) is_path_tracked_at(AT_FDCWD, (path))
+
+/* Whether an open() with these flags can modify the filesystem */
+static inline int open_mutates(int flags) {
+    // O_TMPFILE includes the O_DIRECTORY bit, so test it as a whole
+    return (flags & O_ACCMODE) != O_RDONLY || (flags & (O_CREAT | O_TRUNC)) ||
+           (flags & O_TMPFILE) == O_TMPFILE;
+}
+
+/*
+ * Reserve n bytes against this execution's quota before a write is issued.
+ * Returns 0 if the write may proceed, -1 with errno=ENOSPC otherwise.
+ * Reservation is optimistic (fetch-add, then back out), so concurrent writers
+ * in the same tree can never jointly overshoot the quota.
+ */
+static int quota_reserve(uint64_t n) {
+    if (quota_failed) {
+        errno = ENOSPC;
+        return -1;
+    }
+    if (!quota_slot) return 0;
+    uint64_t quota = __atomic_load_n(&quota_slot->quota_bytes, __ATOMIC_RELAXED);
+    uint64_t prev = __atomic_fetch_add(&quota_slot->bytes_written, n, __ATOMIC_RELAXED);
+    if (quota && prev + n > quota) {
+        __atomic_fetch_sub(&quota_slot->bytes_written, n, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&quota_slot->denials, 1, __ATOMIC_RELAXED);
+        DEBUG_LOG("Write quota exceeded: %llu + %llu > %llu",
+                  (unsigned long long)prev, (unsigned long long)n, (unsigned long long)quota);
+        errno = ENOSPC;
+        return -1;
+    }
+    return 0;
+}
+
+/* Return the unused part of a reservation once the real call has completed. */
+static void quota_settle(uint64_t reserved, ssize_t done) {
+    if (!quota_slot) return;
+    uint64_t used = done > 0 ? (uint64_t)done : 0;
+    if (used < reserved) {
+        __atomic_fetch_sub(&quota_slot->bytes_written, reserved - used, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * Bracket a write of up to n bytes to a tracked fd: pass the quiesce gate,
+ * then reserve quota. Returns a gate token (>= 0), or -1 with errno set if
+ * the write must be refused.
+ */
+static int tracked_write_begin(uint64_t n) {
+    int token = mutation_enter();
+    if (quota_reserve(n) < 0) {
+        mutation_exit(token);
+        return -1;
+    }
+    return token;
+}
+
+static void tracked_write_end(int token, uint64_t reserved, ssize_t done) {
+    int saved_errno = errno;
+    quota_settle(reserved, done);
+    mutation_exit(token);
+    errno = saved_errno;
+}
+
 /* ============================================================================
  * Macro to define intercepted functions
  * ============================================================================ */
@@ -424,82 +1362,135 @@ static int is_path_blocked_at(int dirfd, const char *path) {
     return (ret_val); \
 } while(0)
 
+#define READONLY_AND_RETURN(ret_val) do { \
+    errno = EROFS; \
+    return (ret_val); \
+} while(0)
+
 /* ============================================================================
  * Intercepted functions - File opening
  * ============================================================================ */
 
 typedef int (*orig_open_fn)(const char *, int, ...);
 int open(const char *pathname, int flags, ...) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) BLOCK_AND_RETURN(-1);
+    if (open_mutates(flags) && is_path_readonly(pathname)) READONLY_AND_RETURN(-1);
     
+    if (!open_mutates(flags)) trace_path(flags & O_NOFOLLOW ? 'L' : 'R', AT_FDCWD, pathname);
     orig_open_fn orig = dlsym(RTLD_NEXT, "open");
+    int gate = open_mutates(flags) && is_path_tracked(pathname) ? mutation_enter() : 0;
+    int ret;
     if (flags & (O_CREAT | O_TMPFILE)) {
         va_list args;
         va_start(args, flags);
         mode_t mode = va_arg(args, mode_t);
         va_end(args);
-        return orig(pathname, flags, mode);
+        ret = orig(pathname, flags, mode);
+    } else {
+        ret = orig(pathname, flags);
     }
-    return orig(pathname, flags);
+    mutation_exit(gate);
+    if (ret >= 0) forget_fd(ret);
+    return ret;
 }
 
 typedef int (*orig_open64_fn)(const char *, int, ...);
 int open64(const char *pathname, int flags, ...) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) BLOCK_AND_RETURN(-1);
+    if (open_mutates(flags) && is_path_readonly(pathname)) READONLY_AND_RETURN(-1);
     
+    if (!open_mutates(flags)) trace_path(flags & O_NOFOLLOW ? 'L' : 'R', AT_FDCWD, pathname);
     orig_open64_fn orig = dlsym(RTLD_NEXT, "open64");
+    int gate = open_mutates(flags) && is_path_tracked(pathname) ? mutation_enter() : 0;
+    int ret;
     if (flags & (O_CREAT | O_TMPFILE)) {
         va_list args;
         va_start(args, flags);
         mode_t mode = va_arg(args, mode_t);
         va_end(args);
-        return orig(pathname, flags, mode);
+        ret = orig(pathname, flags, mode);
+    } else {
+        ret = orig(pathname, flags);
     }
-    return orig(pathname, flags);
+    mutation_exit(gate);
+    if (ret >= 0) forget_fd(ret);
+    return ret;
 }
 
 typedef int (*orig_openat_fn)(int, const char *, int, ...);
 int openat(int dirfd, const char *pathname, int flags, ...) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked_at(dirfd, pathname)) BLOCK_AND_RETURN(-1);
+    if (open_mutates(flags) && is_path_readonly_at(dirfd, pathname)) READONLY_AND_RETURN(-1);
     
+    if (!open_mutates(flags)) trace_path(flags & O_NOFOLLOW ? 'L' : 'R', dirfd, pathname);
     orig_openat_fn orig = dlsym(RTLD_NEXT, "openat");
+    int gate = open_mutates(flags) && is_path_tracked_at(dirfd, pathname) ? mutation_enter() : 0;
+    int ret;
     if (flags & (O_CREAT | O_TMPFILE)) {
         va_list args;
         va_start(args, flags);
         mode_t mode = va_arg(args, mode_t);
         va_end(args);
-        return orig(dirfd, pathname, flags, mode);
+        ret = orig(dirfd, pathname, flags, mode);
+    } else {
+        ret = orig(dirfd, pathname, flags);
     }
-    return orig(dirfd, pathname, flags);
+    mutation_exit(gate);
+    if (ret >= 0) forget_fd(ret);
+    return ret;
 }
 
 typedef int (*orig_openat64_fn)(int, const char *, int, ...);
 int openat64(int dirfd, const char *pathname, int flags, ...) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked_at(dirfd, pathname)) BLOCK_AND_RETURN(-1);
+    if (open_mutates(flags) && is_path_readonly_at(dirfd, pathname)) READONLY_AND_RETURN(-1);
     
+    if (!open_mutates(flags)) trace_path(flags & O_NOFOLLOW ? 'L' : 'R', dirfd, pathname);
     orig_openat64_fn orig = dlsym(RTLD_NEXT, "openat64");
+    int gate = open_mutates(flags) && is_path_tracked_at(dirfd, pathname) ? mutation_enter() : 0;
+    int ret;
     if (flags & (O_CREAT | O_TMPFILE)) {
         va_list args;
         va_start(args, flags);
         mode_t mode = va_arg(args, mode_t);
         va_end(args);
-        return orig(dirfd, pathname, flags, mode);
+        ret = orig(dirfd, pathname, flags, mode);
+    } else {
+        ret = orig(dirfd, pathname, flags);
     }
-    return orig(dirfd, pathname, flags);
+    mutation_exit(gate);
+    if (ret >= 0) forget_fd(ret);
+    return ret;
 }
 
 typedef int (*orig_creat_fn)(const char *, mode_t);
 int creat(const char *pathname, mode_t mode) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly(pathname)) READONLY_AND_RETURN(-1);
     orig_creat_fn orig = dlsym(RTLD_NEXT, "creat");
-    return orig(pathname, mode);
+    int gate = is_path_tracked(pathname) ? mutation_enter() : 0;
+    int ret = orig(pathname, mode);
+    mutation_exit(gate);
+    if (ret >= 0) forget_fd(ret);
+    return ret;
 }
 
 typedef int (*orig_creat64_fn)(const char *, mode_t);
 int creat64(const char *pathname, mode_t mode) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly(pathname)) READONLY_AND_RETURN(-1);
     orig_creat64_fn orig = dlsym(RTLD_NEXT, "creat64");
-    return orig(pathname, mode);
+    int gate = is_path_tracked(pathname) ? mutation_enter() : 0;
+    int ret = orig(pathname, mode);
+    mutation_exit(gate);
+    if (ret >= 0) forget_fd(ret);
+    return ret;
 }
 
 /* ============================================================================
@@ -508,42 +1499,78 @@ int creat64(const char *pathname, mode_t mode) {
 
 typedef FILE *(*orig_fopen_fn)(const char *, const char *);
 FILE *fopen(const char *pathname, const char *mode) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) {
         errno = EACCES;
         return NULL;
     }
+    if (strpbrk(mode, "wa+") && is_path_readonly(pathname)) {
+        errno = EROFS;
+        return NULL;
+    }
+    if (!strpbrk(mode, "wa+")) trace_path('R', AT_FDCWD, pathname);
     orig_fopen_fn orig = dlsym(RTLD_NEXT, "fopen");
-    return orig(pathname, mode);
+    int gate = strpbrk(mode, "wa+") && is_path_tracked(pathname) ? mutation_enter() : 0;
+    FILE *ret = orig(pathname, mode);
+    mutation_exit(gate);
+    if (ret) forget_fd(fileno(ret));
+    return ret;
 }
 
 typedef FILE *(*orig_fopen64_fn)(const char *, const char *);
 FILE *fopen64(const char *pathname, const char *mode) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) {
         errno = EACCES;
         return NULL;
     }
+    if (strpbrk(mode, "wa+") && is_path_readonly(pathname)) {
+        errno = EROFS;
+        return NULL;
+    }
+    if (!strpbrk(mode, "wa+")) trace_path('R', AT_FDCWD, pathname);
     orig_fopen64_fn orig = dlsym(RTLD_NEXT, "fopen64");
-    return orig(pathname, mode);
+    int gate = strpbrk(mode, "wa+") && is_path_tracked(pathname) ? mutation_enter() : 0;
+    FILE *ret = orig(pathname, mode);
+    mutation_exit(gate);
+    if (ret) forget_fd(fileno(ret));
+    return ret;
 }
 
 typedef FILE *(*orig_freopen_fn)(const char *, const char *, FILE *);
 FILE *freopen(const char *pathname, const char *mode, FILE *stream) {
+    PROBE_ENTER(pathname);
     if (pathname && is_path_blocked(pathname)) {
         errno = EACCES;
         return NULL;
     }
+    if (pathname && strpbrk(mode, "wa+") && is_path_readonly(pathname)) {
+        errno = EROFS;
+        return NULL;
+    }
+    if (pathname && !strpbrk(mode, "wa+")) trace_path('R', AT_FDCWD, pathname);
     orig_freopen_fn orig = dlsym(RTLD_NEXT, "freopen");
-    return orig(pathname, mode, stream);
+    FILE *ret = orig(pathname, mode, stream);
+    if (ret) forget_fd(fileno(ret));
+    return ret;
 }
 
 typedef FILE *(*orig_freopen64_fn)(const char *, const char *, FILE *);
 FILE *freopen64(const char *pathname, const char *mode, FILE *stream) {
+    PROBE_ENTER(pathname);
     if (pathname && is_path_blocked(pathname)) {
         errno = EACCES;
         return NULL;
     }
+    if (pathname && strpbrk(mode, "wa+") && is_path_readonly(pathname)) {
+        errno = EROFS;
+        return NULL;
+    }
+    if (pathname && !strpbrk(mode, "wa+")) trace_path('R', AT_FDCWD, pathname);
     orig_freopen64_fn orig = dlsym(RTLD_NEXT, "freopen64");
-    return orig(pathname, mode, stream);
+    FILE *ret = orig(pathname, mode, stream);
+    if (ret) forget_fd(fileno(ret));
+    return ret;
 }
 
 /* ============================================================================
@@ -552,42 +1579,54 @@ FILE *freopen64(const char *pathname, const char *mode, FILE *stream) {
 
 typedef int (*orig_stat_fn)(const char *, struct stat *);
 int stat(const char *pathname, struct stat *statbuf) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) BLOCK_AND_RETURN(-1);
+    trace_path('S', AT_FDCWD, pathname);
     orig_stat_fn orig = dlsym(RTLD_NEXT, "stat");
     return orig(pathname, statbuf);
 }
 
 typedef int (*orig_stat64_fn)(const char *, struct stat64 *);
 int stat64(const char *pathname, struct stat64 *statbuf) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) BLOCK_AND_RETURN(-1);
+    trace_path('S', AT_FDCWD, pathname);
     orig_stat64_fn orig = dlsym(RTLD_NEXT, "stat64");
     return orig(pathname, statbuf);
 }
 
 typedef int (*orig_lstat_fn)(const char *, struct stat *);
 int lstat(const char *pathname, struct stat *statbuf) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) BLOCK_AND_RETURN(-1);
+    trace_path('L', AT_FDCWD, pathname);
     orig_lstat_fn orig = dlsym(RTLD_NEXT, "lstat");
     return orig(pathname, statbuf);
 }
 
 typedef int (*orig_lstat64_fn)(const char *, struct stat64 *);
 int lstat64(const char *pathname, struct stat64 *statbuf) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) BLOCK_AND_RETURN(-1);
+    trace_path('L', AT_FDCWD, pathname);
     orig_lstat64_fn orig = dlsym(RTLD_NEXT, "lstat64");
     return orig(pathname, statbuf);
 }
 
 typedef int (*orig_fstatat_fn)(int, const char *, struct stat *, int);
 int fstatat(int dirfd, const char *pathname, struct stat *statbuf, int flags) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked_at(dirfd, pathname)) BLOCK_AND_RETURN(-1);
+    trace_path(flags & AT_SYMLINK_NOFOLLOW ? 'L' : 'S', dirfd, pathname);
     orig_fstatat_fn orig = dlsym(RTLD_NEXT, "fstatat");
     return orig(dirfd, pathname, statbuf, flags);
 }
 
 typedef int (*orig_fstatat64_fn)(int, const char *, struct stat64 *, int);
 int fstatat64(int dirfd, const char *pathname, struct stat64 *statbuf, int flags) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked_at(dirfd, pathname)) BLOCK_AND_RETURN(-1);
+    trace_path(flags & AT_SYMLINK_NOFOLLOW ? 'L' : 'S', dirfd, pathname);
     orig_fstatat64_fn orig = dlsym(RTLD_NEXT, "fstatat64");
     return orig(dirfd, pathname, statbuf, flags);
 }
@@ -595,42 +1634,54 @@ int fstatat64(int dirfd, const char *pathname, struct stat64 *statbuf, int flags
 /* Also intercept __xstat family used by some glibc versions */
 typedef int (*orig___xstat_fn)(int, const char *, struct stat *);
 int __xstat(int ver, const char *pathname, struct stat *statbuf) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) BLOCK_AND_RETURN(-1);
+    trace_path('S', AT_FDCWD, pathname);
     orig___xstat_fn orig = dlsym(RTLD_NEXT, "__xstat");
     return orig(ver, pathname, statbuf);
 }
 
 typedef int (*orig___xstat64_fn)(int, const char *, struct stat64 *);
 int __xstat64(int ver, const char *pathname, struct stat64 *statbuf) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) BLOCK_AND_RETURN(-1);
+    trace_path('S', AT_FDCWD, pathname);
     orig___xstat64_fn orig = dlsym(RTLD_NEXT, "__xstat64");
     return orig(ver, pathname, statbuf);
 }
 
 typedef int (*orig___lxstat_fn)(int, const char *, struct stat *);
 int __lxstat(int ver, const char *pathname, struct stat *statbuf) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) BLOCK_AND_RETURN(-1);
+    trace_path('L', AT_FDCWD, pathname);
     orig___lxstat_fn orig = dlsym(RTLD_NEXT, "__lxstat");
     return orig(ver, pathname, statbuf);
 }
 
 typedef int (*orig___lxstat64_fn)(int, const char *, struct stat64 *);
 int __lxstat64(int ver, const char *pathname, struct stat64 *statbuf) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) BLOCK_AND_RETURN(-1);
+    trace_path('L', AT_FDCWD, pathname);
     orig___lxstat64_fn orig = dlsym(RTLD_NEXT, "__lxstat64");
     return orig(ver, pathname, statbuf);
 }
 
 typedef int (*orig___fxstatat_fn)(int, int, const char *, struct stat *, int);
 int __fxstatat(int ver, int dirfd, const char *pathname, struct stat *statbuf, int flags) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked_at(dirfd, pathname)) BLOCK_AND_RETURN(-1);
+    trace_path(flags & AT_SYMLINK_NOFOLLOW ? 'L' : 'S', dirfd, pathname);
     orig___fxstatat_fn orig = dlsym(RTLD_NEXT, "__fxstatat");
     return orig(ver, dirfd, pathname, statbuf, flags);
 }
 
 typedef int (*orig___fxstatat64_fn)(int, int, const char *, struct stat64 *, int);
 int __fxstatat64(int ver, int dirfd, const char *pathname, struct stat64 *statbuf, int flags) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked_at(dirfd, pathname)) BLOCK_AND_RETURN(-1);
+    trace_path(flags & AT_SYMLINK_NOFOLLOW ? 'L' : 'S', dirfd, pathname);
     orig___fxstatat64_fn orig = dlsym(RTLD_NEXT, "__fxstatat64");
     return orig(ver, dirfd, pathname, statbuf, flags);
 }
@@ -638,7 +1689,9 @@ int __fxstatat64(int ver, int dirfd, const char *pathname, struct stat64 *statbu
 /* statx - newer stat interface */
 typedef int (*orig_statx_fn)(int, const char *, int, unsigned int, struct statx *);
 int statx(int dirfd, const char *pathname, int flags, unsigned int mask, struct statx *statxbuf) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked_at(dirfd, pathname)) BLOCK_AND_RETURN(-1);
+    trace_path(flags & AT_SYMLINK_NOFOLLOW ? 'L' : 'S', dirfd, pathname);
     orig_statx_fn orig = dlsym(RTLD_NEXT, "statx");
     return orig(dirfd, pathname, flags, mask, statxbuf);
 }
@@ -649,28 +1702,36 @@ int statx(int dirfd, const char *pathname, int flags, unsigned int mask, struct
 
 typedef int (*orig_access_fn)(const char *, int);
 int access(const char *pathname, int mode) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) BLOCK_AND_RETURN(-1);
+    trace_path('S', AT_FDCWD, pathname);
     orig_access_fn orig = dlsym(RTLD_NEXT, "access");
     return orig(pathname, mode);
 }
 
 typedef int (*orig_faccessat_fn)(int, const char *, int, int);
 int faccessat(int dirfd, const char *pathname, int mode, int flags) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked_at(dirfd, pathname)) BLOCK_AND_RETURN(-1);
+    trace_path(flags & AT_SYMLINK_NOFOLLOW ? 'L' : 'S', dirfd, pathname);
     orig_faccessat_fn orig = dlsym(RTLD_NEXT, "faccessat");
     return orig(dirfd, pathname, mode, flags);
 }
 
 typedef int (*orig_euidaccess_fn)(const char *, int);
 int euidaccess(const char *pathname, int mode) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) BLOCK_AND_RETURN(-1);
+    trace_path('S', AT_FDCWD, pathname);
     orig_euidaccess_fn orig = dlsym(RTLD_NEXT, "euidaccess");
     return orig(pathname, mode);
 }
 
 typedef int (*orig_eaccess_fn)(const char *, int);
 int eaccess(const char *pathname, int mode) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) BLOCK_AND_RETURN(-1);
+    trace_path('S', AT_FDCWD, pathname);
     orig_eaccess_fn orig = dlsym(RTLD_NEXT, "eaccess");
     return orig(pathname, mode);
 }
@@ -681,17 +1742,21 @@ int eaccess(const char *pathname, int mode) {
 
 typedef DIR *(*orig_opendir_fn)(const char *);
 DIR *opendir(const char *name) {
+    PROBE_ENTER(name);
     if (is_path_blocked(name)) {
         errno = EACCES;
         return NULL;
     }
+    trace_path('R', AT_FDCWD, name);
     orig_opendir_fn orig = dlsym(RTLD_NEXT, "opendir");
     return orig(name);
 }
 
 typedef int (*orig_chdir_fn)(const char *);
 int chdir(const char *path) {
+    PROBE_ENTER(path);
     if (is_path_blocked(path)) BLOCK_AND_RETURN(-1);
+    trace_path('S', AT_FDCWD, path);
     orig_chdir_fn orig = dlsym(RTLD_NEXT, "chdir");
     return orig(path);
 }
@@ -702,23 +1767,38 @@ typedef int (*orig_fchdir_fn)(int);
 
 typedef int (*orig_mkdir_fn)(const char *, mode_t);
 int mkdir(const char *pathname, mode_t mode) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly(pathname)) READONLY_AND_RETURN(-1);
     orig_mkdir_fn orig = dlsym(RTLD_NEXT, "mkdir");
-    return orig(pathname, mode);
+    int gate = is_path_tracked(pathname) ? mutation_enter() : 0;
+    int ret = orig(pathname, mode);
+    mutation_exit(gate);
+    return ret;
 }
 
 typedef int (*orig_mkdirat_fn)(int, const char *, mode_t);
 int mkdirat(int dirfd, const char *pathname, mode_t mode) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked_at(dirfd, pathname)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly_at(dirfd, pathname)) READONLY_AND_RETURN(-1);
     orig_mkdirat_fn orig = dlsym(RTLD_NEXT, "mkdirat");
-    return orig(dirfd, pathname, mode);
+    int gate = is_path_tracked_at(dirfd, pathname) ? mutation_enter() : 0;
+    int ret = orig(dirfd, pathname, mode);
+    mutation_exit(gate);
+    return ret;
 }
 
 typedef int (*orig_rmdir_fn)(const char *);
 int rmdir(const char *pathname) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly(pathname)) READONLY_AND_RETURN(-1);
     orig_rmdir_fn orig = dlsym(RTLD_NEXT, "rmdir");
-    return orig(pathname);
+    int gate = is_path_tracked(pathname) ? mutation_enter() : 0;
+    int ret = orig(pathname);
+    mutation_exit(gate);
+    return ret;
 }
 
 /* ============================================================================
@@ -727,54 +1807,96 @@ int rmdir(const char *pathname) {
 
 typedef int (*orig_unlink_fn)(const char *);
 int unlink(const char *pathname) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly_nofollow(pathname)) READONLY_AND_RETURN(-1);
     orig_unlink_fn orig = dlsym(RTLD_NEXT, "unlink");
-    return orig(pathname);
+    int gate = is_path_tracked(pathname) ? mutation_enter() : 0;
+    int ret = orig(pathname);
+    mutation_exit(gate);
+    return ret;
 }
 
 typedef int (*orig_unlinkat_fn)(int, const char *, int);
 int unlinkat(int dirfd, const char *pathname, int flags) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked_at(dirfd, pathname)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly_at_nofollow(dirfd, pathname)) READONLY_AND_RETURN(-1);
     orig_unlinkat_fn orig = dlsym(RTLD_NEXT, "unlinkat");
-    return orig(dirfd, pathname, flags);
+    int gate = is_path_tracked_at(dirfd, pathname) ? mutation_enter() : 0;
+    int ret = orig(dirfd, pathname, flags);
+    mutation_exit(gate);
+    return ret;
 }
 
 typedef int (*orig_rename_fn)(const char *, const char *);
 int rename(const char *oldpath, const char *newpath) {
+    PROBE_ENTER(oldpath);
     if (is_path_blocked(oldpath) || is_path_blocked(newpath)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly_nofollow(oldpath) || is_path_readonly_nofollow(newpath)) READONLY_AND_RETURN(-1);
     orig_rename_fn orig = dlsym(RTLD_NEXT, "rename");
-    return orig(oldpath, newpath);
+    int gate = is_path_tracked(oldpath) || is_path_tracked(newpath) ? mutation_enter() : 0;
+    int ret = orig(oldpath, newpath);
+    mutation_exit(gate);
+    return ret;
 }
 
 typedef int (*orig_renameat_fn)(int, const char *, int, const char *);
 int renameat(int olddirfd, const char *oldpath, int newdirfd, const char *newpath) {
+    PROBE_ENTER(oldpath);
     if (is_path_blocked_at(olddirfd, oldpath) || is_path_blocked_at(newdirfd, newpath)) 
         BLOCK_AND_RETURN(-1);
+    if (is_path_readonly_at_nofollow(olddirfd, oldpath) || is_path_readonly_at_nofollow(newdirfd, newpath))
+        READONLY_AND_RETURN(-1);
     orig_renameat_fn orig = dlsym(RTLD_NEXT, "renameat");
-    return orig(olddirfd, oldpath, newdirfd, newpath);
+    int gate = is_path_tracked_at(olddirfd, oldpath) || is_path_tracked_at(newdirfd, newpath)
+                   ? mutation_enter() : 0;
+    int ret = orig(olddirfd, oldpath, newdirfd, newpath);
+    mutation_exit(gate);
+    return ret;
 }
 
 typedef int (*orig_renameat2_fn)(int, const char *, int, const char *, unsigned int);
 int renameat2(int olddirfd, const char *oldpath, int newdirfd, const char *newpath, unsigned int flags) {
+    PROBE_ENTER(oldpath);
     if (is_path_blocked_at(olddirfd, oldpath) || is_path_blocked_at(newdirfd, newpath)) 
         BLOCK_AND_RETURN(-1);
+    if (is_path_readonly_at_nofollow(olddirfd, oldpath) || is_path_readonly_at_nofollow(newdirfd, newpath))
+        READONLY_AND_RETURN(-1);
     orig_renameat2_fn orig = dlsym(RTLD_NEXT, "renameat2");
-    return orig(olddirfd, oldpath, newdirfd, newpath, flags);
+    int gate = is_path_tracked_at(olddirfd, oldpath) || is_path_tracked_at(newdirfd, newpath)
+                   ? mutation_enter() : 0;
+    int ret = orig(olddirfd, oldpath, newdirfd, newpath, flags);
+    mutation_exit(gate);
+    return ret;
 }
 
 typedef int (*orig_link_fn)(const char *, const char *);
 int link(const char *oldpath, const char *newpath) {
+    PROBE_ENTER(oldpath);
     if (is_path_blocked(oldpath) || is_path_blocked(newpath)) BLOCK_AND_RETURN(-1);
+    /* A hard link to a read-only file would be writable under its new name */
+    if (is_path_readonly(oldpath) || is_path_readonly_nofollow(newpath)) READONLY_AND_RETURN(-1);
     orig_link_fn orig = dlsym(RTLD_NEXT, "link");
-    return orig(oldpath, newpath);
+    int gate = is_path_tracked(oldpath) || is_path_tracked(newpath) ? mutation_enter() : 0;
+    int ret = orig(oldpath, newpath);
+    mutation_exit(gate);
+    return ret;
 }
 
 typedef int (*orig_linkat_fn)(int, const char *, int, const char *, int);
 int linkat(int olddirfd, const char *oldpath, int newdirfd, const char *newpath, int flags) {
+    PROBE_ENTER(oldpath);
     if (is_path_blocked_at(olddirfd, oldpath) || is_path_blocked_at(newdirfd, newpath)) 
         BLOCK_AND_RETURN(-1);
+    if (is_path_readonly_at(olddirfd, oldpath) || is_path_readonly_at_nofollow(newdirfd, newpath))
+        READONLY_AND_RETURN(-1);
     orig_linkat_fn orig = dlsym(RTLD_NEXT, "linkat");
-    return orig(olddirfd, oldpath, newdirfd, newpath, flags);
+    int gate = is_path_tracked_at(olddirfd, oldpath) || is_path_tracked_at(newdirfd, newpath)
+                   ? mutation_enter() : 0;
+    int ret = orig(olddirfd, oldpath, newdirfd, newpath, flags);
+    mutation_exit(gate);
+    return ret;
 }
 
 /*
@@ -836,19 +1958,26 @@ static int is_symlink_target_blocked(const char *target, const char *linkpath) {
 
 typedef int (*orig_symlink_fn)(const char *, const char *);
 int symlink(const char *target, const char *linkpath) {
+    PROBE_ENTER(linkpath);
     /* Block if linkpath is in blocked area, or if target resolves to blocked area */
     if (is_path_blocked(linkpath)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly_nofollow(linkpath)) READONLY_AND_RETURN(-1);
     
     /* For symlink targets, resolve relative to where the symlink is being created */
     if (is_symlink_target_blocked(target, linkpath)) BLOCK_AND_RETURN(-1);
     
     orig_symlink_fn orig = dlsym(RTLD_NEXT, "symlink");
-    return orig(target, linkpath);
+    int gate = is_path_tracked(linkpath) ? mutation_enter() : 0;
+    int ret = orig(target, linkpath);
+    mutation_exit(gate);
+    return ret;
 }
 
 typedef int (*orig_symlinkat_fn)(const char *, int, const char *);
 int symlinkat(const char *target, int newdirfd, const char *linkpath) {
+    PROBE_ENTER(linkpath);
     if (is_path_blocked_at(newdirfd, linkpath)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly_at_nofollow(newdirfd, linkpath)) READONLY_AND_RETURN(-1);
     
     /* For symlinkat, we need to resolve the linkpath first to get the full path,
      * then use that to determine where to resolve the target relative to */
@@ -904,25 +2033,32 @@ int symlinkat(const char *target, int newdirfd, const char *linkpath) {
     }
     
     orig_symlinkat_fn orig = dlsym(RTLD_NEXT, "symlinkat");
-    return orig(target, newdirfd, linkpath);
+    int gate = is_path_tracked_at(newdirfd, linkpath) ? mutation_enter() : 0;
+    int ret = orig(target, newdirfd, linkpath);
+    mutation_exit(gate);
+    return ret;
 }
 
 typedef ssize_t (*orig_readlink_fn)(const char *, char *, size_t);
 ssize_t readlink(const char *pathname, char *buf, size_t bufsiz) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) {
         errno = EACCES;
         return -1;
     }
+    trace_path('L', AT_FDCWD, pathname);
     orig_readlink_fn orig = dlsym(RTLD_NEXT, "readlink");
     return orig(pathname, buf, bufsiz);
 }
 
 typedef ssize_t (*orig_readlinkat_fn)(int, const char *, char *, size_t);
 ssize_t readlinkat(int dirfd, const char *pathname, char *buf, size_t bufsiz) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked_at(dirfd, pathname)) {
         errno = EACCES;
         return -1;
     }
+    trace_path('L', dirfd, pathname);
     orig_readlinkat_fn orig = dlsym(RTLD_NEXT, "readlinkat");
     return orig(dirfd, pathname, buf, bufsiz);
 }
@@ -933,51 +2069,71 @@ ssize_t readlinkat(int dirfd, const char *pathname, char *buf, size_t bufsiz) {
 
 typedef int (*orig_chmod_fn)(const char *, mode_t);
 int chmod(const char *pathname, mode_t mode) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly(pathname)) READONLY_AND_RETURN(-1);
     orig_chmod_fn orig = dlsym(RTLD_NEXT, "chmod");
     return orig(pathname, mode);
 }
 
 typedef int (*orig_fchmodat_fn)(int, const char *, mode_t, int);
 int fchmodat(int dirfd, const char *pathname, mode_t mode, int flags) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked_at(dirfd, pathname)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly_at(dirfd, pathname)) READONLY_AND_RETURN(-1);
     orig_fchmodat_fn orig = dlsym(RTLD_NEXT, "fchmodat");
     return orig(dirfd, pathname, mode, flags);
 }
 
 typedef int (*orig_chown_fn)(const char *, uid_t, gid_t);
 int chown(const char *pathname, uid_t owner, gid_t group) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly(pathname)) READONLY_AND_RETURN(-1);
     orig_chown_fn orig = dlsym(RTLD_NEXT, "chown");
     return orig(pathname, owner, group);
 }
 
 typedef int (*orig_lchown_fn)(const char *, uid_t, gid_t);
 int lchown(const char *pathname, uid_t owner, gid_t group) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly_nofollow(pathname)) READONLY_AND_RETURN(-1);
     orig_lchown_fn orig = dlsym(RTLD_NEXT, "lchown");
     return orig(pathname, owner, group);
 }
 
 typedef int (*orig_fchownat_fn)(int, const char *, uid_t, gid_t, int);
 int fchownat(int dirfd, const char *pathname, uid_t owner, gid_t group, int flags) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked_at(dirfd, pathname)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly_at(dirfd, pathname)) READONLY_AND_RETURN(-1);
     orig_fchownat_fn orig = dlsym(RTLD_NEXT, "fchownat");
     return orig(dirfd, pathname, owner, group, flags);
 }
 
 typedef int (*orig_truncate_fn)(const char *, off_t);
 int truncate(const char *path, off_t length) {
+    PROBE_ENTER(path);
     if (is_path_blocked(path)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly(path)) READONLY_AND_RETURN(-1);
     orig_truncate_fn orig = dlsym(RTLD_NEXT, "truncate");
-    return orig(path, length);
+    int gate = is_path_tracked(path) ? mutation_enter() : 0;
+    int ret = orig(path, length);
+    mutation_exit(gate);
+    return ret;
 }
 
 typedef int (*orig_truncate64_fn)(const char *, off64_t);
 int truncate64(const char *path, off64_t length) {
+    PROBE_ENTER(path);
     if (is_path_blocked(path)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly(path)) READONLY_AND_RETURN(-1);
     orig_truncate64_fn orig = dlsym(RTLD_NEXT, "truncate64");
-    return orig(path, length);
+    int gate = is_path_tracked(path) ? mutation_enter() : 0;
+    int ret = orig(path, length);
+    mutation_exit(gate);
+    return ret;
 }
 
 /* ============================================================================
@@ -986,68 +2142,84 @@ int truncate64(const char *path, off64_t length) {
 
 typedef ssize_t (*orig_getxattr_fn)(const char *, const char *, void *, size_t);
 ssize_t getxattr(const char *path, const char *name, void *value, size_t size) {
+    PROBE_ENTER(path);
     if (is_path_blocked(path)) {
         errno = EACCES;
         return -1;
     }
+    trace_path('S', AT_FDCWD, path);
     orig_getxattr_fn orig = dlsym(RTLD_NEXT, "getxattr");
     return orig(path, name, value, size);
 }
 
 typedef ssize_t (*orig_lgetxattr_fn)(const char *, const char *, void *, size_t);
 ssize_t lgetxattr(const char *path, const char *name, void *value, size_t size) {
+    PROBE_ENTER(path);
     if (is_path_blocked(path)) {
         errno = EACCES;
         return -1;
     }
+    trace_path('L', AT_FDCWD, path);
     orig_lgetxattr_fn orig = dlsym(RTLD_NEXT, "lgetxattr");
     return orig(path, name, value, size);
 }
 
 typedef int (*orig_setxattr_fn)(const char *, const char *, const void *, size_t, int);
 int setxattr(const char *path, const char *name, const void *value, size_t size, int flags) {
+    PROBE_ENTER(path);
     if (is_path_blocked(path)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly(path)) READONLY_AND_RETURN(-1);
     orig_setxattr_fn orig = dlsym(RTLD_NEXT, "setxattr");
     return orig(path, name, value, size, flags);
 }
 
 typedef int (*orig_lsetxattr_fn)(const char *, const char *, const void *, size_t, int);
 int lsetxattr(const char *path, const char *name, const void *value, size_t size, int flags) {
+    PROBE_ENTER(path);
     if (is_path_blocked(path)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly_nofollow(path)) READONLY_AND_RETURN(-1);
     orig_lsetxattr_fn orig = dlsym(RTLD_NEXT, "lsetxattr");
     return orig(path, name, value, size, flags);
 }
 
 typedef int (*orig_removexattr_fn)(const char *, const char *);
 int removexattr(const char *path, const char *name) {
+    PROBE_ENTER(path);
     if (is_path_blocked(path)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly(path)) READONLY_AND_RETURN(-1);
     orig_removexattr_fn orig = dlsym(RTLD_NEXT, "removexattr");
     return orig(path, name);
 }
 
 typedef int (*orig_lremovexattr_fn)(const char *, const char *);
 int lremovexattr(const char *path, const char *name) {
+    PROBE_ENTER(path);
     if (is_path_blocked(path)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly_nofollow(path)) READONLY_AND_RETURN(-1);
     orig_lremovexattr_fn orig = dlsym(RTLD_NEXT, "lremovexattr");
     return orig(path, name);
 }
 
 typedef ssize_t (*orig_listxattr_fn)(const char *, char *, size_t);
 ssize_t listxattr(const char *path, char *list, size_t size) {
+    PROBE_ENTER(path);
     if (is_path_blocked(path)) {
         errno = EACCES;
         return -1;
     }
+    trace_path('S', AT_FDCWD, path);
     orig_listxattr_fn orig = dlsym(RTLD_NEXT, "listxattr");
     return orig(path, list, size);
 }
 
 typedef ssize_t (*orig_llistxattr_fn)(const char *, char *, size_t);
 ssize_t llistxattr(const char *path, char *list, size_t size) {
+    PROBE_ENTER(path);
     if (is_path_blocked(path)) {
         errno = EACCES;
         return -1;
     }
+    trace_path('L', AT_FDCWD, path);
     orig_llistxattr_fn orig = dlsym(RTLD_NEXT, "llistxattr");
     return orig(path, list, size);
 }
@@ -1058,6 +2230,8 @@ ssize_t llistxattr(const char *path, char *list, size_t size) {
 
 typedef char *(*orig_realpath_fn)(const char *, char *);
 char *realpath(const char *path, char *resolved_path) {
+    PROBE_ENTER(path);
+    trace_components(path);
     /* First resolve the path */
     orig_realpath_fn orig = dlsym(RTLD_NEXT, "realpath");
     char *result = orig(path, resolved_path);
@@ -1077,6 +2251,8 @@ char *realpath(const char *path, char *resolved_path) {
 
 typedef char *(*orig_canonicalize_file_name_fn)(const char *);
 char *canonicalize_file_name(const char *path) {
+    PROBE_ENTER(path);
+    trace_components(path);
     orig_canonicalize_file_name_fn orig = dlsym(RTLD_NEXT, "canonicalize_file_name");
     char *result = orig(path);
     
@@ -1094,14 +2270,20 @@ char *canonicalize_file_name(const char *path) {
 
 typedef int (*orig_execve_fn)(const char *, char *const[], char *const[]);
 int execve(const char *pathname, char *const argv[], char *const envp[]) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) BLOCK_AND_RETURN(-1);
+    trace_path('X', AT_FDCWD, pathname);
+    trace_loaded_objects();
     orig_execve_fn orig = dlsym(RTLD_NEXT, "execve");
     return orig(pathname, argv, envp);
 }
 
 typedef int (*orig_execveat_fn)(int, const char *, char *const[], char *const[], int);
 int execveat(int dirfd, const char *pathname, char *const argv[], char *const envp[], int flags) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked_at(dirfd, pathname)) BLOCK_AND_RETURN(-1);
+    trace_path(flags & AT_SYMLINK_NOFOLLOW ? 'L' : 'X', dirfd, pathname);
+    trace_loaded_objects();
     orig_execveat_fn orig = dlsym(RTLD_NEXT, "execveat");
     return orig(dirfd, pathname, argv, envp, flags);
 }
@@ -1120,14 +2302,18 @@ int execveat(int dirfd, const char *pathname, char *const argv[], char *const en
 
 typedef int (*orig_nftw_fn)(const char *, int (*)(const char *, const struct stat *, int, struct FTW *), int, int);
 int nftw(const char *dirpath, int (*fn)(const char *, const struct stat *, int, struct FTW *), int nopenfd, int flags) {
+    PROBE_ENTER(dirpath);
     if (is_path_blocked(dirpath)) BLOCK_AND_RETURN(-1);
+    trace_taint('T', "nftw");
     orig_nftw_fn orig = dlsym(RTLD_NEXT, "nftw");
     return orig(dirpath, fn, nopenfd, flags);
 }
 
 typedef int (*orig_ftw_fn)(const char *, int (*)(const char *, const struct stat *, int), int);
 int ftw(const char *dirpath, int (*fn)(const char *, const struct stat *, int), int nopenfd) {
+    PROBE_ENTER(dirpath);
     if (is_path_blocked(dirpath)) BLOCK_AND_RETURN(-1);
+    trace_taint('T', "ftw");
     orig_ftw_fn orig = dlsym(RTLD_NEXT, "ftw");
     return orig(dirpath, fn, nopenfd);
 }
@@ -1138,60 +2324,535 @@ int ftw(const char *dirpath, int (*fn)(const char *, const struct stat *, int),
 
 typedef int (*orig_utime_fn)(const char *, const struct utimbuf *);
 int utime(const char *filename, const struct utimbuf *times) {
+    PROBE_ENTER(filename);
     if (is_path_blocked(filename)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly(filename)) READONLY_AND_RETURN(-1);
     orig_utime_fn orig = dlsym(RTLD_NEXT, "utime");
     return orig(filename, times);
 }
 
 typedef int (*orig_utimes_fn)(const char *, const struct timeval[2]);
 int utimes(const char *filename, const struct timeval times[2]) {
+    PROBE_ENTER(filename);
     if (is_path_blocked(filename)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly(filename)) READONLY_AND_RETURN(-1);
     orig_utimes_fn orig = dlsym(RTLD_NEXT, "utimes");
     return orig(filename, times);
 }
 
 typedef int (*orig_utimensat_fn)(int, const char *, const struct timespec[2], int);
 int utimensat(int dirfd, const char *pathname, const struct timespec times[2], int flags) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked_at(dirfd, pathname)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly_at(dirfd, pathname)) READONLY_AND_RETURN(-1);
     orig_utimensat_fn orig = dlsym(RTLD_NEXT, "utimensat");
     return orig(dirfd, pathname, times, flags);
 }
 
 typedef int (*orig_futimesat_fn)(int, const char *, const struct timeval[2]);
 int futimesat(int dirfd, const char *pathname, const struct timeval times[2]) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked_at(dirfd, pathname)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly_at(dirfd, pathname)) READONLY_AND_RETURN(-1);
     orig_futimesat_fn orig = dlsym(RTLD_NEXT, "futimesat");
     return orig(dirfd, pathname, times);
 }
 
 typedef int (*orig_mknod_fn)(const char *, mode_t, dev_t);
 int mknod(const char *pathname, mode_t mode, dev_t dev) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly(pathname)) READONLY_AND_RETURN(-1);
     orig_mknod_fn orig = dlsym(RTLD_NEXT, "mknod");
     return orig(pathname, mode, dev);
 }
 
 typedef int (*orig_mknodat_fn)(int, const char *, mode_t, dev_t);
 int mknodat(int dirfd, const char *pathname, mode_t mode, dev_t dev) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked_at(dirfd, pathname)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly_at(dirfd, pathname)) READONLY_AND_RETURN(-1);
     orig_mknodat_fn orig = dlsym(RTLD_NEXT, "mknodat");
     return orig(dirfd, pathname, mode, dev);
 }
 
 typedef int (*orig_mkfifo_fn)(const char *, mode_t);
 int mkfifo(const char *pathname, mode_t mode) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked(pathname)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly(pathname)) READONLY_AND_RETURN(-1);
     orig_mkfifo_fn orig = dlsym(RTLD_NEXT, "mkfifo");
     return orig(pathname, mode);
 }
 
 typedef int (*orig_mkfifoat_fn)(int, const char *, mode_t);
 int mkfifoat(int dirfd, const char *pathname, mode_t mode) {
+    PROBE_ENTER(pathname);
     if (is_path_blocked_at(dirfd, pathname)) BLOCK_AND_RETURN(-1);
+    if (is_path_readonly_at(dirfd, pathname)) READONLY_AND_RETURN(-1);
     orig_mkfifoat_fn orig = dlsym(RTLD_NEXT, "mkfifoat");
     return orig(dirfd, pathname, mode);
 }
 
+/* ============================================================================
+ * Intercepted functions - Durability (fsync family)
+ *
+ * Files under SANDBOX_EPHEMERAL_ROOTS are snapshotted once at the end of the
+ * episode and then discarded, so per-write durability buys nothing there while
+ * pip, sqlite, git and conda sync constantly. With SANDBOX_RELAXED_DURABILITY=1
+ * these calls become no-ops for such files; the snapshot handler issues a
+ * single syncfs() barrier before archiving instead.
+ * ============================================================================ */
+
+typedef int (*orig_fsync_fn)(int);
+int fsync(int fd) {
+    if (is_fd_ephemeral(fd)) return 0;
+    orig_fsync_fn orig = dlsym(RTLD_NEXT, "fsync");
+    return orig(fd);
+}
+
+typedef int (*orig_fdatasync_fn)(int);
+int fdatasync(int fd) {
+    if (is_fd_ephemeral(fd)) return 0;
+    orig_fdatasync_fn orig = dlsym(RTLD_NEXT, "fdatasync");
+    return orig(fd);
+}
+
+typedef int (*orig_sync_file_range_fn)(int, off64_t, off64_t, unsigned int);
+int sync_file_range(int fd, off64_t offset, off64_t nbytes, unsigned int flags) {
+    if (is_fd_ephemeral(fd)) return 0;
+    orig_sync_file_range_fn orig = dlsym(RTLD_NEXT, "sync_file_range");
+    return orig(fd, offset, nbytes, flags);
+}
+
+typedef int (*orig_syncfs_fn)(int);
+int syncfs(int fd) {
+    if (is_fd_ephemeral(fd)) return 0;
+    orig_syncfs_fn orig = dlsym(RTLD_NEXT, "syncfs");
+    return orig(fd);
+}
+
+/* ============================================================================
+ * Intercepted functions - Write accounting (disk quota) and quiescing
+ *
+ * Bytes written to files under SANDBOX_TRACKED_ROOTS are charged to the
+ * execution's slot in the shared segment, so one runaway script can't fill the
+ * container disk and break every later tool call and the final snapshot.
+ * The same writes pass the snapshot quiesce gate (see mutation_enter).
+ * These sit on the hot path of every write, so the original functions are
+ * resolved once and cached instead of looked up per call.
+ *
+ * stdio buffers and flushes through glibc-internal calls, so bulk stdio
+ * writers (fwrite/fputs, as used by head, tail and friends) are charged at
+ * the call instead. The printf family and writes through a shared mapping
+ * are not charged.
+ * ============================================================================ */
+
+#define RESOLVE_ORIG(type, name) ({ \
+    static type cached_##name; \
+    if (!cached_##name) cached_##name = (type)dlsym(RTLD_NEXT, #name); \
+    cached_##name; \
+})
+
+static uint64_t iov_total(const struct iovec *iov, int iovcnt) {
+    uint64_t total = 0;
+    for (int i = 0; i < iovcnt; i++) total += iov[i].iov_len;
+    return total;
+}
+
+typedef ssize_t (*orig_write_fn)(int, const void *, size_t);
+ssize_t write(int fd, const void *buf, size_t count) {
+    orig_write_fn orig = RESOLVE_ORIG(orig_write_fn, write);
+    if (!is_fd_tracked(fd)) return orig(fd, buf, count);
+    int gate = tracked_write_begin(count);
+    if (gate < 0) return -1;
+    ssize_t ret = orig(fd, buf, count);
+    tracked_write_end(gate, count, ret);
+    return ret;
+}
+
+typedef ssize_t (*orig_pwrite_fn)(int, const void *, size_t, off_t);
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) {
+    orig_pwrite_fn orig = RESOLVE_ORIG(orig_pwrite_fn, pwrite);
+    if (!is_fd_tracked(fd)) return orig(fd, buf, count, offset);
+    int gate = tracked_write_begin(count);
+    if (gate < 0) return -1;
+    ssize_t ret = orig(fd, buf, count, offset);
+    tracked_write_end(gate, count, ret);
+    return ret;
+}
+
+typedef ssize_t (*orig_pwrite64_fn)(int, const void *, size_t, off64_t);
+ssize_t pwrite64(int fd, const void *buf, size_t count, off64_t offset) {
+    orig_pwrite64_fn orig = RESOLVE_ORIG(orig_pwrite64_fn, pwrite64);
+    if (!is_fd_tracked(fd)) return orig(fd, buf, count, offset);
+    int gate = tracked_write_begin(count);
+    if (gate < 0) return -1;
+    ssize_t ret = orig(fd, buf, count, offset);
+    tracked_write_end(gate, count, ret);
+    return ret;
+}
+
+typedef ssize_t (*orig_writev_fn)(int, const struct iovec *, int);
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+    orig_writev_fn orig = RESOLVE_ORIG(orig_writev_fn, writev);
+    if (!is_fd_tracked(fd)) return orig(fd, iov, iovcnt);
+    uint64_t total = iov_total(iov, iovcnt);
+    int gate = tracked_write_begin(total);
+    if (gate < 0) return -1;
+    ssize_t ret = orig(fd, iov, iovcnt);
+    tracked_write_end(gate, total, ret);
+    return ret;
+}
+
+typedef ssize_t (*orig_pwritev_fn)(int, const struct iovec *, int, off_t);
+ssize_t pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
+    orig_pwritev_fn orig = RESOLVE_ORIG(orig_pwritev_fn, pwritev);
+    if (!is_fd_tracked(fd)) return orig(fd, iov, iovcnt, offset);
+    uint64_t total = iov_total(iov, iovcnt);
+    int gate = tracked_write_begin(total);
+    if (gate < 0) return -1;
+    ssize_t ret = orig(fd, iov, iovcnt, offset);
+    tracked_write_end(gate, total, ret);
+    return ret;
+}
+
+typedef ssize_t (*orig_pwritev64_fn)(int, const struct iovec *, int, off64_t);
+ssize_t pwritev64(int fd, const struct iovec *iov, int iovcnt, off64_t offset) {
+    orig_pwritev64_fn orig = RESOLVE_ORIG(orig_pwritev64_fn, pwritev64);
+    if (!is_fd_tracked(fd)) return orig(fd, iov, iovcnt, offset);
+    uint64_t total = iov_total(iov, iovcnt);
+    int gate = tracked_write_begin(total);
+    if (gate < 0) return -1;
+    ssize_t ret = orig(fd, iov, iovcnt, offset);
+    tracked_write_end(gate, total, ret);
+    return ret;
+}
+
+/* Python's shutil.copyfile() uses sendfile(), cp uses copy_file_range() */
+typedef ssize_t (*orig_sendfile_fn)(int, int, off_t *, size_t);
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+    orig_sendfile_fn orig = RESOLVE_ORIG(orig_sendfile_fn, sendfile);
+    if (!is_fd_tracked(out_fd)) return orig(out_fd, in_fd, offset, count);
+    int gate = tracked_write_begin(count);
+    if (gate < 0) return -1;
+    ssize_t ret = orig(out_fd, in_fd, offset, count);
+    tracked_write_end(gate, count, ret);
+    return ret;
+}
+
+typedef ssize_t (*orig_sendfile64_fn)(int, int, off64_t *, size_t);
+ssize_t sendfile64(int out_fd, int in_fd, off64_t *offset, size_t count) {
+    orig_sendfile64_fn orig = RESOLVE_ORIG(orig_sendfile64_fn, sendfile64);
+    if (!is_fd_tracked(out_fd)) return orig(out_fd, in_fd, offset, count);
+    int gate = tracked_write_begin(count);
+    if (gate < 0) return -1;
+    ssize_t ret = orig(out_fd, in_fd, offset, count);
+    tracked_write_end(gate, count, ret);
+    return ret;
+}
+
+typedef ssize_t (*orig_copy_file_range_fn)(int, off64_t *, int, off64_t *, size_t, unsigned int);
+ssize_t copy_file_range(int fd_in, off64_t *off_in, int fd_out, off64_t *off_out, size_t len, unsigned int flags) {
+    orig_copy_file_range_fn orig = RESOLVE_ORIG(orig_copy_file_range_fn, copy_file_range);
+    if (!is_fd_tracked(fd_out)) return orig(fd_in, off_in, fd_out, off_out, len, flags);
+    int gate = tracked_write_begin(len);
+    if (gate < 0) return -1;
+    ssize_t ret = orig(fd_in, off_in, fd_out, off_out, len, flags);
+    tracked_write_end(gate, len, ret);
+    return ret;
+}
+
+/* Preallocation is charged in full; punching or collapsing ranges is free but still gated */
+typedef int (*orig_fallocate_fn)(int, int, off_t, off_t);
+int fallocate(int fd, int mode, off_t offset, off_t len) {
+    orig_fallocate_fn orig = RESOLVE_ORIG(orig_fallocate_fn, fallocate);
+    if (!is_fd_tracked(fd)) return orig(fd, mode, offset, len);
+    uint64_t charge = (len > 0 && !(mode & (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_COLLAPSE_RANGE)))
+                      ? (uint64_t)len : 0;
+    int gate = tracked_write_begin(charge);
+    if (gate < 0) return -1;
+    int ret = orig(fd, mode, offset, len);
+    tracked_write_end(gate, charge, ret == 0 ? (ssize_t)charge : -1);
+    return ret;
+}
+
+typedef int (*orig_fallocate64_fn)(int, int, off64_t, off64_t);
+int fallocate64(int fd, int mode, off64_t offset, off64_t len) {
+    orig_fallocate64_fn orig = RESOLVE_ORIG(orig_fallocate64_fn, fallocate64);
+    if (!is_fd_tracked(fd)) return orig(fd, mode, offset, len);
+    uint64_t charge = (len > 0 && !(mode & (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_COLLAPSE_RANGE)))
+                      ? (uint64_t)len : 0;
+    int gate = tracked_write_begin(charge);
+    if (gate < 0) return -1;
+    int ret = orig(fd, mode, offset, len);
+    tracked_write_end(gate, charge, ret == 0 ? (ssize_t)charge : -1);
+    return ret;
+}
+
+/* Growing a file through ftruncate is charged for the extension only */
+static uint64_t truncate_growth(int fd, off64_t length) {
+    struct stat64 st;
+    if (fstat64(fd, &st) != 0 || length <= st.st_size) return 0;
+    return (uint64_t)(length - st.st_size);
+}
+
+typedef int (*orig_ftruncate_fn)(int, off_t);
+int ftruncate(int fd, off_t length) {
+    orig_ftruncate_fn orig = RESOLVE_ORIG(orig_ftruncate_fn, ftruncate);
+    if (!is_fd_tracked(fd)) return orig(fd, length);
+    uint64_t growth = truncate_growth(fd, length);
+    int gate = tracked_write_begin(growth);
+    if (gate < 0) return -1;
+    int ret = orig(fd, length);
+    tracked_write_end(gate, growth, ret == 0 ? (ssize_t)growth : -1);
+    return ret;
+}
+
+typedef int (*orig_ftruncate64_fn)(int, off64_t);
+int ftruncate64(int fd, off64_t length) {
+    orig_ftruncate64_fn orig = RESOLVE_ORIG(orig_ftruncate64_fn, ftruncate64);
+    if (!is_fd_tracked(fd)) return orig(fd, length);
+    uint64_t growth = truncate_growth(fd, length);
+    int gate = tracked_write_begin(growth);
+    if (gate < 0) return -1;
+    int ret = orig(fd, length);
+    tracked_write_end(gate, growth, ret == 0 ? (ssize_t)growth : -1);
+    return ret;
+}
+
+/* A refused stdio write reports zero items written with errno=ENOSPC */
+typedef size_t (*orig_fwrite_fn)(const void *, size_t, size_t, FILE *);
+size_t fwrite(const void *ptr, size_t size, size_t nmemb, FILE *stream) {
+    orig_fwrite_fn orig = RESOLVE_ORIG(orig_fwrite_fn, fwrite);
+    if (!is_fd_tracked(fileno(stream))) return orig(ptr, size, nmemb, stream);
+    uint64_t total = (uint64_t)size * nmemb;
+    int gate = tracked_write_begin(total);
+    if (gate < 0) return 0;
+    size_t ret = orig(ptr, size, nmemb, stream);
+    tracked_write_end(gate, total, (ssize_t)(ret * size));
+    return ret;
+}
+
+/* glibc may provide these as macros when optimizing */
+#undef fwrite_unlocked
+#undef fputs_unlocked
+
+typedef size_t (*orig_fwrite_unlocked_fn)(const void *, size_t, size_t, FILE *);
+size_t fwrite_unlocked(const void *ptr, size_t size, size_t nmemb, FILE *stream) {
+    orig_fwrite_unlocked_fn orig = RESOLVE_ORIG(orig_fwrite_unlocked_fn, fwrite_unlocked);
+    if (!is_fd_tracked(fileno_unlocked(stream))) return orig(ptr, size, nmemb, stream);
+    uint64_t total = (uint64_t)size * nmemb;
+    int gate = tracked_write_begin(total);
+    if (gate < 0) return 0;
+    size_t ret = orig(ptr, size, nmemb, stream);
+    tracked_write_end(gate, total, (ssize_t)(ret * size));
+    return ret;
+}
+
+typedef int (*orig_fputs_fn)(const char *, FILE *);
+int fputs(const char *s, FILE *stream) {
+    orig_fputs_fn orig = RESOLVE_ORIG(orig_fputs_fn, fputs);
+    if (!is_fd_tracked(fileno(stream))) return orig(s, stream);
+    uint64_t total = strlen(s);
+    int gate = tracked_write_begin(total);
+    if (gate < 0) return EOF;
+    int ret = orig(s, stream);
+    tracked_write_end(gate, total, ret == EOF ? -1 : (ssize_t)total);
+    return ret;
+}
+
+typedef int (*orig_fputs_unlocked_fn)(const char *, FILE *);
+int fputs_unlocked(const char *s, FILE *stream) {
+    orig_fputs_unlocked_fn orig = RESOLVE_ORIG(orig_fputs_unlocked_fn, fputs_unlocked);
+    if (!is_fd_tracked(fileno_unlocked(stream))) return orig(s, stream);
+    uint64_t total = strlen(s);
+    int gate = tracked_write_begin(total);
+    if (gate < 0) return EOF;
+    int ret = orig(s, stream);
+    tracked_write_end(gate, total, ret == EOF ? -1 : (ssize_t)total);
+    return ret;
+}
+
+/* fd numbers are reused, so the cached classification dies with the fd */
+typedef int (*orig_close_fn)(int);
+int close(int fd) {
+    forget_fd(fd);
+    orig_close_fn orig = RESOLVE_ORIG(orig_close_fn, close);
+    return orig(fd);
+}
+
+typedef int (*orig_fclose_fn)(FILE *);
+int fclose(FILE *stream) {
+    if (stream) forget_fd(fileno(stream));
+    orig_fclose_fn orig = RESOLVE_ORIG(orig_fclose_fn, fclose);
+    return orig(stream);
+}
+
+typedef int (*orig_dup_fn)(int);
+int dup(int oldfd) {
+    orig_dup_fn orig = RESOLVE_ORIG(orig_dup_fn, dup);
+    int ret = orig(oldfd);
+    if (ret >= 0) forget_fd(ret);
+    return ret;
+}
+
+typedef int (*orig_dup2_fn)(int, int);
+int dup2(int oldfd, int newfd) {
+    orig_dup2_fn orig = RESOLVE_ORIG(orig_dup2_fn, dup2);
+    int ret = orig(oldfd, newfd);
+    if (ret >= 0 && oldfd != newfd) forget_fd(newfd);
+    return ret;
+}
+
+typedef int (*orig_dup3_fn)(int, int, int);
+int dup3(int oldfd, int newfd, int flags) {
+    orig_dup3_fn orig = RESOLVE_ORIG(orig_dup3_fn, dup3);
+    int ret = orig(oldfd, newfd, flags);
+    if (ret >= 0) forget_fd(newfd);
+    return ret;
+}
+
+/*
+ * fcntl is only interposed for the commands that hand out a new fd; the rest
+ * pass straight through. Every command's argument is at most pointer sized.
+ * fcntl64 is what fcntl resolves to in callers built with 64-bit off_t.
+ */
+#define FCNTL_DUPS(cmd) ((cmd) == F_DUPFD || (cmd) == F_DUPFD_CLOEXEC)
+
+typedef int (*orig_fcntl_fn)(int, int, ...);
+int fcntl(int fd, int cmd, ...) {
+    va_list args;
+    va_start(args, cmd);
+    void *arg = va_arg(args, void *);
+    va_end(args);
+    orig_fcntl_fn orig = RESOLVE_ORIG(orig_fcntl_fn, fcntl);
+    int ret = orig(fd, cmd, arg);
+    if (ret >= 0 && FCNTL_DUPS(cmd)) forget_fd(ret);
+    return ret;
+}
+
+typedef int (*orig_fcntl64_fn)(int, int, ...);
+int fcntl64(int fd, int cmd, ...) {
+    va_list args;
+    va_start(args, cmd);
+    void *arg = va_arg(args, void *);
+    va_end(args);
+    orig_fcntl64_fn orig = RESOLVE_ORIG(orig_fcntl64_fn, fcntl64);
+    if (!orig) orig = RESOLVE_ORIG(orig_fcntl_fn, fcntl);
+    int ret = orig(fd, cmd, arg);
+    if (ret >= 0 && FCNTL_DUPS(cmd)) forget_fd(ret);
+    return ret;
+}
+
+/*
+ * Bulk closes: CPython's os.closerange() and subprocess's close_fds, run in a
+ * forked child, close every fd above 2 without going through close(). Declared
+ * here because older headers lack them; glibc before 2.34 has neither.
+ */
+#ifndef CLOSE_RANGE_CLOEXEC
+#define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+
+static void forget_fd_range(unsigned int first, unsigned int last) {
+    if (first >= MAX_TRACKED_FDS) return;
+    if (last >= MAX_TRACKED_FDS) last = MAX_TRACKED_FDS - 1;
+    if (first <= last) memset(&fd_state[first], FD_UNKNOWN, last - first + 1);
+}
+
+typedef int (*orig_close_range_fn)(unsigned int, unsigned int, int);
+int close_range(unsigned int first, unsigned int last, int flags) {
+    orig_close_range_fn orig = RESOLVE_ORIG(orig_close_range_fn, close_range);
+    int ret;
+    if (orig) {
+        ret = orig(first, last, flags);
+    } else {
+#ifdef SYS_close_range
+        ret = (int)syscall(SYS_close_range, first, last, flags);
+#else
+        errno = ENOSYS;
+        ret = -1;
+#endif
+    }
+    // CLOSE_RANGE_CLOEXEC only marks the fds; they close at exec, with the table
+    if (ret == 0 && !(flags & CLOSE_RANGE_CLOEXEC)) forget_fd_range(first, last);
+    return ret;
+}
+
+typedef void (*orig_closefrom_fn)(int);
+void closefrom(int lowfd) {
+    orig_closefrom_fn orig = RESOLVE_ORIG(orig_closefrom_fn, closefrom);
+    if (orig) orig(lowfd);
+    if (lowfd >= 0) forget_fd_range((unsigned int)lowfd, MAX_TRACKED_FDS - 1);
+}
+
+/* ============================================================================
+ * Intercepted functions - Nondeterminism (execution tracing only)
+ *
+ * A run whose output may depend on the date, on randomness or on the network
+ * is never reused, so these only mark the trace (see "Execution tracing").
+ * time() is left alone: interpreters call it at startup to work out the
+ * timezone, and anything after the current date reads a finer clock.
+ * glob() and scandir() read directories through glibc-internal calls the
+ * trace can't see, so they mark it too. The library's own clock reads use
+ * clock_now() and don't come through here.
+ * ============================================================================ */
+
+typedef int (*orig_gettimeofday_fn)(struct timeval *, void *);
+int gettimeofday(struct timeval *restrict tv, void *restrict tz) {
+    trace_taint('T', "gettimeofday");
+    return RESOLVE_ORIG(orig_gettimeofday_fn, gettimeofday)(tv, tz);
+}
+
+/*
+ * Only wall-clock reads count: interpreters read the monotonic clocks for lock
+ * timeouts on every start, and a reused run reporting the durations it
+ * measured the first time is still a faithful answer.
+ */
+int clock_gettime(clockid_t clk, struct timespec *ts) {
+    if (clk == CLOCK_REALTIME || clk == CLOCK_REALTIME_COARSE || clk == CLOCK_TAI ||
+        clk == CLOCK_REALTIME_ALARM) {
+        trace_taint('T', "clock_gettime");
+    }
+    return clock_now(clk, ts);
+}
+
+typedef ssize_t (*orig_getrandom_fn)(void *, size_t, unsigned int);
+ssize_t getrandom(void *buf, size_t buflen, unsigned int flags) {
+    trace_taint('T', "getrandom");
+    return RESOLVE_ORIG(orig_getrandom_fn, getrandom)(buf, buflen, flags);
+}
+
+typedef int (*orig_getentropy_fn)(void *, size_t);
+int getentropy(void *buf, size_t buflen) {
+    trace_taint('T', "getentropy");
+    return RESOLVE_ORIG(orig_getentropy_fn, getentropy)(buf, buflen);
+}
+
+typedef int (*orig_socket_fn)(int, int, int);
+int socket(int domain, int type, int protocol) {
+    trace_taint('N', "socket");
+    return RESOLVE_ORIG(orig_socket_fn, socket)(domain, type, protocol);
+}
+
+typedef int (*orig_glob_fn)(const char *, int, int (*)(const char *, int), glob_t *);
+int glob(const char *restrict pattern, int flags, int (*errfunc)(const char *, int),
+         glob_t *restrict pglob) {
+    trace_taint('T', "glob");
+    return RESOLVE_ORIG(orig_glob_fn, glob)(pattern, flags, errfunc, pglob);
+}
+
+typedef int (*orig_scandir_fn)(const char *, struct dirent ***, int (*)(const struct dirent *),
+                               int (*)(const struct dirent **, const struct dirent **));
+int scandir(const char *restrict dirp, struct dirent ***restrict namelist,
+            int (*filter)(const struct dirent *),
+            int (*compar)(const struct dirent **, const struct dirent **)) {
+    PROBE_ENTER(dirp);
+    if (is_path_blocked(dirp)) BLOCK_AND_RETURN(-1);
+    trace_taint('T', "scandir");
+    return RESOLVE_ORIG(orig_scandir_fn, scandir)(dirp, namelist, filter, compar);
+}
+
 /* ============================================================================
  * Library constructor/destructor
  * ============================================================================ */
@@ -1205,7 +2866,17 @@ static void sandbox_init(void) {
 __attribute__((destructor))
 static void sandbox_cleanup(void) {
     DEBUG_LOG("Sandbox cleanup");
+    trace_loaded_objects();
     for (int i = 0; i < blocked_paths_count; i++) {
         free(blocked_paths[i]);
     }
+    for (int i = 0; i < ephemeral_roots_count; i++) {
+        free(ephemeral_roots[i]);
+    }
+    for (int i = 0; i < tracked_roots_count; i++) {
+        free(tracked_roots[i]);
+    }
+    for (int i = 0; i < readonly_paths_count; i++) {
+        free(readonly_paths[i]);
+    }
 }
@@ -0,0 +1,87 @@
+"""Tests for the USDT probes compiled into sandbox_fs.so."""
+
+import re
+import shutil
+import subprocess
+from pathlib import Path
+
+import pytest
+
+SOURCE = Path(__file__).resolve().parent.parent / "sandbox_fs.c"
+
+EXPECTED_PROBES = {
+    "policy_init",
+    "enter",
+    "match_normalized",
+    "match_resolved",
+    "match_parent",
+    "dirfd_failed",
+    "check",
+    "audit",
+}
+
+
+def _build(output: Path, *flags: str) -> Path:
+    subprocess.run(
+        ["gcc", "-shared", "-fPIC", "-O2", *flags, "-o", str(output), str(SOURCE)]
+        + ["-ldl", "-lpthread"],
+        check=True,
+        capture_output=True,
+    )
+    return output
+
+
+def _stapsdt_notes(library: Path) -> list[dict[str, str]]:
+    """Parse the NT_STAPSDT entries printed by `readelf -n`."""
+    out = subprocess.run(
+        ["readelf", "-n", str(library)], check=True, capture_output=True, text=True
+    ).stdout
+    notes = []
+    for block in out.split("NT_STAPSDT")[1:]:
+        fields = dict(re.findall(r"(Provider|Name|Semaphore): (\S+)", block))
+        notes.append(fields)
+    return notes
+
+
+def _have_sdt_header(tmp_path: Path) -> bool:
+    probe = tmp_path / "sdt_check.c"
+    probe.write_text("#include <sys/sdt.h>\nint main(void) { return 0; }\n")
+    result = subprocess.run(
+        ["gcc", "-fsyntax-only", str(probe)], capture_output=True, check=False
+    )
+    return result.returncode == 0
+
+
+@pytest.fixture(scope="module")
+def build_dir(tmp_path_factory: pytest.TempPathFactory) -> Path:
+    if shutil.which("gcc") is None or shutil.which("readelf") is None:
+        pytest.skip("gcc and readelf are required")
+    return tmp_path_factory.mktemp("probes")
+
+
+class TestSandboxProbes:
+    """The probe notes are what bpftrace/perf/stap use to attach."""
+
+    def test_note_section_lists_all_probes(self, build_dir: Path) -> None:
+        """Every probe is listed under the sandbox_fs provider."""
+        if not _have_sdt_header(build_dir):
+            pytest.skip("sys/sdt.h not installed (systemtap-sdt-dev)")
+        notes = _stapsdt_notes(_build(build_dir / "sandbox_fs.so"))
+
+        assert {n["Provider"] for n in notes} == {"sandbox_fs"}
+        assert {n["Name"] for n in notes} == EXPECTED_PROBES
+
+    def test_probes_are_semaphore_gated(self, build_dir: Path) -> None:
+        """Probe arguments are only computed while a tracer is attached."""
+        if not _have_sdt_header(build_dir):
+            pytest.skip("sys/sdt.h not installed (systemtap-sdt-dev)")
+        notes = _stapsdt_notes(_build(build_dir / "sandbox_fs.so"))
+
+        assert notes
+        assert all(int(n["Semaphore"], 16) != 0 for n in notes)
+
+    def test_probes_can_be_compiled_out(self, build_dir: Path) -> None:
+        """-DSANDBOX_NO_USDT leaves no probe notes behind."""
+        library = _build(build_dir / "sandbox_fs_nousdt.so", "-DSANDBOX_NO_USDT")
+
+        assert _stapsdt_notes(library) == []
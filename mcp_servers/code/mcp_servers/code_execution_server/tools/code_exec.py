@@ -1,5 +1,7 @@
 import os
 import re
+import uuid
+from functools import partial
 
 from loguru import logger
 from models.code_exec import (
@@ -7,11 +9,24 @@ from models.code_exec import (
     CodeExecResponse,
 )
 from utils.decorators import make_async_background
+from utils.memo import CommandMemo
+from utils.package_cache import PackageStore
+from utils.prewarm import (
+    DEFAULT_BUDGET_SECONDS,
+    DEFAULT_PROFILE_PATH,
+    AccessProfile,
+    default_paths,
+    prewarm,
+)
+from utils.process_tree import EXEC_TOKEN_ENV, become_subreaper
 from utils.sandbox import (
+    AUDIT_RULE_PREFIX,
     DEFAULT_LIBRARY_PATH,
+    build_sandbox_env,
     run_sandboxed_command,
     verify_sandbox_library_available,
 )
+from utils.shared_segment import DEFAULT_SEGMENT_PATH, SharedSegment
 
 MAX_OUTPUT_SIZE = 100_000  # 100KB general limit
 MAX_HTML_OUTPUT_SIZE = 2_000  # 2KB for HTML content
@@ -43,6 +58,45 @@ CODE_EXEC_COMMAND_TIMEOUT = os.getenv("CODE_EXEC_COMMAND_TIMEOUT", "300")
 SANDBOX_LIBRARY_PATH = os.getenv("SANDBOX_LIBRARY_PATH", DEFAULT_LIBRARY_PATH)
 # Paths to hide from code execution
 BLOCKED_PATHS = ["/app", "/.apps_data"]
+# Candidate rules evaluated in audit-only mode: would-denies are counted (and
+# logged to CODE_EXEC_AUDIT_LOG) but the calls are allowed
+AUDIT_BLOCKED_PATHS = [
+    p for p in os.getenv("CODE_EXEC_AUDIT_BLOCKED_PATHS", "").split(":") if p
+]
+AUDIT_READONLY_PATHS = [
+    p for p in os.getenv("CODE_EXEC_AUDIT_READONLY_PATHS", "").split(":") if p
+]
+CODE_EXEC_AUDIT_LOG = os.getenv("CODE_EXEC_AUDIT_LOG", "")
+# Skip fsync & co. under the (snapshotted, then discarded) filesystem root
+RELAXED_DURABILITY = (
+    os.getenv("CODE_EXEC_RELAXED_DURABILITY", "false").lower() == "true"
+)
+EPHEMERAL_ROOTS = [
+    p for p in os.getenv("CODE_EXEC_EPHEMERAL_ROOTS", FS_ROOT).split(":") if p
+]
+# Per-execution cap on bytes written under the filesystem root (0 = no quota)
+CODE_EXEC_WRITE_QUOTA_BYTES = os.getenv("CODE_EXEC_WRITE_QUOTA_BYTES", "0")
+SANDBOX_SHARED_SEGMENT = os.getenv("SANDBOX_SHARED_SEGMENT", DEFAULT_SEGMENT_PATH)
+# Shared wheel/bytecode store, read-only inside the sandbox. Off unless set, e.g. to
+# /var/cache/sandbox-packages on a volume shared between containers (see
+# utils/package_cache.py)
+CODE_EXEC_PACKAGE_STORE = os.getenv("CODE_EXEC_PACKAGE_STORE", "")
+INTERNET_ENABLED = os.getenv("INTERNET_ENABLED", "true").lower() == "true"
+# Kill daemons/background jobs a command leaves behind when it exits
+KILL_BACKGROUND = os.getenv("CODE_EXEC_KILL_BACKGROUND", "true").lower() == "true"
+# Reuse the result of a rerun whose traced inputs are unchanged (see utils/memo.py)
+MEMOIZE = os.getenv("CODE_EXEC_MEMOIZE", "false").lower() == "true"
+# Read the files executions use into the page cache at startup (see utils/prewarm.py)
+PREWARM = os.getenv("CODE_EXEC_PREWARM", "true").lower() == "true"
+CODE_EXEC_PREWARM_PROFILE = os.getenv("CODE_EXEC_PREWARM_PROFILE", DEFAULT_PROFILE_PATH)
+CODE_EXEC_PREWARM_SECONDS = os.getenv(
+    "CODE_EXEC_PREWARM_SECONDS", str(DEFAULT_BUDGET_SECONDS)
+)
+
+_segment: SharedSegment | None = None
+_package_store: PackageStore | None = None
+_memo: CommandMemo | None = None
+_profile: AccessProfile | None = None
 
 
 def verify_sandbox_available() -> None:
@@ -53,6 +107,96 @@ def verify_sandbox_available() -> None:
     """
     verify_sandbox_library_available(SANDBOX_LIBRARY_PATH)
 
+    # Orphaned descendants (setsid, double-forked daemons) are re-parented here
+    # so they can be found and killed after the command finishes
+    become_subreaper()
+
+    # The shared segment carries the write quota and the snapshot quiesce count.
+    # Quiescing is best-effort, a configured quota is not.
+    global _segment
+    try:
+        _segment = SharedSegment.create(SANDBOX_SHARED_SEGMENT)
+    except OSError as e:
+        if int(CODE_EXEC_WRITE_QUOTA_BYTES) > 0:
+            raise RuntimeError(
+                f"Cannot create shared sandbox segment at {SANDBOX_SHARED_SEGMENT} "
+                "required by CODE_EXEC_WRITE_QUOTA_BYTES"
+            ) from e
+        logger.warning(
+            f"Shared sandbox segment unavailable ({e}); "
+            "snapshots will not quiesce running commands"
+        )
+
+    # The package store only speeds up installs, so it is best-effort too
+    global _package_store
+    if CODE_EXEC_PACKAGE_STORE:
+        try:
+            _package_store = PackageStore.open(CODE_EXEC_PACKAGE_STORE)
+            _package_store.schedule_refresh(allow_download=INTERNET_ENABLED)
+        except (OSError, RuntimeError) as e:
+            logger.warning(f"Package store unavailable ({e}); installs won't be cached")
+
+    # Trace completeness is reported through the segment, so memoization needs it
+    global _memo
+    if MEMOIZE:
+        if _segment is None:
+            logger.warning("Command memoization needs the shared segment; disabled")
+        else:
+            try:
+                _memo = CommandMemo.open()
+            except OSError as e:
+                logger.warning(f"Command memoization unavailable ({e})")
+
+    # Last, so the files are still cached when the first command arrives
+    if PREWARM:
+        _prewarm()
+
+
+def _prewarm() -> None:
+    """Warm the page cache from the access profile (or the default list)."""
+    global _profile
+    profile = AccessProfile.load(
+        CODE_EXEC_PREWARM_PROFILE, exclude_roots=[FS_ROOT, *BLOCKED_PATHS]
+    )
+    paths = profile.hot_paths()
+    source = "access profile"
+    if not paths:
+        paths = default_paths(SANDBOX_LIBRARY_PATH)
+        source = "default list"
+    stats = prewarm(paths, budget_seconds=float(CODE_EXEC_PREWARM_SECONDS))
+    logger.info(
+        f"Prewarmed {stats.files} of {len(paths)} files from the {source} "
+        f"({stats.bytes / 2**20:.1f} MiB) in {stats.seconds:.2f}s"
+    )
+    # The profile is recorded from execution traces, which need the segment
+    if _segment is not None:
+        _profile = profile
+
+
+def sandbox_session_env() -> dict[str, str]:
+    """Environment for a long-lived sandboxed interpreter (see tools/python_session.py).
+
+    Same policy as code_exec, without a write-quota slot or trace. Its own exec
+    token keeps code_exec teardowns from mistaking it for a leftover.
+    """
+    extra_env = (
+        _package_store.sandbox_env(offline=not INTERNET_ENABLED)
+        if _package_store
+        else {}
+    )
+    return build_sandbox_env(
+        blocked_paths=BLOCKED_PATHS
+        + [AUDIT_RULE_PREFIX + p for p in AUDIT_BLOCKED_PATHS],
+        library_path=SANDBOX_LIBRARY_PATH,
+        extra_env={**extra_env, EXEC_TOKEN_ENV: f"session-{uuid.uuid4().hex}"},
+        ephemeral_roots=EPHEMERAL_ROOTS if RELAXED_DURABILITY else None,
+        segment_path=_segment.path if _segment else None,
+        tracked_roots=[FS_ROOT],
+        readonly_paths=([str(_package_store.root)] if _package_store else [])
+        + [AUDIT_RULE_PREFIX + p for p in AUDIT_READONLY_PATHS],
+        audit_log=CODE_EXEC_AUDIT_LOG or None,
+    )
+
 
 @make_async_background
 def code_exec(request: CodeExecRequest) -> CodeExecResponse:
@@ -126,8 +270,12 @@ def code_exec(request: CodeExecRequest) -> CodeExecResponse:
 
     try:
         timeout_value = int(CODE_EXEC_COMMAND_TIMEOUT)
+        write_quota = int(CODE_EXEC_WRITE_QUOTA_BYTES)
     except ValueError:
-        error_msg = f"Invalid timeout value: {CODE_EXEC_COMMAND_TIMEOUT}"
+        error_msg = (
+            f"Invalid timeout or write quota value: {CODE_EXEC_COMMAND_TIMEOUT}, "
+            f"{CODE_EXEC_WRITE_QUOTA_BYTES}"
+        )
         logger.error(error_msg)
         return CodeExecResponse(
             success=False,
@@ -136,13 +284,70 @@ def code_exec(request: CodeExecRequest) -> CodeExecResponse:
 
     try:
         # Use LD_PRELOAD-sandboxed execution
-        result = run_sandboxed_command(
+        run = partial(
+            run_sandboxed_command,
             command=request.code,
             timeout=timeout_value,
             working_dir=FS_ROOT,
-            blocked_paths=BLOCKED_PATHS,
+            blocked_paths=BLOCKED_PATHS
+            + [AUDIT_RULE_PREFIX + p for p in AUDIT_BLOCKED_PATHS],
             library_path=SANDBOX_LIBRARY_PATH,
+            ephemeral_roots=EPHEMERAL_ROOTS if RELAXED_DURABILITY else None,
+            segment=_segment,
+            write_quota_bytes=write_quota,
+            tracked_roots=[FS_ROOT],
+            readonly_paths=([str(_package_store.root)] if _package_store else [])
+            + [AUDIT_RULE_PREFIX + p for p in AUDIT_READONLY_PATHS],
+            extra_env=(
+                _package_store.sandbox_env(offline=not INTERNET_ENABLED)
+                if _package_store
+                else None
+            ),
+            kill_background=KILL_BACKGROUND,
+            audit_log=CODE_EXEC_AUDIT_LOG or None,
         )
+        memo_key = None
+        result = None
+        if _memo is not None:
+            memo_key = _memo.key(
+                **{k: v for k, v in run.keywords.items() if k != "segment"}
+            )
+            result = _memo.lookup(memo_key)
+        if result is None:
+            # The first few commands after startup are traced for the prewarm profile
+            profile = (
+                _profile if _profile is not None and _profile.wants_trace() else None
+            )
+            tracer = _memo or profile
+            if tracer is None:
+                result = run()
+            else:
+                with tracer.trace() as trace_file:
+                    # Only a memo trace changes the command's stdin and hash seed
+                    result = run(
+                        trace_file=trace_file, hermetic_trace=_memo is not None
+                    )
+                    if _memo is not None and memo_key is not None:
+                        _memo.record(memo_key, result, trace_file)
+                    if profile is not None:
+                        profile.add_trace(trace_file)
+        if _package_store is not None:
+            # Pick up whatever the command installed, off the request path (a
+            # no-op unless site-packages changed)
+            _package_store.schedule_refresh(allow_download=INTERNET_ENABLED)
+
+        if result.audit_denials:
+            logger.info(
+                f"Audit-only rules would have denied {result.audit_denials} call(s); "
+                f"{result.policy_checks} policy checks took "
+                f"{result.policy_check_ns / 1e6:.2f} ms"
+            )
+
+        if result.quota_exceeded:
+            logger.warning(
+                f"Command hit the write quota: {result.bytes_written:,} of "
+                f"{write_quota:,} bytes written"
+            )
 
         if result.timed_out:
             logger.error(f"Command timed out after {timeout_value} seconds")
@@ -179,6 +384,11 @@ def code_exec(request: CodeExecRequest) -> CodeExecResponse:
             output = result.stdout if result.stdout else ""
             if result.stderr:
                 output += f"\nError output:\n{result.stderr}"
+            if result.quota_exceeded:
+                output += (
+                    f"\nDisk write quota of {write_quota:,} bytes per command exceeded "
+                    f"under {FS_ROOT}; further writes failed with ENOSPC."
+                )
             return CodeExecResponse(
                 success=False,
                 output=_sanitize_output(
@@ -194,6 +404,12 @@ def code_exec(request: CodeExecRequest) -> CodeExecResponse:
                     output = f"{output.rstrip()}\n\nStderr output:\n{stderr_stripped}"
                 else:
                     output = stderr_stripped
+        if result.leaked_processes and KILL_BACKGROUND:
+            output += (
+                f"\n\nNote: {len(result.leaked_processes)} background process(es) were "
+                "still running when the command exited and have been terminated. "
+                "Processes do not persist between commands."
+            )
 
         return CodeExecResponse(
             success=True,
@@ -0,0 +1,115 @@
+import os
+import threading
+
+from loguru import logger
+from models.python_session import (
+    PythonSessionRequest,
+    PythonSessionResponse,
+)
+from tools.code_exec import (
+    CODE_EXEC_COMMAND_TIMEOUT,
+    FS_ROOT,
+    _sanitize_output,
+    sandbox_session_env,
+)
+from utils.decorators import make_async_background
+from utils.interpreter import (
+    DEFAULT_MAX_CHECKPOINTS,
+    DEFAULT_MAX_SESSIONS,
+    DEFAULT_MEMORY_BUDGET,
+    SessionError,
+    SessionManager,
+)
+
+# Memory the paused checkpoints may hold between them (their proportional set size)
+CODE_EXEC_CHECKPOINT_MEMORY_MB = os.getenv(
+    "CODE_EXEC_CHECKPOINT_MEMORY_MB", str(DEFAULT_MEMORY_BUDGET >> 20)
+)
+CODE_EXEC_MAX_CHECKPOINTS = os.getenv(
+    "CODE_EXEC_MAX_CHECKPOINTS", str(DEFAULT_MAX_CHECKPOINTS)
+)
+CODE_EXEC_MAX_SESSIONS = os.getenv("CODE_EXEC_MAX_SESSIONS", str(DEFAULT_MAX_SESSIONS))
+
+_manager: SessionManager | None = None
+_manager_lock = threading.Lock()
+
+
+def _get_manager() -> SessionManager:
+    """The session manager, created on first use (after verify_sandbox_available)."""
+    global _manager
+    with _manager_lock:
+        if _manager is None:
+            _manager = SessionManager(
+                sandbox_session_env(),
+                working_dir=FS_ROOT,
+                memory_budget=int(CODE_EXEC_CHECKPOINT_MEMORY_MB) << 20,
+                max_checkpoints=int(CODE_EXEC_MAX_CHECKPOINTS),
+                max_sessions=int(CODE_EXEC_MAX_SESSIONS),
+            )
+        return _manager
+
+
+@make_async_background
+def python_session(request: PythonSessionRequest) -> PythonSessionResponse:
+    """Run Python code in a persistent sandboxed session: variables, imports and loaded data survive between calls. Save the session's state with 'checkpoint' and branch from it with 'resume' to try alternatives without recomputing it."""
+    try:
+        timeout_value = int(CODE_EXEC_COMMAND_TIMEOUT)
+        manager = _get_manager()
+    except ValueError as e:
+        error_msg = f"Invalid session settings: {e}"
+        logger.error(error_msg)
+        return PythonSessionResponse(
+            success=False,
+            output=f"Configuration error: {error_msg}",
+        )
+
+    try:
+        if request.action == "exec":
+            if request.code is None:
+                return PythonSessionResponse(
+                    success=False,
+                    output="Error: Required parameter 'code' (Python source to run)",
+                )
+            result = manager.exec(request.session, request.code, timeout_value)
+            if result.timed_out:
+                logger.error(f"Session {request.session} timed out")
+            output = result.stdout
+            if result.stderr.strip():
+                output = f"{output.rstrip()}\n\nStderr output:\n{result.stderr.strip()}"
+            if result.error:
+                output = f"{output.rstrip()}\n\n{result.error}".lstrip()
+            return PythonSessionResponse(
+                success=result.error is None,
+                output=_sanitize_output(output),
+            )
+
+        if request.action == "checkpoint":
+            checkpoint = manager.checkpoint(request.session)
+            output = (
+                f"Saved session {request.session} as checkpoint {checkpoint.id} "
+                f"({checkpoint.memory_bytes / 2**20:.1f} MiB)"
+            )
+        elif request.action == "resume":
+            if request.checkpoint is None:
+                return PythonSessionResponse(
+                    success=False,
+                    output="Error: Required parameter 'checkpoint' for resume",
+                )
+            manager.resume(request.checkpoint, request.session)
+            output = f"Session {request.session} resumed from {request.checkpoint}"
+        elif request.action == "drop":
+            name = request.checkpoint or request.session
+            manager.drop(name)
+            output = f"Dropped {name}"
+        else:
+            output = manager.describe()
+        return PythonSessionResponse(success=True, output=output)
+    except SessionError as e:
+        return PythonSessionResponse(success=False, output=f"Error: {e}")
+    except OSError as e:
+        error_msg = f"OS error in Python session: {e}"
+        logger.error(error_msg)
+        return PythonSessionResponse(
+            success=False,
+            output=f"System error: {error_msg}",
+        )
@@ -0,0 +1,333 @@
+"""
+interpreter.py - Persistent sandboxed Python sessions with fork checkpoints
+
+A session is a long-lived python3 running utils/interpreter_driver.py under
+sandbox_fs.so; cells sent to it share one namespace, so expensive state (a DataFrame
+loaded from a large CSV, a fitted model) survives between requests.
+
+A checkpoint forks the session into a process that holds its state copy-on-write and
+sleeps. Any number of sessions can later be resumed from it: each is a fresh fork of
+the checkpoint, so a tree search can try several continuations from one state without
+reloading it. Checkpoints are charged their proportional set size (each page
+divided among the processes sharing it, from /proc/<pid>/smaps_rollup), so state
+shared by a checkpoint and the sessions forked from it is counted once overall; when
+the total goes over the memory budget, the least recently used checkpoints are
+dropped. A checkpoint's share grows as the sessions that shared its pages write to
+them or exit, so it is re-read whenever checkpoints are added or used.
+
+Killing a session or checkpoint kills its process and the processes it started.
+Sessions run without a write-quota slot: the quota applies per code_exec command.
+
+Usage:
+    manager = SessionManager(env, working_dir="/filesystem", memory_budget=4 << 30)
+    manager.exec("main", "import pandas as pd; df = pd.read_csv('big.csv')", 300)
+    cp = manager.checkpoint("main")
+    manager.resume(cp.id, "try-a")
+    manager.exec("try-a", "df.describe()", 300)
+"""
+
+import itertools
+import os
+import signal
+import socket
+import subprocess
+import threading
+import time
+from dataclasses import dataclass, field
+from pathlib import Path
+
+from loguru import logger
+
+from utils.interpreter_driver import recv_msg, send_msg
+from utils.process_tree import list_processes, read_proc
+
+DRIVER_SOURCE = (Path(__file__).parent / "interpreter_driver.py").read_text()
+CONTROL_FD_ENV = "SANDBOX_SESSION_FD"
+
+DEFAULT_MEMORY_BUDGET = 4 << 30
+DEFAULT_MAX_CHECKPOINTS = 16
+DEFAULT_MAX_SESSIONS = 8
+
+# Forking a session and starting the interpreter are quick; the exec timeout is the
+# caller's
+_CONTROL_TIMEOUT = 30
+
+
+class SessionError(Exception):
+    """A request that could not be carried out; the message is for the caller."""
+
+
+@dataclass
+class ExecResult:
+    stdout: str
+    stderr: str
+    error: str | None = None
+    timed_out: bool = False
+
+
+@dataclass
+class _Process:
+    """A driver process we talk to over its control socket."""
+
+    id: str
+    pid: int
+    sock: socket.socket
+    last_used: float = field(default_factory=time.monotonic)
+    lock: threading.Lock = field(default_factory=threading.Lock)
+
+    def request(self, message: dict, timeout: float) -> tuple[dict, list[int]]:
+        self.sock.settimeout(timeout)
+        send_msg(self.sock, message)
+        reply, fds = recv_msg(self.sock)
+        if reply is None:
+            raise SessionError(f"{self.id} exited")
+        self.last_used = time.monotonic()
+        return reply, fds
+
+    def kill(self) -> None:
+        self.sock.close()
+        _kill_tree(self.pid)
+
+
+@dataclass
+class Checkpoint(_Process):
+    session_id: str = ""
+    memory_bytes: int = 0
+
+
+def proportional_set_size(pid: int) -> int:
+    """The process's share of the memory it maps, in bytes (0 if it is gone)."""
+    try:
+        with open(f"/proc/{pid}/smaps_rollup") as f:
+            for line in f:
+                if line.startswith("Pss:"):
+                    return int(line.split()[1]) * 1024
+    except OSError:
+        pass
+    return 0
+
+
+def _kill_tree(pid: int) -> None:
+    """SIGKILL pid and its descendants, then reap whichever of them are ours."""
+    procs = list_processes()
+    doomed = [pid]
+    for parent in doomed:
+        doomed.extend(p.pid for p in procs.values() if p.ppid == parent)
+    my_pid = os.getpid()
+    for victim in doomed:
+        try:
+            fd = os.pidfd_open(victim)
+        except OSError:
+            continue  # Already gone
+        try:
+            signal.pidfd_send_signal(fd, signal.SIGKILL)
+            info = procs.get(victim)
+            if info is not None and info.ppid == my_pid:
+                os.waitid(os.P_PIDFD, fd, os.WEXITED)
+        except (ProcessLookupError, ChildProcessError):
+            pass
+        finally:
+            os.close(fd)
+
+
+class SessionManager:
+    """Named sessions and numbered checkpoints, shared by every request."""
+
+    def __init__(
+        self,
+        env: dict[str, str],
+        working_dir: str,
+        memory_budget: int = DEFAULT_MEMORY_BUDGET,
+        max_checkpoints: int = DEFAULT_MAX_CHECKPOINTS,
+        max_sessions: int = DEFAULT_MAX_SESSIONS,
+    ):
+        self.env = env
+        self.working_dir = working_dir
+        self.memory_budget = memory_budget
+        self.max_checkpoints = max_checkpoints
+        self.max_sessions = max_sessions
+        self._sessions: dict[str, _Process] = {}
+        self._checkpoints: dict[str, Checkpoint] = {}
+        self._ids = itertools.count(1)
+        self._lock = threading.Lock()
+        # Sessions (in the setsid sense) of the sandboxed interpreters; pids they
+        # report must be in one of them
+        self._sids: set[int] = set()
+
+    def _start(self, session_id: str) -> _Process:
+        mine, theirs = socket.socketpair(socket.AF_UNIX, socket.SOCK_SEQPACKET)
+        env = {**self.env, CONTROL_FD_ENV: str(theirs.fileno())}
+        try:
+            process = subprocess.Popen(
+                ["python3", "-c", DRIVER_SOURCE],
+                stdin=subprocess.DEVNULL,
+                stdout=subprocess.DEVNULL,
+                stderr=subprocess.DEVNULL,
+                env=env,
+                cwd=self.working_dir,
+                pass_fds=(theirs.fileno(),),
+                start_new_session=True,
+            )
+        finally:
+            theirs.close()
+        mine.settimeout(_CONTROL_TIMEOUT)
+        ready, _ = recv_msg(mine)
+        if ready is None:
+            mine.close()
+            process.kill()
+            process.wait()
+            raise SessionError("The sandboxed interpreter failed to start")
+        self._sids.add(process.pid)
+        logger.info(f"Started Python session {session_id} (pid {process.pid})")
+        return _Process(session_id, process.pid, mine)
+
+    def _adopt(
+        self, reply: dict, fds: list[int], what: str
+    ) -> tuple[int, socket.socket]:
+        """Take over a process forked in the sandbox from its reply and socket.
+
+        The pid comes from sandboxed code, so it is only believed if it names a
+        process of one of our interpreters: it is what drop() later kills.
+        """
+        pid = reply.get("pid")
+        info = read_proc(pid) if isinstance(pid, int) and pid > 0 else None
+        if len(fds) != 1 or info is None or info.session not in self._sids:
+            for fd in fds:
+                os.close(fd)
+            raise SessionError(f"Could not {what}: {reply.get('error', 'bad reply')}")
+        return info.pid, socket.socket(fileno=fds[0])
+
+    def _add_session(self, session: _Process) -> None:
+        with self._lock:
+            self._sessions[session.id] = session
+            idle = sorted(self._sessions.values(), key=lambda s: s.last_used)
+            evicted = idle[: max(0, len(idle) - self.max_sessions)]
+            for victim in evicted:
+                del self._sessions[victim.id]
+        for victim in evicted:
+            logger.info(f"Closing idle Python session {victim.id}")
+            victim.kill()
+
+    def _session(self, session_id: str, create: bool) -> _Process:
+        with self._lock:
+            session = self._sessions.get(session_id)
+        if session is not None:
+            return session
+        if not create:
+            raise SessionError(f"No session named {session_id!r}")
+        session = self._start(session_id)
+        self._add_session(session)
+        return session
+
+    def exec(self, session_id: str, code: str, timeout: float) -> ExecResult:
+        """Run a cell in the session, starting it if needed.
+
+        A cell that times out kills the session (its checkpoints are kept).
+        """
+        session = self._session(session_id, create=True)
+        with session.lock:
+            try:
+                reply, _ = session.request({"op": "exec", "code": code}, timeout)
+            except TimeoutError:
+                self.drop(session_id)
+                return ExecResult(
+                    "", "", f"Timed out after {timeout} seconds", timed_out=True
+                )
+            except (SessionError, OSError) as e:
+                self.drop(session_id)
+                return ExecResult("", "", f"Session {session_id} died: {e}")
+        return ExecResult(reply["stdout"], reply["stderr"], reply["error"])
+
+    def checkpoint(self, session_id: str) -> Checkpoint:
+        """Fork the session's current state into a new checkpoint.
+
+        Raises:
+            SessionError: If the session doesn't exist or the checkpoint doesn't fit
+                in the memory budget.
+        """
+        session = self._session(session_id, create=False)
+        with session.lock:
+            reply, fds = session.request({"op": "checkpoint"}, _CONTROL_TIMEOUT)
+        pid, sock = self._adopt(reply, fds, "checkpoint")
+        checkpoint = Checkpoint(f"cp{next(self._ids)}", pid, sock, session_id=session_id)
+        with self._lock:
+            self._checkpoints[checkpoint.id] = checkpoint
+        self._enforce_budget(checkpoint)
+        logger.info(f"Checkpointed session {session_id} as {checkpoint.id}")
+        return checkpoint
+
+    def resume(self, checkpoint_id: str, session_id: str) -> _Process:
+        """Start (or replace) session_id as a fork of the checkpoint."""
+        with self._lock:
+            checkpoint = self._checkpoints.get(checkpoint_id)
+        if checkpoint is None:
+            raise SessionError(f"No checkpoint {checkpoint_id!r}")
+        with checkpoint.lock:
+            reply, fds = checkpoint.request({"op": "fork"}, _CONTROL_TIMEOUT)
+        pid, sock = self._adopt(reply, fds, "resume")
+        self.drop(session_id, missing_ok=True)
+        session = _Process(session_id, pid, sock)
+        self._add_session(session)
+        self._enforce_budget(checkpoint)
+        logger.info(f"Resumed session {session_id} from {checkpoint_id}")
+        return session
+
+    def drop(self, name: str, missing_ok: bool = False) -> None:
+        """Kill a session or checkpoint."""
+        with self._lock:
+            victim = self._sessions.pop(name, None) or self._checkpoints.pop(name, None)
+        if victim is not None:
+            victim.kill()
+        elif not missing_ok:
+            raise SessionError(f"No session or checkpoint named {name!r}")
+
+    def _enforce_budget(self, keep: Checkpoint) -> None:
+        """Drop least recently used checkpoints until the rest fit the budget.
+
+        Raises:
+            SessionError: If keep alone is over the budget (it is dropped instead).
+        """
+        with self._lock:
+            checkpoints = sorted(self._checkpoints.values(), key=lambda c: c.last_used)
+        for checkpoint in checkpoints:
+            checkpoint.memory_bytes = proportional_set_size(checkpoint.pid)
+        if keep.memory_bytes > self.memory_budget:
+            self.drop(keep.id, missing_ok=True)
+            raise SessionError(
+                f"Checkpoint {keep.id} needs {keep.memory_bytes / 2**20:.1f} MiB, "
+                f"over the {self.memory_budget / 2**20:.0f} MiB checkpoint budget"
+            )
+        total = sum(c.memory_bytes for c in checkpoints)
+        count = len(checkpoints)
+        for victim in checkpoints:
+            if total <= self.memory_budget and count <= self.max_checkpoints:
+                return
+            if victim is keep:
+                continue
+            logger.info(
+                f"Evicting checkpoint {victim.id} "
+                f"({victim.memory_bytes / 2**20:.1f} MiB)"
+            )
+            self.drop(victim.id, missing_ok=True)
+            total -= victim.memory_bytes
+            count -= 1
+
+    def describe(self) -> str:
+        with self._lock:
+            sessions = list(self._sessions.values())
+            checkpoints = list(self._checkpoints.values())
+        lines = [f"Session {s.id} (pid {s.pid})" for s in sessions]
+        lines += [
+            f"Checkpoint {c.id} of session {c.session_id}: "
+            f"{proportional_set_size(c.pid) / 2**20:.1f} MiB"
+            for c in checkpoints
+        ]
+        return "\n".join(lines) or "No sessions or checkpoints"
+
+    def close(self) -> None:
+        with self._lock:
+            everything = [*self._sessions.values(), *self._checkpoints.values()]
+            self._sessions.clear()
+            self._checkpoints.clear()
+        for process in everything:
+            process.kill()
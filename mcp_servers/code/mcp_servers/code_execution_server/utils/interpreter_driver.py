@@ -0,0 +1,179 @@
+"""
+interpreter_driver.py - The loop inside a sandboxed Python session
+
+utils/interpreter.py starts `python3 -c <this file's source>` under sandbox_fs.so (the
+server's own directory is blocked in there, so the source travels on the command line)
+and talks to it over a SOCK_SEQPACKET socket whose fd is in SANDBOX_SESSION_FD. The
+server also imports send_msg/recv_msg from here so both ends frame messages the same
+way.
+
+Requests and replies are JSON objects:
+
+    {"op": "exec", "code": ...}  -> {"stdout", "stderr", "error"}
+    {"op": "checkpoint"}         -> {"pid"} + the checkpoint's control socket
+
+A checkpoint is a forked copy of the session that does nothing but wait on its own
+control socket, holding the session's memory copy-on-write. Each {"op": "fork"} sent to
+it forks a new live session from that state and replies with the new session's
+control socket. Both forks are double forks, so the new process is re-parented to the
+server (a child subreaper) rather than left as a child of the process it came from.
+
+Only the standard library may be used here: this runs in the sandbox's interpreter.
+"""
+
+import ast
+import json
+import os
+import socket
+import sys
+import traceback
+
+# Payload per packet; a message spans as many packets as it needs
+_CHUNK = 32 * 1024
+_MORE, _END = b"M", b"E"
+# Output kept per stream and exec, beyond which it is cut (the tool truncates further)
+_MAX_OUTPUT = 1 << 20
+
+
+def send_msg(sock: socket.socket, obj: dict, fds: list[int] | None = None) -> None:
+    data = json.dumps(obj).encode()
+    chunks = [data[i : i + _CHUNK] for i in range(0, len(data), _CHUNK)] or [b""]
+    for i, chunk in enumerate(chunks):
+        marker = _END if i == len(chunks) - 1 else _MORE
+        if i == 0 and fds:
+            socket.send_fds(sock, [marker + chunk], fds)
+        else:
+            sock.sendall(marker + chunk)
+
+
+def recv_msg(sock: socket.socket) -> tuple[dict | None, list[int]]:
+    """Next message and the fds that came with it; (None, []) once the peer is gone."""
+    parts: list[bytes] = []
+    fds: list[int] = []
+    while True:
+        packet, received, _, _ = socket.recv_fds(sock, _CHUNK + 1, 1)
+        fds.extend(received)
+        if not packet:
+            return None, fds
+        parts.append(packet[1:])
+        if packet[:1] == _END:
+            return json.loads(b"".join(parts)), fds
+
+
+def _seqpacket_pair() -> tuple[socket.socket, socket.socket]:
+    return socket.socketpair(socket.AF_UNIX, socket.SOCK_SEQPACKET)
+
+
+def _fork_detached() -> bool:
+    """Double fork. Returns True in the grandchild, False in the caller."""
+    pid = os.fork()
+    if pid == 0:
+        if os.fork() != 0:
+            os._exit(0)
+        return True
+    os.waitpid(pid, 0)
+    return False
+
+
+class _Capture:
+    """Point fds 1 and 2 at memfds for one exec, so subprocesses are captured too."""
+
+    def __enter__(self) -> "_Capture":
+        sys.stdout.flush()
+        sys.stderr.flush()
+        self._saved = (os.dup(1), os.dup(2))
+        self._files = (os.memfd_create("stdout"), os.memfd_create("stderr"))
+        os.dup2(self._files[0], 1)
+        os.dup2(self._files[1], 2)
+        return self
+
+    def __exit__(self, *exc: object) -> None:
+        sys.stdout.flush()
+        sys.stderr.flush()
+        os.dup2(self._saved[0], 1)
+        os.dup2(self._saved[1], 2)
+        self.output = tuple(self._read(fd) for fd in self._files)
+        for fd in (*self._saved, *self._files):
+            os.close(fd)
+
+    @staticmethod
+    def _read(fd: int) -> str:
+        size = os.lseek(fd, 0, os.SEEK_END)
+        data = os.pread(fd, min(size, _MAX_OUTPUT), 0)
+        text = data.decode(errors="replace")
+        if size > _MAX_OUTPUT:
+            text += f"\n[output cut at {_MAX_OUTPUT:,} of {size:,} bytes]"
+        return text
+
+
+def _run(code: str, namespace: dict) -> dict:
+    """Run a cell; like a notebook, a trailing expression's value is printed."""
+    error = None
+    with _Capture() as capture:
+        try:
+            tree = ast.parse(code, "<session>", "exec")
+            last = None
+            if tree.body and isinstance(tree.body[-1], ast.Expr):
+                last = ast.Expression(tree.body.pop().value)
+            exec(compile(tree, "<session>", "exec"), namespace)
+            if last is not None:
+                value = eval(compile(last, "<session>", "eval"), namespace)
+                if value is not None:
+                    print(repr(value))
+        except BaseException as e:  # noqa: BLE001 - reported to the caller
+            if isinstance(e, SystemExit) and not e.code:
+                pass
+            else:
+                error = "".join(traceback.format_exception(e))
+    stdout, stderr = capture.output
+    return {"stdout": stdout, "stderr": stderr, "error": error}
+
+
+def _checkpoint(conn: socket.socket, namespace: dict) -> None:
+    mine, theirs = _seqpacket_pair()
+    if _fork_detached():
+        conn.close()
+        mine.close()
+        _hold(theirs, namespace)
+    theirs.close()
+    pid, _ = recv_msg(mine)
+    send_msg(conn, pid or {}, [mine.fileno()])
+    mine.close()
+
+
+def _hold(conn: socket.socket, namespace: dict) -> None:
+    """Checkpoint loop: sleep until asked to fork a live session. Never returns."""
+    send_msg(conn, {"pid": os.getpid()})
+    while True:
+        request, _ = recv_msg(conn)
+        if request is None:
+            os._exit(0)
+        mine, theirs = _seqpacket_pair()
+        if _fork_detached():
+            conn.close()
+            mine.close()
+            _serve(theirs, namespace)
+        theirs.close()
+        ready, _ = recv_msg(mine)
+        send_msg(conn, ready or {}, [mine.fileno()])
+        mine.close()
+
+
+def _serve(conn: socket.socket, namespace: dict) -> None:
+    """Session loop. Never returns."""
+    send_msg(conn, {"pid": os.getpid()})
+    while True:
+        request, _ = recv_msg(conn)
+        if request is None:
+            os._exit(0)
+        if request["op"] == "exec":
+            send_msg(conn, _run(request["code"], namespace))
+        elif request["op"] == "checkpoint":
+            _checkpoint(conn, namespace)
+        else:
+            send_msg(conn, {"error": f"unknown op {request['op']!r}"})
+
+
+if __name__ == "__main__":
+    control_fd = int(os.environ.pop("SANDBOX_SESSION_FD"))
+    _serve(socket.socket(fileno=control_fd), {"__name__": "__main__"})
@@ -0,0 +1,261 @@
+"""
+memo.py - Reuse the result of a command whose inputs haven't changed
+
+Agents often rerun the same read-only command (`cat`, `ls`, `python analyze.py` on an
+unchanged file) several times in an episode. When memoization is enabled, each run is
+traced by sandbox_fs.so (SANDBOX_TRACE_FILE): every path it read, stat'ed or executed
+is recorded with the identity it had - device, inode, mode, size, mtime and ctime -
+along with any mutation, socket, wall-clock or randomness use.
+
+A run is kept only if it was a pure function of those inputs: it finished in time,
+wrote nothing (other than to stdout/stderr), left no process behind, touched no
+network, clock, randomness, pseudo-filesystem or device, and its trace is complete.
+Its inputs are re-stat'ed when the entry is stored and again on every hit; any
+difference (or an input that appeared or disappeared) makes the entry stale.
+Inputs changed within the last RACY_WINDOW_NS are not trusted yet: a second write in
+the same timestamp tick could leave size and times unchanged.
+
+What the library can't see is a blind spot: static binaries, raw syscalls, and
+shared libraries loaded by a process that neither execs nor exits normally (the
+library lists loaded objects at exec and exit). Output that depends only on pid or
+elapsed time is reused as is.
+
+Usage:
+    memo = CommandMemo.open()
+    key = memo.key(command, working_dir=..., blocked_paths=...)
+    result = memo.lookup(key)
+    if result is None:
+        with memo.trace() as trace_file:
+            result = run_sandboxed_command(
+                command, ..., trace_file=trace_file, hermetic_trace=True
+            )
+            memo.record(key, result, trace_file)
+"""
+
+import copy
+import hashlib
+import json
+import os
+import stat
+import tempfile
+import threading
+import time
+from collections import OrderedDict
+from collections.abc import Iterator
+from contextlib import contextmanager
+from dataclasses import dataclass
+
+from loguru import logger
+
+from utils.sandbox import SandboxResult
+
+# Blocked inside the sandbox (passed as trace_file, see build_sandbox_env)
+DEFAULT_TRACE_DIR = "/dev/shm/sandbox_traces"
+DEFAULT_CAPACITY = 256
+
+# Inputs whose ctime is this recent are not trusted yet
+RACY_WINDOW_NS = 50_000_000
+# Longer traces are not worth parsing, let alone revalidating on every hit
+MAX_TRACE_BYTES = 64 << 20
+
+# Writes that don't change anything a later run could read
+_DISCARDED_OUTPUTS = {"/dev/null", "/dev/stdout", "/dev/stderr", "/dev/tty"}
+_DISCARDED_OUTPUT_PREFIXES = ("/dev/fd/", "/proc/self/fd/")
+# Devices whose contents never change
+_CONSTANT_DEVICES = {"/dev/null", "/dev/zero", "/dev/full"}
+# Pseudo-filesystems whose contents change without their metadata changing
+_VOLATILE_ROOTS = ("/proc/", "/sys/")
+# ... except these, which are fixed for the container's lifetime (libselinux and
+# CPU-count probes read them) or only tell a process about its own stack (glibc's
+# pthread_getattr_np). Their inode times change, so they aren't tracked.
+_STABLE_PSEUDO_FILES = {
+    "/proc/filesystems",
+    "/proc/mounts",
+    "/proc/self/mounts",
+    "/proc/self/maps",
+    "/sys/devices/system/cpu/online",
+    "/sys/devices/system/cpu/possible",
+    "/sys/devices/system/cpu/present",
+}
+
+# (dev, ino, mode, size, mtime_ns, ctime_ns), or None for a missing path
+Identity = tuple[int, int, int, int, int, int] | None
+# (follow symlinks, absolute path)
+InputKey = tuple[bool, str]
+
+
+class Uncacheable(Exception):
+    """The traced run can't be reused; the message says why."""
+
+
+@dataclass
+class MemoEntry:
+    result: SandboxResult
+    inputs: dict[InputKey, Identity]
+
+
+def _identity(path: str, follow: bool) -> Identity:
+    try:
+        st = os.stat(path, follow_symlinks=follow)
+    except (FileNotFoundError, NotADirectoryError):
+        return None
+    return (st.st_dev, st.st_ino, st.st_mode, st.st_size, st.st_mtime_ns, st.st_ctime_ns)
+
+
+def _parse_identity(field: str) -> Identity:
+    if field == "-":
+        return None
+    dev, ino, mode, size, mtime, ctime = field.split(":")
+    return (int(dev), int(ino), int(mode, 8), int(size), int(mtime), int(ctime))
+
+
+def _is_volatile(path: str) -> bool:
+    return path.startswith(_VOLATILE_ROOTS) or path in ("/proc", "/sys")
+
+
+def parse_trace(trace_file: str) -> dict[InputKey, Identity]:
+    """Read a trace into the identities of the run's inputs.
+
+    Raises:
+        Uncacheable: If the run did anything besides reading its inputs.
+    """
+    if os.path.getsize(trace_file) > MAX_TRACE_BYTES:
+        raise Uncacheable("trace too large")
+    inputs: dict[InputKey, Identity] = {}
+    with open(trace_file, encoding="utf-8", errors="surrogateescape") as f:
+        for line in f:
+            kind, path, field = line.rstrip("\n").split("\t")
+            if kind in ("T", "N"):
+                raise Uncacheable(f"called {path}()")
+            if kind == "W":
+                if path in _DISCARDED_OUTPUTS or path.startswith(
+                    _DISCARDED_OUTPUT_PREFIXES
+                ):
+                    continue
+                raise Uncacheable(f"modified {path}")
+            if path in _STABLE_PSEUDO_FILES:
+                continue
+            if _is_volatile(path):
+                raise Uncacheable(f"read {path}")
+
+            identity = _parse_identity(field)
+            if (
+                kind == "R"
+                and identity is not None
+                and not stat.S_ISREG(identity[2])
+                and not stat.S_ISDIR(identity[2])
+                and path not in _CONSTANT_DEVICES
+            ):
+                raise Uncacheable(f"read from {path}")
+
+            key = (kind != "L", path)
+            if inputs.setdefault(key, identity) != identity:
+                raise Uncacheable(f"{path} changed during the run")
+    return inputs
+
+
+class CommandMemo:
+    """In-memory LRU of command results, keyed by command and environment."""
+
+    def __init__(self, trace_dir: str, capacity: int = DEFAULT_CAPACITY):
+        self.trace_dir = trace_dir
+        self.capacity = capacity
+        self._entries: OrderedDict[str, MemoEntry] = OrderedDict()
+        self._lock = threading.Lock()
+        self.hits = 0
+        self.misses = 0
+
+    @classmethod
+    def open(
+        cls, trace_dir: str = DEFAULT_TRACE_DIR, capacity: int = DEFAULT_CAPACITY
+    ) -> "CommandMemo":
+        """Create the trace directory. Call once at server startup.
+
+        Raises:
+            OSError: If the trace directory cannot be created.
+        """
+        os.makedirs(trace_dir, mode=0o700, exist_ok=True)
+        logger.info(f"Command memoization enabled (up to {capacity} results)")
+        return cls(trace_dir, capacity)
+
+    def key(self, command: str, **settings: object) -> str:
+        """Key for a command run with the given sandbox settings.
+
+        The server's environment is part of the key since the sandbox inherits it.
+        """
+        material = json.dumps(
+            [command, settings, sorted(os.environ.items())],
+            sort_keys=True,
+            default=str,
+        )
+        return hashlib.sha256(material.encode()).hexdigest()
+
+    @contextmanager
+    def trace(self) -> Iterator[str]:
+        """An empty trace file for one run, removed afterwards."""
+        fd, path = tempfile.mkstemp(dir=self.trace_dir, suffix=".trace")
+        os.close(fd)
+        try:
+            yield path
+        finally:
+            os.unlink(path)
+
+    def lookup(self, key: str) -> SandboxResult | None:
+        """The stored result for key if none of its inputs changed since."""
+        with self._lock:
+            entry = self._entries.get(key)
+            if entry is not None:
+                self._entries.move_to_end(key)
+        if entry is None:
+            self.misses += 1
+            return None
+
+        for (follow, path), identity in entry.inputs.items():
+            if _identity(path, follow) != identity:
+                logger.debug(f"Memoized result is stale: {path} changed")
+                with self._lock:
+                    if self._entries.get(key) is entry:
+                        del self._entries[key]
+                self.misses += 1
+                return None
+
+        self.hits += 1
+        logger.debug(
+            f"Reusing memoized result ({len(entry.inputs)} inputs unchanged; "
+            f"{self.hits} hits, {self.misses} misses)"
+        )
+        return copy.deepcopy(entry.result)
+
+    def record(self, key: str, result: SandboxResult, trace_file: str) -> bool:
+        """Store result if its run can be reused.
+
+        Returns:
+            Whether the result was stored.
+        """
+        try:
+            if result.timed_out or result.error is not None:
+                raise Uncacheable("did not complete")
+            if result.leaked_processes:
+                raise Uncacheable("left processes running")
+            if result.quota_exceeded:
+                raise Uncacheable("hit the write quota")
+            if result.trace_errors:
+                raise Uncacheable(f"{result.trace_errors} trace events lost")
+            inputs = parse_trace(trace_file)
+
+            racy_after = time.time_ns() - RACY_WINDOW_NS
+            for (follow, path), identity in inputs.items():
+                if _identity(path, follow) != identity:
+                    raise Uncacheable(f"{path} changed since it was read")
+                if identity is not None and identity[5] > racy_after:
+                    raise Uncacheable(f"{path} changed too recently")
+        except (Uncacheable, OSError, ValueError) as e:
+            logger.debug(f"Not memoizing command: {e}")
+            return False
+
+        with self._lock:
+            self._entries[key] = MemoEntry(copy.deepcopy(result), inputs)
+            self._entries.move_to_end(key)
+            while len(self._entries) > self.capacity:
+                self._entries.popitem(last=False)
+        return True
@@ -0,0 +1,398 @@
+"""
+package_cache.py - Content-addressed wheel and bytecode store shared by executions
+
+Sandboxed commands run with HOME=/tmp, so pip's wheel cache and the per-package
+__pycache__ directories are lost with every episode. This module keeps a host-level
+store (by default /var/cache/sandbox-packages, meant to be a volume shared between
+containers) with:
+
+    blobs/sha256/ab/<digest>   wheel contents, named by their SHA-256
+    wheels/<name>.whl          hard links into blobs/, used as pip/uv --find-links
+    pycache/                   PYTHONPYCACHEPREFIX tree for the sandbox's interpreter
+
+The store is read-only inside the sandbox (SANDBOX_READONLY_PATHS). Only this
+trusted helper, running in the server process, adds to it: when the distributions
+installed in the sandbox's interpreter change (an execution installed or upgraded
+something), it downloads the matching wheels from the index (binary wheels only -
+nothing produced inside the sandbox is ever ingested) and compiles bytecode into the
+prefix. Checking for changes only lists the site-packages directories; the last
+state refreshed is kept in the store, so a server started on an up-to-date store
+does no work at all.
+
+With an index available, pip and uv treat the store as one more source (--find-links)
+and pick the best match across all of them, so the store mainly serves offline
+executions, which resolve from it alone (--no-index).
+
+The helper runs outside the sandbox over directories sandboxed code can write, so it
+never runs anything they contain: Python runs isolated (-I: no PYTHON* variables, no
+user site, so no planted .pth file is executed), pip runs --isolated with
+PIP_CONFIG_FILE=/dev/null and a HOME inside the store (no planted pip.conf), installed
+distributions are listed from their metadata (pip list --path) and symlinks are never
+followed into the bytecode prefix.
+
+Usage:
+    store = PackageStore.open("/var/cache/sandbox-packages")
+    env = store.sandbox_env(offline=True)
+    store.schedule_refresh()
+"""
+
+import hashlib
+import json
+import os
+import shutil
+import subprocess
+import tempfile
+import threading
+from pathlib import Path
+
+from loguru import logger
+
+DEFAULT_STORE_PATH = "/var/cache/sandbox-packages"
+
+# Same search order as the sandbox's PATH (see build_sandbox_env)
+_SANDBOX_PYTHON_SEARCH_PATH = "/usr/local/bin:/usr/bin:/bin"
+# The sandbox's PYTHONUSERBASE (see build_sandbox_env)
+_SANDBOX_USERBASE = "/tmp"
+
+_HASH_CHUNK_SIZE = 1 << 20
+_DOWNLOAD_TIMEOUT = 300
+_COMPILE_TIMEOUT = 900
+
+
+# compileall over the regular .py files under the given directories, symlinks skipped
+_COMPILE_SCRIPT = """
+import compileall, concurrent.futures, functools, os, sys
+def sources(top):
+    for root, dirs, files in os.walk(top):
+        for name in files:
+            path = os.path.join(root, name)
+            if name.endswith(".py") and not os.path.islink(path):
+                yield path
+files = [path for top in sys.argv[1:] for path in sources(top)]
+with concurrent.futures.ProcessPoolExecutor() as pool:
+    compile_file = functools.partial(compileall.compile_file, quiet=2)
+    for _ in pool.map(compile_file, files, chunksize=64):
+        pass
+"""
+
+
+def _canonical_name(name: str) -> str:
+    """PEP 503 normalized project name (wheel filenames use '_' for '-')."""
+    out = []
+    prev_sep = False
+    for ch in name.lower():
+        if ch in "-_.":
+            if not prev_sep:
+                out.append("-")
+            prev_sep = True
+        else:
+            out.append(ch)
+            prev_sep = False
+    return "".join(out)
+
+
+class PackageStore:
+    """Host-side owner of the shared wheel and bytecode store."""
+
+    def __init__(self, root: Path, python: str):
+        self.root = root
+        self.python = python
+        self.blobs_dir = root / "blobs" / "sha256"
+        self.wheels_dir = root / "wheels"
+        self.pycache_dir = root / "pycache"
+        self._staging_dir = root / ".staging"
+        # HOME of the helper's pip: read-only in the sandbox, like the rest of the store
+        self._home_dir = root / ".home"
+        # Fingerprint of the installed distributions the store last caught up with
+        self._state_file = root / ".installed"
+        # (name, version) pairs with no binary wheel on the index; not retried
+        self._unavailable: set[tuple[str, str]] = set()
+        self._refresh_requested = threading.Event()
+        self._worker: threading.Thread | None = None
+        self._allow_download = False
+        self._site_dir_candidates: list[str] | None = None
+
+    @classmethod
+    def open(cls, root: str = DEFAULT_STORE_PATH) -> "PackageStore":
+        """Create the store layout if needed. Call once at server startup.
+
+        Raises:
+            OSError: If the store directories cannot be created.
+            RuntimeError: If no python3 interpreter is found for the sandbox.
+        """
+        python = shutil.which("python3", path=_SANDBOX_PYTHON_SEARCH_PATH)
+        if python is None:
+            raise RuntimeError("No python3 found for the sandboxed interpreter")
+        store = cls(Path(root), python)
+        for d in (
+            store.blobs_dir,
+            store.wheels_dir,
+            store.pycache_dir,
+            store._staging_dir,
+            store._home_dir,
+        ):
+            d.mkdir(parents=True, exist_ok=True)
+        wheel_count = sum(1 for _ in store.wheels_dir.glob("*.whl"))
+        logger.info(f"Package store at {root} ({wheel_count} wheels)")
+        return store
+
+    def sandbox_env(self, offline: bool) -> dict[str, str]:
+        """Environment that points pip, uv and Python at the store.
+
+        Args:
+            offline: Resolve from the store only (no index lookups at all);
+                otherwise the store is only an extra source next to the index
+        """
+        env = {
+            "PIP_FIND_LINKS": str(self.wheels_dir),
+            "UV_FIND_LINKS": str(self.wheels_dir),
+            "PYTHONPYCACHEPREFIX": str(self.pycache_dir),
+        }
+        if offline:
+            env["PIP_NO_INDEX"] = "1"
+            env["UV_OFFLINE"] = "1"
+        return env
+
+    def has_wheel_for(self, name: str, version: str) -> bool:
+        # Wheel filenames are {distribution}-{version}(-{build})?-{tags}.whl
+        project = _canonical_name(name)
+        for wheel in self.wheels_dir.glob("*.whl"):
+            dist, _, rest = wheel.name.partition("-")
+            if _canonical_name(dist) == project and rest.split("-", 1)[0] == version:
+                return True
+        return False
+
+    def ingest_wheel(self, path: Path) -> Path:
+        """Add a wheel to the store and return its path under wheels/.
+
+        The content lands in blobs/ under its digest first; the wheels/ entry is a
+        hard link to it, published with an atomic rename.
+        """
+        digest = hashlib.sha256()
+        with open(path, "rb") as f:
+            while chunk := f.read(_HASH_CHUNK_SIZE):
+                digest.update(chunk)
+        hexdigest = digest.hexdigest()
+
+        blob = self.blobs_dir / hexdigest[:2] / hexdigest
+        if not blob.exists():
+            blob.parent.mkdir(parents=True, exist_ok=True)
+            fd, tmp = tempfile.mkstemp(dir=self._staging_dir)
+            os.close(fd)
+            shutil.copyfile(path, tmp)
+            os.chmod(tmp, 0o444)
+            os.replace(tmp, blob)
+
+        target = self.wheels_dir / path.name
+        if target.exists() and os.path.samefile(target, blob):
+            return target
+        tmp_link = self._staging_dir / f"{hexdigest}.{threading.get_ident()}"
+        tmp_link.unlink(missing_ok=True)
+        os.link(blob, tmp_link)
+        os.replace(tmp_link, target)
+        logger.debug(f"Stored {path.name} as sha256:{hexdigest}")
+        return target
+
+    def _helper_env(self) -> dict[str, str]:
+        """Environment of the helper's interpreter and pip.
+
+        Nothing in it points at a place sandboxed code can write: Python runs with
+        -I anyway, and pip gets a private HOME and no config file.
+        """
+        env = {
+            k: v
+            for k, v in os.environ.items()
+            if not k.startswith(("PYTHON", "PIP_", "LD_"))
+        }
+        env["HOME"] = str(self._home_dir)
+        env["PIP_CONFIG_FILE"] = os.devnull
+        return env
+
+    def _python(self, *args: str) -> list[str]:
+        """Command line of the sandbox's interpreter, isolated (-I implies -s -E)."""
+        return [self.python, "-I", *args]
+
+    def _pip(self, *args: str) -> list[str]:
+        return self._python(
+            "-m", "pip", *args, "--isolated", "--disable-pip-version-check"
+        )
+
+    def _installed_distributions(self) -> list[tuple[str, str]]:
+        # From the metadata in the site directories: nothing in them is imported
+        paths = [f"--path={d}" for d in self._site_dirs()]
+        if not paths:
+            return []
+        result = subprocess.run(
+            self._pip("list", "--format=json", *paths),
+            capture_output=True,
+            text=True,
+            env=self._helper_env(),
+            timeout=_DOWNLOAD_TIMEOUT,
+        )
+        if result.returncode != 0:
+            logger.warning(f"pip list failed: {result.stderr.strip()[:500]}")
+            return []
+        return [(d["name"], d["version"]) for d in json.loads(result.stdout)]
+
+    def harvest_installed(self) -> int:
+        """Fetch wheels for installed distributions that aren't stored yet.
+
+        Only binary wheels are downloaded: building an sdist here would run
+        untrusted build code outside the sandbox.
+
+        Returns:
+            Number of wheels added.
+        """
+        missing = [
+            (name, version)
+            for name, version in self._installed_distributions()
+            if (name, version) not in self._unavailable
+            and not self.has_wheel_for(name, version)
+        ]
+        added = 0
+        for name, version in missing:
+            with tempfile.TemporaryDirectory(dir=self._staging_dir) as tmp:
+                result = subprocess.run(
+                    self._pip(
+                        "download",
+                        "--no-deps",
+                        "--only-binary=:all:",
+                        "--no-cache-dir",
+                        "-d",
+                        tmp,
+                        f"{name}=={version}",
+                    ),
+                    capture_output=True,
+                    text=True,
+                    env=self._helper_env(),
+                    timeout=_DOWNLOAD_TIMEOUT,
+                )
+                wheels = list(Path(tmp).glob("*.whl"))
+                if result.returncode != 0 or not wheels:
+                    self._unavailable.add((name, version))
+                    logger.debug(f"No binary wheel for {name}=={version}")
+                    continue
+                for wheel in wheels:
+                    self.ingest_wheel(wheel)
+                    added += 1
+        return added
+
+    def _site_dirs(self) -> list[str]:
+        """The interpreter's stdlib and site directories that exist right now.
+
+        The candidates are asked of the interpreter once; the sandbox's user site
+        (under PYTHONUSERBASE=/tmp) only exists once something was installed there.
+        """
+        if self._site_dir_candidates is None:
+            self._site_dir_candidates = self._query_site_dirs()
+        return [d for d in self._site_dir_candidates if os.path.isdir(d)]
+
+    def _query_site_dirs(self) -> list[str]:
+        # The user site is computed for the sandbox's user base, not read from
+        # the environment (which -I ignores)
+        result = subprocess.run(
+            self._python(
+                "-c",
+                "import json, os, site, sysconfig; "
+                "paths = sysconfig.get_paths(); "
+                "user = sysconfig.get_path('purelib', f'{os.name}_user', "
+                f"vars={{'userbase': {_SANDBOX_USERBASE!r}}}); "
+                "print(json.dumps([paths['stdlib'], paths['purelib'], paths['platlib'], "
+                "*site.getsitepackages(), user]))",
+            ),
+            capture_output=True,
+            text=True,
+            env=self._helper_env(),
+            timeout=_DOWNLOAD_TIMEOUT,
+        )
+        if result.returncode != 0:
+            return []
+        return list(dict.fromkeys(json.loads(result.stdout)))
+
+    def installed_fingerprint(self) -> str:
+        """Digest of the distributions installed for the sandbox's interpreter.
+
+        Built from the *.dist-info / *.egg-info entry names (which carry the
+        version) in the site directories, so it changes with every install,
+        upgrade or removal without running pip.
+        """
+        digest = hashlib.sha256()
+        for site_dir in self._site_dirs():
+            try:
+                names = sorted(
+                    entry.name
+                    for entry in os.scandir(site_dir)
+                    if entry.name.endswith((".dist-info", ".egg-info"))
+                )
+            except OSError:
+                continue
+            digest.update("\0".join([site_dir, *names]).encode() + b"\n")
+        return digest.hexdigest()
+
+    def compile_bytecode(self) -> None:
+        """Compile the interpreter's stdlib and site packages into pycache/.
+
+        With PYTHONPYCACHEPREFIX set, Python ignores in-tree __pycache__ dirs, so
+        the stdlib must be compiled into the prefix too. Files whose bytecode is
+        already up to date are skipped. Symlinks are not followed: the prefix is
+        readable in the sandbox, so a link to a blocked file must not be compiled
+        into it.
+        """
+        dirs = self._site_dirs()
+        if not dirs:
+            return
+        subprocess.run(
+            self._python(
+                "-X", f"pycache_prefix={self.pycache_dir}", "-c", _COMPILE_SCRIPT, *dirs
+            ),
+            capture_output=True,
+            env=self._helper_env(),
+            timeout=_COMPILE_TIMEOUT,
+        )
+
+    def refresh(self) -> None:
+        """Bring the store up to date with what the sandbox has installed.
+
+        Does nothing if the installed distributions haven't changed since the
+        store last caught up with them.
+        """
+        try:
+            # Wheels are only harvested with downloads allowed: track both states
+            fingerprint = self.installed_fingerprint()
+            if self._allow_download:
+                fingerprint += "+downloads"
+            try:
+                if self._state_file.read_text() == fingerprint:
+                    return
+            except FileNotFoundError:
+                pass
+            if self._allow_download:
+                added = self.harvest_installed()
+                if added:
+                    logger.info(f"Added {added} wheel(s) to the package store")
+            self.compile_bytecode()
+            fd, tmp = tempfile.mkstemp(dir=self._staging_dir)
+            with os.fdopen(fd, "w") as f:
+                f.write(fingerprint)
+            os.replace(tmp, self._state_file)
+        except (OSError, subprocess.SubprocessError, ValueError) as e:
+            logger.warning(f"Package store refresh failed: {e}")
+
+    def schedule_refresh(self, allow_download: bool = True) -> None:
+        """Queue a refresh on the background worker (coalesces repeated calls).
+
+        Cheap when nothing was installed: see refresh().
+        """
+        self._allow_download = allow_download
+        if self._worker is None:
+            self._worker = threading.Thread(
+                target=self._run_worker, name="package-store", daemon=True
+            )
+            self._worker.start()
+        self._refresh_requested.set()
+
+    def _run_worker(self) -> None:
+        while True:
+            self._refresh_requested.wait()
+            self._refresh_requested.clear()
+            self.refresh()
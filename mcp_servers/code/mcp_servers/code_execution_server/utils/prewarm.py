@@ -0,0 +1,267 @@
+"""
+prewarm.py - Pull the files executions read into the page cache at server start
+
+The first command after a container starts pays for every interpreter, shared
+library and site-packages file it touches being read from cold (often overlay or
+network) storage: `import pandas` alone opens several hundred files. At startup the
+server asks the kernel to read those files ahead (posix_fadvise(WILLNEED)) from a
+pool of threads, so the I/O is queued in parallel instead of being faulted in one
+file at a time by the first command.
+
+Which files: the access profile, recorded from execution traces (the same
+SANDBOX_TRACE_FILE sandbox_fs.so writes for utils/memo.py). The first
+PROFILE_RUNS commands after each start are traced, and the regular files they
+opened, executed or loaded as shared objects outside the working directory are
+counted and saved across restarts (under /var/cache, like the package store). Without
+a profile, the sandbox library, the interpreter and its extension modules are warmed.
+Profiling only sets the trace file: unlike a memo trace, it leaves the command's
+stdin and hash seed alone.
+
+Prewarming stops at a time budget and a byte budget, both checked before each file.
+
+Usage:
+    profile = AccessProfile.load(DEFAULT_PROFILE_PATH, exclude_roots=["/filesystem"])
+    paths = profile.hot_paths() or default_paths(library_path)
+    prewarm(paths, budget_seconds=10)
+    ...
+    if profile.wants_trace():
+        with profile.trace() as trace_file:
+            run_sandboxed_command(..., trace_file=trace_file)
+            profile.add_trace(trace_file)
+"""
+
+import json
+import os
+import shutil
+import stat
+import subprocess
+import tempfile
+import threading
+import time
+from collections import Counter
+from collections.abc import Iterator
+from concurrent.futures import ThreadPoolExecutor
+from contextlib import contextmanager
+from dataclasses import dataclass
+
+from loguru import logger
+
+DEFAULT_PROFILE_PATH = "/var/cache/sandbox-prewarm/profile.json"
+# Blocked inside the sandbox like the memo's traces (see build_sandbox_env)
+DEFAULT_TRACE_DIR = "/dev/shm/sandbox_prewarm_traces"
+
+DEFAULT_BUDGET_SECONDS = 10.0
+# Never ask for more than this share of MemAvailable
+_MAX_MEMORY_SHARE = 0.25
+_WORKERS = 16
+
+# Commands traced per server start
+PROFILE_RUNS = 16
+# Paths kept in the saved profile, most used first
+MAX_PROFILE_PATHS = 20_000
+
+# Same search order as the sandbox's PATH (see build_sandbox_env)
+_SANDBOX_PYTHON_SEARCH_PATH = "/usr/local/bin:/usr/bin:/bin"
+_PSEUDO_ROOTS = ("/proc/", "/sys/", "/dev/")
+
+
+@dataclass
+class PrewarmStats:
+    files: int = 0
+    bytes: int = 0
+    skipped: int = 0
+    seconds: float = 0.0
+
+
+def _mem_available() -> int:
+    try:
+        with open("/proc/meminfo") as f:
+            for line in f:
+                if line.startswith("MemAvailable:"):
+                    return int(line.split()[1]) * 1024
+    except OSError:
+        pass
+    return 0
+
+
+def _willneed(path: str) -> int:
+    """Start readahead of the whole file; returns its size (0 if it can't be read)."""
+    try:
+        fd = os.open(path, os.O_RDONLY | os.O_CLOEXEC | os.O_NONBLOCK)
+    except OSError:
+        return 0
+    try:
+        st = os.fstat(fd)
+        if not stat.S_ISREG(st.st_mode):
+            return 0
+        os.posix_fadvise(fd, 0, 0, os.POSIX_FADV_WILLNEED)
+        return st.st_size
+    except OSError:
+        return 0
+    finally:
+        os.close(fd)
+
+
+def prewarm(
+    paths: list[str],
+    budget_seconds: float = DEFAULT_BUDGET_SECONDS,
+    max_bytes: int | None = None,
+) -> PrewarmStats:
+    """Read paths ahead, hottest first, until either budget runs out.
+
+    max_bytes defaults to a quarter of MemAvailable, so warming never pushes
+    anything hotter out of the cache.
+    """
+    if max_bytes is None:
+        max_bytes = int(_mem_available() * _MAX_MEMORY_SHARE)
+    start = time.monotonic()
+    deadline = start + budget_seconds
+    stats = PrewarmStats()
+    lock = threading.Lock()
+    queue = iter(paths)
+
+    def worker() -> None:
+        while True:
+            with lock:
+                if time.monotonic() > deadline or stats.bytes >= max_bytes:
+                    return
+                path = next(queue, None)
+            if path is None:
+                return
+            size = _willneed(path)
+            with lock:
+                if size:
+                    stats.files += 1
+                    stats.bytes += size
+                else:
+                    stats.skipped += 1
+
+    with ThreadPoolExecutor(_WORKERS, thread_name_prefix="prewarm") as pool:
+        for _ in range(_WORKERS):
+            pool.submit(worker)
+    stats.seconds = time.monotonic() - start
+    return stats
+
+
+def default_paths(library_path: str) -> list[str]:
+    """The sandbox library, the sandbox's interpreter and its extension modules."""
+    paths = [library_path]
+    python = shutil.which("python3", path=_SANDBOX_PYTHON_SEARCH_PATH)
+    if python is None:
+        return paths
+    paths.append(os.path.realpath(python))
+    try:
+        out = subprocess.run(
+            [
+                python,
+                "-c",
+                "import json, sysconfig; print(json.dumps(["
+                "sysconfig.get_config_var('LIBDIR') or '', "
+                "sysconfig.get_paths()['stdlib'], sysconfig.get_paths()['platlib']]))",
+            ],
+            capture_output=True,
+            text=True,
+            timeout=30,
+            check=True,
+        ).stdout
+        libdir, stdlib, platlib = json.loads(out)
+    except (OSError, subprocess.SubprocessError, ValueError) as e:
+        logger.warning(f"Cannot locate the sandbox interpreter's libraries: {e}")
+        return paths
+
+    if libdir and os.path.isdir(libdir):
+        paths += [
+            os.path.join(libdir, name)
+            for name in sorted(os.listdir(libdir))
+            if name.startswith("libpython") and ".so" in name
+        ]
+    for root in (os.path.join(stdlib, "lib-dynload"), platlib):
+        for dirpath, _, filenames in os.walk(root):
+            paths += [
+                os.path.join(dirpath, name)
+                for name in sorted(filenames)
+                if name.endswith(".so") or ".so." in name
+            ]
+    return paths
+
+
+class AccessProfile:
+    """Files opened by recent executions, with how many of them opened each."""
+
+    def __init__(self, path: str, counts: Counter[str], exclude_roots: list[str]):
+        self.path = path
+        self.counts = counts
+        self.exclude_roots = tuple(r.rstrip("/") + "/" for r in exclude_roots)
+        self.trace_dir = DEFAULT_TRACE_DIR
+        self.traced_runs = 0
+        self._lock = threading.Lock()
+
+    @classmethod
+    def load(cls, path: str, exclude_roots: list[str]) -> "AccessProfile":
+        """Read the saved profile; an unreadable one is started over."""
+        counts: Counter[str] = Counter()
+        try:
+            with open(path) as f:
+                counts.update(json.load(f)["paths"])
+        except FileNotFoundError:
+            pass
+        except (OSError, ValueError, KeyError, TypeError) as e:
+            logger.warning(f"Ignoring unreadable prewarm profile {path}: {e}")
+            counts.clear()
+        return cls(path, counts, exclude_roots)
+
+    def hot_paths(self) -> list[str]:
+        with self._lock:
+            return [path for path, _ in self.counts.most_common()]
+
+    def wants_trace(self) -> bool:
+        """Whether the next command should be traced for the profile."""
+        with self._lock:
+            if self.traced_runs >= PROFILE_RUNS:
+                return False
+            self.traced_runs += 1
+            return True
+
+    @contextmanager
+    def trace(self) -> Iterator[str]:
+        """An empty trace file for one run, removed afterwards."""
+        os.makedirs(self.trace_dir, mode=0o700, exist_ok=True)
+        fd, path = tempfile.mkstemp(dir=self.trace_dir, suffix=".trace")
+        os.close(fd)
+        try:
+            yield path
+        finally:
+            os.unlink(path)
+
+    def add_trace(self, trace_file: str) -> None:
+        """Count the regular files a traced run read, and save the profile."""
+        seen: set[str] = set()
+        try:
+            with open(trace_file, encoding="utf-8", errors="surrogateescape") as f:
+                for line in f:
+                    kind, path, identity = line.rstrip("\n").split("\t")
+                    if kind not in ("R", "X", "L", "M") or identity == "-":
+                        continue
+                    if path.startswith(_PSEUDO_ROOTS + self.exclude_roots):
+                        continue
+                    if stat.S_ISREG(int(identity.split(":")[2], 8)):
+                        seen.add(path)
+        except (OSError, ValueError, IndexError) as e:
+            logger.debug(f"Not adding trace to the prewarm profile: {e}")
+            return
+        with self._lock:
+            self.counts.update(seen)
+            if len(self.counts) > MAX_PROFILE_PATHS:
+                self.counts = Counter(dict(self.counts.most_common(MAX_PROFILE_PATHS)))
+            data = {"paths": dict(self.counts)}
+        self._save(data)
+
+    def _save(self, data: dict) -> None:
+        try:
+            os.makedirs(os.path.dirname(self.path), exist_ok=True)
+            fd, tmp = tempfile.mkstemp(dir=os.path.dirname(self.path), suffix=".tmp")
+            with os.fdopen(fd, "w") as f:
+                json.dump(data, f)
+            os.replace(tmp, self.path)
+        except OSError as e:
+            logger.warning(f"Cannot save prewarm profile {self.path}: {e}")
@@ -0,0 +1,274 @@
+"""
+process_tree.py - Find and tear down everything a sandboxed command left behind
+
+Killing a command's process group misses anything that left it: `setsid`, daemons
+that double-fork, servers started with `nohup ... &` that outlive the shell. To find
+those, the server makes itself a child subreaper (PR_SET_CHILD_SUBREAPER), so orphans
+are re-parented to it instead of init. Each execution also carries a
+SANDBOX_EXEC_TOKEN in its environment.
+
+A process belongs to an execution if it is in the shell's session (the shell is
+started with start_new_session), carries the execution's token, or descends from
+either. Nothing else is: an adopted orphan that left the session and scrubbed its
+environment can't be told apart from the server's own children (pip, probes,
+interpreter checkpoints), so it is left alone.
+
+Teardown freezes members with SIGSTOP (so nothing can fork while we scan), repeats
+the scan until no new members appear, then SIGKILLs them. All signals go through
+pidfds, so a recycled pid is never hit. Adopted processes are reaped by the server.
+
+Usage:
+    become_subreaper()
+    tree = ProcessTree(process.pid, token)
+    with tree.tracking():
+        process.communicate()
+        killed = tree.teardown()
+"""
+
+import ctypes
+import os
+import select
+import signal
+import threading
+import time
+from collections.abc import Iterator
+from contextlib import contextmanager
+from dataclasses import dataclass
+
+from loguru import logger
+
+PR_SET_CHILD_SUBREAPER = 36
+EXEC_TOKEN_ENV = "SANDBOX_EXEC_TOKEN"
+
+# Scan/freeze rounds before giving up on a tree that keeps forking
+_MAX_FREEZE_ROUNDS = 16
+
+# Root shells of running executions -> their tokens
+_active_roots: dict[int, str | None] = {}
+_active_lock = threading.Lock()
+
+
+@dataclass(frozen=True)
+class ProcInfo:
+    """The fields of /proc/<pid>/stat that teardown needs."""
+
+    pid: int
+    ppid: int
+    session: int
+    state: str
+    comm: str
+    cpu_ticks: int
+    start_ticks: int
+
+    def describe(self) -> str:
+        return f"{self.pid} ({self.comm})"
+
+
+def become_subreaper() -> bool:
+    """Make this process the reaper for orphaned descendants. Call at startup."""
+    libc = ctypes.CDLL(None, use_errno=True)
+    if libc.prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0) != 0:
+        logger.warning(
+            f"PR_SET_CHILD_SUBREAPER failed ({os.strerror(ctypes.get_errno())}); "
+            "daemonized processes will only be found by their exec token"
+        )
+        return False
+    return True
+
+
+def read_proc(pid: int) -> ProcInfo | None:
+    try:
+        with open(f"/proc/{pid}/stat", "rb") as f:
+            data = f.read().decode(errors="replace")
+    except OSError:
+        return None
+    # comm may contain spaces and parentheses; it ends at the last ')'
+    open_paren = data.index("(")
+    close_paren = data.rindex(")")
+    fields = data[close_paren + 2 :].split()
+    return ProcInfo(
+        pid=pid,
+        ppid=int(fields[1]),
+        session=int(fields[3]),
+        state=fields[0],
+        comm=data[open_paren + 1 : close_paren],
+        cpu_ticks=int(fields[11]) + int(fields[12]),
+        start_ticks=int(fields[19]),
+    )
+
+
+def list_processes() -> dict[int, ProcInfo]:
+    procs = {}
+    for entry in os.listdir("/proc"):
+        if entry.isdigit():
+            info = read_proc(int(entry))
+            if info is not None:
+                procs[info.pid] = info
+    return procs
+
+
+def _exec_token(pid: int) -> str | None:
+    try:
+        with open(f"/proc/{pid}/environ", "rb") as f:
+            environ = f.read()
+    except OSError:
+        return None
+    prefix = f"{EXEC_TOKEN_ENV}=".encode()
+    for var in environ.split(b"\0"):
+        if var.startswith(prefix):
+            return var[len(prefix) :].decode(errors="replace")
+    return None
+
+
+def reap_orphans() -> None:
+    """Reap zombies adopted from sandboxed sessions.
+
+    Only children outside the server's own session are touched, and never a
+    running execution's root shell, so subprocess.Popen objects elsewhere in
+    the server keep their exit statuses.
+    """
+    my_pid, my_session = os.getpid(), os.getsid(0)
+    with _active_lock:
+        roots = set(_active_roots)
+    for info in list_processes().values():
+        if (
+            info.ppid == my_pid
+            and info.state == "Z"
+            and info.session != my_session
+            and info.pid not in roots
+        ):
+            try:
+                os.waitpid(info.pid, os.WNOHANG)
+            except ChildProcessError:
+                pass  # Reaped by a concurrent teardown
+
+
+class ProcessTree:
+    """The processes started, directly or not, by one sandboxed command."""
+
+    def __init__(self, root_pid: int, token: str | None):
+        self.root_pid = root_pid
+        self.token = token
+
+    @contextmanager
+    def tracking(self) -> Iterator["ProcessTree"]:
+        """Register the root shell so concurrent teardowns leave it alone."""
+        with _active_lock:
+            _active_roots[self.root_pid] = self.token
+        try:
+            yield self
+        finally:
+            with _active_lock:
+                _active_roots.pop(self.root_pid, None)
+
+    def members(self, procs: dict[int, ProcInfo]) -> dict[int, ProcInfo]:
+        """Live members of the tree (excluding the root shell) in a /proc scan."""
+        my_pid, my_session = os.getpid(), os.getsid(0)
+        with _active_lock:
+            other_roots = {pid for pid in _active_roots if pid != self.root_pid}
+
+        members: dict[int, ProcInfo] = {}
+        for info in procs.values():
+            if info.pid in (my_pid, self.root_pid) or info.pid in other_roots:
+                continue
+            if info.session == self.root_pid:
+                members[info.pid] = info
+            elif (
+                self.token is not None
+                and info.session != my_session
+                and info.session not in other_roots
+                and _exec_token(info.pid) == self.token
+            ):
+                members[info.pid] = info
+
+        # Descendants of members, whatever session or environment they have
+        children: dict[int, list[ProcInfo]] = {}
+        for info in procs.values():
+            children.setdefault(info.ppid, []).append(info)
+        pending = [self.root_pid, *members]
+        while pending:
+            for child in children.get(pending.pop(), []):
+                if child.pid not in members and child.pid not in other_roots:
+                    members[child.pid] = child
+                    pending.append(child.pid)
+        return {pid: p for pid, p in members.items() if p.state != "Z"}
+
+    def survivors(self) -> list[ProcInfo]:
+        return list(self.members(list_processes()).values())
+
+    def teardown(self, wait_timeout: float = 2.0) -> list[ProcInfo]:
+        """Kill every member of the tree and reap the ones we adopted.
+
+        Returns:
+            The processes that were killed.
+        """
+        pidfds: dict[int, tuple[int, ProcInfo]] = {}
+        try:
+            for _ in range(_MAX_FREEZE_ROUNDS):
+                new = [
+                    p
+                    for p in self.members(list_processes()).values()
+                    if p.pid not in pidfds
+                ]
+                if not new:
+                    break
+                for info in new:
+                    try:
+                        fd = os.pidfd_open(info.pid)
+                    except OSError:
+                        continue  # Already gone
+                    # The pid may have been recycled between the scan and pidfd_open
+                    current = read_proc(info.pid)
+                    if current is None or current.start_ticks != info.start_ticks:
+                        os.close(fd)
+                        continue
+                    pidfds[info.pid] = (fd, info)
+                    _pidfd_signal(fd, signal.SIGSTOP)
+            else:
+                logger.warning(
+                    f"Process tree of {self.root_pid} still growing after "
+                    f"{_MAX_FREEZE_ROUNDS} rounds; killing what was found"
+                )
+
+            for fd, _ in pidfds.values():
+                _pidfd_signal(fd, signal.SIGKILL)
+            self._wait_exited([fd for fd, _ in pidfds.values()], wait_timeout)
+
+            my_pid = os.getpid()
+            for pid, (fd, _) in pidfds.items():
+                current = read_proc(pid)
+                if current is not None and current.ppid == my_pid:
+                    try:
+                        os.waitid(os.P_PIDFD, fd, os.WEXITED | os.WNOHANG)
+                    except ChildProcessError:
+                        pass
+        finally:
+            for fd, _ in pidfds.values():
+                os.close(fd)
+
+        reap_orphans()
+        return [info for _, info in pidfds.values()]
+
+    @staticmethod
+    def _wait_exited(fds: list[int], timeout: float) -> None:
+        """Wait until every pidfd reports its process has exited."""
+        poller = select.poll()
+        for fd in fds:
+            poller.register(fd, select.POLLIN)
+        remaining = len(fds)
+        deadline = time.monotonic() + timeout
+        while remaining:
+            left_ms = int((deadline - time.monotonic()) * 1000)
+            if left_ms <= 0:
+                logger.warning(f"{remaining} killed process(es) did not exit in time")
+                return
+            for fd, _ in poller.poll(left_ms):
+                poller.unregister(fd)
+                remaining -= 1
+
+
+def _pidfd_signal(fd: int, sig: int) -> None:
+    try:
+        signal.pidfd_send_signal(fd, sig)
+    except ProcessLookupError:
+        pass  # Exited since we looked
@@ -16,18 +16,27 @@ Usage:
 """
 
 import os
+import select
 import signal
 import subprocess
-from dataclasses import dataclass
+import threading
+import uuid
+from dataclasses import dataclass, field
 
 from loguru import logger
 
+from utils.process_tree import EXEC_TOKEN_ENV, ProcessTree, ProcInfo
+from utils.shared_segment import SharedSegment, SlotsExhausted
+
 # Default paths to block from user code execution
 DEFAULT_BLOCKED_PATHS = ["/app", "/.apps_data"]
 
 # Default library installation path (under /app/ for Docker multi-stage build compatibility)
 DEFAULT_LIBRARY_PATH = "/app/lib/sandbox_fs.so"
 
+# Marks a blocked/read-only path as audit-only (must match sandbox_fs.c)
+AUDIT_RULE_PREFIX = "~"
+
 
 @dataclass
 class SandboxResult:
@@ -38,6 +47,18 @@ class SandboxResult:
     return_code: int
     timed_out: bool = False
     error: str | None = None
+    bytes_written: int = 0
+    quota_exceeded: bool = False
+    # Audit-only policy rules (see build_sandbox_env): calls they would have
+    # denied, and the number/total time of policy checks during the run
+    audit_denials: int = 0
+    policy_checks: int = 0
+    policy_check_ns: int = 0
+    # Trace events the library failed to record (see trace_file); nonzero means
+    # the trace is incomplete
+    trace_errors: int = 0
+    # "pid (comm)" of processes still running after the command finished
+    leaked_processes: list[str] = field(default_factory=list)
 
     @property
     def success(self) -> bool:
@@ -65,15 +86,44 @@ def build_sandbox_env(
     debug: bool = False,
     inherit_env: bool = True,
     extra_env: dict[str, str] | None = None,
+    ephemeral_roots: list[str] | None = None,
+    segment_path: str | None = None,
+    exec_slot: int | None = None,
+    tracked_roots: list[str] | None = None,
+    readonly_paths: list[str] | None = None,
+    audit_log: str | None = None,
+    trace_file: str | None = None,
+    hermetic_trace: bool = False,
 ) -> dict[str, str]:
     """Build environment variables for sandboxed execution.
 
     Args:
-        blocked_paths: List of filesystem paths to block (default: ["/app", "/.apps_data"])
+        blocked_paths: List of filesystem paths to block (default: ["/app", "/.apps_data"]).
+            Entries of blocked_paths and readonly_paths prefixed with AUDIT_RULE_PREFIX
+            ("~") are audit-only: evaluated and counted, but never enforced.
         library_path: Path to the sandbox_fs.so library
         debug: Enable debug logging in the sandbox library
         inherit_env: Whether to inherit current environment variables
         extra_env: Additional environment variables to set
+        ephemeral_roots: Roots whose contents are discarded after the episode.
+            When set, fsync/fdatasync/sync_file_range/syncfs on files under
+            these roots become no-ops (the snapshot issues one syncfs barrier).
+        segment_path: Shared segment (see utils/shared_segment.py). Mutations under
+            tracked_roots pause while a snapshot quiesces it. Added to the blocked
+            paths so sandboxed code can't tamper with it.
+        exec_slot: Slot in the shared segment charged for writes under tracked_roots
+        tracked_roots: Roots subject to the write quota and snapshot quiescing
+            (default in the library: /filesystem)
+        readonly_paths: Paths that stay readable but reject every modification
+            with EROFS (e.g. the shared package store)
+        audit_log: File the library appends audit-only decisions to. Added to
+            the blocked paths.
+        trace_file: Existing file the library appends the execution trace to
+            (see utils/memo.py). Added to the blocked paths.
+        hermetic_trace: The trace decides whether the result can be reused, so
+            Python's hash seed is pinned (the interpreter doesn't read randomness
+            at startup). Other traces (e.g. prewarm profiling) leave the
+            command's environment as it is.
 
     Returns:
         Dictionary of environment variables for the subprocess.
@@ -134,8 +184,32 @@ def build_sandbox_env(
 
     # Set sandbox-specific environment variables
     env["LD_PRELOAD"] = library_path
+    if segment_path:
+        paths = [*paths, segment_path]
+    if audit_log:
+        paths = [*paths, audit_log]
+        env["SANDBOX_AUDIT_LOG"] = audit_log
+    if trace_file:
+        paths = [*paths, trace_file]
+        env["SANDBOX_TRACE_FILE"] = trace_file
+        if hermetic_trace:
+            env["PYTHONHASHSEED"] = "0"
     env["SANDBOX_BLOCKED_PATHS"] = ":".join(paths)
 
+    if readonly_paths:
+        env["SANDBOX_READONLY_PATHS"] = ":".join(readonly_paths)
+
+    if ephemeral_roots:
+        env["SANDBOX_RELAXED_DURABILITY"] = "1"
+        env["SANDBOX_EPHEMERAL_ROOTS"] = ":".join(ephemeral_roots)
+
+    if segment_path:
+        env["SANDBOX_SHARED_SEGMENT"] = segment_path
+        if exec_slot is not None:
+            env["SANDBOX_EXEC_SLOT"] = str(exec_slot)
+        if tracked_roots:
+            env["SANDBOX_TRACKED_ROOTS"] = ":".join(tracked_roots)
+
     if debug:
         env["SANDBOX_DEBUG"] = "1"
 
@@ -153,6 +227,16 @@ def run_sandboxed_command(
     blocked_paths: list[str] | None = None,
     library_path: str = DEFAULT_LIBRARY_PATH,
     debug: bool = False,
+    ephemeral_roots: list[str] | None = None,
+    segment: SharedSegment | None = None,
+    write_quota_bytes: int = 0,
+    tracked_roots: list[str] | None = None,
+    readonly_paths: list[str] | None = None,
+    extra_env: dict[str, str] | None = None,
+    kill_background: bool = True,
+    audit_log: str | None = None,
+    trace_file: str | None = None,
+    hermetic_trace: bool = False,
 ) -> SandboxResult:
     """Run a shell command with filesystem sandboxing via LD_PRELOAD.
 
@@ -172,6 +256,28 @@ def run_sandboxed_command(
         blocked_paths: List of paths to block (default: ["/app", "/.apps_data"])
         library_path: Path to the sandbox_fs.so library
         debug: Enable sandbox debug logging
+        ephemeral_roots: Roots on which sync calls are relaxed (default: none)
+        segment: Shared segment. When given, the execution tree gets a slot,
+            bytes written under tracked_roots are counted and mutations there
+            pause while a snapshot is being captured. The slot is held until
+            every process of the tree has exited; with all slots held, the
+            command is not run and the result carries the error.
+        write_quota_bytes: Writes fail with ENOSPC beyond this many bytes
+            (0 = count only). Requires segment.
+        tracked_roots: Roots charged against the quota and quiesced for snapshots
+            (default: ["/filesystem"])
+        readonly_paths: Paths mounted read-only into the sandbox (default: none)
+        extra_env: Additional environment variables for the command
+        kill_background: Kill processes the command left running (daemons,
+            nohup/setsid jobs) once it exits. They are reported in
+            leaked_processes either way; on timeout they are always killed.
+        audit_log: File to append audit-only rule decisions to (default: none)
+        trace_file: Existing file to record the command's inputs in (see
+            utils/memo.py). Requires segment: events that could not be recorded
+            are reported in trace_errors through the slot.
+        hermetic_trace: The trace is for memoization: the command gets
+            /dev/null as stdin and a fixed PYTHONHASHSEED, so it reads nothing
+            the trace can't see. Ignored without trace_file.
 
     Returns:
         SandboxResult with stdout, stderr, return_code, etc.
@@ -198,19 +304,98 @@ def run_sandboxed_command(
             error=error_msg,
         )
 
-    env = build_sandbox_env(
-        blocked_paths=blocked_paths,
-        library_path=library_path,
-        debug=debug,
-        inherit_env=True,
-    )
-
     logger.debug(f"Running sandboxed command: {command}")
     logger.debug(f"Working directory: {working_dir}")
     logger.debug(f"Blocked paths: {blocked_paths or DEFAULT_BLOCKED_PATHS}")
 
+    # Lets the teardown find descendants that left the process group and session
+    extra_env = {**(extra_env or {}), EXEC_TOKEN_ENV: uuid.uuid4().hex}
+
+    if segment is None:
+        if trace_file:
+            logger.warning("Tracing requires the shared segment; not tracing")
+        env = build_sandbox_env(
+            blocked_paths=blocked_paths,
+            library_path=library_path,
+            debug=debug,
+            inherit_env=True,
+            ephemeral_roots=ephemeral_roots,
+            readonly_paths=readonly_paths,
+            extra_env=extra_env,
+            audit_log=audit_log,
+        )
+        return _run_process(command, timeout, working_dir, env, kill_background)[0]
+
+    try:
+        slot = segment.acquire(quota_bytes=write_quota_bytes)
+    except SlotsExhausted as e:
+        logger.error(str(e))
+        return SandboxResult(
+            stdout="",
+            stderr="",
+            return_code=-1,
+            error=f"{e}. Retry once running commands finish.",
+        )
+    left_running: ProcessTree | None = None
+    try:
+        env = build_sandbox_env(
+            blocked_paths=blocked_paths,
+            library_path=library_path,
+            debug=debug,
+            inherit_env=True,
+            ephemeral_roots=ephemeral_roots,
+            segment_path=segment.path,
+            exec_slot=slot.index,
+            tracked_roots=tracked_roots,
+            readonly_paths=readonly_paths,
+            extra_env=extra_env,
+            audit_log=audit_log,
+            trace_file=trace_file,
+            hermetic_trace=hermetic_trace,
+        )
+        hermetic = bool(trace_file) and hermetic_trace
+        result, left_running = _run_process(
+            command, timeout, working_dir, env, kill_background, hermetic
+        )
+        usage = slot.usage()
+    finally:
+        # Processes left running keep writing through the slot: it is only
+        # handed out again once they are gone
+        segment.release(
+            slot,
+            in_use=(lambda tree=left_running: bool(tree.survivors()))
+            if left_running is not None
+            else None,
+        )
+
+    result.bytes_written = usage.bytes_written
+    result.quota_exceeded = usage.quota_exceeded
+    result.audit_denials = usage.audit_denials
+    result.policy_checks = usage.policy_checks
+    result.policy_check_ns = usage.policy_check_ns
+    result.trace_errors = usage.trace_errors
+    return result
+
+
+def _run_process(
+    command: str,
+    timeout: int,
+    working_dir: str,
+    env: dict[str, str],
+    kill_background: bool,
+    hermetic: bool = False,
+) -> tuple[SandboxResult, ProcessTree | None]:
+    """Run the shell command in its own session, collect its output and clean up
+    whatever it left running. A hermetic command gets /dev/null as stdin.
+
+    Returns:
+        The result, and the command's process tree if processes of it were left
+        running (kill_background off)
+    """
     process = subprocess.Popen(
         ["sh", "-c", command],
+        # A traced command must not read anything the trace can't see
+        stdin=subprocess.DEVNULL if hermetic else None,
         stdout=subprocess.PIPE,
         stderr=subprocess.PIPE,
         text=True,
@@ -219,6 +404,46 @@ def run_sandboxed_command(
         start_new_session=True,  # Create new process group for clean timeout handling
     )
 
+    tree = ProcessTree(process.pid, env.get(EXEC_TOKEN_ENV))
+    killed: list[ProcInfo] = []
+    with tree.tracking():
+        watcher = None
+        if kill_background:
+            # Background jobs that inherited stdout/stderr would keep communicate()
+            # waiting long after the shell exits; kill them as soon as it does.
+            # communicate() stays the only waiter: the watcher polls a pidfd,
+            # readable once the shell exits whether or not it was reaped yet.
+            shell_fd = os.pidfd_open(process.pid)
+
+            def kill_on_exit() -> None:
+                poller = select.poll()
+                poller.register(shell_fd, select.POLLIN)
+                poller.poll()
+                killed.extend(tree.teardown())
+
+            watcher = threading.Thread(target=kill_on_exit, daemon=True)
+            watcher.start()
+        try:
+            result = _communicate(process, timeout)
+        finally:
+            if watcher is not None:
+                watcher.join()
+                os.close(shell_fd)
+        kill = kill_background or result.timed_out or result.error is not None
+        leaked = [*killed, *(tree.teardown() if kill else tree.survivors())]
+
+    if leaked:
+        result.leaked_processes = [p.describe() for p in leaked]
+        logger.warning(
+            f"Command left {len(leaked)} process(es) running"
+            f"{' (killed)' if kill else ''}: "
+            f"{', '.join(result.leaked_processes[:10])}"
+        )
+    return result, (tree if leaked and not kill else None)
+
+
+def _communicate(process: subprocess.Popen[str], timeout: int) -> SandboxResult:
+    """Wait for the shell, killing its process group on timeout."""
     try:
         stdout, stderr = process.communicate(timeout=timeout)
         return SandboxResult(
@@ -0,0 +1,205 @@
+"""
+shared_segment.py - Per-execution accounting shared with sandbox_fs.so
+
+The code execution server owns a small file (by default under /dev/shm) that every
+sandboxed process maps MAP_SHARED. It starts with a 64-byte header followed by one
+64-byte slot per concurrent execution. A slot is handed to an execution through
+SANDBOX_EXEC_SLOT; the interposer charges bytes written under the tracked roots to it
+and refuses writes with ENOSPC once the slot's quota is exceeded. While audit-only
+policy rules are configured, the slot also collects would-deny counts and the time
+spent in policy checks; while a command is traced, it counts trace events that could
+not be recorded.
+
+The header also carries the snapshot quiesce count, which is driven by the environment's
+snapshot handler (runner/data/snapshot/quiesce.py), not by this server.
+
+The layout must match the structs in sandbox_fs.c.
+
+A slot stays reserved for as long as any process of its execution may still write
+through it: when processes are left running, the slot is released with a check that
+says whether they still are, and it only returns to the free list once they are gone.
+
+Usage:
+    segment = SharedSegment.create("/dev/shm/sandbox_fs.seg", nslots=64)
+    slot = segment.acquire(quota_bytes=1 << 30)
+    env["SANDBOX_EXEC_SLOT"] = str(slot.index)
+    ...
+    usage = slot.usage()
+    segment.release(slot, in_use=lambda: bool(tree.survivors()))
+"""
+
+import mmap
+import os
+import struct
+import threading
+from collections.abc import Callable, Iterator
+from contextlib import contextmanager
+from dataclasses import dataclass, fields
+
+from loguru import logger
+
+DEFAULT_SEGMENT_PATH = "/dev/shm/sandbox_fs.seg"
+DEFAULT_NSLOTS = 64
+
+SEGMENT_MAGIC = 0x46584253  # "SBXF" in memory
+SEGMENT_VERSION = 1
+
+# struct segment_header { u32 magic, version, nslots, quiesce, mutators, reserved;
+#                         u64 quiesce_expires_ns; u8 pad[32]; }
+HEADER_FORMAT = "<IIIIIIQ32x"
+HEADER_SIZE = 64
+# struct exec_slot { u64 quota_bytes, bytes_written, denials,
+#                    audit_denials, policy_checks, policy_check_ns,
+#                    trace_errors; u8 pad[8]; }
+SLOT_FORMAT = "<QQQQQQQ8x"
+SLOT_SIZE = 64
+
+
+class SlotsExhausted(RuntimeError):
+    """Every slot is held by a running execution or by processes it left behind."""
+
+
+@dataclass
+class SlotUsage:
+    """Counters read back from an execution slot."""
+
+    quota_bytes: int
+    bytes_written: int
+    denials: int
+    # Only counted while audit-only rules are configured
+    audit_denials: int = 0
+    policy_checks: int = 0
+    policy_check_ns: int = 0
+    # Only counted while the command is traced (SANDBOX_TRACE_FILE)
+    trace_errors: int = 0
+
+    @property
+    def quota_exceeded(self) -> bool:
+        return self.denials > 0
+
+
+class ExecSlot:
+    """One execution's slot in the shared segment."""
+
+    def __init__(self, segment: "SharedSegment", index: int):
+        self._segment = segment
+        self.index = index
+
+    def usage(self) -> SlotUsage:
+        return SlotUsage(
+            *struct.unpack_from(
+                SLOT_FORMAT, self._segment._map, self._segment._slot_offset(self.index)
+            )
+        )
+
+
+class SharedSegment:
+    """Server-side owner of the shared accounting segment.
+
+    Slots are allocated from a free list under a lock; only the server allocates,
+    sandboxed processes only ever update the counters of the slot they were given.
+    Slots released while still in use wait in a lingering list and are reclaimed
+    once their check says they no longer are.
+    """
+
+    def __init__(self, path: str, fd: int, nslots: int):
+        self.path = path
+        self.nslots = nslots
+        self._map = mmap.mmap(fd, HEADER_SIZE + nslots * SLOT_SIZE)
+        self._lock = threading.Lock()
+        self._free = list(range(nslots - 1, -1, -1))
+        # (slot index, whether its execution's processes are still running)
+        self._lingering: list[tuple[int, Callable[[], bool]]] = []
+
+    @classmethod
+    def create(
+        cls, path: str = DEFAULT_SEGMENT_PATH, nslots: int = DEFAULT_NSLOTS
+    ) -> "SharedSegment":
+        """Create (or reset) the segment file. Call once at server startup.
+
+        Raises:
+            OSError: If the segment file cannot be created or mapped.
+        """
+        fd = os.open(path, os.O_RDWR | os.O_CREAT | os.O_CLOEXEC, 0o600)
+        try:
+            os.ftruncate(fd, 0)
+            os.ftruncate(fd, HEADER_SIZE + nslots * SLOT_SIZE)
+            segment = cls(path, fd, nslots)
+        finally:
+            os.close(fd)
+        struct.pack_into(
+            HEADER_FORMAT,
+            segment._map,
+            0,
+            SEGMENT_MAGIC,
+            SEGMENT_VERSION,
+            nslots,
+            0,
+            0,
+            0,
+            0,
+        )
+        logger.info(f"Shared sandbox segment at {path} ({nslots} slots)")
+        return segment
+
+    def _slot_offset(self, index: int) -> int:
+        return HEADER_SIZE + index * SLOT_SIZE
+
+    def acquire(self, quota_bytes: int = 0) -> ExecSlot:
+        """Reserve a zeroed slot for one execution. Pair with release().
+
+        Args:
+            quota_bytes: Bytes the execution tree may write under the tracked roots
+                (0 = count only, never refuse)
+
+        Raises:
+            SlotsExhausted: If every slot is in use.
+        """
+        with self._lock:
+            if not self._free:
+                self._reclaim()
+            if not self._free:
+                raise SlotsExhausted(
+                    f"All {self.nslots} sandbox accounting slots are in use "
+                    f"({len(self._lingering)} by processes left running)"
+                )
+            index = self._free.pop()
+        struct.pack_into(
+            SLOT_FORMAT,
+            self._map,
+            self._slot_offset(index),
+            quota_bytes,
+            *[0] * (len(fields(SlotUsage)) - 1),
+        )
+        return ExecSlot(self, index)
+
+    def release(self, slot: ExecSlot, in_use: Callable[[], bool] | None = None) -> None:
+        """Return a slot, or park it while in_use() says processes still hold it."""
+        with self._lock:
+            if in_use is not None and in_use():
+                self._lingering.append((slot.index, in_use))
+            else:
+                self._free.append(slot.index)
+
+    def _reclaim(self) -> None:
+        """Free the lingering slots whose processes are gone (call with the lock)."""
+        still = []
+        for index, in_use in self._lingering:
+            if in_use():
+                still.append((index, in_use))
+            else:
+                self._free.append(index)
+        self._lingering = still
+
+    @contextmanager
+    def slot(self, quota_bytes: int = 0) -> Iterator[ExecSlot]:
+        """acquire() a slot for the block and release() it afterwards.
+
+        Raises:
+            SlotsExhausted: If every slot is in use.
+        """
+        slot = self.acquire(quota_bytes)
+        try:
+            yield slot
+        finally:
+            self.release(slot)
@@ -0,0 +1,104 @@
+"""Benchmark teardown of background processes left behind by sandboxed commands.
+
+Each scenario starts CPU-burning background processes in a way that escapes the
+command's process group (or not) and returns immediately. For each we report how
+long run_sandboxed_command took, how many processes were reported as leaked, and how
+much CPU the survivors burned in the second after the call returned.
+
+Run from mcp_servers/code_execution_server:
+    python ../../scripts/bench_process_teardown.py --library /app/lib/sandbox_fs.so
+"""
+
+import argparse
+import os
+import signal
+import sys
+import time
+import uuid
+
+sys.path.insert(0, os.getcwd())
+
+from utils.process_tree import become_subreaper, list_processes  # noqa: E402
+from utils.sandbox import DEFAULT_LIBRARY_PATH, run_sandboxed_command  # noqa: E402
+
+BURN = "python3 -c 'while True: pass' {marker}"
+
+SCENARIOS = {
+    "none": "true",
+    "background": "{burn} & {burn} &",
+    "nohup": "nohup {burn} >/dev/null 2>&1 &",
+    "setsid": "setsid {burn} >/dev/null 2>&1 < /dev/null &",
+    "double-fork": "( ( {burn} >/dev/null 2>&1 & ) & ) ; sleep 0.05",
+    "fork-bomb-ish": "for i in 1 2 3 4 5 6 7 8; do setsid {burn} >/dev/null 2>&1 & done",
+}
+
+
+def _marked(marker: str) -> list[int]:
+    pids = []
+    for pid in list_processes():
+        try:
+            with open(f"/proc/{pid}/cmdline", "rb") as f:
+                if marker.encode() in f.read():
+                    pids.append(pid)
+        except OSError:
+            continue
+    return pids
+
+
+def _cpu_seconds(pids: list[int], window: float) -> float:
+    def ticks() -> int:
+        procs = list_processes()
+        return sum(procs[p].cpu_ticks for p in pids if p in procs)
+
+    before = ticks()
+    time.sleep(window)
+    return (ticks() - before) / os.sysconf("SC_CLK_TCK")
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--library", default=DEFAULT_LIBRARY_PATH)
+    parser.add_argument("--workdir", default="/tmp")
+    parser.add_argument("--window", type=float, default=1.0)
+    args = parser.parse_args()
+
+    subreaper = become_subreaper()
+    print(f"subreaper: {subreaper}")
+    print(
+        f"{'scenario':<14} {'kill':<5} {'call ms':>8} {'leaked':>7} "
+        f"{'alive':>6} {'cpu s/s':>8}"
+    )
+    for name, template in SCENARIOS.items():
+        for kill in (False, True):
+            marker = f"teardown-bench-{uuid.uuid4().hex[:8]}"
+            command = template.format(burn=BURN.format(marker=marker))
+            started = time.monotonic()
+            result = run_sandboxed_command(
+                command=command,
+                timeout=30,
+                working_dir=args.workdir,
+                library_path=args.library,
+                kill_background=kill,
+            )
+            elapsed_ms = (time.monotonic() - started) * 1000
+            alive = _marked(marker)
+            cpu = _cpu_seconds(alive, args.window) / args.window if alive else 0.0
+            print(
+                f"{name:<14} {str(kill):<5} {elapsed_ms:>8.1f} "
+                f"{len(result.leaked_processes):>7} {len(alive):>6} {cpu:>8.2f}"
+            )
+            for pid in _marked(marker):
+                try:
+                    os.kill(pid, signal.SIGKILL)
+                except ProcessLookupError:
+                    pass
+    time.sleep(0.2)
+    for pid in list_processes():
+        try:
+            os.waitpid(pid, os.WNOHANG)
+        except ChildProcessError:
+            pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,1075 @@
+/*
+ * fs_walk.c - Parallel directory walker for search_files and get_directory_tree
+ *
+ * Compile: gcc -shared -fPIC -O2 -o fs_walk.so fs_walk.c -lpthread
+ * Usage:   loaded with ctypes by utils/native_walk.py (FS_WALK_LIBRARY_PATH)
+ *
+ * fs_walk_search() walks a directory tree the way search_files'
+ * os.walk(followlinks=False) loop does, without the per-file Python overhead:
+ *
+ *   - Directories are read with getdents64 and entries classified from d_type,
+ *     falling back to fstatat relative to the directory fd. Subdirectories are
+ *     opened relative to the search base with openat2(RESOLVE_BENEATH |
+ *     RESOLVE_NO_SYMLINKS) where the kernel has it, so a directory swapped for
+ *     a symlink mid-walk is never followed.
+ *   - Symlinked directories are neither descended into nor matched. Other
+ *     symlinks match only if they resolve inside the root, resolved like
+ *     os.path.realpath (links that exist are followed, the rest is kept
+ *     lexically) and checked with the same prefix-and-boundary rule as
+ *     sandbox_fs.c's match_rules().
+ *   - Names are matched against a glob compiled by utils/native_walk.py into
+ *     the program below, with fnmatch's semantics (names are decoded as UTF-8,
+ *     invalid bytes as surrogateescape, so '?' is one character).
+ *
+ * fs_walk_tree() renders the same lines as get_directory_tree's _build_tree():
+ * directories and regular files (no symlinks) classified from d_type, sorted
+ * case-insensitively, with sizes from statx only when they are asked for, and
+ * cut off after max_entries entries. Names are lowercased for sorting as ASCII
+ * only, so a directory whose names to sort aren't all ASCII makes it return
+ * -EILSEQ and the caller renders in Python (str.lower() is Unicode-aware).
+ *
+ * Directories are processed by a pool of threads with work stealing: each
+ * worker pops its own newest directory (depth first) and steals the oldest one
+ * of another worker when it runs dry. Results are deterministic: the calling
+ * thread emits them in depth-first order, waiting for directories as needed,
+ * and stops the walk as soon as it has emitted enough.
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+#ifdef SYS_openat2
+#include <linux/openat2.h>
+#endif
+
+#define MAX_THREADS 64
+#define GETDENTS_BUF_SIZE (64 * 1024)
+#define MAX_SYMLINKS 40
+
+/* ============================================================================
+ * Glob matching
+ *
+ * The program is a sequence of uint32 words:
+ *   GLOB_LIT <codepoint>                       one given character
+ *   GLOB_ANY                                   any one character ('?')
+ *   GLOB_STAR                                  any run of characters ('*')
+ *   GLOB_SET <negate> <n> <lo1> <hi1> ...      a '[...]' set of n ranges
+ *   GLOB_FAIL                                  nothing (an empty set)
+ * ============================================================================ */
+
+enum { GLOB_LIT = 1, GLOB_ANY = 2, GLOB_STAR = 3, GLOB_SET = 4, GLOB_FAIL = 5 };
+
+struct glob_op {
+    uint32_t op;
+    uint32_t c;               // GLOB_LIT
+    uint32_t negate;          // GLOB_SET
+    uint32_t nranges;         // GLOB_SET
+    const uint32_t *ranges;   // GLOB_SET: lo, hi pairs
+};
+
+struct glob {
+    struct glob_op *ops;
+    size_t nops;
+};
+
+static int glob_compile(const uint32_t *program, size_t len, struct glob *g) {
+    g->ops = calloc(len ? len : 1, sizeof(*g->ops));
+    g->nops = 0;
+    if (!g->ops) return -ENOMEM;
+    for (size_t i = 0; i < len; ) {
+        struct glob_op *op = &g->ops[g->nops++];
+        op->op = program[i++];
+        switch (op->op) {
+        case GLOB_LIT:
+            if (i >= len) return -EINVAL;
+            op->c = program[i++];
+            break;
+        case GLOB_SET:
+            if (i + 2 > len) return -EINVAL;
+            op->negate = program[i++];
+            op->nranges = program[i++];
+            if (op->nranges > (len - i) / 2) return -EINVAL;
+            op->ranges = &program[i];
+            i += 2 * (size_t)op->nranges;
+            break;
+        case GLOB_ANY:
+        case GLOB_STAR:
+        case GLOB_FAIL:
+            break;
+        default:
+            return -EINVAL;
+        }
+    }
+    return 0;
+}
+
+static inline int glob_op_matches(const struct glob_op *op, uint32_t c) {
+    switch (op->op) {
+    case GLOB_LIT:
+        return op->c == c;
+    case GLOB_ANY:
+        return 1;
+    case GLOB_SET:
+        for (uint32_t r = 0; r < op->nranges; r++) {
+            if (c >= op->ranges[2 * r] && c <= op->ranges[2 * r + 1]) return !op->negate;
+        }
+        return op->negate;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Whole-name match. Every op but '*' consumes exactly one character, so
+ * backtracking to the last '*' only is enough (as fnmatch's atomic groups).
+ */
+static int glob_match(const struct glob *g, const uint32_t *s, size_t n) {
+    size_t p = 0, i = 0, star_p = SIZE_MAX, star_i = 0;
+    while (i < n) {
+        if (p < g->nops && g->ops[p].op == GLOB_STAR) {
+            star_p = ++p;
+            star_i = i;
+        } else if (p < g->nops && glob_op_matches(&g->ops[p], s[i])) {
+            p++;
+            i++;
+        } else if (star_p != SIZE_MAX) {
+            p = star_p;
+            i = ++star_i;
+        } else {
+            return 0;
+        }
+    }
+    while (p < g->nops && g->ops[p].op == GLOB_STAR) p++;
+    return p == g->nops;
+}
+
+/* UTF-8 to codepoints; invalid bytes become U+DC80..U+DCFF like surrogateescape. */
+static size_t decode_name(const unsigned char *s, uint32_t *out) {
+    size_t n = 0;
+    while (*s) {
+        unsigned char b = *s;
+        uint32_t cp;
+        int len;
+        if (b < 0x80) { cp = b; len = 1; }
+        else if (b >= 0xC2 && b <= 0xDF) { cp = b & 0x1F; len = 2; }
+        else if (b >= 0xE0 && b <= 0xEF) { cp = b & 0x0F; len = 3; }
+        else if (b >= 0xF0 && b <= 0xF4) { cp = b & 0x07; len = 4; }
+        else { cp = 0; len = 0; }
+        int ok = len > 0;
+        for (int k = 1; ok && k < len; k++) {
+            if ((s[k] & 0xC0) != 0x80) ok = 0;
+            else cp = (cp << 6) | (s[k] & 0x3F);
+        }
+        if (ok && len == 3 && (cp < 0x800 || (cp >= 0xD800 && cp <= 0xDFFF))) ok = 0;
+        if (ok && len == 4 && (cp < 0x10000 || cp > 0x10FFFF)) ok = 0;
+        if (!ok) {
+            out[n++] = 0xDC00 + b;
+            s++;
+        } else {
+            out[n++] = cp;
+            s += len;
+        }
+    }
+    return n;
+}
+
+static int name_matches(const struct glob *g, const char *name) {
+    uint32_t cps[NAME_MAX + 1];
+    size_t n = decode_name((const unsigned char *)name, cps);
+    return glob_match(g, cps, n);
+}
+
+/* ============================================================================
+ * Symlink containment
+ * ============================================================================ */
+
+static void pop_component(char *path, size_t *len) {
+    while (*len > 0 && path[*len - 1] != '/') (*len)--;
+    if (*len > 0) (*len)--;
+    path[*len] = '\0';
+}
+
+/*
+ * os.path.realpath(path) with strict=False: symlinks that exist are followed,
+ * components that don't are kept as they are. path must be absolute.
+ */
+static int resolve_lenient(const char *path, char *out, size_t out_size) {
+    char rest[2 * PATH_MAX];
+    if (strlen(path) >= sizeof(rest)) return -1;
+    strcpy(rest, path);
+    size_t out_len = 0;
+    out[0] = '\0';
+    int links = 0;
+    const char *p = rest;
+    while (*p) {
+        while (*p == '/') p++;
+        const char *end = strchrnul(p, '/');
+        size_t comp_len = (size_t)(end - p);
+        const char *comp = p;
+        p = end;
+        if (comp_len == 0 || (comp_len == 1 && comp[0] == '.')) continue;
+        if (comp_len == 2 && comp[0] == '.' && comp[1] == '.') {
+            pop_component(out, &out_len);
+            continue;
+        }
+        if (out_len + 1 + comp_len >= out_size) return -1;
+        out[out_len++] = '/';
+        memcpy(out + out_len, comp, comp_len);
+        out_len += comp_len;
+        out[out_len] = '\0';
+        if (links > MAX_SYMLINKS) continue;  // A loop: keep the rest as it is
+
+        struct stat st;
+        if (lstat(out, &st) != 0 || !S_ISLNK(st.st_mode)) continue;
+        char target[PATH_MAX];
+        ssize_t target_len = readlink(out, target, sizeof(target) - 1);
+        if (target_len < 0) continue;
+        target[target_len] = '\0';
+        links++;
+
+        // Continue with the link's target followed by what was left
+        char spliced[2 * PATH_MAX];
+        size_t rest_len = strlen(p);
+        if ((size_t)target_len + 1 + rest_len >= sizeof(spliced)) return -1;
+        memcpy(spliced, target, (size_t)target_len);
+        spliced[target_len] = '/';
+        memcpy(spliced + target_len + 1, p, rest_len + 1);
+        memcpy(rest, spliced, (size_t)target_len + rest_len + 2);
+        p = rest;
+        if (target[0] == '/') {
+            out_len = 0;
+            out[0] = '\0';
+        } else {
+            pop_component(out, &out_len);
+        }
+    }
+    if (out_len == 0) strcpy(out, "/");
+    return 0;
+}
+
+static int path_under_root(const char *path, const char *root) {
+    size_t root_len = strlen(root);
+    return strncmp(path, root, root_len) == 0 &&
+           (path[root_len] == '\0' || path[root_len] == '/');
+}
+
+/* ============================================================================
+ * Walk state
+ * ============================================================================ */
+
+struct dir_node {
+    char *rel;                    // Relative to the base, "" for the base itself
+    const char *name;             // Last component of rel
+    char *matches;                // NUL-separated names of matching entries (or
+    size_t matches_len;           // of regular files, for a tree), sorted
+    size_t nmatches;
+    long long *sizes;             // Tree with sizes: of each file, -1 if unknown
+    struct dir_node **children;   // Subdirectories, sorted by name
+    size_t nchildren;
+    int depth;                    // Tree: 1 for the base
+    int error;                    // Tree: errno of listing the directory
+    int unsortable;               // Tree: names to sort that aren't ASCII
+    int done;                     // Read (or not to be read)
+};
+
+struct deque {
+    pthread_mutex_t lock;
+    struct dir_node **items;
+    size_t head, tail, cap;       // items[head..tail)
+};
+
+struct walk {
+    int base_fd;
+    const char *base;             // Absolute, resolved
+    const char *root;             // Absolute, resolved
+    struct glob glob;
+    int tree;                     // fs_walk_tree() rather than fs_walk_search()
+    int max_depth;                // Tree: deepest level listed
+    int include_files;            // Tree: files listed
+    int show_size;                // Tree: files' sizes wanted
+    size_t max_entries;           // Tree: entries rendered at most
+    int nthreads;
+    struct deque deques[MAX_THREADS];
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_cv;       // Work was queued, or the walk ended
+    pthread_cond_t done_cv;       // The node the emitter waits for is done
+    size_t pending;               // Nodes queued or being read
+    uint64_t work_gen;            // Bumped after every push, so no wakeup is lost
+    int idle;
+    struct dir_node *awaited;
+    int stop;
+};
+
+static int use_openat2 = 1;
+
+static void deque_push(struct deque *d, struct dir_node *node) {
+    pthread_mutex_lock(&d->lock);
+    if (d->tail == d->cap) {
+        if (d->head > 0) {
+            memmove(d->items, d->items + d->head, (d->tail - d->head) * sizeof(*d->items));
+            d->tail -= d->head;
+            d->head = 0;
+        }
+        if (d->tail == d->cap) {
+            size_t cap = d->cap ? 2 * d->cap : 64;
+            struct dir_node **items = realloc(d->items, cap * sizeof(*items));
+            if (!items) abort();
+            d->items = items;
+            d->cap = cap;
+        }
+    }
+    d->items[d->tail++] = node;
+    pthread_mutex_unlock(&d->lock);
+}
+
+/* Owner end: newest first, so a worker goes depth first. */
+static struct dir_node *deque_pop(struct deque *d) {
+    struct dir_node *node = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (d->tail > d->head) node = d->items[--d->tail];
+    pthread_mutex_unlock(&d->lock);
+    return node;
+}
+
+/* Thief end: oldest first, which is the largest subtree left. */
+static struct dir_node *deque_steal(struct deque *d) {
+    struct dir_node *node = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (d->tail > d->head) node = d->items[d->head++];
+    pthread_mutex_unlock(&d->lock);
+    return node;
+}
+
+static int open_dir(struct walk *w, const char *rel) {
+    if (rel[0] == '\0') return dup(w->base_fd);
+#ifdef SYS_openat2
+    if (__atomic_load_n(&use_openat2, __ATOMIC_RELAXED)) {
+        struct open_how how = {
+            .flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC,
+            .resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS | RESOLVE_NO_MAGICLINKS,
+        };
+        int fd = (int)syscall(SYS_openat2, w->base_fd, rel, &how, sizeof(how));
+        if (fd >= 0 || (errno != ENOSYS && errno != EPERM)) return fd;
+        __atomic_store_n(&use_openat2, 0, __ATOMIC_RELAXED);
+    }
+#endif
+    return openat(w->base_fd, rel, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+}
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct name_list {
+    char **names;
+    size_t count, cap;
+};
+
+static int name_list_add(struct name_list *l, const char *name) {
+    if (l->count == l->cap) {
+        size_t cap = l->cap ? 2 * l->cap : 16;
+        char **names = realloc(l->names, cap * sizeof(*names));
+        if (!names) return -1;
+        l->names = names;
+        l->cap = cap;
+    }
+    l->names[l->count] = strdup(name);
+    return l->names[l->count] ? (int)l->count++ : -1;
+}
+
+static void name_list_free(struct name_list *l) {
+    for (size_t i = 0; i < l->count; i++) free(l->names[i]);
+    free(l->names);
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Set up child, a subdirectory called name, and append it to node's children. */
+static int init_child(struct dir_node *node, struct dir_node *child, const char *name) {
+    if (node->rel[0]) {
+        if (asprintf(&child->rel, "%s/%s", node->rel, name) < 0) child->rel = NULL;
+    } else {
+        child->rel = strdup(name);
+    }
+    if (!child->rel) {
+        free(child);
+        return -1;
+    }
+    child->name = child->rel + strlen(child->rel) - strlen(name);
+    child->depth = node->depth + 1;
+    node->children[node->nchildren++] = child;
+    return 0;
+}
+
+/* A symlink that matched: kept if it isn't a directory and resolves inside the root. */
+static int symlink_allowed(struct walk *w, int dirfd, const char *rel, const char *name) {
+    struct stat st;
+    if (fstatat(dirfd, name, &st, 0) == 0 && S_ISDIR(st.st_mode)) return 0;
+    char full[PATH_MAX], resolved[PATH_MAX];
+    int n = rel[0] ? snprintf(full, sizeof(full), "%s/%s/%s", w->base, rel, name)
+                   : snprintf(full, sizeof(full), "%s/%s", w->base, name);
+    if (n < 0 || (size_t)n >= sizeof(full)) return 0;
+    if (resolve_lenient(full, resolved, sizeof(resolved)) != 0) return 0;
+    return path_under_root(resolved, w->root);
+}
+
+/* Read one directory into node. Unreadable directories are left empty, as os.walk does. */
+static void read_dir(struct walk *w, struct dir_node *node) {
+    int fd = open_dir(w, node->rel);
+    if (fd < 0) return;
+
+    struct name_list files = {0}, dirs = {0};
+    char *buf = malloc(GETDENTS_BUF_SIZE);
+    if (!buf) goto out;
+    for (;;) {
+        long nread = syscall(SYS_getdents64, fd, buf, GETDENTS_BUF_SIZE);
+        if (nread <= 0) break;
+        for (long off = 0; off < nread; ) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+            off += d->d_reclen;
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+
+            unsigned char type = d->d_type;
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISLNK(st.st_mode) ? DT_LNK : DT_REG;
+            }
+            if (type == DT_DIR) {
+                name_list_add(&dirs, name);
+            } else if (name_matches(&w->glob, name) &&
+                       (type != DT_LNK || symlink_allowed(w, fd, node->rel, name))) {
+                name_list_add(&files, name);
+            }
+        }
+    }
+    free(buf);
+
+    qsort(files.names, files.count, sizeof(char *), compare_names);
+    qsort(dirs.names, dirs.count, sizeof(char *), compare_names);
+
+    size_t len = 0;
+    for (size_t i = 0; i < files.count; i++) len += strlen(files.names[i]) + 1;
+    if (len > 0 && (node->matches = malloc(len))) {
+        char *p = node->matches;
+        for (size_t i = 0; i < files.count; i++) p = stpcpy(p, files.names[i]) + 1;
+        node->matches_len = len;
+        node->nmatches = files.count;
+    }
+
+    if (dirs.count > 0 && (node->children = calloc(dirs.count, sizeof(*node->children)))) {
+        for (size_t i = 0; i < dirs.count; i++) {
+            struct dir_node *child = calloc(1, sizeof(*child));
+            if (!child) break;
+            if (init_child(node, child, dirs.names[i]) != 0) break;
+        }
+    }
+out:
+    name_list_free(&files);
+    name_list_free(&dirs);
+    close(fd);
+}
+
+struct tree_entry {
+    char *name;
+    size_t order;                 // Position in the directory, for a stable sort
+    long long size;
+};
+
+struct tree_list {
+    struct tree_entry *items;
+    size_t count, cap;
+    int nonascii;
+};
+
+static int tree_list_add(struct tree_list *l, const char *name, long long size) {
+    if (l->count == l->cap) {
+        size_t cap = l->cap ? 2 * l->cap : 16;
+        struct tree_entry *items = realloc(l->items, cap * sizeof(*items));
+        if (!items) return -1;
+        l->items = items;
+        l->cap = cap;
+    }
+    char *copy = strdup(name);
+    if (!copy) return -1;
+    for (const char *c = name; *c; c++) {
+        if ((unsigned char)*c >= 0x80) l->nonascii = 1;
+    }
+    l->items[l->count] = (struct tree_entry){copy, l->count, size};
+    l->count++;
+    return 0;
+}
+
+static void tree_list_free(struct tree_list *l) {
+    for (size_t i = 0; i < l->count; i++) free(l->items[i].name);
+    free(l->items);
+}
+
+/* name.lower() order for ASCII names, ties kept in directory order like sorted(). */
+static int compare_tree_entries(const void *a, const void *b) {
+    const struct tree_entry *x = a, *y = b;
+    int c = strcasecmp(x->name, y->name);
+    if (c != 0) return c;
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static long long file_size(int dirfd, const char *name) {
+#ifdef STATX_SIZE
+    struct statx stx;
+    if (statx(dirfd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, STATX_SIZE, &stx) == 0) {
+        return (stx.stx_mask & STATX_SIZE) ? (long long)stx.stx_size : -1;
+    }
+    if (errno != ENOSYS) return -1;
+#endif
+    struct stat st;
+    return fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 ? (long long)st.st_size : -1;
+}
+
+/*
+ * Read one directory of a tree into node: its subdirectories and regular
+ * files, as DirEntry.is_dir()/is_file(follow_symlinks=False) classify them.
+ */
+static void read_tree_dir(struct walk *w, struct dir_node *node) {
+    int fd = open_dir(w, node->rel);
+    if (fd < 0) {
+        node->error = errno;
+        return;
+    }
+
+    struct tree_list files = {0}, dirs = {0};
+    char *buf = malloc(GETDENTS_BUF_SIZE);
+    if (!buf) {
+        node->error = ENOMEM;
+        goto out;
+    }
+    for (;;) {
+        long nread = syscall(SYS_getdents64, fd, buf, GETDENTS_BUF_SIZE);
+        if (nread < 0) node->error = errno;
+        if (nread <= 0) break;
+        for (long off = 0; off < nread; ) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+            off += d->d_reclen;
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+
+            unsigned char type = d->d_type;
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_LNK;
+            }
+            if (type == DT_DIR) {
+                tree_list_add(&dirs, name, -1);
+            } else if (type == DT_REG && w->include_files) {
+                tree_list_add(&files, name, -1);
+            }
+        }
+    }
+    free(buf);
+    if (node->error) goto out;
+
+    // Only the names that get sorted matter
+    if ((dirs.nonascii && dirs.count > 1) || (files.nonascii && files.count > 1)) {
+        node->unsortable = 1;
+        goto out;
+    }
+    qsort(files.items, files.count, sizeof(*files.items), compare_tree_entries);
+    qsort(dirs.items, dirs.count, sizeof(*dirs.items), compare_tree_entries);
+
+    // Sizes of the files that can be rendered only
+    if (w->show_size) {
+        size_t room = w->max_entries > dirs.count ? w->max_entries - dirs.count : 0;
+        for (size_t i = 0; i < files.count && i < room; i++) {
+            files.items[i].size = file_size(fd, files.items[i].name);
+        }
+    }
+
+    size_t len = 0;
+    for (size_t i = 0; i < files.count; i++) len += strlen(files.items[i].name) + 1;
+    if (len > 0 && (node->matches = malloc(len)) && (node->sizes = malloc(files.count * sizeof(long long)))) {
+        char *p = node->matches;
+        for (size_t i = 0; i < files.count; i++) {
+            p = stpcpy(p, files.items[i].name) + 1;
+            node->sizes[i] = files.items[i].size;
+        }
+        node->matches_len = len;
+        node->nmatches = files.count;
+    }
+
+    if (dirs.count > 0 && (node->children = calloc(dirs.count, sizeof(*node->children)))) {
+        for (size_t i = 0; i < dirs.count; i++) {
+            struct dir_node *child = calloc(1, sizeof(*child));
+            if (!child || init_child(node, child, dirs.items[i].name) != 0) break;
+            // Listed but not descended into
+            if (child->depth > w->max_depth) child->done = 1;
+        }
+    }
+out:
+    tree_list_free(&files);
+    tree_list_free(&dirs);
+    close(fd);
+}
+
+struct worker_arg {
+    struct walk *w;
+    int index;
+};
+
+static void finish_node(struct walk *w, struct dir_node *node) {
+    pthread_mutex_lock(&w->lock);
+    node->done = 1;
+    if (w->awaited == node) pthread_cond_signal(&w->done_cv);
+    if (--w->pending == 0) pthread_cond_broadcast(&w->work_cv);
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void *worker_main(void *p) {
+    struct worker_arg *arg = p;
+    struct walk *w = arg->w;
+    struct deque *own = &w->deques[arg->index];
+
+    for (;;) {
+        uint64_t gen = __atomic_load_n(&w->work_gen, __ATOMIC_ACQUIRE);
+        struct dir_node *node = deque_pop(own);
+        for (int i = 1; !node && i < w->nthreads; i++) {
+            node = deque_steal(&w->deques[(arg->index + i) % w->nthreads]);
+        }
+        if (node) {
+            if (!__atomic_load_n(&w->stop, __ATOMIC_RELAXED)) {
+                if (w->tree) read_tree_dir(w, node);
+                else read_dir(w, node);
+            }
+            size_t queued = 0;
+            for (size_t i = 0; i < node->nchildren; i++) queued += !node->children[i]->done;
+            if (queued > 0) {
+                pthread_mutex_lock(&w->lock);
+                w->pending += queued;
+                pthread_mutex_unlock(&w->lock);
+                // Reversed, so the first subdirectory is popped first
+                for (size_t i = node->nchildren; i-- > 0; ) {
+                    if (!node->children[i]->done) deque_push(own, node->children[i]);
+                }
+                pthread_mutex_lock(&w->lock);
+                __atomic_add_fetch(&w->work_gen, 1, __ATOMIC_RELEASE);
+                if (w->idle > 0) pthread_cond_broadcast(&w->work_cv);
+                pthread_mutex_unlock(&w->lock);
+            }
+            finish_node(w, node);
+            continue;
+        }
+
+        pthread_mutex_lock(&w->lock);
+        if (w->pending == 0 || w->stop) {
+            pthread_mutex_unlock(&w->lock);
+            return NULL;
+        }
+        // Someone is still reading a directory that may add work
+        if (__atomic_load_n(&w->work_gen, __ATOMIC_ACQUIRE) == gen) {
+            w->idle++;
+            pthread_cond_wait(&w->work_cv, &w->lock);
+            w->idle--;
+        }
+        pthread_mutex_unlock(&w->lock);
+    }
+}
+
+static void free_tree(struct dir_node *node) {
+    for (size_t i = 0; i < node->nchildren; i++) free_tree(node->children[i]);
+    free(node->children);
+    free(node->matches);
+    free(node->sizes);
+    free(node->rel);
+    free(node);
+}
+
+/* ============================================================================
+ * Running a walk
+ * ============================================================================ */
+
+struct walk_threads {
+    pthread_t threads[MAX_THREADS];
+    struct worker_arg args[MAX_THREADS];
+    int started;
+};
+
+/* Open base and set up w; the caller has filled in the rest. */
+static long walk_init(struct walk *w, const char *base, int nthreads) {
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > MAX_THREADS) nthreads = MAX_THREADS;
+    w->base_fd = open(base, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (w->base_fd < 0) return -errno;
+    w->base = base;
+    w->nthreads = nthreads;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->work_cv, NULL);
+    pthread_cond_init(&w->done_cv, NULL);
+    for (int i = 0; i < nthreads; i++) pthread_mutex_init(&w->deques[i].lock, NULL);
+    return 0;
+}
+
+static void walk_destroy(struct walk *w) {
+    for (int i = 0; i < w->nthreads; i++) {
+        free(w->deques[i].items);
+        pthread_mutex_destroy(&w->deques[i].lock);
+    }
+    pthread_cond_destroy(&w->done_cv);
+    pthread_cond_destroy(&w->work_cv);
+    pthread_mutex_destroy(&w->lock);
+    close(w->base_fd);
+}
+
+/* Queue the base directory and start the workers; returns it, or NULL. */
+static struct dir_node *walk_start(struct walk *w, struct walk_threads *t, long *err) {
+    struct dir_node *top = calloc(1, sizeof(*top));
+    if (!top || !(top->rel = strdup(""))) {
+        free(top);
+        *err = -ENOMEM;
+        return NULL;
+    }
+    top->name = top->rel;
+    top->depth = 1;
+    w->pending = 1;
+    deque_push(&w->deques[0], top);
+
+    t->started = 0;
+    for (int i = 0; i < w->nthreads; i++) {
+        t->args[i] = (struct worker_arg){w, i};
+        if (pthread_create(&t->threads[i], NULL, worker_main, &t->args[i]) != 0) break;
+        t->started++;
+    }
+    if (t->started == 0) {
+        free_tree(top);
+        *err = -EAGAIN;
+        return NULL;
+    }
+    return top;
+}
+
+static void walk_await(struct walk *w, struct dir_node *node) {
+    pthread_mutex_lock(&w->lock);
+    w->awaited = node;
+    while (!node->done) pthread_cond_wait(&w->done_cv, &w->lock);
+    w->awaited = NULL;
+    pthread_mutex_unlock(&w->lock);
+}
+
+/* Stop the workers and free the tree. */
+static void walk_stop(struct walk *w, struct walk_threads *t, struct dir_node *top) {
+    pthread_mutex_lock(&w->lock);
+    w->stop = 1;
+    pthread_cond_broadcast(&w->work_cv);
+    pthread_mutex_unlock(&w->lock);
+    for (int i = 0; i < t->started; i++) pthread_join(t->threads[i], NULL);
+
+    // Workers that stopped early leave queued nodes behind; the tree owns them all
+    free_tree(top);
+}
+
+/* ============================================================================
+ * Entry points
+ * ============================================================================ */
+
+/*
+ * Find the files under base whose names match the compiled glob.
+ *
+ * base and root are resolved absolute paths, base inside root. On success,
+ * *out holds the matches' paths relative to base, NUL-separated and in
+ * depth-first order, *out_len its size in bytes, and the number of matches is
+ * returned (at most max_results unless it is 0). Free *out with fs_walk_free().
+ * Returns -errno on failure.
+ */
+long fs_walk_search(const char *root, const char *base, const uint32_t *program,
+                    size_t program_len, size_t max_results, int nthreads,
+                    char **out, size_t *out_len) {
+    *out = NULL;
+    *out_len = 0;
+
+    struct walk *w = calloc(1, sizeof(*w));
+    if (!w) return -ENOMEM;
+    long ret = glob_compile(program, program_len, &w->glob);
+    if (ret == 0) ret = walk_init(w, base, nthreads);
+    if (ret < 0) {
+        free(w->glob.ops);
+        free(w);
+        return ret;
+    }
+    w->root = root;
+
+    struct walk_threads threads;
+    struct dir_node *top = walk_start(w, &threads, &ret);
+    if (!top) goto cleanup;
+
+    // Emit depth first, waiting for each directory as it comes up
+    size_t cap = 4096, len = 0, count = 0;
+    char *result = malloc(cap);
+    size_t stack_cap = 256, depth = 0;
+    struct dir_node **stack = malloc(stack_cap * sizeof(*stack));
+    if (!result || !stack) {
+        ret = -ENOMEM;
+    } else {
+        stack[depth++] = top;
+        while (depth > 0 && (max_results == 0 || count < max_results)) {
+            struct dir_node *node = stack[--depth];
+            walk_await(w, node);
+
+            const char *name = node->matches;
+            for (size_t i = 0; i < node->nmatches && (max_results == 0 || count < max_results); i++) {
+                size_t name_len = strlen(name);
+                size_t need = (node->rel[0] ? strlen(node->rel) + 1 : 0) + name_len + 1;
+                if (len + need > cap) {
+                    while (len + need > cap) cap *= 2;
+                    char *grown = realloc(result, cap);
+                    if (!grown) {
+                        ret = -ENOMEM;
+                        break;
+                    }
+                    result = grown;
+                }
+                if (node->rel[0]) {
+                    len += (size_t)sprintf(result + len, "%s/", node->rel);
+                }
+                memcpy(result + len, name, name_len + 1);
+                len += name_len + 1;
+                count++;
+                name += name_len + 1;
+            }
+            if (ret < 0) break;
+
+            if (depth + node->nchildren > stack_cap) {
+                while (depth + node->nchildren > stack_cap) stack_cap *= 2;
+                struct dir_node **grown = realloc(stack, stack_cap * sizeof(*stack));
+                if (!grown) {
+                    ret = -ENOMEM;
+                    break;
+                }
+                stack = grown;
+            }
+            for (size_t i = node->nchildren; i-- > 0; ) stack[depth++] = node->children[i];
+        }
+    }
+
+    walk_stop(w, &threads, top);
+    free(stack);
+    if (ret < 0) {
+        free(result);
+    } else {
+        *out = result;
+        *out_len = len;
+        ret = (long)count;
+    }
+
+cleanup:
+    walk_destroy(w);
+    free(w->glob.ops);
+    free(w);
+    return ret;
+}
+
+/* Rendered tree text, grown as lines are added. */
+struct text {
+    char *data;
+    size_t len, cap;
+    int failed;
+};
+
+static void text_add(struct text *t, const char *s, size_t n) {
+    if (t->failed) return;
+    if (t->len + n > t->cap) {
+        size_t cap = t->cap ? t->cap : 4096;
+        while (t->len + n > cap) cap *= 2;
+        char *grown = realloc(t->data, cap);
+        if (!grown) {
+            t->failed = 1;
+            return;
+        }
+        t->data = grown;
+        t->cap = cap;
+    }
+    memcpy(t->data + t->len, s, n);
+    t->len += n;
+}
+
+static void text_str(struct text *t, const char *s) {
+    text_add(t, s, strlen(s));
+}
+
+/* Start a line: lines are joined with '\n' like "\n".join(lines). */
+static void text_line(struct text *t, const char *prefix) {
+    if (t->len > 0) text_add(t, "\n", 1);
+    text_str(t, prefix);
+}
+
+/* The class repr(OSError(errno, ...)) shows, as Python maps errnos to subclasses. */
+static const char *oserror_class(int err) {
+    switch (err) {
+    case EAGAIN: case EALREADY: case EINPROGRESS: return "BlockingIOError";
+    case ECHILD: return "ChildProcessError";
+    case EPIPE: case ESHUTDOWN: return "BrokenPipeError";
+    case ECONNABORTED: return "ConnectionAbortedError";
+    case ECONNREFUSED: return "ConnectionRefusedError";
+    case ECONNRESET: return "ConnectionResetError";
+    case EEXIST: return "FileExistsError";
+    case ENOENT: return "FileNotFoundError";
+    case EISDIR: return "IsADirectoryError";
+    case ENOTDIR: return "NotADirectoryError";
+    case EINTR: return "InterruptedError";
+    case EACCES: case EPERM: return "PermissionError";
+    case ESRCH: return "ProcessLookupError";
+    case ETIMEDOUT: return "TimeoutError";
+    default: return "OSError";
+    }
+}
+
+struct tree_render {
+    struct walk *w;
+    struct text text;
+    size_t max_entries;
+    size_t counter;
+    int unsortable;
+};
+
+/* _build_tree(): the lines for node's entries, each line starting with prefix. */
+static void render_dir(struct tree_render *r, struct dir_node *node, const char *prefix) {
+    if (r->counter >= r->max_entries || r->unsortable || r->text.failed) return;
+    walk_await(r->w, node);
+    if (node->unsortable) {
+        r->unsortable = 1;
+        return;
+    }
+    if (node->error == EACCES || node->error == EPERM) {
+        text_line(&r->text, prefix);
+        text_str(&r->text, "[permission denied]");
+        return;
+    }
+    if (node->error) {
+        char line[256];
+        snprintf(line, sizeof(line), "[error: %s(%d, '%s')]", oserror_class(node->error),
+                 node->error, strerror(node->error));
+        text_line(&r->text, prefix);
+        text_str(&r->text, line);
+        return;
+    }
+
+    size_t total = node->nchildren + node->nmatches;
+    size_t prefix_len = strlen(prefix);
+    const char *file = node->matches;
+    for (size_t idx = 0; idx < total; idx++) {
+        if (r->counter >= r->max_entries) {
+            char line[64];
+            snprintf(line, sizeof(line), "... (truncated at %zu entries)", r->max_entries);
+            text_line(&r->text, prefix);
+            text_str(&r->text, line);
+            break;
+        }
+        int is_last = idx == total - 1;
+        const char *connector = is_last ? "└── " : "├── ";
+        const char *child_prefix = is_last ? "    " : "│   ";
+        r->counter++;
+
+        text_line(&r->text, prefix);
+        text_str(&r->text, connector);
+        if (idx < node->nchildren) {
+            struct dir_node *child = node->children[idx];
+            text_str(&r->text, child->name);
+            text_add(&r->text, "/", 1);
+            if (node->depth < r->w->max_depth) {
+                char *next = malloc(prefix_len + strlen(child_prefix) + 1);
+                if (!next) {
+                    r->text.failed = 1;
+                    return;
+                }
+                stpcpy(stpcpy(next, prefix), child_prefix);
+                render_dir(r, child, next);
+                free(next);
+                if (r->unsortable || r->text.failed) return;
+            }
+        } else {
+            size_t i = idx - node->nchildren;
+            text_str(&r->text, file);
+            if (r->w->show_size && node->sizes && node->sizes[i] >= 0) {
+                char size[48];
+                snprintf(size, sizeof(size), " (%lld bytes)", node->sizes[i]);
+                text_str(&r->text, size);
+            }
+            file += strlen(file) + 1;
+        }
+    }
+}
+
+/*
+ * Render the tree under base (a resolved absolute path) as get_directory_tree's
+ * _build_tree(base, "", 1, max_depth, include_files, show_size) does, with
+ * MAX_TREE_ENTRIES = max_entries.
+ *
+ * On success, *out holds the lines joined with '\n' (UTF-8, no trailing
+ * newline), *out_len its size in bytes, and the number of entries rendered is
+ * returned. Free *out with fs_walk_free(). Returns -EILSEQ if the names can't
+ * be ordered like Python would (see the top of the file), -errno on failure.
+ */
+long fs_walk_tree(const char *base, int max_depth, int include_files, int show_size,
+                  size_t max_entries, int nthreads, char **out, size_t *out_len) {
+    *out = NULL;
+    *out_len = 0;
+
+    struct walk *w = calloc(1, sizeof(*w));
+    if (!w) return -ENOMEM;
+    long ret = walk_init(w, base, nthreads);
+    if (ret < 0) {
+        free(w);
+        return ret;
+    }
+    w->root = base;
+    w->tree = 1;
+    w->max_depth = max_depth;
+    w->include_files = include_files;
+    w->show_size = show_size && include_files;
+    w->max_entries = max_entries;
+
+    struct walk_threads threads;
+    struct dir_node *top = walk_start(w, &threads, &ret);
+    if (!top) goto cleanup;
+
+    struct tree_render r = {
+        .w = w,
+        .max_entries = max_entries,
+    };
+    render_dir(&r, top, "");
+    walk_stop(w, &threads, top);
+
+    if (r.unsortable || r.text.failed) {
+        free(r.text.data);
+        ret = r.unsortable ? -EILSEQ : -ENOMEM;
+    } else {
+        *out = r.text.data;
+        *out_len = r.text.len;
+        ret = (long)r.counter;
+    }
+
+cleanup:
+    walk_destroy(w);
+    free(w);
+    return ret;
+}
+
+void fs_walk_free(char *buf) {
+    free(buf);
+}
@@ -11,14 +11,16 @@ from middleware.logging import LoggingMiddleware
 from middleware.validation_error_sanitizer import ValidationErrorSanitizerMiddleware
 from tools.get_directory_tree import get_directory_tree
 from tools.get_file_metadata import get_file_metadata
+from tools.get_files_metadata import get_files_metadata
 from tools.list_files import list_files
 from tools.read_image_file import read_image_file
 from tools.read_text_file import read_text_file
 from tools.search_files import search_files
+from utils import fs_index, native_walk
 
 mcp = FastMCP(
     "filesystem-server",
-    instructions="Read-only access to a sandboxed directory. List and search files, read text or image files, get file or directory metadata, and get a directory tree. No create, modify, or delete. Use for browsing files, validating paths, and feeding content to vision or text agents.",
+    instructions="Read-only access to a sandboxed directory. List and search files, read text or image files, get file or directory metadata (one or many paths, optionally with content hashes to detect changes), and get a directory tree. No create, modify, or delete. Use for browsing files, validating paths, and feeding content to vision or text agents.",
 )
 mcp.add_middleware(ErrorHandlingMiddleware(include_traceback=True))
 mcp.add_middleware(RetryMiddleware())
@@ -30,8 +32,16 @@ mcp.tool(read_image_file)
 mcp.tool(read_text_file)
 mcp.tool(search_files)
 mcp.tool(get_file_metadata)
+mcp.tool(get_files_metadata)
 mcp.tool(get_directory_tree)
 
+# Load the native walker now, so the log says whether searches and trees use it
+native_walk.available()
+
+# Answer searches and trees from an inotify-maintained index (see utils/fs_index.py)
+if os.getenv("FS_INDEX", "true").lower() not in ("0", "false", "no"):
+    fs_index.start(os.getenv("APP_FS_ROOT", "/filesystem"))
+
 
 async def _flatten_tool_schemas():
     for tool in await mcp.list_tools():
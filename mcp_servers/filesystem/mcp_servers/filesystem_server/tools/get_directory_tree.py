@@ -2,6 +2,7 @@ import os
 from typing import Annotated
 
 from pydantic import Field
+from utils import fs_index, native_walk
 from utils.decorators import make_async_background
 
 FS_ROOT = os.getenv("APP_FS_ROOT", "/filesystem")
@@ -26,6 +27,46 @@ def _resolve_under_root(path: str | None) -> str:
 MAX_TREE_ENTRIES = 500
 
 
+def _list_entries(
+    base_path: str,
+) -> tuple[list[tuple[str, str]], list[tuple[str, int | os.DirEntry]]]:
+    """A directory's subdirectories as (name, path) and its files as (name, size or
+    DirEntry to stat), each sorted."""
+    listed = fs_index.list_dir(base_path)
+    if listed is not None:
+        dirs, files = listed
+    else:
+        entries = list(os.scandir(base_path))
+
+        # Separate directories and files
+        # Note: is_dir()/is_file() can raise OSError on some filesystems
+        # SECURITY: Use follow_symlinks=False to prevent symlinks from escaping sandbox
+        dirs = []
+        files = []
+        for e in entries:
+            try:
+                if e.is_dir(follow_symlinks=False):
+                    dirs.append((e.name, e.path))
+                elif e.is_file(follow_symlinks=False):
+                    files.append((e.name, e))
+                # Symlinks are intentionally skipped to prevent sandbox escape
+            except OSError:
+                continue
+    dirs.sort(key=lambda e: e[0].lower())
+    files.sort(key=lambda e: e[0].lower())
+    return dirs, files
+
+
+def _file_size(size_or_entry: int | os.DirEntry) -> int | None:
+    if isinstance(size_or_entry, int):
+        return size_or_entry
+    try:
+        # SECURITY: Use follow_symlinks=False to prevent sandbox escape
+        return size_or_entry.stat(follow_symlinks=False).st_size
+    except OSError:
+        return None
+
+
 def _build_tree(
     base_path: str,
     prefix: str,
@@ -48,7 +89,7 @@ def _build_tree(
         return lines
 
     try:
-        entries = list(os.scandir(base_path))
+        dirs, files = _list_entries(base_path)
     except PermissionError:
         lines.append(f"{prefix}[permission denied]")
         return lines
@@ -56,29 +97,13 @@ def _build_tree(
         lines.append(f"{prefix}[error: {repr(exc)}]")
         return lines
 
-    # Separate directories and files, sort each
-    # Note: is_dir()/is_file() can raise OSError on some filesystems
-    # SECURITY: Use follow_symlinks=False to prevent symlinks from escaping sandbox
-    dirs = []
-    files = []
-    for e in entries:
-        try:
-            if e.is_dir(follow_symlinks=False):
-                dirs.append(e)
-            elif e.is_file(follow_symlinks=False):
-                files.append(e)
-            # Symlinks are intentionally skipped to prevent sandbox escape
-        except OSError:
-            continue
-    dirs.sort(key=lambda e: e.name.lower())
-    files.sort(key=lambda e: e.name.lower())
-
     # Combine: directories first, then files
-    all_entries = dirs + (files if include_files else [])
+    all_entries = [(name, path, None) for name, path in dirs]
+    if include_files:
+        all_entries += [(name, None, file) for name, file in files]
     total = len(all_entries)
-    dir_set = set(dirs)
 
-    for idx, entry in enumerate(all_entries):
+    for idx, (name, dir_path, file) in enumerate(all_entries):
         if _counter[0] >= MAX_TREE_ENTRIES:
             lines.append(f"{prefix}... (truncated at {MAX_TREE_ENTRIES} entries)")
             break
@@ -89,12 +114,12 @@ def _build_tree(
 
         _counter[0] += 1
 
-        if entry in dir_set:
-            lines.append(f"{prefix}{connector}{entry.name}/")
+        if dir_path is not None:
+            lines.append(f"{prefix}{connector}{name}/")
             if current_depth < max_depth:
                 lines.extend(
                     _build_tree(
-                        entry.path,
+                        dir_path,
                         prefix + child_prefix,
                         current_depth + 1,
                         max_depth,
@@ -103,17 +128,10 @@ def _build_tree(
                         _counter,
                     )
                 )
+        elif show_size and (size := _file_size(file)) is not None:
+            lines.append(f"{prefix}{connector}{name} ({size} bytes)")
         else:
-            # File
-            if show_size:
-                try:
-                    # SECURITY: Use follow_symlinks=False to prevent sandbox escape
-                    size = entry.stat(follow_symlinks=False).st_size
-                    lines.append(f"{prefix}{connector}{entry.name} ({size} bytes)")
-                except OSError:
-                    lines.append(f"{prefix}{connector}{entry.name}")
-            else:
-                lines.append(f"{prefix}{connector}{entry.name}")
+            lines.append(f"{prefix}{connector}{name}")
 
     return lines
 
@@ -179,14 +197,23 @@ def get_directory_tree(
     else:
         lines = [f"{path}/"]
 
-    tree_lines = _build_tree(
-        real_base,
-        "",
-        current_depth=1,
-        max_depth=max_depth,
-        include_files=include_files,
-        show_size=show_size,
-    )
+    # The index answers from memory; otherwise render natively if possible
+    rendered = None
+    if not fs_index.covers(real_base):
+        rendered = native_walk.tree(
+            real_base, max_depth, include_files, show_size, MAX_TREE_ENTRIES
+        )
+    if rendered is not None:
+        tree_lines = [rendered] if rendered else []
+    else:
+        tree_lines = _build_tree(
+            real_base,
+            "",
+            current_depth=1,
+            max_depth=max_depth,
+            include_files=include_files,
+            show_size=show_size,
+        )
 
     lines.extend(tree_lines)
 
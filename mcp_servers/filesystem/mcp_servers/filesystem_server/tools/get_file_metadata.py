@@ -5,6 +5,7 @@ from datetime import UTC, datetime
 from typing import Annotated
 
 from pydantic import Field
+from utils import content_hash
 from utils.decorators import make_async_background
 
 FS_ROOT = os.getenv("APP_FS_ROOT", "/filesystem")
@@ -61,16 +62,8 @@ def _format_timestamp(timestamp: float) -> str:
     return datetime.fromtimestamp(timestamp, tz=UTC).isoformat()
 
 
-@make_async_background
-def get_file_metadata(
-    file_path: Annotated[
-        str,
-        Field(
-            description="Absolute path to the file or directory within the sandbox filesystem. REQUIRED. Must start with '/'. The path is relative to the sandbox root, not the host system. Example: '/documents/report.pdf' or '/data/config.json'. Returns a newline-separated string containing: Path, Type (file/directory/symlink), MIME type (for files), Size (in bytes and human-readable), Permissions (rwx format and octal), Modified/Accessed/Created timestamps (ISO 8601), Inode, Device, Hard links count. Returns '[not found: path]' if path doesn't exist, '[access denied: path]' if outside sandbox, '[permission denied: path]' for permission errors."
-        ),
-    ],
-) -> str:
-    """Return metadata for a file or directory (path, type, size, MIME type, permissions, modified time). Use to check existence and type."""
+def describe(file_path: str, include_hash: bool = False) -> str:
+    """get_file_metadata's result for file_path."""
     if not isinstance(file_path, str) or not file_path:
         raise ValueError("File path is required and must be a string")
 
@@ -153,9 +146,35 @@ def get_file_metadata(
         # Add link count
         lines.append(f"Hard links: {stat_result.st_nlink}")
 
+        if include_hash and stat.S_ISREG(stat_result.st_mode):
+            try:
+                digest = content_hash.file_digest(real_path)
+                lines.append(f"Content hash: {content_hash.ALGORITHM}:{digest}")
+            except OSError as exc:
+                lines.append(f"Content hash: (unreadable: {exc.strerror})")
+
         return "\n".join(lines)
 
     except PermissionError:
         return f"[permission denied: {file_path}]"
     except Exception as exc:
         return f"[error: {repr(exc)}]"
+
+
+@make_async_background
+def get_file_metadata(
+    file_path: Annotated[
+        str,
+        Field(
+            description="Absolute path to the file or directory within the sandbox filesystem. REQUIRED. Must start with '/'. The path is relative to the sandbox root, not the host system. Example: '/documents/report.pdf' or '/data/config.json'. Returns a newline-separated string containing: Path, Type (file/directory/symlink), MIME type (for files), Size (in bytes and human-readable), Permissions (rwx format and octal), Modified/Accessed/Created timestamps (ISO 8601), Inode, Device, Hard links count. Returns '[not found: path]' if path doesn't exist, '[access denied: path]' if outside sandbox, '[permission denied: path]' for permission errors."
+        ),
+    ],
+    include_hash: Annotated[
+        bool,
+        Field(
+            description="Also return a 'Content hash: blake2b-256:<hex>' line for files (the digest `b2sum -l 256` prints). Default: false. Hashing reads the whole file the first time; the digest is cached until the file changes, so asking again about an unchanged file is instant. Use to detect whether a file's content changed."
+        ),
+    ] = False,
+) -> str:
+    """Return metadata for a file or directory (path, type, size, MIME type, permissions, modified time). Use to check existence and type."""
+    return describe(file_path, include_hash)
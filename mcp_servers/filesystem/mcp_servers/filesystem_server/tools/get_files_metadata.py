@@ -0,0 +1,44 @@
+import os
+from concurrent.futures import ThreadPoolExecutor
+from typing import Annotated
+
+from pydantic import Field
+from tools.get_file_metadata import describe
+from utils.decorators import make_async_background
+
+MAX_BATCH_PATHS = 1000
+_WORKERS = min(16, os.cpu_count() or 1)
+
+
+@make_async_background
+def get_files_metadata(
+    file_paths: Annotated[
+        list[str],
+        Field(
+            description="Absolute paths of files or directories within the sandbox filesystem, at most 1000. REQUIRED. Each must start with '/'. Example: ['/data/a.csv', '/data/b.csv']. Returns one get_file_metadata result per path, in the same order, separated by blank lines; a path that doesn't exist or is outside the sandbox gets its bracketed error message ('[not found: path]', '[access denied: path]', ...) in its place."
+        ),
+    ],
+    include_hash: Annotated[
+        bool,
+        Field(
+            description="Also return a 'Content hash: blake2b-256:<hex>' line for each file. Default: false. Files are hashed in parallel, and digests are cached until a file changes, so re-checking unchanged files is instant."
+        ),
+    ] = False,
+) -> str:
+    """Return get_file_metadata's metadata for many files or directories at once, optionally with content hashes. Use to check which of a set of files exist or changed."""
+    if not isinstance(file_paths, list) or not file_paths:
+        raise ValueError("File paths are required and must be a non-empty list")
+
+    if len(file_paths) > MAX_BATCH_PATHS:
+        raise ValueError(f"At most {MAX_BATCH_PATHS} paths can be described at once")
+
+    for file_path in file_paths:
+        if not isinstance(file_path, str) or not file_path.startswith("/"):
+            raise ValueError(
+                f"Each path must be a string starting with /: {file_path!r}"
+            )
+
+    workers = min(_WORKERS, len(file_paths))
+    with ThreadPoolExecutor(workers, thread_name_prefix="metadata") as pool:
+        results = pool.map(lambda p: describe(p, include_hash), file_paths)
+        return "\n\n".join(results)
@@ -3,6 +3,7 @@ from typing import Annotated
 
 from fastmcp.utilities.types import Image
 from pydantic import Field
+from utils import image_cache
 from utils.decorators import make_async_background
 
 FS_ROOT = os.getenv("APP_FS_ROOT", "/filesystem")
@@ -39,6 +40,18 @@ def read_image_file(
             description="Absolute path to the image file within the sandbox filesystem. REQUIRED. Must start with '/'. Supported formats: PNG, JPG, JPEG, GIF, WEBP (case-insensitive). Example: '/images/screenshot.png' or '/uploads/photo.jpg'. Returns an Image object with 'data' (binary image content) and 'format' (string: 'png', 'jpeg', 'gif', or 'webp'). Raises FileNotFoundError if file doesn't exist, ValueError for unsupported formats or non-file paths, RuntimeError for read failures."
         ),
     ],
+    max_dimension: Annotated[
+        int | None,
+        Field(
+            description="Scale the image down so that neither its width nor its height exceeds this many pixels, keeping its aspect ratio. Optional: by default the image is returned at full size. Images already within the limit are returned unchanged. Example: 1568. Large screenshots and photos are much smaller to send this way; repeat reads with the same parameters are served from a cache until the file changes."
+        ),
+    ] = None,
+    quality: Annotated[
+        int | None,
+        Field(
+            description="Re-encode the image lossily at this quality, from 1 (smallest) to 100 (best). Optional. JPEG and WEBP images keep their format; PNG and GIF images become JPEG, or WEBP if they have transparency. Without quality, a downscaled image keeps its format (GIF becomes PNG) and JPEG/WEBP use quality 85. Animated images are reduced to their first frame."
+        ),
+    ] = None,
 ) -> Image:
     """Read an image file and return it for vision APIs. Use to pass images to vision-capable agents."""
     if not isinstance(file_path, str) or not file_path:
@@ -66,6 +79,18 @@ def read_image_file(
     if not os.path.isfile(real_path):
         raise ValueError(f"Not a file: {file_path}")
 
+    if max_dimension is not None or quality is not None:
+        if max_dimension is not None and max_dimension < 1:
+            raise ValueError("max_dimension must be at least 1")
+        if quality is not None and not 1 <= quality <= 100:
+            raise ValueError("quality must be between 1 and 100")
+        try:
+            derivative = image_cache.derivative(real_path, max_dimension, quality)
+        except Exception as exc:
+            raise RuntimeError(f"Failed to resize image file: {repr(exc)}") from exc
+        if derivative is not None:
+            return Image(data=derivative.data, format=derivative.format)
+
     try:
         with open(real_path, "rb") as f:
             image_data = f.read()
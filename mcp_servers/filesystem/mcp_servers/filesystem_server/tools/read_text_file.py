@@ -3,6 +3,7 @@ from typing import Annotated
 
 from loguru import logger
 from pydantic import Field
+from utils import line_index
 from utils.decorators import make_async_background
 
 FS_ROOT = os.getenv("APP_FS_ROOT", "/filesystem")
@@ -107,12 +108,61 @@ def _get_extension(file_path: str) -> str:
     return ""
 
 
+def _read_range(
+    real_path: str,
+    file_path: str,
+    encoding: str,
+    start_line: int | None,
+    end_line: int | None,
+    offset: int | None,
+    length: int | None,
+) -> str:
+    """A page of the file, with a header saying where it is."""
+    if (start_line is not None or end_line is not None) and (
+        offset is not None or length is not None
+    ):
+        raise ValueError("Use either start_line/end_line or offset/length, not both")
+    if start_line is not None and start_line < 1:
+        raise ValueError("start_line must be at least 1")
+    if end_line is not None and end_line < (start_line or 1):
+        raise ValueError("end_line must not be before start_line")
+    if offset is not None and offset < 0:
+        raise ValueError("offset must not be negative")
+    if length is not None and length < 1:
+        raise ValueError("length must be at least 1")
+    if not line_index.supports_ranges(encoding):
+        raise ValueError(
+            f"Ranged reads need an ASCII-compatible encoding (such as utf-8), "
+            f"not '{encoding}'"
+        )
+
+    try:
+        if offset is None and length is None:
+            page = line_index.read_lines(real_path, encoding, start_line or 1, end_line)
+            header = f"[lines {page.first}-{page.last} of {page.total}]"
+        else:
+            page = line_index.read_bytes(real_path, encoding, offset or 0, length)
+            header = f"[bytes {page.first}-{page.last} of {page.total}]"
+    except UnicodeDecodeError as exc:
+        raise ValueError(
+            f"Failed to decode {file_path} with encoding '{encoding}': {exc}"
+        ) from exc
+    except ValueError:
+        raise
+    except Exception as exc:
+        raise RuntimeError(f"Failed to read text file: {repr(exc)}") from exc
+    if page.total == 0:
+        # Neither range form reads sensibly for nothing ("bytes 0--1 of 0")
+        header = "[empty file]"
+    return f"{header}\n{page.text}"
+
+
 @make_async_background
 def read_text_file(
     file_path: Annotated[
         str,
         Field(
-            description="Absolute path to the text file within the sandbox filesystem. REQUIRED. Must start with '/'. Supported extensions: txt, json, csv, py, md, xml, yaml, yml, js, ts, jsx, tsx, htm, html, css, scss, less, java, c, cpp, h, hpp, rs, go, rb, php, sh, bash, zsh, fish, ps1, bat, cmd, sql, graphql, gql, toml, ini, cfg, conf, env, properties, log, gitignore, dockerignore, editorconfig, rst, tex, bib. Also supports extensionless files: Makefile, Dockerfile, Vagrantfile. Example: '/config/settings.json' or '/src/main.py'. Returns the complete text content of the file as a string. Raises FileNotFoundError if file doesn't exist, ValueError for unsupported extensions or encoding errors, RuntimeError for other read failures. Note: Very large files (>3GB) will succeed but may be slow and memory-intensive."
+            description="Absolute path to the text file within the sandbox filesystem. REQUIRED. Must start with '/'. Supported extensions: txt, json, csv, py, md, xml, yaml, yml, js, ts, jsx, tsx, htm, html, css, scss, less, java, c, cpp, h, hpp, rs, go, rb, php, sh, bash, zsh, fish, ps1, bat, cmd, sql, graphql, gql, toml, ini, cfg, conf, env, properties, log, gitignore, dockerignore, editorconfig, rst, tex, bib. Also supports extensionless files: Makefile, Dockerfile, Vagrantfile. Example: '/config/settings.json' or '/src/main.py'. Returns the complete text content of the file as a string. Raises FileNotFoundError if file doesn't exist, ValueError for unsupported extensions or encoding errors, RuntimeError for other read failures. Note: Very large files (>3GB) will succeed but may be slow and memory-intensive; page through them with start_line/end_line or offset/length instead."
         ),
     ],
     encoding: Annotated[
@@ -127,6 +177,30 @@ def read_text_file(
             description="DEPRECATED - This parameter is ignored and has no effect. Included only for backward compatibility. Files of any size can be read; a warning is logged for files exceeding 3GB."
         ),
     ] = 0,
+    start_line: Annotated[
+        int | None,
+        Field(
+            description="First line to return (1-based). Optional: with start_line or end_line only that range of lines is read, in time and memory proportional to the range, and the result starts with a '[lines A-B of N]' header line ('[empty file]' for an empty file). Lines are counted by '\\n'. Example: start_line=1001, end_line=2000. Cannot be combined with offset/length."
+        ),
+    ] = None,
+    end_line: Annotated[
+        int | None,
+        Field(
+            description="Last line to return (1-based, inclusive). Default: the end of the file when start_line is given. Values past the end are clamped."
+        ),
+    ] = None,
+    offset: Annotated[
+        int | None,
+        Field(
+            description="Byte offset to start reading at. Optional: with offset or length only that byte range is read, moved to character boundaries for UTF-8, and the result starts with a '[bytes A-B of N]' header line ('[empty file]' for an empty file). Cannot be combined with start_line/end_line."
+        ),
+    ] = None,
+    length: Annotated[
+        int | None,
+        Field(
+            description="Number of bytes to read from offset. Default: to the end of the file."
+        ),
+    ] = None,
 ) -> str:
     """Read the contents of a text file. Only files with supported extensions (e.g. .txt, .json, .csv, .py, .md, .xml, .yaml, .htm, .html, .sh) are readable. Use to read configs, logs, or source."""
     if not isinstance(file_path, str) or not file_path:
@@ -155,6 +229,11 @@ def read_text_file(
     if not os.path.isfile(real_path):
         raise ValueError(f"Not a file: {file_path}")
 
+    if any(v is not None for v in (start_line, end_line, offset, length)):
+        return _read_range(
+            real_path, file_path, encoding, start_line, end_line, offset, length
+        )
+
     # Log warning for very large files but still process them
     file_size = os.path.getsize(real_path)
     if file_size > LARGE_FILE_WARNING_BYTES:
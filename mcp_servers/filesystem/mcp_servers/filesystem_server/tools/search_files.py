@@ -3,6 +3,7 @@ import os
 from typing import Annotated
 
 from pydantic import Field
+from utils import fs_index, native_walk
 from utils.decorators import make_async_background
 
 FS_ROOT = os.getenv("APP_FS_ROOT", "/filesystem")
@@ -100,10 +101,25 @@ def search_files(
     count = 0
 
     try:
-        if recursive:
+        indexed = fs_index.search(real_base, pattern, recursive, max_results)
+        native = (
+            native_walk.search(
+                os.path.realpath(FS_ROOT), real_base, pattern, max_results
+            )
+            if recursive and indexed is None
+            else None
+        )
+        found = indexed if indexed is not None else native
+        if found is not None:
+            base_rel = _get_relative_path(real_base)
+            matches = [os.path.join(base_rel, rel) for rel in found]
+            count = len(matches)
+        elif recursive:
             # SECURITY: followlinks=False prevents symlink directory traversal escape
+            # Sorted like the native walker's results
             for root, _dirs, files in os.walk(real_base, followlinks=False):
-                for filename in files:
+                _dirs.sort()
+                for filename in sorted(files):
                     if fnmatch.fnmatch(filename, pattern):
                         full_path = os.path.join(root, filename)
                         # SECURITY: Skip files that are symlinks pointing outside sandbox
@@ -119,7 +135,8 @@ def search_files(
                 if max_results > 0 and count >= max_results:
                     break
         else:
-            with os.scandir(real_base) as entries:
+            with os.scandir(real_base) as it:
+                entries = sorted(it, key=lambda entry: entry.name)
                 for entry in entries:
                     if not fnmatch.fnmatch(entry.name, pattern):
                         continue
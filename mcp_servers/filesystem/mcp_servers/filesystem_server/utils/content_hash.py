@@ -0,0 +1,64 @@
+"""Content fingerprints of files, cached by what stat says about them.
+
+A file's BLAKE2b-256 digest (the same as `b2sum -l 256`) is computed once and
+kept for as long as its (device, inode, size, mtime_ns, ctime_ns) stay the same,
+so asking again about an unchanged file costs a stat. Any write changes mtime
+and ctime, and ctime can't be set back from user space, so a stale digest is
+never returned for a file modified since.
+
+hashlib releases the GIL while it hashes, so threads hash files in parallel
+(get_files_metadata describes its files from a pool of them).
+"""
+
+import hashlib
+import os
+import threading
+from collections import OrderedDict
+
+ALGORITHM = "blake2b-256"
+# Digests kept
+MAX_CACHED = 65536
+_READ_BYTES = 1 << 20
+# Tries before giving up on a file that keeps changing while it's hashed
+_ATTEMPTS = 3
+
+_cache: OrderedDict[tuple[int, int, int, int, int], str] = OrderedDict()
+_cache_lock = threading.Lock()
+
+
+def _key(st: os.stat_result) -> tuple[int, int, int, int, int]:
+    return (st.st_dev, st.st_ino, st.st_size, st.st_mtime_ns, st.st_ctime_ns)
+
+
+def _hash_fd(fd: int) -> str:
+    h = hashlib.blake2b(digest_size=32)
+    buf = bytearray(_READ_BYTES)
+    view = memoryview(buf)
+    while n := os.readv(fd, [view]):
+        h.update(view[:n])
+    return h.hexdigest()
+
+
+def file_digest(path: str) -> str:
+    """The hex digest of the regular file at path (symlinks followed)."""
+    fd = os.open(path, os.O_RDONLY | os.O_CLOEXEC)
+    try:
+        for _ in range(_ATTEMPTS):
+            key = _key(os.fstat(fd))
+            with _cache_lock:
+                digest = _cache.get(key)
+                if digest is not None:
+                    _cache.move_to_end(key)
+                    return digest
+            os.lseek(fd, 0, os.SEEK_SET)
+            digest = _hash_fd(fd)
+            if _key(os.fstat(fd)) == key:
+                with _cache_lock:
+                    _cache[key] = digest
+                    while len(_cache) > MAX_CACHED:
+                        _cache.popitem(last=False)
+                return digest
+        # Still being written: the digest of what was read, not cached
+        return digest
+    finally:
+        os.close(fd)
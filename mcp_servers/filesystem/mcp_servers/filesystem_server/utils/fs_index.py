@@ -0,0 +1,528 @@
+"""In-memory index of the sandbox tree for search_files and get_directory_tree.
+
+A background thread walks the root once (retrying until it exists, so it also
+covers a tree populated after the server starts) and keeps the index current
+from inotify events. The index is a trie of directories, each holding its
+subdirectories and a {name: (kind, size, mtime_ns)} map of its other entries.
+
+Queries first apply any events the kernel has queued, then check that the
+directory asked about has the mtime the index recorded for it. If it doesn't, or
+the event queue overflowed, or a directory couldn't be watched or read, the
+query returns None, the caller scans live, and the index is rebuilt.
+
+Usage:
+    fs_index.start(FS_ROOT)
+    ...
+    rel_paths = fs_index.search(real_base, "*.csv", recursive=True, max_results=100)
+    if rel_paths is None:
+        ...  # live scan
+"""
+
+import ctypes
+import errno
+import os
+import re
+import select
+import stat
+import struct
+import threading
+import time
+from fnmatch import translate
+
+from loguru import logger
+
+# Entry kinds
+DIR, FILE, LINK, OTHER = 0, 1, 2, 3
+
+_IN_MODIFY = 0x00000002
+_IN_ATTRIB = 0x00000004
+_IN_CLOSE_WRITE = 0x00000008
+_IN_MOVED_FROM = 0x00000040
+_IN_MOVED_TO = 0x00000080
+_IN_CREATE = 0x00000100
+_IN_DELETE = 0x00000200
+_IN_DELETE_SELF = 0x00000400
+_IN_MOVE_SELF = 0x00000800
+_IN_Q_OVERFLOW = 0x00004000
+_IN_IGNORED = 0x00008000
+_IN_ONLYDIR = 0x01000000
+_IN_DONT_FOLLOW = 0x02000000
+_IN_EXCL_UNLINK = 0x04000000
+_IN_ISDIR = 0x40000000
+
+_WATCH_MASK = (
+    _IN_MODIFY
+    | _IN_ATTRIB
+    | _IN_CLOSE_WRITE
+    | _IN_MOVED_FROM
+    | _IN_MOVED_TO
+    | _IN_CREATE
+    | _IN_DELETE
+    | _IN_DELETE_SELF
+    | _IN_MOVE_SELF
+    | _IN_ONLYDIR
+    | _IN_DONT_FOLLOW
+    | _IN_EXCL_UNLINK
+)
+_EVENT = struct.Struct("iIII")
+
+# Seconds between attempts to (re)build the index
+_RETRY_SECONDS = 2.0
+
+
+class _Dir:
+    __slots__ = (
+        "name",
+        "parent",
+        "wd",
+        "mtime_ns",
+        "unreadable",
+        "files",
+        "dirs",
+        "_file_order",
+        "_dir_order",
+    )
+
+    def __init__(self, name: str, parent: "_Dir | None"):
+        self.name = name
+        self.parent = parent
+        self.wd = -1
+        self.mtime_ns = -1
+        # Not watched or not fully listed: queries touching it go live
+        self.unreadable = False
+        self.files: dict[str, tuple[int, int, int]] = {}
+        self.dirs: dict[str, _Dir] = {}
+        self._file_order: list[str] | None = None
+        self._dir_order: list[str] | None = None
+
+    def file_order(self) -> list[str]:
+        if self._file_order is None:
+            self._file_order = sorted(self.files)
+        return self._file_order
+
+    def dir_order(self) -> list[str]:
+        if self._dir_order is None:
+            self._dir_order = sorted(self.dirs)
+        return self._dir_order
+
+    def set_file(self, name: str, entry: tuple[int, int, int]) -> None:
+        if name not in self.files:
+            self._file_order = None
+        self.files[name] = entry
+
+    def pop_file(self, name: str) -> None:
+        if self.files.pop(name, None) is not None:
+            self._file_order = None
+
+    def set_dir(self, name: str, child: "_Dir") -> None:
+        self.dirs[name] = child
+        self._dir_order = None
+
+    def pop_dir(self, name: str) -> "_Dir | None":
+        child = self.dirs.pop(name, None)
+        if child is not None:
+            self._dir_order = None
+        return child
+
+    def walk(self):
+        stack = [self]
+        while stack:
+            node = stack.pop()
+            yield node
+            stack.extend(node.dirs.values())
+
+
+def _kind(mode: int) -> int:
+    if stat.S_ISREG(mode):
+        return FILE
+    if stat.S_ISLNK(mode):
+        return LINK
+    return OTHER
+
+
+class _Inotify:
+    _libc: ctypes.CDLL | None = None
+
+    def __init__(self):
+        if _Inotify._libc is None:
+            _Inotify._libc = ctypes.CDLL(None, use_errno=True)
+        fd = self._libc.inotify_init1(os.O_NONBLOCK | os.O_CLOEXEC)
+        if fd < 0:
+            e = ctypes.get_errno()
+            raise OSError(e, f"inotify_init1: {os.strerror(e)}")
+        self.fd = fd
+
+    def add_watch(self, path: str) -> int:
+        """The watch descriptor, or -errno."""
+        wd = self._libc.inotify_add_watch(self.fd, os.fsencode(path), _WATCH_MASK)
+        return wd if wd >= 0 else -ctypes.get_errno()
+
+    def rm_watch(self, wd: int) -> None:
+        self._libc.inotify_rm_watch(self.fd, wd)
+
+    def read(self) -> list[tuple[int, int, int, str]]:
+        """Queued events as (wd, mask, cookie, name), without blocking."""
+        events = []
+        while True:
+            try:
+                data = os.read(self.fd, 1 << 16)
+            except BlockingIOError:
+                return events
+            offset = 0
+            while offset < len(data):
+                wd, mask, cookie, length = _EVENT.unpack_from(data, offset)
+                offset += _EVENT.size
+                name = data[offset : offset + length].rstrip(b"\0")
+                offset += length
+                events.append((wd, mask, cookie, os.fsdecode(name)))
+
+    def close(self) -> None:
+        os.close(self.fd)
+
+
+class FsIndex:
+    def __init__(self, root: str):
+        self.root = os.path.realpath(root)
+        self._lock = threading.Lock()
+        self._inotify: _Inotify | None = None
+        self._tree: _Dir | None = None
+        self._wds: dict[int, _Dir] = {}
+        self._stale = True
+        self._watch_limit_logged = False
+
+    def start(self) -> None:
+        threading.Thread(target=self._run, name="fs-index", daemon=True).start()
+
+    # Building and updating
+
+    def _run(self) -> None:
+        while True:
+            try:
+                self._build()
+            except OSError as e:
+                logger.debug(f"Cannot index {self.root}: {e}")
+                time.sleep(_RETRY_SECONDS)
+                continue
+            poller = select.poll()
+            poller.register(self._inotify.fd, select.POLLIN)
+            while not self._stale:
+                if poller.poll(1000):
+                    with self._lock:
+                        self._apply_events()
+            with self._lock:
+                self._inotify.close()
+                self._inotify = None
+                self._tree = None
+                self._wds = {}
+            time.sleep(_RETRY_SECONDS)
+
+    def _build(self) -> None:
+        """Walk the root with a fresh inotify instance and install the result."""
+        start = time.monotonic()
+        inotify = _Inotify()
+        tree = _Dir("", None)
+        wds: dict[int, _Dir] = {}
+        try:
+            if not os.path.isdir(self.root):
+                raise FileNotFoundError(errno.ENOENT, "No such directory", self.root)
+            self._scan(inotify, wds, tree, self.root)
+            if tree.wd < 0:
+                raise OSError(errno.EIO, "Cannot watch the root", self.root)
+        except BaseException:
+            inotify.close()
+            raise
+        files = dirs = 0
+        for node in tree.walk():
+            dirs += 1
+            files += len(node.files)
+        with self._lock:
+            self._inotify, self._tree, self._wds = inotify, tree, wds
+            self._stale = False
+            # Events that arrived during the walk
+            self._apply_events()
+        logger.info(
+            f"Indexed {files} files in {dirs} directories under {self.root} "
+            f"in {time.monotonic() - start:.2f}s"
+        )
+
+    def _scan(
+        self, inotify: _Inotify, wds: dict[int, _Dir], top: _Dir, top_path: str
+    ) -> None:
+        """Watch and list top and everything below it."""
+        stack = [(top, top_path)]
+        while stack:
+            node, path = stack.pop()
+            # Watch before listing, so nothing created meanwhile is missed
+            wd = inotify.add_watch(path)
+            if wd < 0:
+                if wd == -errno.ENOSPC and not self._watch_limit_logged:
+                    self._watch_limit_logged = True
+                    logger.warning(
+                        f"inotify watch limit reached indexing {path}; "
+                        "raise fs.inotify.max_user_watches to index all of it"
+                    )
+                node.unreadable = True
+                continue
+            node.wd = wd
+            wds[wd] = node
+            try:
+                node.mtime_ns = os.lstat(path).st_mtime_ns
+                with os.scandir(path) as entries:
+                    for entry in entries:
+                        try:
+                            st = entry.stat(follow_symlinks=False)
+                        except FileNotFoundError:
+                            continue
+                        if stat.S_ISDIR(st.st_mode):
+                            child = _Dir(entry.name, node)
+                            node.set_dir(entry.name, child)
+                            stack.append((child, entry.path))
+                        else:
+                            node.set_file(
+                                entry.name,
+                                (_kind(st.st_mode), st.st_size, st.st_mtime_ns),
+                            )
+            except OSError:
+                node.unreadable = True
+
+    def _path(self, node: _Dir) -> str:
+        names = []
+        while node.parent is not None:
+            names.append(node.name)
+            node = node.parent
+        return os.path.join(self.root, *reversed(names))
+
+    def _forget(self, node: _Dir, remove_watches: bool) -> None:
+        for n in node.walk():
+            if self._wds.get(n.wd) is n:
+                del self._wds[n.wd]
+                if remove_watches:
+                    self._inotify.rm_watch(n.wd)
+
+    def _apply_events(self) -> None:
+        """Bring the index up to date with the queued events (lock held)."""
+        if self._inotify is None:
+            return
+        events = self._inotify.read()
+        if not events:
+            return
+        touched: dict[tuple[int, str], tuple[_Dir, str]] = {}
+        changed_dirs: dict[int, _Dir] = {}
+        moved: dict[int, _Dir] = {}
+        for wd, mask, cookie, name in events:
+            if mask & _IN_Q_OVERFLOW:
+                logger.info("inotify queue overflowed; rebuilding the file index")
+                self._stale = True
+                return
+            node = self._wds.get(wd)
+            if node is None:
+                continue
+            if mask & _IN_IGNORED:
+                # Watch gone (unmounted, or removed before its parent's event)
+                del self._wds[wd]
+                node.unreadable = True
+                continue
+            if mask & (_IN_DELETE_SELF | _IN_MOVE_SELF):
+                if node is self._tree:
+                    self._stale = True
+                    return
+                # The parent's event updates the tree
+                continue
+            changed_dirs[id(node)] = node
+            if not name:
+                continue
+            if mask & _IN_MOVED_FROM and mask & _IN_ISDIR:
+                child = node.pop_dir(name)
+                if child is not None:
+                    moved[cookie] = child
+                continue
+            if mask & _IN_MOVED_TO and mask & _IN_ISDIR and cookie in moved:
+                child = moved.pop(cookie)
+                replaced = node.pop_dir(name)
+                if replaced is not None:
+                    self._forget(replaced, remove_watches=False)
+                node.pop_file(name)
+                child.name, child.parent = name, node
+                node.set_dir(name, child)
+                continue
+            touched[(id(node), name)] = (node, name)
+
+        # Moved out of the tree: stop watching them
+        for child in moved.values():
+            self._forget(child, remove_watches=True)
+        for node, name in touched.values():
+            if self._wds.get(node.wd) is node:
+                self._refresh(node, name)
+        for node in changed_dirs.values():
+            if self._wds.get(node.wd) is not node:
+                continue
+            try:
+                node.mtime_ns = os.lstat(self._path(node)).st_mtime_ns
+            except OSError:
+                pass
+
+    def _refresh(self, node: _Dir, name: str) -> None:
+        path = os.path.join(self._path(node), name)
+        try:
+            st = os.lstat(path)
+        except OSError:
+            node.pop_file(name)
+            child = node.pop_dir(name)
+            if child is not None:
+                self._forget(child, remove_watches=False)
+            return
+        if stat.S_ISDIR(st.st_mode):
+            node.pop_file(name)
+            if name not in node.dirs:
+                child = _Dir(name, node)
+                node.set_dir(name, child)
+                self._scan(self._inotify, self._wds, child, path)
+            return
+        child = node.pop_dir(name)
+        if child is not None:
+            self._forget(child, remove_watches=False)
+        node.set_file(name, (_kind(st.st_mode), st.st_size, st.st_mtime_ns))
+
+    # Queries
+
+    def _lookup(self, real_path: str) -> _Dir | None:
+        """The up-to-date node for real_path, if the index can answer for it (lock held)."""
+        if self._stale or self._tree is None:
+            return None
+        self._apply_events()
+        if self._stale:
+            return None
+        if real_path == self.root:
+            node = self._tree
+        elif real_path.startswith(self.root + os.sep):
+            node = self._tree
+            for part in real_path[len(self.root) + 1 :].split(os.sep):
+                node = node.dirs.get(part)
+                if node is None:
+                    return None
+        else:
+            return None
+        if node.unreadable:
+            return None
+        # Cheap consistency check against changes no event reported. The event
+        # for a change can be queued just after the change is visible, so look
+        # at the queue once more before deciding the index missed it.
+        for attempt in range(2):
+            try:
+                mtime_ns = os.lstat(real_path).st_mtime_ns
+            except OSError:
+                return None
+            if mtime_ns == node.mtime_ns:
+                return node
+            if attempt == 0:
+                self._apply_events()
+                if self._stale or self._wds.get(node.wd) is not node:
+                    return None
+        logger.info(f"File index is stale at {real_path}; rebuilding")
+        self._stale = True
+        return None
+
+    def _link_within_root(self, path: str) -> bool:
+        real_path = os.path.realpath(path)
+        return real_path.startswith(self.root + os.sep) or real_path == self.root
+
+    def search(
+        self, real_base: str, pattern: str, recursive: bool, max_results: int
+    ) -> list[str] | None:
+        """Paths (relative to real_base) of the files under it whose names match pattern.
+
+        Same results and order as search_files' live scan: depth first, each
+        directory's files before its subdirectories, both sorted by name.
+        """
+        match = re.compile(translate(pattern)).match
+        results: list[str] = []
+        with self._lock:
+            base = self._lookup(real_base)
+            if base is None:
+                return None
+            stack = [(base, "")]
+            while stack:
+                node, rel = stack.pop()
+                path = os.path.join(real_base, rel)
+                if node.unreadable:
+                    return None
+                for name in node.file_order():
+                    if not match(name):
+                        continue
+                    kind = node.files[name][0]
+                    full_path = os.path.join(path, name)
+                    if kind == LINK:
+                        # Directory links are listed as directories (and not
+                        # followed) by the live scan; others must stay inside
+                        if recursive and os.path.isdir(full_path):
+                            continue
+                        if not recursive and not os.path.isfile(full_path):
+                            continue
+                        if not self._link_within_root(full_path):
+                            continue
+                    elif kind == OTHER and not recursive:
+                        continue
+                    results.append(os.path.join(rel, name))
+                    if max_results > 0 and len(results) >= max_results:
+                        return results
+                if recursive:
+                    stack.extend(
+                        (node.dirs[name], os.path.join(rel, name))
+                        for name in reversed(node.dir_order())
+                    )
+        return results
+
+    def covers(self, real_path: str) -> bool:
+        """Whether the index can answer for real_path right now."""
+        with self._lock:
+            return self._lookup(real_path) is not None
+
+    def list_dir(
+        self, real_path: str
+    ) -> tuple[list[tuple[str, str]], list[tuple[str, int]]] | None:
+        """(name, path) of real_path's directories and (name, size) of its regular files."""
+        with self._lock:
+            node = self._lookup(real_path)
+            if node is None:
+                return None
+            dirs = [(name, os.path.join(real_path, name)) for name in node.dirs]
+            files = [
+                (name, size)
+                for name, (kind, size, _) in node.files.items()
+                if kind == FILE
+            ]
+        return dirs, files
+
+
+_index: FsIndex | None = None
+
+
+def start(root: str) -> None:
+    """Index root in the background (once)."""
+    global _index
+    if _index is None:
+        _index = FsIndex(root)
+        _index.start()
+
+
+def search(
+    real_base: str, pattern: str, recursive: bool, max_results: int
+) -> list[str] | None:
+    """See FsIndex.search; None when there's no usable index."""
+    if _index is None:
+        return None
+    return _index.search(real_base, pattern, recursive, max_results)
+
+
+def covers(real_path: str) -> bool:
+    """See FsIndex.covers; False when there's no index."""
+    return _index is not None and _index.covers(real_path)
+
+
+def list_dir(
+    real_path: str,
+) -> tuple[list[tuple[str, str]], list[tuple[str, int]]] | None:
+    """See FsIndex.list_dir; None when there's no usable index."""
+    if _index is None:
+        return None
+    return _index.list_dir(real_path)
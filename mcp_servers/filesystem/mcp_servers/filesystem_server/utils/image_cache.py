@@ -0,0 +1,142 @@
+"""Downscaled and re-encoded copies of images, cached by what stat says about them.
+
+Pillow does the work in C with the GIL released: JPEGs are decoded straight to
+a smaller size through libjpeg-turbo's DCT scaling (Image.draft), the rest is
+reduced by whole factors with a box filter and then resampled with Lanczos
+(Image.thumbnail's reducing_gap), and the result is encoded with libjpeg-turbo,
+zlib or libwebp.
+
+A derivative is kept for as long as its source's (device, inode, size,
+mtime_ns, ctime_ns) stay the same, as utils/content_hash.py keeps digests, so
+reading the same image with the same parameters again costs a stat.
+"""
+
+import io
+import os
+import threading
+from collections import OrderedDict
+from dataclasses import dataclass
+
+from PIL import Image, ImageOps
+
+# Bytes of encoded derivatives kept
+MAX_CACHED_BYTES = 256 * 1024 * 1024
+DEFAULT_QUALITY = 85
+# Decode at least this many times the target size before resampling, so the
+# DCT scaling and box reduction stay well above the final resolution
+_REDUCING_GAP = 2.0
+_MODES = ("L", "LA", "RGB", "RGBA")
+
+_Key = tuple[int, int, int, int, int, int | None, int | None]
+
+
+@dataclass
+class Derivative:
+    data: bytes
+    format: str  # "png", "jpeg", "gif" or "webp"
+
+
+_cache: OrderedDict[_Key, Derivative] = OrderedDict()
+_cached_bytes = 0
+_cache_lock = threading.Lock()
+
+
+def _key(st: os.stat_result, max_dimension: int | None, quality: int | None) -> _Key:
+    return (
+        st.st_dev,
+        st.st_ino,
+        st.st_size,
+        st.st_mtime_ns,
+        st.st_ctime_ns,
+        max_dimension,
+        quality,
+    )
+
+
+def _encode(im: Image.Image, source_format: str, quality: int | None) -> Derivative:
+    # Keep the source's format where it can be kept; re-encode losslessly
+    # compressed images lossily only when asked to
+    if source_format == "webp" or (
+        quality is not None and source_format != "jpeg" and "A" in im.mode
+    ):
+        fmt = "webp"
+    elif source_format == "jpeg" or quality is not None:
+        fmt = "jpeg"
+    else:
+        fmt = "png"
+
+    out = io.BytesIO()
+    if fmt == "jpeg":
+        if im.mode != "L":
+            im = im.convert("RGB")
+        im.save(out, "JPEG", quality=quality or DEFAULT_QUALITY, optimize=True)
+    elif fmt == "webp":
+        im.save(out, "WEBP", quality=quality or DEFAULT_QUALITY, method=4)
+    else:
+        im.save(out, "PNG", compress_level=6)
+    return Derivative(out.getvalue(), fmt)
+
+
+def _render(
+    im: Image.Image, max_dimension: int | None, quality: int | None
+) -> Derivative | None:
+    """The derivative of the opened image, or None if the original already is one."""
+    source_format = (im.format or "").lower()
+    fits = max_dimension is None or max(im.size) <= max_dimension
+    if fits and quality is None:
+        return None
+
+    if max_dimension is not None and not fits:
+        bound = int(max_dimension * _REDUCING_GAP)
+        im.draft(None, (bound, bound))
+    # Palette and 1-bit images can only be resized nearest-neighbour, and
+    # CMYK and 16-bit ones can't be written in every format
+    frame = im
+    if frame.mode not in _MODES:
+        frame = frame.convert("RGBA" if frame.has_transparency_data else "RGB")
+    if max_dimension is not None and not fits:
+        frame.thumbnail(
+            (max_dimension, max_dimension),
+            Image.Resampling.LANCZOS,
+            reducing_gap=_REDUCING_GAP,
+        )
+    # Camera JPEGs are often stored sideways with an orientation tag, which
+    # the re-encoded copy doesn't carry
+    frame = ImageOps.exif_transpose(frame)
+    return _encode(frame, source_format, quality)
+
+
+def derivative(
+    path: str, max_dimension: int | None, quality: int | None
+) -> Derivative | None:
+    """The image at path scaled to fit max_dimension and/or re-encoded at quality.
+
+    None if it already fits and isn't to be re-encoded, after reading only its
+    header. Animated images are reduced to their first frame.
+    """
+    global _cached_bytes
+
+    with open(path, "rb") as f:
+        st = os.fstat(f.fileno())
+        key = _key(st, max_dimension, quality)
+        with _cache_lock:
+            cached = _cache.get(key)
+            if cached is not None:
+                _cache.move_to_end(key)
+                return cached
+
+        with Image.open(f) as im:
+            result = _render(im, max_dimension, quality)
+        if result is None:
+            return None
+
+        # Don't keep a copy of a file that changed while it was read
+        if _key(os.fstat(f.fileno()), max_dimension, quality) == key:
+            with _cache_lock:
+                if key not in _cache:
+                    _cache[key] = result
+                    _cached_bytes += len(result.data)
+                while _cached_bytes > MAX_CACHED_BYTES and _cache:
+                    _, evicted = _cache.popitem(last=False)
+                    _cached_bytes -= len(evicted.data)
+        return result
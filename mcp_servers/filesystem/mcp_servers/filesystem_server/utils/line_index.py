@@ -0,0 +1,187 @@
+"""Ranged reads of large text files with pread.
+
+A line range is found through a sparse line index: the number of newlines
+before every CHUNK_BYTES-byte chunk of the file, counted once at C speed
+(bytes.count) on first access and cached by (device, inode, mtime, size). A line
+is then located by bisecting to its chunk and scanning that chunk only, and
+only the requested bytes are read and decoded, so a page costs O(page) time
+and memory whatever the size of the file.
+
+Reads go through os.pread rather than a mapping: a file truncated by another
+process while it is read just yields fewer bytes, where touching a mapped page
+past the new end would kill the server with SIGBUS.
+
+Lines are counted by b"\\n", so ranges need an encoding in which "\\n" is that
+byte and never part of another character (UTF-8, ASCII, Latin-1, cp1252, ...).
+"""
+
+import bisect
+import codecs
+import os
+import threading
+from array import array
+from collections import OrderedDict
+from dataclasses import dataclass
+from typing import BinaryIO
+
+CHUNK_BYTES = 1 << 16
+_READ_BYTES = 16 * CHUNK_BYTES
+# Indexed files kept
+MAX_CACHED_INDEXES = 32
+
+
+@dataclass
+class LineIndex:
+    size: int
+    # newlines_before[k]: newlines in the file before byte k * CHUNK_BYTES
+    newlines_before: array
+    newlines: int
+    ends_with_newline: bool
+
+    @property
+    def lines(self) -> int:
+        """Lines in the file, the last one counted even without a newline."""
+        if self.size == 0 or self.ends_with_newline:
+            return self.newlines
+        return self.newlines + 1
+
+    def line_start(self, fd: int, line: int) -> int:
+        """Byte offset where 0-based line starts (self.size past the last one)."""
+        if line <= 0:
+            return 0
+        if line > self.newlines:
+            return self.size
+        # The chunk holding the line-th newline
+        k = bisect.bisect_right(self.newlines_before, line - 1) - 1
+        base = k * CHUNK_BYTES
+        chunk = os.pread(fd, CHUNK_BYTES, base)
+        pos = 0
+        for _ in range(line - self.newlines_before[k]):
+            found = chunk.find(b"\n", pos)
+            if found < 0:
+                # Truncated since it was indexed
+                return base + len(chunk)
+            pos = found + 1
+        return base + pos
+
+
+_cache: OrderedDict[tuple[int, int, int, int], LineIndex] = OrderedDict()
+_cache_lock = threading.Lock()
+
+
+def _build(f: BinaryIO, size: int) -> LineIndex:
+    newlines_before = array("Q")
+    newlines = 0
+    buf = bytearray(_READ_BYTES)
+    view = memoryview(buf)
+    last_byte = 0
+    pos = 0
+    while pos < size:
+        n = os.preadv(f.fileno(), [view], pos)
+        if n <= 0:
+            break
+        for start in range(0, n, CHUNK_BYTES):
+            newlines_before.append(newlines)
+            newlines += buf.count(b"\n", start, min(n, start + CHUNK_BYTES))
+        last_byte = buf[n - 1]
+        pos += n
+    return LineIndex(pos, newlines_before, newlines, last_byte == 0x0A)
+
+
+def get_index(f: BinaryIO, st: os.stat_result) -> LineIndex:
+    """The line index of the open file f, whose fstat is st."""
+    key = (st.st_dev, st.st_ino, st.st_mtime_ns, st.st_size)
+    with _cache_lock:
+        index = _cache.get(key)
+        if index is not None:
+            _cache.move_to_end(key)
+            return index
+    index = _build(f, st.st_size)
+    with _cache_lock:
+        _cache[key] = index
+        while len(_cache) > MAX_CACHED_INDEXES:
+            _cache.popitem(last=False)
+    return index
+
+
+def supports_ranges(encoding: str) -> bool:
+    """Whether lines of text in encoding can be found by byte b"\\n"."""
+    try:
+        info = codecs.lookup(encoding)
+    except LookupError:
+        return False
+    if info.name.startswith(("utf-16", "utf-32", "utf-7")):
+        return False
+    try:
+        return "\n".encode(info.name) == b"\n" and "A".encode(info.name) == b"A"
+    except (UnicodeError, LookupError):
+        return False
+
+
+def _decode(data: bytes, encoding: str) -> str:
+    # As open()'s universal newlines would return it
+    text = data.decode(encoding)
+    return text.replace("\r\n", "\n").replace("\r", "\n")
+
+
+def _pread(fd: int, length: int, offset: int) -> bytes:
+    """Up to length bytes at offset (fewer only at the end of the file)."""
+    parts = []
+    while length > 0:
+        data = os.pread(fd, length, offset)
+        if not data:
+            break
+        parts.append(data)
+        length -= len(data)
+        offset += len(data)
+    return b"".join(parts)
+
+
+@dataclass
+class Page:
+    text: str
+    first: int  # 1-based first line, or first byte offset
+    last: int  # Inclusive
+    total: int  # Lines or bytes in the file
+
+
+def read_lines(path: str, encoding: str, start_line: int, end_line: int | None) -> Page:
+    """Lines start_line..end_line (1-based, inclusive; None = to the end)."""
+    with open(path, "rb") as f:
+        st = os.fstat(f.fileno())
+        if st.st_size == 0:
+            if start_line > 1:
+                raise ValueError(f"start_line {start_line} is past the end (0 lines)")
+            return Page("", 1, 0, 0)
+        index = get_index(f, st)
+        total = index.lines
+        if start_line > total:
+            raise ValueError(f"start_line {start_line} is past the end ({total} lines)")
+        last = total if end_line is None else min(end_line, total)
+        begin = index.line_start(f.fileno(), start_line - 1)
+        end = index.line_start(f.fileno(), last)
+        data = _pread(f.fileno(), end - begin, begin)
+        return Page(_decode(data, encoding), start_line, last, total)
+
+
+def read_bytes(path: str, encoding: str, offset: int, length: int | None) -> Page:
+    """length bytes (None = to the end) from offset, moved to character boundaries."""
+    with open(path, "rb") as f:
+        size = os.fstat(f.fileno()).st_size
+        if offset >= size:
+            if offset == 0:
+                return Page("", 0, -1, 0)
+            raise ValueError(f"offset {offset} is past the end ({size} bytes)")
+        end = size if length is None else min(size, offset + length)
+        # With the byte after the range, to tell whether it splits a character
+        data = _pread(f.fileno(), min(end + 1, size) - offset, offset)
+        begin = 0
+        stop = min(end - offset, len(data))
+        if codecs.lookup(encoding).name == "utf-8":
+            # Don't split a character: skip continuation bytes at both ends
+            while begin < stop and 0x80 <= data[begin] < 0xC0:
+                begin += 1
+            while begin < stop < len(data) and 0x80 <= data[stop] < 0xC0:
+                stop -= 1
+        text = _decode(data[begin:stop], encoding)
+        return Page(text, offset + begin, offset + stop - 1, size)
@@ -0,0 +1,248 @@
+"""Native directory walker (fs_walk.so) for search_files and get_directory_tree.
+
+fs_walk.c walks the tree with a pool of threads and matches names or renders
+the tree in C; this module compiles the glob into its match program and calls
+it through ctypes. When the library isn't installed, search() and tree() return
+None and callers fall back to Python. The server loads it at startup (see
+available()), so the log says once which walker is in use.
+
+Build (done by environment/Dockerfile):
+    gcc -shared -fPIC -O2 -o /app/lib/fs_walk.so fs_walk.c -lpthread
+"""
+
+import ctypes
+import errno
+import os
+import threading
+
+from loguru import logger
+
+DEFAULT_LIBRARY_PATH = "/app/lib/fs_walk.so"
+LIBRARY_PATH = os.getenv("FS_WALK_LIBRARY_PATH", DEFAULT_LIBRARY_PATH)
+THREADS = int(os.getenv("FS_WALK_THREADS", str(min(16, os.cpu_count() or 1))))
+
+# Match program opcodes (see fs_walk.c)
+_LIT, _ANY, _STAR, _SET, _FAIL = 1, 2, 3, 4, 5
+
+_lib: ctypes.CDLL | None = None
+_lib_loaded = False
+_lib_lock = threading.Lock()
+
+
+def _load() -> ctypes.CDLL | None:
+    global _lib, _lib_loaded
+    with _lib_lock:
+        if not _lib_loaded:
+            _lib_loaded = True
+            try:
+                lib = ctypes.CDLL(LIBRARY_PATH)
+            except OSError as e:
+                logger.warning(f"Native walker unavailable ({e}); using os.walk")
+            else:
+                logger.info(
+                    f"Native walker loaded from {LIBRARY_PATH} ({THREADS} threads)"
+                )
+                lib.fs_walk_search.restype = ctypes.c_long
+                lib.fs_walk_search.argtypes = [
+                    ctypes.c_char_p,
+                    ctypes.c_char_p,
+                    ctypes.POINTER(ctypes.c_uint32),
+                    ctypes.c_size_t,
+                    ctypes.c_size_t,
+                    ctypes.c_int,
+                    ctypes.POINTER(ctypes.POINTER(ctypes.c_char)),
+                    ctypes.POINTER(ctypes.c_size_t),
+                ]
+                lib.fs_walk_tree.restype = ctypes.c_long
+                lib.fs_walk_tree.argtypes = [
+                    ctypes.c_char_p,
+                    ctypes.c_int,
+                    ctypes.c_int,
+                    ctypes.c_int,
+                    ctypes.c_size_t,
+                    ctypes.c_int,
+                    ctypes.POINTER(ctypes.POINTER(ctypes.c_char)),
+                    ctypes.POINTER(ctypes.c_size_t),
+                ]
+                lib.fs_walk_free.restype = None
+                lib.fs_walk_free.argtypes = [ctypes.POINTER(ctypes.c_char)]
+                _lib = lib
+        return _lib
+
+
+def available() -> bool:
+    """Load the library if that hasn't been tried yet; whether it loaded."""
+    return _load() is not None
+
+
+def _set_members(stuff: str, chunks: list[str] | None) -> list[tuple[int, int]]:
+    """Ranges of the regex class fnmatch builds from a '[...]' body."""
+    # Items of the class: (char, is_range_operator)
+    if chunks is None:
+        items = [(c, False) for c in stuff]
+    else:
+        items = []
+        for k, chunk in enumerate(chunks):
+            if k > 0:
+                items.append(("-", True))
+            items.extend((c, False) for c in chunk)
+    ranges = []
+    i = 0
+    while i < len(items):
+        char, is_operator = items[i]
+        if (
+            not is_operator
+            and i + 2 < len(items)
+            and items[i + 1][1]
+            and not items[i + 2][1]
+        ):
+            ranges.append((ord(char), ord(items[i + 2][0])))
+            i += 3
+        else:
+            ranges.append((ord(char), ord(char)))
+            i += 1
+    return ranges
+
+
+def compile_glob(pattern: str) -> list[int]:
+    """The walker's match program for pattern, with fnmatch.translate's semantics."""
+    program: list[int] = []
+    last_was_star = False
+    i, n = 0, len(pattern)
+    while i < n:
+        c = pattern[i]
+        i += 1
+        if c == "*":
+            if not last_was_star:
+                program.append(_STAR)
+            last_was_star = True
+            continue
+        last_was_star = False
+        if c == "?":
+            program.append(_ANY)
+        elif c == "[":
+            j = i
+            if j < n and pattern[j] == "!":
+                j += 1
+            if j < n and pattern[j] == "]":
+                j += 1
+            while j < n and pattern[j] != "]":
+                j += 1
+            if j >= n:
+                program += [_LIT, ord("[")]
+                continue
+            stuff = pattern[i:j]
+            chunks = None
+            if "-" in stuff:
+                # Same splitting into ranges as fnmatch.translate
+                chunks = []
+                k = i + 2 if pattern[i] == "!" else i + 1
+                while True:
+                    k = pattern.find("-", k, j)
+                    if k < 0:
+                        break
+                    chunks.append(pattern[i:k])
+                    i = k + 1
+                    k = k + 3
+                chunk = pattern[i:j]
+                if chunk:
+                    chunks.append(chunk)
+                else:
+                    chunks[-1] += "-"
+                for k in range(len(chunks) - 1, 0, -1):
+                    if chunks[k - 1][-1] > chunks[k][0]:
+                        chunks[k - 1] = chunks[k - 1][:-1] + chunks[k][1:]
+                        del chunks[k]
+                stuff = "-".join(chunks)
+            i = j + 1
+            if not stuff:
+                program.append(_FAIL)
+            elif stuff == "!":
+                program.append(_ANY)
+            else:
+                negate = stuff[0] == "!"
+                if negate:
+                    stuff = stuff[1:]
+                    if chunks is not None:
+                        chunks[0] = chunks[0][1:]
+                ranges = _set_members(stuff, chunks)
+                program += [_SET, int(negate), len(ranges)]
+                for lo, hi in ranges:
+                    program += [lo, hi]
+        else:
+            program += [_LIT, ord(c)]
+    return program
+
+
+def search(
+    real_root: str, real_base: str, pattern: str, max_results: int
+) -> list[str] | None:
+    """Paths (relative to real_base) of files under it whose names match pattern.
+
+    Same matches as search_files' os.walk loop, in depth-first order with each
+    directory's files before its subdirectories, both sorted by name. At most
+    max_results (0 = all). None if the native walker isn't available or failed.
+    """
+    lib = _load()
+    if lib is None:
+        return None
+    program = compile_glob(pattern)
+    program_array = (ctypes.c_uint32 * max(1, len(program)))(*program)
+    out = ctypes.POINTER(ctypes.c_char)()
+    out_len = ctypes.c_size_t()
+    count = lib.fs_walk_search(
+        os.fsencode(real_root),
+        os.fsencode(real_base),
+        program_array,
+        len(program),
+        max(0, max_results),
+        THREADS,
+        ctypes.byref(out),
+        ctypes.byref(out_len),
+    )
+    if count < 0:
+        logger.warning(f"Native walk of {real_base} failed: {os.strerror(-count)}")
+        return None
+    try:
+        data = ctypes.string_at(out, out_len.value) if count else b""
+    finally:
+        lib.fs_walk_free(out)
+    return [os.fsdecode(p) for p in data.split(b"\0")[:count]]
+
+
+def tree(
+    real_base: str,
+    max_depth: int,
+    include_files: bool,
+    show_size: bool,
+    max_entries: int,
+) -> str | None:
+    """The lines get_directory_tree's _build_tree() renders for real_base, joined.
+
+    None if the native walker isn't available, failed, or can't order the names
+    exactly as Python would (non-ASCII names).
+    """
+    lib = _load()
+    if lib is None:
+        return None
+    out = ctypes.POINTER(ctypes.c_char)()
+    out_len = ctypes.c_size_t()
+    count = lib.fs_walk_tree(
+        os.fsencode(real_base),
+        max_depth,
+        int(include_files),
+        int(show_size),
+        max_entries,
+        THREADS,
+        ctypes.byref(out),
+        ctypes.byref(out_len),
+    )
+    if count < 0:
+        if count != -errno.EILSEQ:
+            logger.warning(f"Native tree of {real_base} failed: {os.strerror(-count)}")
+        return None
+    try:
+        data = ctypes.string_at(out, out_len.value) if out_len.value else b""
+    finally:
+        lib.fs_walk_free(out)
+    return os.fsdecode(data)